@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/cdefs.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -13,12 +14,16 @@
 #include "esp_lcd_panel_vendor.h"
 #include "esp_lcd_panel_ops.h"
 #include "esp_lcd_panel_commands.h"
+#include "esp_lcd_gc9a01.h"
 #include "driver/gpio.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_check.h"
 
 static const char *TAG = "gc9a01";
 
+#define GC9A01_BOUNCE_BUFFER_SIZE (8 * 1024)
+
 static esp_err_t panel_gc9a01_del(esp_lcd_panel_t *panel);
 static esp_err_t panel_gc9a01_reset(esp_lcd_panel_t *panel);
 static esp_err_t panel_gc9a01_init(esp_lcd_panel_t *panel);
@@ -39,6 +44,7 @@ typedef struct {
     uint8_t fb_bits_per_pixel;
     uint8_t madctl_val; // save current value of LCD_CMD_MADCTL register
     uint8_t colmod_cal; // save surrent value of LCD_CMD_COLMOD register
+    bool warm_init;
 } gc9a01_panel_t;
 
 esp_err_t esp_lcd_new_panel_gc9a01(const esp_lcd_panel_io_handle_t io, const esp_lcd_panel_dev_config_t *panel_dev_config, esp_lcd_panel_handle_t *ret_panel)
@@ -49,7 +55,14 @@ esp_err_t esp_lcd_new_panel_gc9a01(const esp_lcd_panel_io_handle_t io, const esp
     gc9a01 = calloc(1, sizeof(gc9a01_panel_t));
     ESP_GOTO_ON_FALSE(gc9a01, ESP_ERR_NO_MEM, err, TAG, "no mem for gc9a01 panel");
 
+    if (panel_dev_config->vendor_config) {
+        const gc9a01_vendor_config_t *vendor_config = panel_dev_config->vendor_config;
+        gc9a01->warm_init = vendor_config->flags.warm_init;
+    }
+
     if (panel_dev_config->reset_gpio_num >= 0) {
+        // drive the RST line inactive before it becomes an output, so a configured panel is not reset
+        gpio_set_level(panel_dev_config->reset_gpio_num, !panel_dev_config->flags.reset_active_high);
         gpio_config_t io_conf = {
             .mode = GPIO_MODE_OUTPUT,
             .pin_bit_mask = 1ULL << panel_dev_config->reset_gpio_num,
@@ -134,6 +147,11 @@ static esp_err_t panel_gc9a01_reset(esp_lcd_panel_t *panel)
     gc9a01_panel_t *gc9a01 = __containerof(panel, gc9a01_panel_t, base);
     esp_lcd_panel_io_handle_t io = gc9a01->io;
 
+    if (gc9a01->warm_init) {
+        ESP_LOGD(TAG, "warm init, skip reset");
+        return ESP_OK;
+    }
+
     // perform hardware reset
     if (gc9a01->reset_gpio_num >= 0) {
         gpio_set_level(gc9a01->reset_gpio_num, gc9a01->reset_level);
@@ -209,7 +227,13 @@ static esp_err_t panel_gc9a01_init(esp_lcd_panel_t *panel)
 
     // LCD goes into sleep mode and display will be turned off after power on reset, exit sleep mode first
     esp_lcd_panel_io_tx_param(io, LCD_CMD_SLPOUT, NULL, 0);
-    vTaskDelay(pdMS_TO_TICKS(100));
+    if (gc9a01->warm_init) {
+        // already awake, the command is ignored but needs 5ms before the next one
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    else {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
     esp_lcd_panel_io_tx_param(io, LCD_CMD_MADCTL, (uint8_t[]) {
         gc9a01->madctl_val,
     }, 1);
@@ -217,6 +241,12 @@ static esp_err_t panel_gc9a01_init(esp_lcd_panel_t *panel)
         gc9a01->colmod_cal,
     }, 1);
 
+    if (gc9a01->warm_init) {
+        // vendor registers survive a reset of the MCU
+        ESP_LOGD(TAG, "warm init, skip vendor specific init");
+        return ESP_OK;
+    }
+
     // vendor specific initialization, it can be different between manufacturers
     // should consult the LCD supplier for initialization sequence code
     int cmd = 0;
@@ -254,11 +284,54 @@ static esp_err_t panel_gc9a01_draw_bitmap(esp_lcd_panel_t *panel, int x_start, i
     }, 4);
     // transfer frame buffer
     size_t len = (x_end - x_start) * (y_end - y_start) * gc9a01->fb_bits_per_pixel / 8;
-    esp_lcd_panel_io_tx_color(io, LCD_CMD_RAMWR, color_data, len);
+    return esp_lcd_panel_io_tx_color(io, LCD_CMD_RAMWR, color_data, len);
+}
 
+esp_err_t esp_lcd_gc9a01_set_io(esp_lcd_panel_handle_t panel, esp_lcd_panel_io_handle_t io)
+{
+    ESP_RETURN_ON_FALSE(panel && io, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    gc9a01_panel_t *gc9a01 = __containerof(panel, gc9a01_panel_t, base);
+    gc9a01->io = io;
     return ESP_OK;
 }
 
+esp_err_t esp_lcd_gc9a01_draw_image(esp_lcd_panel_handle_t panel, int x_start, int y_start, int x_end, int y_end, const void *image)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t *bounce[2] = { NULL, NULL };
+    ESP_RETURN_ON_FALSE(panel && image && (x_start < x_end) && (y_start < y_end), ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    gc9a01_panel_t *gc9a01 = __containerof(panel, gc9a01_panel_t, base);
+
+    size_t row_bytes = (x_end - x_start) * gc9a01->fb_bits_per_pixel / 8;
+    int band_rows = GC9A01_BOUNCE_BUFFER_SIZE / row_bytes;
+    ESP_RETURN_ON_FALSE(band_rows > 0, ESP_ERR_INVALID_ARG, TAG, "image too wide");
+
+    for (int i = 0; i < 2; i++) {
+        bounce[i] = heap_caps_malloc(band_rows * row_bytes, MALLOC_CAP_DMA);
+        ESP_GOTO_ON_FALSE(bounce[i], ESP_ERR_NO_MEM, err, TAG, "no mem for bounce buffer");
+    }
+
+    // Setting the window of a band waits for the transfer of the band before it, so the
+    // buffer used two bands ago is always free when it gets refilled.
+    const uint8_t *src = image;
+    int band = 0;
+    for (int y = y_start; y < y_end; y += band_rows, band++) {
+        int rows = (y_end - y) < band_rows ? (y_end - y) : band_rows;
+        uint8_t *buf = bounce[band & 1];
+        memcpy(buf, src, rows * row_bytes);
+        src += rows * row_bytes;
+        panel_gc9a01_draw_bitmap(panel, x_start, y, x_end, y + rows, buf);
+    }
+
+    // wait for the last band before the bounce buffers are released
+    esp_lcd_panel_io_tx_param(gc9a01->io, LCD_CMD_NOP, NULL, 0);
+
+err:
+    free(bounce[0]);
+    free(bounce[1]);
+    return ret;
+}
+
 static esp_err_t panel_gc9a01_invert_color(esp_lcd_panel_t *panel, bool invert_color_data)
 {
     gc9a01_panel_t *gc9a01 = __containerof(panel, gc9a01_panel_t, base);
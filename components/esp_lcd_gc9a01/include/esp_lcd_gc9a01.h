@@ -16,6 +16,16 @@
 extern "C" {
 #endif
 
+/**
+ * @brief GC9A01 vendor specific configuration, passed through `esp_lcd_panel_dev_config_t::vendor_config`
+ */
+typedef struct {
+    struct {
+        unsigned int warm_init: 1;  /*!< Panel is already configured (e.g. after a software reset of the MCU),
+                                         skip hardware reset and the vendor specific init sequence */
+    } flags;
+} gc9a01_vendor_config_t;
+
 /**
  * @brief Create LCD panel for model GC9A01
  *
@@ -29,6 +39,42 @@ extern "C" {
  */
 esp_err_t esp_lcd_new_panel_gc9a01(const esp_lcd_panel_io_handle_t io, const esp_lcd_panel_dev_config_t *panel_dev_config, esp_lcd_panel_handle_t *ret_panel);
 
+/**
+ * @brief Stream an image to a GC9A01 panel
+ *
+ * Unlike `esp_lcd_panel_draw_bitmap` the image does not have to be DMA capable, it can e.g. be a
+ * memory mapped flash partition. Pixels are copied through a small DMA capable bounce buffer and
+ * the function returns when the last transfer has completed.
+ *
+ * @note Pixel data must already be in panel byte order.
+ *
+ * @param[in] panel LCD panel handle returned by `esp_lcd_new_panel_gc9a01`
+ * @param[in] x_start Start column of the image
+ * @param[in] y_start Start row of the image
+ * @param[in] x_end End column of the image (exclusive)
+ * @param[in] y_end End row of the image (exclusive)
+ * @param[in] image Pixel data
+ * @return
+ *          - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *          - ESP_ERR_NO_MEM        if the bounce buffers could not be allocated
+ *          - ESP_OK                on success
+ */
+esp_err_t esp_lcd_gc9a01_draw_image(esp_lcd_panel_handle_t panel, int x_start, int y_start, int x_end, int y_end, const void *image);
+
+/**
+ * @brief Replace the panel IO of a GC9A01 panel
+ *
+ * Used to change the SPI configuration at runtime. The panel registers are kept, the caller must
+ * make sure no transfer is in progress on the old IO and delete it afterwards.
+ *
+ * @param[in] panel LCD panel handle returned by `esp_lcd_new_panel_gc9a01`
+ * @param[in] io New LCD panel IO handle
+ * @return
+ *          - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *          - ESP_OK                on success
+ */
+esp_err_t esp_lcd_gc9a01_set_io(esp_lcd_panel_handle_t panel, esp_lcd_panel_io_handle_t io);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,8 +1,9 @@
 #pragma once
 
-#include <esp_event.h>
+#include "storage.h"
 
 void app_base_init();
+void app_storage_init();
 
 /**
  * Time config 
@@ -12,12 +13,10 @@ void app_base_init();
 bool app_set_timezone(const char *tz);
 bool app_set_ntp_server(const char *ntp_server);
 
-
 /**
- * Application event loop
+ * Storage backend, mounted from the next boot
+ *
+ * The partition is formatted when the backend changes, so all files are lost.
  */
-esp_err_t app_event_loop_run(TickType_t ticks_to_run);
-
-esp_err_t app_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void *event_handler_arg);
-
-esp_err_t app_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data, size_t event_data_size, TickType_t ticks_to_wait);
+storage_fs_t app_storage_fs();
+bool app_set_storage_fs(storage_fs_t fs);
@@ -0,0 +1,21 @@
+#include "app_events.h"
+
+#include <stdio.h>
+
+
+template<typename E>
+static void print_stats()
+{
+    using queue = app_event_queue<E>;
+    printf("%-10s %5u %7u %10lu %8lu\n", E::NAME, E::SLOTS, queue::pending(), queue::published(), queue::dropped());
+}
+
+
+void app_events_print_stats()
+{
+    printf("Event      Slots Pending  Published  Dropped\n");
+    printf("--------------------------------------------\n");
+    print_stats<app_input_event_t>();
+    print_stats<app_wifi_event_t>();
+    print_stats<app_time_sync_event_t>();
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <atomic>
+#include <esp_timer.h>
+
+/**
+ * Application event bus
+ *
+ * Every event type has its own statically sized ring of payload slots, so
+ * publishing never allocates and never blocks. The rings are single producer,
+ * single consumer: each event type must be published from one task only.
+ * When a ring is full the new event is dropped and counted.
+ *
+ * Consumers declare the handlers for each event type at compile time as an
+ * app_event_bus of app_event_route entries, and dispatch it from their own
+ * loop with a time budget.
+ */
+
+
+/** -------------------------------------------------------------------------------
+ * Events
+ */
+
+struct app_input_event_t {
+    static constexpr size_t SLOTS { 8 };
+    static constexpr char NAME[] { "input" };
+    uint pad;
+    bool pressed;
+    bool long_press;
+};
+
+struct app_wifi_event_t {
+    static constexpr size_t SLOTS { 4 };
+    static constexpr char NAME[] { "wifi" };
+    bool connected;
+    bool has_ip;
+};
+
+struct app_time_sync_event_t {
+    static constexpr size_t SLOTS { 2 };
+    static constexpr char NAME[] { "time_sync" };
+    struct timeval tv;
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Queues
+ */
+
+template<typename E>
+class app_event_queue {
+    public:
+        static bool publish(const E &event)
+        {
+            auto head = s_head.load(std::memory_order_relaxed);
+            if (head - s_tail.load(std::memory_order_acquire) >= E::SLOTS) {
+                s_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            s_slots[head % E::SLOTS] = event;
+            s_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        static bool consume(E &event)
+        {
+            auto tail = s_tail.load(std::memory_order_relaxed);
+            if (tail == s_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            event = s_slots[tail % E::SLOTS];
+            s_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        static uint32_t published() { return s_head.load(std::memory_order_relaxed); }
+        static uint32_t pending() { return s_head.load(std::memory_order_relaxed) - s_tail.load(std::memory_order_relaxed); }
+        static uint32_t dropped() { return s_dropped.load(std::memory_order_relaxed); }
+
+    private:
+        static inline E s_slots[E::SLOTS];
+        static inline std::atomic<uint32_t> s_head { 0 };
+        static inline std::atomic<uint32_t> s_tail { 0 };
+        static inline std::atomic<uint32_t> s_dropped { 0 };
+};
+
+
+template<typename E>
+static inline bool app_event_publish(const E &event)
+{
+    return app_event_queue<E>::publish(event);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Dispatch
+ */
+
+template<typename E, void (*...Handlers)(const E &)>
+struct app_event_route {
+    static bool dispatch_one()
+    {
+        E event;
+        if (!app_event_queue<E>::consume(event)) {
+            return false;
+        }
+        (Handlers(event), ...);
+        return true;
+    }
+};
+
+
+template<typename... Routes>
+struct app_event_bus {
+    /**
+     * Dispatch pending events round robin over the event types until all
+     * queues are empty or the budget is spent. Returns the number of events
+     * handled.
+     */
+    static uint dispatch(int64_t budget_us)
+    {
+        const int64_t deadline = esp_timer_get_time() + budget_us;
+        uint count = 0;
+        bool more = true;
+        auto handled = [&](bool res) {
+            if (res) {
+                more = true;
+                count++;
+            }
+        };
+        while (more && esp_timer_get_time() < deadline) {
+            more = false;
+            (handled(Routes::dispatch_one()), ...);
+        }
+        return count;
+    }
+};
+
+
+void app_events_print_stats();
@@ -0,0 +1,354 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+#include "settings.h"
+#include "display.h"
+#include "bench.h"
+
+static constexpr char TAG[] = "arena";
+
+static constexpr uint ARENA_MAX_LISTENERS { 2 };
+
+
+struct arena_def_t {
+    const char *name;
+    setting_id_t setting;
+    arena_place_t default_place;
+    bool dma;                   ///< Read by DMA, always in DMA capable internal RAM
+};
+
+static constexpr arena_def_t ARENAS[ARENA_COUNT] = {
+    { "render", SETTING_ARENA_RENDER, ARENA_INTERNAL, true  },
+    { "dma",    SETTING_ARENA_DMA,    ARENA_INTERNAL, true  },
+    { "ui",     SETTING_ARENA_UI,     ARENA_PSRAM,    false },
+    { "net",    SETTING_ARENA_NET,    ARENA_PSRAM,    false },
+};
+
+static constexpr const char *PLACE_NAMES[ARENA_PLACE_COUNT] = { "internal", "psram" };
+
+struct listener_t {
+    arena_relocate_t relocate;
+    void *arg;
+};
+
+struct arena_state_t {
+    arena_place_t place;
+    arena_stats_t stats;
+    listener_t listeners[ARENA_MAX_LISTENERS];
+    uint listener_count;
+};
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static arena_state_t g_arenas[ARENA_COUNT] = {
+    { .place = ARENAS[ARENA_RENDER].default_place },
+    { .place = ARENAS[ARENA_DMA].default_place },
+    { .place = ARENAS[ARENA_UI].default_place },
+    { .place = ARENAS[ARENA_NET].default_place },
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Placement
+ */
+
+static bool place_allowed(arena_t arena, arena_place_t place)
+{
+    return place==ARENA_INTERNAL || !ARENAS[arena].dma;
+}
+
+
+static uint32_t place_caps(arena_t arena, arena_place_t place)
+{
+    if (ARENAS[arena].dma) {
+        return MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL;
+    }
+    if (place==ARENA_PSRAM) {
+        return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    }
+    return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+}
+
+
+/**
+ * With CONFIG_HEAP_ABORT_WHEN_ALLOCATION_FAILS a failed heap_caps_malloc
+ * aborts before the fallback runs, so only try where the block fits. Another
+ * task can still take the block in between, that is no worse than before.
+ */
+static void *try_alloc(size_t size, uint32_t caps)
+{
+    if (heap_caps_get_largest_free_block(caps)<size) {
+        return nullptr;
+    }
+    return heap_caps_malloc(size, caps);
+}
+
+
+static arena_place_t block_place(const void *ptr)
+{
+    return esp_ptr_external_ram(ptr) ? ARENA_PSRAM : ARENA_INTERNAL;
+}
+
+
+static void apply_place(arena_t arena, arena_place_t place)
+{
+    auto &state = g_arenas[arena];
+    portENTER_CRITICAL(&g_lock);
+    const bool changed = state.place!=place;
+    state.place = place;
+    portEXIT_CRITICAL(&g_lock);
+    if (!changed) {
+        return;
+    }
+    ESP_LOGI(TAG, "%s arena in %s", ARENAS[arena].name, PLACE_NAMES[place]);
+    for (uint i=0; i<state.listener_count; i++) {
+        state.listeners[i].relocate(arena, state.listeners[i].arg);
+    }
+}
+
+
+static void on_setting_changed(setting_id_t id, void *arg)
+{
+    const auto arena = static_cast<arena_t>(reinterpret_cast<uintptr_t>(arg));
+    const int32_t value = settings_get_int(id);
+    if (value<0 || value>=ARENA_PLACE_COUNT) {
+        return;
+    }
+    if (!place_allowed(arena, static_cast<arena_place_t>(value))) {
+        ESP_LOGW(TAG, "%s arena must stay in %s", ARENAS[arena].name, PLACE_NAMES[ARENA_INTERNAL]);
+        return;
+    }
+    apply_place(arena, static_cast<arena_place_t>(value));
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public
+ */
+
+void arena_init()
+{
+    for (uint i=0; i<ARENA_COUNT; i++) {
+        auto arg = reinterpret_cast<void*>(static_cast<uintptr_t>(i));
+        settings_subscribe(ARENAS[i].setting, on_setting_changed, arg);
+        on_setting_changed(ARENAS[i].setting, arg);
+    }
+}
+
+
+void *arena_alloc(arena_t arena, size_t size)
+{
+    auto &state = g_arenas[arena];
+    const arena_place_t place = state.place;
+    void *ptr = try_alloc(size, place_caps(arena, place));
+    bool fallback = false;
+    const auto other = place==ARENA_INTERNAL ? ARENA_PSRAM : ARENA_INTERNAL;
+    if (!ptr && place_allowed(arena, other)) {
+        ptr = try_alloc(size, place_caps(arena, other));
+        fallback = ptr!=nullptr;
+    }
+
+    portENTER_CRITICAL(&g_lock);
+    auto &stats = state.stats;
+    if (!ptr) {
+        stats.failures++;
+    }
+    else {
+        stats.blocks++;
+        stats.bytes[block_place(ptr)] += heap_caps_get_allocated_size(ptr);
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes[ARENA_INTERNAL] + stats.bytes[ARENA_PSRAM]);
+        stats.fallbacks += fallback;
+    }
+    portEXIT_CRITICAL(&g_lock);
+
+    if (!ptr) {
+        ESP_LOGW(TAG, "No memory for %u bytes in %s arena", size, ARENAS[arena].name);
+    }
+    else if (fallback) {
+        ESP_LOGW(TAG, "%u bytes of %s arena not in %s", size, ARENAS[arena].name, PLACE_NAMES[place]);
+    }
+    return ptr;
+}
+
+
+void *arena_calloc(arena_t arena, size_t count, size_t size)
+{
+    void *ptr = arena_alloc(arena, count*size);
+    if (ptr) {
+        memset(ptr, 0, count*size);
+    }
+    return ptr;
+}
+
+
+void arena_free(arena_t arena, void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    const size_t size = heap_caps_get_allocated_size(ptr);
+    const auto place = block_place(ptr);
+    portENTER_CRITICAL(&g_lock);
+    auto &stats = g_arenas[arena].stats;
+    stats.blocks--;
+    stats.bytes[place] -= size;
+    portEXIT_CRITICAL(&g_lock);
+    heap_caps_free(ptr);
+}
+
+
+bool arena_subscribe(arena_t arena, arena_relocate_t relocate, void *arg)
+{
+    auto &state = g_arenas[arena];
+    if (state.listener_count>=ARENA_MAX_LISTENERS) {
+        ESP_LOGE(TAG, "Too many listeners on %s arena", ARENAS[arena].name);
+        return false;
+    }
+    state.listeners[state.listener_count++] = { relocate, arg };
+    return true;
+}
+
+
+bool arena_set_place(arena_t arena, arena_place_t place, bool persist)
+{
+    if (!place_allowed(arena, place)) {
+        ESP_LOGW(TAG, "%s arena is read by DMA and must stay in %s", ARENAS[arena].name, PLACE_NAMES[ARENA_INTERNAL]);
+        return false;
+    }
+    if (persist) {
+        // The settings listener applies it
+        return settings_set_int(ARENAS[arena].setting, place);
+    }
+    apply_place(arena, place);
+    return true;
+}
+
+
+arena_place_t arena_get_place(arena_t arena)
+{
+    return g_arenas[arena].place;
+}
+
+
+const char *arena_name(arena_t arena)
+{
+    return ARENAS[arena].name;
+}
+
+
+const char *arena_place_name(arena_place_t place)
+{
+    return PLACE_NAMES[place];
+}
+
+
+bool arena_find(const char *name, arena_t *arena)
+{
+    for (uint i=0; i<ARENA_COUNT; i++) {
+        if (strcmp(name, ARENAS[i].name)==0) {
+            *arena = static_cast<arena_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool arena_find_place(const char *name, arena_place_t *place)
+{
+    for (uint i=0; i<ARENA_PLACE_COUNT; i++) {
+        if (strcmp(name, PLACE_NAMES[i])==0) {
+            *place = static_cast<arena_place_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void arena_get_stats(arena_t arena, arena_stats_t *stats)
+{
+    portENTER_CRITICAL(&g_lock);
+    *stats = g_arenas[arena].stats;
+    stats->place = g_arenas[arena].place;
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+void arena_print_report()
+{
+    printf("Arena   Place     Moves  Blocks  Internal KB  PSRAM KB  Peak KB  Fallbacks  Failed\n");
+    printf("--------------------------------------------------------------------------------\n");
+    for (uint i=0; i<ARENA_COUNT; i++) {
+        arena_stats_t st;
+        arena_get_stats(static_cast<arena_t>(i), &st);
+        printf("%-7s %-9s %5s  %6lu  %11.1f  %8.1f  %7.1f  %9lu  %6lu\n",
+            ARENAS[i].name,
+            PLACE_NAMES[st.place],
+            ARENAS[i].dma ? "-" : g_arenas[i].listener_count ? "now" : "alloc",
+            st.blocks,
+            st.bytes[ARENA_INTERNAL] / 1024.0f,
+            st.bytes[ARENA_PSRAM] / 1024.0f,
+            st.peak_bytes / 1024.0f,
+            st.fallbacks,
+            st.failures
+            );
+    }
+
+    // LVGL allocates from its own pool, outside of the arenas
+    lv_mem_monitor_t mon = {};
+    if (display_acquire(pdMS_TO_TICKS(100))) {
+        lv_mem_monitor(&mon);
+        display_release();
+    }
+    printf("\nLVGL heap: %lu of %lu KB used, internal\n", (mon.total_size - mon.free_size) / 1024, mon.total_size / 1024);
+
+    static constexpr struct {
+        const char *name;
+        uint32_t caps;
+    } HEAPS[] = {
+        { "Internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT },
+        { "DMA",      MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL },
+        { "PSRAM",    MALLOC_CAP_SPIRAM },
+    };
+    for (auto &heap : HEAPS) {
+        printf("%-9s  free %6u KB, largest block %6u KB\n",
+            heap.name,
+            heap_caps_get_free_size(heap.caps) / 1024,
+            heap_caps_get_largest_free_block(heap.caps) / 1024
+            );
+    }
+}
+
+
+bool arena_bench(const char *filter, uint32_t scene_ms)
+{
+    bool ok = true;
+    for (uint i=0; i<ARENA_COUNT && ok; i++) {
+        const auto arena = static_cast<arena_t>(i);
+        // Moving the others needs a restart, DMA arenas stay internal
+        if (!g_arenas[arena].listener_count || ARENAS[arena].dma) {
+            continue;
+        }
+        const arena_place_t original = arena_get_place(arena);
+        for (uint p=0; p<ARENA_PLACE_COUNT && ok; p++) {
+            const auto place = static_cast<arena_place_t>(p);
+            apply_place(arena, place);
+            arena_stats_t st;
+            arena_get_stats(arena, &st);
+            printf("\n%s arena in %s, %.1f KB internal, %.1f KB PSRAM\n", ARENAS[arena].name, PLACE_NAMES[place], st.bytes[ARENA_INTERNAL] / 1024.0f, st.bytes[ARENA_PSRAM] / 1024.0f);
+            ok = bench_run(filter, scene_ms);
+        }
+        apply_place(arena, original);
+    }
+    return ok;
+}
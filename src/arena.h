@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Memory arenas
+ *
+ * Buffers of the application are allocated from named arenas instead of
+ * picking heap caps at every call site. Each arena is placed in internal RAM
+ * or in PSRAM:
+ *
+ *  - render: LVGL draw buffers, written by every render and read by the SPI DMA
+ *  - dma:    staging buffers for SPI and flash transfers, such as display tuning
+ *  - ui:     compositor layers, face files and snapshots, large and rarely written
+ *  - net:    mirror frame copies and OTA inflate state
+ *
+ * The placement is stored in the ARENA_* settings. The render and dma
+ * arenas are read by DMA and always stay in DMA capable internal RAM, moving
+ * them to PSRAM is refused. Allocations of the others fall back to the other
+ * placement when the preferred one is out of memory, and count it. An
+ * allocation is only tried where the largest free block fits, so a full heap
+ * returns nullptr instead of aborting. Arenas with a relocation handler move
+ * their buffers when the placement is changed, the others on their next
+ * allocation. The LVGL heap is a static
+ * pool in internal RAM set by CONFIG_LV_MEM_SIZE_KILOBYTES, the report shows
+ * its usage next to the arenas.
+ */
+enum arena_t {
+    ARENA_RENDER,
+    ARENA_DMA,
+    ARENA_UI,
+    ARENA_NET,
+    ARENA_COUNT
+};
+
+enum arena_place_t {
+    ARENA_INTERNAL,
+    ARENA_PSRAM,
+    ARENA_PLACE_COUNT
+};
+
+struct arena_stats_t {
+    arena_place_t place;
+    uint32_t blocks;
+    uint32_t bytes[ARENA_PLACE_COUNT];      ///< By where the blocks actually are
+    uint32_t peak_bytes;
+    uint32_t fallbacks;
+    uint32_t failures;
+};
+
+/** Apply the stored placements, allocations before use the defaults */
+void arena_init();
+
+void *arena_alloc(arena_t arena, size_t size);
+void *arena_calloc(arena_t arena, size_t count, size_t size);
+void arena_free(arena_t arena, void *ptr);
+
+
+/**
+ * Relocation handler, called from the task changing the placement after the
+ * new placement is in effect. Reallocate and free the old buffers.
+ */
+using arena_relocate_t = void (*)(arena_t arena, void *arg);
+
+bool arena_subscribe(arena_t arena, arena_relocate_t relocate, void *arg);
+
+/** Store a new placement, or apply it until restart if not persist. False for PSRAM and a DMA arena. */
+bool arena_set_place(arena_t arena, arena_place_t place, bool persist = true);
+arena_place_t arena_get_place(arena_t arena);
+
+const char *arena_name(arena_t arena);
+const char *arena_place_name(arena_place_t place);
+bool arena_find(const char *name, arena_t *arena);
+bool arena_find_place(const char *name, arena_place_t *place);
+
+void arena_get_stats(arena_t arena, arena_stats_t *stats);
+void arena_print_report();
+
+/**
+ * Run the display benchmark with each relocatable arena that is not read by
+ * DMA in each placement and restore the placements afterwards. Must not be
+ * called from the LVGL task.
+ */
+bool arena_bench(const char *filter, uint32_t scene_ms);
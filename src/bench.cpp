@@ -0,0 +1,297 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+#include "display.h"
+#include "refresh.h"
+#include "ui/ui.h"
+
+static constexpr char TAG[] = "bench";
+
+static constexpr uint32_t BENCH_SETTLE_MS { 300 };
+static constexpr uint32_t BENCH_TRANSITION_MS { 500 };
+static constexpr uint16_t BENCH_CHART_POINTS { 50 };
+
+
+/**
+ * A scene sets up its screen from setup() and changes it from step(), which
+ * runs from an LVGL timer on every pass of the LVGL task.
+ */
+struct bench_scene_t {
+    const char *name;
+    lv_obj_t *(*setup)(const bench_scene_t &scene);
+    void (*step)(const bench_scene_t &scene, uint32_t n);
+    void (*teardown)(const bench_scene_t &scene);
+    lv_obj_t **from;        ///< Transition scenes only
+    lv_obj_t **to;
+};
+
+static struct {
+    bool running;
+    lv_obj_t *screen;       ///< Plain screen for the scenes that do not use the UI
+    lv_obj_t *chart;
+    lv_chart_series_t *series;
+    const bench_scene_t *scene;
+    uint32_t step;
+} g_bench;
+
+
+
+/** -------------------------------------------------------------------------------
+ * Scenes
+ */
+
+static lv_obj_t *bench_screen()
+{
+    if (!g_bench.screen) {
+        g_bench.screen = lv_obj_create(nullptr);
+    }
+    return g_bench.screen;
+}
+
+
+static lv_obj_t *fill_setup(const bench_scene_t &scene)
+{
+    return bench_screen();
+}
+
+static void fill_step(const bench_scene_t &scene, uint32_t n)
+{
+    // Every step repaints the whole screen
+    lv_obj_set_style_bg_color(g_bench.screen, lv_palette_main(static_cast<lv_palette_t>(n % LV_PALETTE_LAST)), 0);
+}
+
+
+static lv_obj_t *clock_setup(const bench_scene_t &scene)
+{
+    return ui_Clock;
+}
+
+static void arc_step(const bench_scene_t &scene, uint32_t n)
+{
+    lv_arc_set_value(ui_clock_seconds, n % 60);
+}
+
+static void text_step(const bench_scene_t &scene, uint32_t n)
+{
+    lv_label_set_text_fmt(ui_clock_label, "%02lu:%02lu", (n / 60) % 24, n % 60);
+}
+
+
+static lv_obj_t *chart_setup(const bench_scene_t &scene)
+{
+    auto screen = bench_screen();
+    g_bench.chart = lv_chart_create(screen);
+    lv_obj_set_size(g_bench.chart, 150, 150);
+    lv_obj_align(g_bench.chart, LV_ALIGN_CENTER, 0, 0);
+    lv_obj_set_style_line_width(g_bench.chart, 0, LV_PART_ITEMS);
+    lv_chart_set_type(g_bench.chart, LV_CHART_TYPE_SCATTER);
+    lv_chart_set_range(g_bench.chart, LV_CHART_AXIS_PRIMARY_X, 0, 200);
+    lv_chart_set_range(g_bench.chart, LV_CHART_AXIS_PRIMARY_Y, 0, 1000);
+    lv_chart_set_point_count(g_bench.chart, BENCH_CHART_POINTS);
+    g_bench.series = lv_chart_add_series(g_bench.chart, lv_palette_main(LV_PALETTE_RED), LV_CHART_AXIS_PRIMARY_Y);
+    for (uint i=0; i<BENCH_CHART_POINTS; i++) {
+        lv_chart_set_next_value2(g_bench.chart, g_bench.series, lv_rand(0, 200), lv_rand(0, 1000));
+    }
+    return screen;
+}
+
+static void chart_step(const bench_scene_t &scene, uint32_t n)
+{
+    lv_chart_set_next_value2(g_bench.chart, g_bench.series, lv_rand(0, 200), lv_rand(0, 1000));
+}
+
+static void chart_teardown(const bench_scene_t &scene)
+{
+    lv_obj_del(g_bench.chart);
+    g_bench.chart = nullptr;
+    g_bench.series = nullptr;
+}
+
+
+static lv_obj_t *bars_setup(const bench_scene_t &scene)
+{
+    return ui_Demo2;
+}
+
+static void bars_step(const bench_scene_t &scene, uint32_t n)
+{
+    // The bar chart is drawn over the gradient background of the screen
+    lv_chart_series_t *series = lv_chart_get_series_next(ui_Chart2, nullptr);
+    if (series) {
+        lv_chart_set_next_value(ui_Chart2, series, lv_rand(0, 100));
+    }
+}
+
+
+static lv_obj_t *colorwheel_setup(const bench_scene_t &scene)
+{
+    return ui_Demo1;
+}
+
+static void colorwheel_step(const bench_scene_t &scene, uint32_t n)
+{
+    lv_obj_invalidate(ui_Colorwheel1);
+}
+
+
+static lv_obj_t *transition_setup(const bench_scene_t &scene)
+{
+    return *scene.from;
+}
+
+static void transition_step(const bench_scene_t &scene, uint32_t n)
+{
+    // Move back and forth between the screens, starting the next move when the last one is done
+    auto disp = display_get();
+    if (disp->prev_scr) {
+        return;
+    }
+    if (lv_scr_act()==*scene.from) {
+        lv_scr_load_anim(*scene.to, LV_SCR_LOAD_ANIM_MOVE_LEFT, BENCH_TRANSITION_MS, 0, false);
+    }
+    else {
+        lv_scr_load_anim(*scene.from, LV_SCR_LOAD_ANIM_MOVE_RIGHT, BENCH_TRANSITION_MS, 0, false);
+    }
+}
+
+
+static const bench_scene_t SCENES[] = {
+    { "fill",              fill_setup,       fill_step,       nullptr,        nullptr,   nullptr   },
+    { "arc",               clock_setup,      arc_step,        nullptr,        nullptr,   nullptr   },
+    { "text",              clock_setup,      text_step,       nullptr,        nullptr,   nullptr   },
+    { "chart",             chart_setup,      chart_step,      chart_teardown, nullptr,   nullptr   },
+    { "bars",              bars_setup,       bars_step,       nullptr,        nullptr,   nullptr   },
+    { "colorwheel",        colorwheel_setup, colorwheel_step, nullptr,        nullptr,   nullptr   },
+    { "trans_clock_demo",  transition_setup, transition_step, nullptr,        &ui_Clock, &ui_Demo  },
+    { "trans_demo_demo1",  transition_setup, transition_step, nullptr,        &ui_Demo,  &ui_Demo1 },
+    { "trans_demo1_demo2", transition_setup, transition_step, nullptr,        &ui_Demo1, &ui_Demo2 },
+    { "trans_demo2_clock", transition_setup, transition_step, nullptr,        &ui_Demo2, &ui_Clock },
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Runner
+ */
+
+static void step_timer_cb(lv_timer_t *timer)
+{
+    auto &scene = *g_bench.scene;
+    scene.step(scene, g_bench.step++);
+}
+
+
+static void run_scene(const bench_scene_t &scene, uint32_t scene_ms)
+{
+    display_acquire();
+    lv_scr_load(scene.setup(scene));
+    display_release();
+    vTaskDelay(pdMS_TO_TICKS(BENCH_SETTLE_MS));
+
+    display_stats_t before, after;
+    display_get_stats(&before);
+    int64_t start = esp_timer_get_time();
+
+    display_acquire();
+    g_bench.scene = &scene;
+    g_bench.step = 0;
+    lv_timer_t *timer = lv_timer_create(step_timer_cb, 0, nullptr);
+    display_release();
+
+    vTaskDelay(pdMS_TO_TICKS(scene_ms));
+
+    display_acquire();
+    lv_timer_del(timer);
+    display_release();
+
+    display_get_stats(&after);
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    // Let a transition finish before the next scene loads its screen
+    vTaskDelay(pdMS_TO_TICKS(BENCH_SETTLE_MS + BENCH_TRANSITION_MS));
+    if (scene.teardown) {
+        display_acquire();
+        scene.teardown(scene);
+        display_release();
+    }
+
+    uint32_t frames = after.frames - before.frames;
+    uint64_t frame_us = frames ? (after.frame_time_sum_ms - before.frame_time_sum_ms) * 1000 / frames : 0;
+    uint64_t wait_us = frames ? (after.flush_wait_us - before.flush_wait_us) / frames : 0;
+    uint64_t spi_us = after.spi_busy_us - before.spi_busy_us;
+    uint64_t bytes = after.flush_bytes - before.flush_bytes;
+
+    printf("%-17s %6lu %6.1f %8llu %9llu %7llu %10llu %12.1f %8.2f %12.1f\n",
+        scene.name,
+        frames,
+        frames * 1000000.0f / elapsed_us,
+        frame_us,
+        frame_us > wait_us ? frame_us - wait_us : 0,
+        wait_us,
+        frames ? spi_us / frames : 0,
+        spi_us * 100.0f / elapsed_us,
+        bytes * 8.0f / elapsed_us,
+        frames ? bytes / 1024.0f / frames : 0.0f
+        );
+}
+
+
+bool bench_run(const char *filter, uint32_t scene_ms)
+{
+    auto disp = display_get();
+
+    display_acquire();
+    if (g_bench.running) {
+        display_release();
+        printf("Benchmark already running\n");
+        return false;
+    }
+    g_bench.running = true;
+    display_release();
+
+    // Scenes run at a fixed rate
+    refresh_stats_t refresh;
+    refresh_get_stats(&refresh);
+    refresh_set_enabled(false);
+
+    display_acquire();
+    lv_obj_t *screen = lv_scr_act();
+    uint32_t refr_period = disp->refr_timer->period;
+    lv_timer_set_period(disp->refr_timer, 1);
+    display_release();
+
+    ESP_LOGI(TAG, "Running scenes for %lu ms", scene_ms);
+    printf("scene             frames    fps frame_us render_us wait_us spi_us_frame spi_util_pct spi_mbps kb_per_frame\n");
+    uint count = 0;
+    for (auto &scene : SCENES) {
+        if (filter && strncmp(scene.name, filter, strlen(filter))!=0) {
+            continue;
+        }
+        run_scene(scene, scene_ms);
+        count++;
+    }
+
+    display_acquire();
+    lv_timer_set_period(disp->refr_timer, refr_period);
+    lv_scr_load(screen);
+    if (g_bench.screen) {
+        lv_obj_del(g_bench.screen);
+        g_bench.screen = nullptr;
+    }
+    g_bench.running = false;
+    display_release();
+    refresh_set_enabled(refresh.enabled);
+
+    if (count==0) {
+        printf("No scene matches '%s'\n", filter);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Display benchmark
+ *
+ * Runs a fixed suite of scenes through the real LVGL, SPI and panel path
+ * with the refresh period lowered to 1 ms, so every scene renders as fast as
+ * it can. Prints one row per scene with the frame rate, the split of frame
+ * time between rendering and waiting on flushes, and the SPI bus utilization.
+ * The active screen and refresh period are restored afterwards.
+ */
+static constexpr uint32_t BENCH_DEFAULT_SCENE_MS { 3000 };
+
+/**
+ * Run the scenes whose name starts with filter, all when it is null.
+ * Blocks the calling task, must not be called from the LVGL task.
+ */
+bool bench_run(const char *filter, uint32_t scene_ms = BENCH_DEFAULT_SCENE_MS);
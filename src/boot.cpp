@@ -0,0 +1,142 @@
+#include "boot.h"
+
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+static constexpr char TAG[] = "boot";
+
+static constexpr uint BOOT_CORE_COUNT { portNUM_PROCESSORS };
+static constexpr uint32_t BOOT_TASK_STACK_SIZE { 8192 };
+static constexpr UBaseType_t BOOT_TASK_PRIORITY { 5 };
+
+
+struct boot_timeline_t {
+    int64_t ready;      // All dependencies satisfied
+    int64_t start;
+    int64_t end;
+    BaseType_t core;
+};
+
+static const boot_phase_t *g_phases = nullptr;
+static uint g_phase_count = 0;
+static uint32_t g_all_mask = 0;
+static int64_t g_boot_start = 0;
+static boot_timeline_t g_timeline[BOOT_MAX_PHASES];
+static EventGroupHandle_t g_boot_event_group = nullptr;
+
+
+static void boot_task(void *param)
+{
+    const BaseType_t core = reinterpret_cast<uintptr_t>(param);
+
+    for (uint i=0; i<g_phase_count; i++) {
+        auto &phase = g_phases[i];
+        if (phase.core!=core)
+            continue;
+
+        if (phase.depends) {
+            xEventGroupWaitBits(g_boot_event_group, phase.depends, pdFALSE, pdTRUE, portMAX_DELAY);
+        }
+
+        auto &tl = g_timeline[i];
+        tl.core = core;
+        tl.start = esp_timer_get_time();
+        phase.func();
+        tl.end = esp_timer_get_time();
+
+        // The phase became runnable when the last of its dependencies finished
+        tl.ready = g_boot_start;
+        for (uint dep=0; dep<i; dep++) {
+            if ((phase.depends & boot_dep(dep)) && g_timeline[dep].end>tl.ready) {
+                tl.ready = g_timeline[dep].end;
+            }
+        }
+
+        ESP_LOGI(TAG, "Phase %-8s done in %4lld ms (core %d)", phase.name, (tl.end-tl.start)/1000, core);
+        xEventGroupSetBits(g_boot_event_group, boot_dep(i));
+    }
+
+    vTaskDelete(nullptr);
+}
+
+
+void boot_start(const boot_phase_t *phases, uint count)
+{
+    assert(!g_phases);
+    assert(count<=BOOT_MAX_PHASES);
+    for (uint i=0; i<count; i++) {
+        // Table must be in dependency order, otherwise a core could wait on itself
+        assert((phases[i].depends & ~(boot_dep(i)-1))==0);
+        assert(phases[i].core>=0 && phases[i].core<(BaseType_t)BOOT_CORE_COUNT);
+    }
+
+    static StaticEventGroup_t event_group_buffer;
+    g_boot_event_group = xEventGroupCreateStatic(&event_group_buffer);
+
+    g_phases = phases;
+    g_phase_count = count;
+    g_all_mask = boot_dep(count)-1;
+    g_boot_start = esp_timer_get_time();
+
+    for (uint core=0; core<BOOT_CORE_COUNT; core++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "boot%u", core);
+        auto res = xTaskCreatePinnedToCore(boot_task, name, BOOT_TASK_STACK_SIZE, reinterpret_cast<void*>(core), BOOT_TASK_PRIORITY, nullptr, core);
+        assert(res==pdPASS);
+    }
+}
+
+
+bool boot_wait(uint32_t phase_mask, TickType_t ticksToWait)
+{
+    auto bits = xEventGroupWaitBits(g_boot_event_group, phase_mask, pdFALSE, pdTRUE, ticksToWait);
+    return (bits & phase_mask)==phase_mask;
+}
+
+bool boot_wait_all(TickType_t ticksToWait)
+{
+    return boot_wait(g_all_mask, ticksToWait);
+}
+
+
+void boot_print_timeline()
+{
+    if (!g_phases) {
+        printf("Boot not started\n");
+        return;
+    }
+
+    auto done = xEventGroupGetBits(g_boot_event_group);
+
+    printf("Phase      Core   Ready   Start     End    Wait     Run\n");
+    printf("-------------------------------------------------------\n");
+
+    int64_t last_end = g_boot_start;
+    for (uint i=0; i<g_phase_count; i++) {
+        auto &phase = g_phases[i];
+        auto &tl = g_timeline[i];
+        if (!(done & boot_dep(i))) {
+            printf("%-10s    %d  pending\n", phase.name, (int)phase.core);
+            continue;
+        }
+        printf("%-10s    %d %7lld %7lld %7lld %7lld %7lld\n",
+            phase.name,
+            (int)tl.core,
+            tl.ready/1000,
+            tl.start/1000,
+            tl.end/1000,
+            (tl.start-tl.ready)/1000,
+            (tl.end-tl.start)/1000
+            );
+        if (tl.end>last_end) {
+            last_end = tl.end;
+        }
+    }
+
+    printf("-------------------------------------------------------\n");
+    printf("Boot started at %lld ms, completed in %lld ms (times in ms since reset)\n", g_boot_start/1000, (last_end-g_boot_start)/1000);
+}
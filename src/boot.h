@@ -0,0 +1,30 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+/**
+ * Staged boot
+ *
+ * Phases are declared in a table in dependency order. Each phase is pinned
+ * to a core and starts as soon as all phases in its dependency mask have
+ * completed, so independent phases run concurrently on both cores.
+ */
+using boot_phase_func_t = void (*)();
+
+struct boot_phase_t {
+    const char *name;
+    boot_phase_func_t func;
+    uint32_t depends;       ///< Bitmask of phase indices that must complete first
+    BaseType_t core;        ///< Core the phase runs on (0 or 1)
+};
+
+static constexpr uint BOOT_MAX_PHASES { 24 };
+
+static constexpr uint32_t boot_dep(uint phase) { return 1ul << phase; }
+
+void boot_start(const boot_phase_t *phases, uint count);
+
+bool boot_wait(uint32_t phase_mask, TickType_t ticksToWait = portMAX_DELAY);
+bool boot_wait_all(TickType_t ticksToWait = portMAX_DELAY);
+
+void boot_print_timeline();
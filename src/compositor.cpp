@@ -0,0 +1,489 @@
+#include "compositor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "display.h"
+#include "arena.h"
+
+static constexpr char TAG[] = "compositor";
+
+static constexpr uint COMPOSITOR_MAX_STATIC { 4 };
+static constexpr uint COMPOSITOR_MAX_CHILDREN { 32 };        // Direct children of a cached screen
+// A layer is judged once it has been copied over this many screens
+static constexpr uint COMPOSITOR_JUDGE_SCREENS { 8 };
+
+// Objects in this state are drawn transparent by g_transparent_style and
+// g_hidden_style. A style for the exact state of an object wins over local
+// styles in the default state.
+static constexpr lv_state_t COMPOSITOR_STATE { LV_STATE_USER_4 };
+
+// Parts g_hidden_style is added to, the widgets on faces draw in these
+static constexpr lv_style_selector_t HIDDEN_PARTS[] { LV_PART_MAIN, LV_PART_INDICATOR, LV_PART_KNOB, LV_PART_ITEMS };
+
+
+struct layer_t {
+    lv_obj_t *screen;
+    const char *name;
+    lv_obj_t *statics[COMPOSITOR_MAX_STATIC];
+    uint static_count;
+    lv_color_t *pixels;             // Screen sized, in the ui arena
+    bool valid;
+    bool kept;                      // False once copying was found slower than drawing
+    bool judged;
+    uint32_t renders;
+    uint64_t render_us;
+    uint64_t copied_px;
+    uint64_t copy_us;
+};
+
+static layer_t g_layers[COMPOSITOR_MAX_SCREENS];
+static uint g_layer_count = 0;
+static bool g_enabled = true;
+static bool g_applying = false;     // Our own state changes send style events too
+static lv_style_t g_transparent_style;     // Screen background only, the rest is inherited by children
+static lv_style_t g_hidden_style;          // Static objects and everything in them
+static lv_timer_t *g_render_timer = nullptr;
+static void (*g_default_draw_bg)(lv_draw_ctx_t *draw_ctx, const lv_draw_rect_dsc_t *dsc, const lv_area_t *coords) = nullptr;
+static uint g_width = 0;
+static uint g_height = 0;
+
+
+
+/** -------------------------------------------------------------------------------
+ * Layers
+ */
+
+/** Call fn for obj and all objects below it */
+template<typename F>
+static void for_tree(lv_obj_t *obj, F &&fn)
+{
+    fn(obj);
+    const uint32_t count = lv_obj_get_child_cnt(obj);
+    for (uint32_t i=0; i<count; i++) {
+        for_tree(lv_obj_get_child(obj, i), fn);
+    }
+}
+
+
+static layer_t *find_layer(const lv_obj_t *screen)
+{
+    if (!screen) {
+        return nullptr;
+    }
+    for (uint i=0; i<g_layer_count; i++) {
+        if (g_layers[i].screen==screen) {
+            return &g_layers[i];
+        }
+    }
+    return nullptr;
+}
+
+
+/** Draw the screen and its static children transparent, or normally */
+static void set_transparent(layer_t &layer, bool transparent)
+{
+    g_applying = true;
+    auto set = transparent ? lv_obj_add_state : lv_obj_clear_state;
+    set(layer.screen, COMPOSITOR_STATE);
+    for (uint i=0; i<layer.static_count; i++) {
+        for_tree(layer.statics[i], [set](lv_obj_t *obj) { set(obj, COMPOSITOR_STATE); });
+    }
+    g_applying = false;
+}
+
+
+static bool render_layer(layer_t &layer)
+{
+    const int64_t start = esp_timer_get_time();
+
+    // Everything but the static children is left out of the snapshot
+    const uint32_t child_count = lv_obj_get_child_cnt(layer.screen);
+    if (child_count>COMPOSITOR_MAX_CHILDREN) {
+        ESP_LOGW(TAG, "%s has more than %u children", layer.name, COMPOSITOR_MAX_CHILDREN);
+        return false;
+    }
+    uint32_t hidden = 0;        // Children hidden for the snapshot
+    g_applying = true;
+    for (uint32_t i=0; i<child_count; i++) {
+        auto child = lv_obj_get_child(layer.screen, i);
+        if (!lv_obj_has_flag(child, LV_OBJ_FLAG_HIDDEN) && !std::count(layer.statics, layer.statics+layer.static_count, child)) {
+            lv_obj_add_flag(child, LV_OBJ_FLAG_HIDDEN);
+            hidden |= 1ul << i;
+        }
+    }
+    g_applying = false;
+
+    lv_img_dsc_t dsc;
+    const uint32_t size = g_width * g_height * sizeof(lv_color_t);
+    bool ok = lv_snapshot_buf_size_needed(layer.screen, LV_IMG_CF_TRUE_COLOR)==size
+        && lv_snapshot_take_to_buf(layer.screen, LV_IMG_CF_TRUE_COLOR, &dsc, layer.pixels, size)==LV_RES_OK;
+
+    g_applying = true;
+    for (uint32_t i=0; i<child_count; i++) {
+        if (hidden & (1ul << i)) {
+            lv_obj_clear_flag(lv_obj_get_child(layer.screen, i), LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+    g_applying = false;
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Error rendering %s layer", layer.name);
+        return false;
+    }
+    layer.renders++;
+    layer.render_us += esp_timer_get_time() - start;
+    return true;
+}
+
+
+/**
+ * Keep a layer only where it wins. The snapshot draws the background and the
+ * static children over the whole screen, so its time per pixel estimates
+ * what drawing the copied pixels normally would have cost. The layer has to
+ * beat that including its own renders.
+ */
+static void judge_layer(layer_t &layer)
+{
+    layer.judged = true;
+    const uint64_t drawn_us = layer.copied_px * layer.render_us / layer.renders / (g_width * g_height);
+    const uint64_t spent_us = layer.copy_us + layer.render_us;
+    if (spent_us<drawn_us) {
+        ESP_LOGI(TAG, "Keeping %s layer, %llu us instead of about %llu us", layer.name, spent_us, drawn_us);
+        return;
+    }
+    ESP_LOGI(TAG, "Dropping %s layer, %llu us instead of about %llu us", layer.name, spent_us, drawn_us);
+    layer.kept = false;
+    layer.valid = false;
+    set_transparent(layer, false);
+}
+
+
+static void render_timer_cb(lv_timer_t *timer)
+{
+    g_render_timer = nullptr;
+    if (!g_enabled) {
+        return;
+    }
+    for (uint i=0; i<g_layer_count; i++) {
+        auto &layer = g_layers[i];
+        if (!layer.screen || !layer.kept) {
+            continue;
+        }
+        if (layer.valid && !layer.judged && layer.copied_px>=COMPOSITOR_JUDGE_SCREENS*g_width*g_height) {
+            judge_layer(layer);
+        }
+        else if (!layer.valid && render_layer(layer)) {
+            layer.valid = true;
+            set_transparent(layer, true);
+        }
+    }
+}
+
+
+/** Render invalid layers from the LVGL timer handler, never from inside a refresh */
+static void schedule_render()
+{
+    if (!g_render_timer) {
+        g_render_timer = lv_timer_create(render_timer_cb, 0, nullptr);
+        lv_timer_set_repeat_count(g_render_timer, 1);
+    }
+}
+
+
+static void invalidate_layer(layer_t &layer)
+{
+    if (layer.valid) {
+        layer.valid = false;
+        set_transparent(layer, false);
+    }
+    schedule_render();
+}
+
+
+/** Render the layers again into buffers at the new placement of the ui arena */
+static void on_ui_relocate(__unused arena_t arena, __unused void *arg)
+{
+    lv_color_t *old[COMPOSITOR_MAX_SCREENS] = {};
+    display_acquire();
+    for (uint i=0; i<g_layer_count; i++) {
+        auto &layer = g_layers[i];
+        if (!layer.screen) {
+            continue;
+        }
+        auto pixels = static_cast<lv_color_t*>(arena_alloc(ARENA_UI, g_width * g_height * sizeof(lv_color_t)));
+        if (!pixels) {
+            continue;
+        }
+        invalidate_layer(layer);
+        old[i] = layer.pixels;
+        layer.pixels = pixels;
+    }
+    display_release();
+    for (auto pixels : old) {
+        arena_free(ARENA_UI, pixels);
+    }
+}
+
+
+static void on_static_changed(lv_event_t *e)
+{
+    if (g_applying) {
+        return;
+    }
+    invalidate_layer(*static_cast<layer_t*>(lv_event_get_user_data(e)));
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Background
+ */
+
+/** Copy the part of a layer at its screen's position that falls inside clip */
+static bool copy_layer(lv_draw_ctx_t *draw_ctx, layer_t &layer, const lv_area_t &clip)
+{
+    const auto &scr = layer.screen->coords;
+    lv_area_t area;
+    if (!_lv_area_intersect(&area, &clip, &scr)) {
+        return false;
+    }
+    const auto &buf_area = *draw_ctx->buf_area;
+    const lv_coord_t buf_w = lv_area_get_width(&buf_area);
+    const size_t row_bytes = lv_area_get_width(&area) * sizeof(lv_color_t);
+    auto dst = static_cast<lv_color_t*>(draw_ctx->buf) + (area.y1 - buf_area.y1) * buf_w + (area.x1 - buf_area.x1);
+    auto src = layer.pixels + (area.y1 - scr.y1) * g_width + (area.x1 - scr.x1);
+    const int64_t start = esp_timer_get_time();
+    for (lv_coord_t y=area.y1; y<=area.y2; y++) {
+        memcpy(dst, src, row_bytes);
+        dst += buf_w;
+        src += g_width;
+    }
+    layer.copy_us += esp_timer_get_time() - start;
+    layer.copied_px += lv_area_get_size(&area);
+    // Judged from the timer, styles can't change during a refresh
+    if (!layer.judged && layer.copied_px>=COMPOSITOR_JUDGE_SCREENS*g_width*g_height) {
+        schedule_render();
+    }
+    return true;
+}
+
+
+/** Display background, called by LVGL when no object covers the redrawn area */
+static void draw_bg(lv_draw_ctx_t *draw_ctx, const lv_draw_rect_dsc_t *dsc, const lv_area_t *coords)
+{
+    lv_area_t clip;
+    if (!_lv_area_intersect(&clip, draw_ctx->clip_area, draw_ctx->buf_area)) {
+        return;
+    }
+
+    // The previous screen is below the active one during transitions
+    auto disp = _lv_refr_get_disp_refreshing();
+    layer_t *layers[2] = { find_layer(disp->prev_scr), find_layer(disp->act_scr) };
+    bool covered = false;
+    for (auto layer : layers) {
+        if (layer && layer->valid && _lv_area_is_in(&clip, &layer->screen->coords, 0)) {
+            covered = true;
+        }
+    }
+    if (!covered) {
+        if (g_default_draw_bg) {
+            g_default_draw_bg(draw_ctx, dsc, coords);
+        }
+        else {
+            lv_draw_rect(draw_ctx, dsc, coords);
+        }
+    }
+    for (auto layer : layers) {
+        if (layer && layer->valid) {
+            copy_layer(draw_ctx, *layer, clip);
+        }
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public
+ */
+
+void compositor_init()
+{
+    display_acquire();
+    auto disp = display_get();
+    g_width = lv_disp_get_hor_res(disp);
+    g_height = lv_disp_get_ver_res(disp);
+
+    lv_style_init(&g_transparent_style);
+    lv_style_set_bg_opa(&g_transparent_style, LV_OPA_TRANSP);
+    lv_style_set_bg_img_opa(&g_transparent_style, LV_OPA_TRANSP);
+    lv_style_set_border_opa(&g_transparent_style, LV_OPA_TRANSP);
+    lv_style_set_outline_opa(&g_transparent_style, LV_OPA_TRANSP);
+    lv_style_set_shadow_opa(&g_transparent_style, LV_OPA_TRANSP);
+
+    lv_style_init(&g_hidden_style);
+    lv_style_set_bg_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_bg_img_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_border_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_outline_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_shadow_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_text_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_line_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_arc_opa(&g_hidden_style, LV_OPA_TRANSP);
+    lv_style_set_img_opa(&g_hidden_style, LV_OPA_TRANSP);
+
+    auto draw_ctx = disp->driver->draw_ctx;
+    g_default_draw_bg = draw_ctx->draw_bg;
+    draw_ctx->draw_bg = draw_bg;
+    display_release();
+
+    arena_subscribe(ARENA_UI, on_ui_relocate, nullptr);
+}
+
+
+bool compositor_add_screen(lv_obj_t *screen, const char *name, lv_obj_t *const *static_children, uint count)
+{
+    if (count>COMPOSITOR_MAX_STATIC) {
+        return false;
+    }
+    // Event callbacks point at their layer, so removed slots are reused instead of moved
+    layer_t *slot = nullptr;
+    for (uint i=0; i<g_layer_count && !slot; i++) {
+        if (!g_layers[i].screen) {
+            slot = &g_layers[i];
+        }
+    }
+    if (!slot && g_layer_count<COMPOSITOR_MAX_SCREENS) {
+        slot = &g_layers[g_layer_count++];
+    }
+    if (!slot) {
+        return false;
+    }
+    auto pixels = static_cast<lv_color_t*>(arena_alloc(ARENA_UI, g_width * g_height * sizeof(lv_color_t)));
+    if (!pixels) {
+        ESP_LOGW(TAG, "No memory for %s layer", name);
+        return false;
+    }
+
+    display_acquire();
+    auto &layer = *slot;
+    layer = {
+        .screen = screen,
+        .name = name,
+        .statics = {},
+        .static_count = count,
+        .pixels = pixels,
+        .valid = false,
+        .kept = true,
+        .judged = false,
+        .renders = 0,
+        .render_us = 0,
+        .copied_px = 0,
+        .copy_us = 0,
+    };
+    std::copy(static_children, static_children+count, layer.statics);
+
+    lv_obj_add_style(screen, &g_transparent_style, LV_PART_MAIN | COMPOSITOR_STATE);
+    lv_obj_add_event_cb(screen, on_static_changed, LV_EVENT_STYLE_CHANGED, &layer);
+    lv_obj_add_event_cb(screen, on_static_changed, LV_EVENT_SIZE_CHANGED, &layer);
+    for (uint i=0; i<count; i++) {
+        for_tree(layer.statics[i], [](lv_obj_t *obj) {
+            for (auto part : HIDDEN_PARTS) {
+                lv_obj_add_style(obj, &g_hidden_style, part | COMPOSITOR_STATE);
+            }
+        });
+        lv_obj_add_event_cb(layer.statics[i], on_static_changed, LV_EVENT_STYLE_CHANGED, &layer);
+        lv_obj_add_event_cb(layer.statics[i], on_static_changed, LV_EVENT_SIZE_CHANGED, &layer);
+    }
+
+    // Render ahead, before the screen is shown
+    schedule_render();
+    display_release();
+    return true;
+}
+
+
+void compositor_remove_screen(lv_obj_t *screen)
+{
+    display_acquire();
+    auto layer = find_layer(screen);
+    if (layer) {
+        set_transparent(*layer, false);
+        lv_obj_remove_style(screen, &g_transparent_style, LV_PART_MAIN | COMPOSITOR_STATE);
+        lv_obj_remove_event_cb_with_user_data(screen, on_static_changed, layer);
+        for (uint i=0; i<layer->static_count; i++) {
+            for_tree(layer->statics[i], [](lv_obj_t *obj) {
+                for (auto part : HIDDEN_PARTS) {
+                    lv_obj_remove_style(obj, &g_hidden_style, part | COMPOSITOR_STATE);
+                }
+            });
+            lv_obj_remove_event_cb_with_user_data(layer->statics[i], on_static_changed, layer);
+        }
+        arena_free(ARENA_UI, layer->pixels);
+        *layer = {};
+    }
+    display_release();
+}
+
+
+void compositor_invalidate(lv_obj_t *screen)
+{
+    display_acquire();
+    auto layer = find_layer(screen);
+    if (layer) {
+        invalidate_layer(*layer);
+    }
+    display_release();
+}
+
+
+void compositor_set_enabled(bool enable)
+{
+    display_acquire();
+    g_enabled = enable;
+    for (uint i=0; i<g_layer_count; i++) {
+        auto &layer = g_layers[i];
+        if (!layer.screen) {
+            continue;
+        }
+        // Layers are rendered again with everything drawn normally, and judged again
+        set_transparent(layer, false);
+        layer.valid = false;
+        layer.kept = true;
+        layer.judged = false;
+        layer.copied_px = 0;
+        layer.copy_us = 0;
+    }
+    if (enable) {
+        schedule_render();
+    }
+    display_release();
+}
+
+
+void compositor_print_stats()
+{
+    display_acquire();
+    printf("Compositor %s\n", g_enabled ? "enabled" : "disabled");
+    printf("Screen      Valid  Kept  Renders  Render ms  Copied kpx  Copy ns/px  Draw ns/px\n");
+    for (uint i=0; i<g_layer_count; i++) {
+        const auto &layer = g_layers[i];
+        if (!layer.screen) {
+            continue;
+        }
+        printf("%-10s  %5s  %4s  %7lu  %9.1f  %10llu  %10.1f  %10.1f\n",
+            layer.name,
+            layer.valid ? "yes" : "no",
+            !layer.judged ? "-" : layer.kept ? "yes" : "no",
+            layer.renders,
+            layer.renders ? layer.render_us / 1000.0f / layer.renders : 0.0f,
+            layer.copied_px / 1000,
+            layer.copied_px ? layer.copy_us * 1000.0f / layer.copied_px : 0.0f,
+            layer.renders ? layer.render_us * 1000.0f / layer.renders / (g_width * g_height) : 0.0f
+            );
+    }
+    display_release();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <lvgl.h>
+
+/**
+ * Cached background layers
+ *
+ * A registered screen's background and its static children, such as the
+ * corner touch panels, are rendered once with lv_snapshot into an RGB565
+ * layer in PSRAM. While the layer is valid the screen and its static children,
+ * including everything inside them, are drawn transparent, and the display
+ * background hook copies the layer row by row into the draw buffer under
+ * every redrawn area, so only the dynamic widgets are rendered. This holds during screen transitions too,
+ * where the layer is copied at the screen's animated position.
+ *
+ * A style or size change of the screen or a static child drops the layer,
+ * the screen is drawn normally until the layer has been rendered again from
+ * an LVGL timer.
+ *
+ * Copying from PSRAM is not always faster than drawing. After a layer has
+ * been copied over a few screens its copy and render time is compared with
+ * what drawing the same pixels would have cost, estimated from the
+ * snapshot, and a layer that loses is dropped until the compositor is
+ * switched off and on again.
+ */
+static constexpr uint COMPOSITOR_MAX_SCREENS { 4 };
+
+void compositor_init();
+
+/** Cache the background of screen, the listed children are part of it */
+bool compositor_add_screen(lv_obj_t *screen, const char *name, lv_obj_t *const *static_children, uint count);
+
+/** Stop caching screen, call before deleting it */
+void compositor_remove_screen(lv_obj_t *screen);
+
+/** Render the layer of screen again, for changes that send no style event */
+void compositor_invalidate(lv_obj_t *screen);
+
+/** Switch the cached layers off and on, for comparing with bench */
+void compositor_set_enabled(bool enable);
+
+void compositor_print_stats();
@@ -15,7 +15,25 @@
 #include <argtable3/argtable3.h>
 
 #include "app_base.h"
+#include "boot.h"
+#include "profiler.h"
+#include "heap_prof.h"
+#include "app_events.h"
+#include "storage.h"
+#include "settings.h"
 #include "wifi.h"
+#include "wifi_power.h"
+#include "timekeeper.h"
+#include "ota.h"
+#include "mirror.h"
+#include "scene.h"
+#include "bench.h"
+#include "compositor.h"
+#include "face.h"
+#include "refresh.h"
+#include "raster.h"
+#include "arena.h"
+#include "display.h"
 
 
 #define PROMPT_STR CONFIG_IDF_TARGET
@@ -183,6 +201,424 @@ static int cmd_tasks(int argc, char **argv)
 }
 
 
+static constexpr uint TOP_DEFAULT_WINDOW_S { 5 };
+static constexpr uint TOP_DEFAULT_ITERATIONS { 10 };
+static constexpr uint TOP_REFRESH_MS { 1000 };
+
+static struct {
+    struct arg_int *window;
+    struct arg_int *iterations;
+    struct arg_end *end;
+} top_args;
+
+static int cmd_top(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &top_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, top_args.end, argv[0]);
+        return 1;
+    }
+    uint window_s = top_args.window->count ? top_args.window->ival[0] : TOP_DEFAULT_WINDOW_S;
+    uint iterations = top_args.iterations->count ? top_args.iterations->ival[0] : TOP_DEFAULT_ITERATIONS;
+
+    for (uint i=0; i<iterations; i++) {
+        if (i>0) {
+            vTaskDelay(pdMS_TO_TICKS(TOP_REFRESH_MS));
+        }
+        // Cursor home and clear screen, so the table refreshes in place
+        printf("\033[H\033[J");
+        if (!profiler_print_top(window_s*1000)) {
+            printf("Not enough samples yet\n");
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
+
+
+static struct {
+    struct arg_str *action;
+    struct arg_int *records;
+    struct arg_int *interval;
+    struct arg_str *path;
+    struct arg_end *end;
+} heapprof_args;
+
+static int cmd_heapprof(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &heapprof_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, heapprof_args.end, argv[0]);
+        return 1;
+    }
+    const char *action = heapprof_args.action->sval[0];
+    esp_err_t res = ESP_OK;
+
+    if (strcmp(action, "start")==0) {
+        uint records = heapprof_args.records->count ? heapprof_args.records->ival[0] : HEAP_PROF_DEFAULT_RECORDS;
+        uint32_t interval = heapprof_args.interval->count ? heapprof_args.interval->ival[0] : HEAP_PROF_DEFAULT_INTERVAL_S;
+        // Negative values wrap around and are caught by the upper bounds
+        if (records<1 || records>HEAP_PROF_MAX_RECORDS) {
+            printf("Records must be 1 to %u\n", HEAP_PROF_MAX_RECORDS);
+            return 1;
+        }
+        if (interval<HEAP_PROF_MIN_INTERVAL_S || interval>HEAP_PROF_MAX_INTERVAL_S) {
+            printf("Interval must be %lu to %lu s\n", HEAP_PROF_MIN_INTERVAL_S, HEAP_PROF_MAX_INTERVAL_S);
+            return 1;
+        }
+        res = heap_prof_start(records, interval);
+    }
+    else if (strcmp(action, "stop")==0) {
+        res = heap_prof_stop();
+    }
+    else if (strcmp(action, "report")==0) {
+        heap_prof_report();
+    }
+    else if (strcmp(action, "dump")==0) {
+        res = heap_prof_dump(heapprof_args.path->count ? heapprof_args.path->sval[0] : HEAP_PROF_DUMP_PATH);
+    }
+    else {
+        printf("Unknown action '%s'\n", action);
+        return 1;
+    }
+
+    if (res!=ESP_OK) {
+        printf("heapprof %s failed: %s\n", action, esp_err_to_name(res));
+        return 1;
+    }
+    return 0;
+}
+
+
+static int cmd_boot(int argc, char **argv)
+{
+    boot_print_timeline();
+    return 0;
+}
+
+
+static int cmd_events(int argc, char **argv)
+{
+    app_events_print_stats();
+    return 0;
+}
+
+
+static int cmd_mirror(int argc, char **argv)
+{
+    mirror_print_stats();
+    return 0;
+}
+
+
+static int cmd_scene(int argc, char **argv)
+{
+    scene_print_stats();
+    return 0;
+}
+
+
+static struct {
+    struct arg_str *scene;
+    struct arg_int *time;
+    struct arg_end *end;
+} bench_args;
+
+static int cmd_bench(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &bench_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, bench_args.end, argv[0]);
+        return 1;
+    }
+    const char *filter = bench_args.scene->count ? bench_args.scene->sval[0] : nullptr;
+    uint32_t scene_ms = bench_args.time->count ? bench_args.time->ival[0] : BENCH_DEFAULT_SCENE_MS;
+    return bench_run(filter, scene_ms) ? 0 : 1;
+}
+
+
+static struct {
+    struct arg_str *state;
+    struct arg_end *end;
+} compositor_args;
+
+static int cmd_compositor(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &compositor_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, compositor_args.end, argv[0]);
+        return 1;
+    }
+    if (compositor_args.state->count) {
+        const char *state = compositor_args.state->sval[0];
+        if (strcmp(state, "on")==0) {
+            compositor_set_enabled(true);
+        }
+        else if (strcmp(state, "off")==0) {
+            compositor_set_enabled(false);
+        }
+        else {
+            printf("Unknown state '%s'\n", state);
+            return 1;
+        }
+    }
+    compositor_print_stats();
+    return 0;
+}
+
+
+
+static struct {
+    struct arg_str *state;
+    struct arg_end *end;
+} refresh_args;
+
+static int cmd_refresh(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &refresh_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, refresh_args.end, argv[0]);
+        return 1;
+    }
+    if (refresh_args.state->count) {
+        const char *state = refresh_args.state->sval[0];
+        if (strcmp(state, "on")==0) {
+            refresh_set_enabled(true);
+        }
+        else if (strcmp(state, "off")==0) {
+            refresh_set_enabled(false);
+        }
+        else {
+            printf("Unknown state '%s'\n", state);
+            return 1;
+        }
+    }
+    refresh_print_stats();
+    return 0;
+}
+
+
+
+static struct {
+    struct arg_str *state;
+    struct arg_int *min_px;
+    struct arg_lit *verify;
+    struct arg_end *end;
+} raster_args;
+
+static int cmd_raster(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &raster_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, raster_args.end, argv[0]);
+        return 1;
+    }
+    if (raster_args.state->count) {
+        const char *state = raster_args.state->sval[0];
+        if (strcmp(state, "on")==0) {
+            raster_set_enabled(true);
+        }
+        else if (strcmp(state, "off")==0) {
+            raster_set_enabled(false);
+        }
+        else {
+            printf("Unknown state '%s'\n", state);
+            return 1;
+        }
+    }
+    if (raster_args.min_px->count) {
+        if (raster_args.min_px->ival[0]<0) {
+            printf("Invalid pixel count\n");
+            return 1;
+        }
+        raster_set_min_px(raster_args.min_px->ival[0]);
+    }
+    if (raster_args.verify->count) {
+        return raster_verify() ? 0 : 1;
+    }
+    raster_print_stats();
+    return 0;
+}
+
+
+
+static struct {
+    struct arg_str *name;
+    struct arg_str *place;
+    struct arg_lit *bench;
+    struct arg_str *scene;
+    struct arg_int *time;
+    struct arg_end *end;
+} arena_args;
+
+static int cmd_arena(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &arena_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, arena_args.end, argv[0]);
+        return 1;
+    }
+    if (arena_args.name->count) {
+        arena_t arena;
+        arena_place_t place;
+        if (!arena_find(arena_args.name->sval[0], &arena)) {
+            printf("Unknown arena '%s'\n", arena_args.name->sval[0]);
+            return 1;
+        }
+        if (!arena_args.place->count || !arena_find_place(arena_args.place->sval[0], &place)) {
+            printf("Place the arena in internal or psram\n");
+            return 1;
+        }
+        if (!arena_set_place(arena, place)) {
+            return 1;
+        }
+    }
+    if (arena_args.bench->count) {
+        const char *filter = arena_args.scene->count ? arena_args.scene->sval[0] : nullptr;
+        uint32_t scene_ms = arena_args.time->count ? arena_args.time->ival[0] : BENCH_DEFAULT_SCENE_MS;
+        return arena_bench(filter, scene_ms) ? 0 : 1;
+    }
+    arena_print_report();
+    return 0;
+}
+
+
+static struct {
+    struct arg_str *name;
+    struct arg_lit *close;
+    struct arg_end *end;
+} face_args;
+
+static int cmd_face(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &face_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, face_args.end, argv[0]);
+        return 1;
+    }
+    if (face_args.close->count) {
+        face_unload();
+        return 0;
+    }
+    if (face_args.name->count && !face_load(face_args.name->sval[0])) {
+        printf("Error loading face '%s'\n", face_args.name->sval[0]);
+        return 1;
+    }
+    face_print_stats();
+    return 0;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Storage commands
+ */
+
+static constexpr uint STORAGE_BENCH_DEFAULT_KB { 256 };
+
+
+static struct {
+    struct arg_str *fs;
+    struct arg_lit *erase;
+    struct arg_end *end;
+} storage_args;
+
+static int cmd_storage(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &storage_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, storage_args.end, argv[0]);
+        return 1;
+    }
+
+    if (storage_args.fs->count) {
+        storage_fs_t fs;
+        if (!storage_fs_from_name(storage_args.fs->sval[0], &fs)) {
+            printf("Unknown filesystem '%s'\n", storage_args.fs->sval[0]);
+            return 1;
+        }
+        if (fs!=app_storage_fs() && storage_args.erase->count == 0) {
+            printf("Switching filesystem formats the storage partition on the next boot, confirm with --erase\n");
+            return 1;
+        }
+        if (!app_set_storage_fs(fs)) {
+            printf("Error storing filesystem setting\n");
+            return 1;
+        }
+    }
+
+    size_t total = 0, used = 0;
+    if (storage_info(&total, &used)!=ESP_OK) {
+        printf("Storage not mounted\n");
+        return 1;
+    }
+    printf("Storage info:\n");
+    printf(" Filesystem: %s\n", storage_fs_name(storage_type()));
+    printf("  Next boot: %s\n", storage_fs_name(app_storage_fs()));
+    printf("      Total: %u (%u KB)\n", total, total/1024);
+    printf("       Used: %u (%u KB)\n", used, used/1024);
+    return 0;
+}
+
+
+static struct {
+    struct arg_str *fs;
+    struct arg_int *size;
+    struct arg_lit *erase;
+    struct arg_end *end;
+} storage_bench_args;
+
+static int cmd_storage_bench(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &storage_bench_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, storage_bench_args.end, argv[0]);
+        return 1;
+    }
+    if (storage_bench_args.erase->count == 0) {
+        printf("The benchmark formats the storage partition, confirm with --erase\n");
+        return 1;
+    }
+
+    int size_kb = storage_bench_args.size->count ? storage_bench_args.size->ival[0] : STORAGE_BENCH_DEFAULT_KB;
+    // Sequential passes move whole blocks, random ones need at least one block
+    if (size_kb<=0 || size_kb % STORAGE_BENCH_BLOCK_KB) {
+        printf("Size must be a positive multiple of %u KB\n", STORAGE_BENCH_BLOCK_KB);
+        return 1;
+    }
+
+    printf("fs        format_ms mount_empty_ms mount_used_ms seq_wr_kbps seq_rd_kbps rnd_wr_iops rnd_rd_iops append_us rewrite_us used_bytes\n");
+    for (int i=0; i<storage_bench_args.fs->count; i++) {
+        storage_fs_t fs;
+        if (!storage_fs_from_name(storage_bench_args.fs->sval[i], &fs)) {
+            printf("Unknown filesystem '%s'\n", storage_bench_args.fs->sval[i]);
+            return 1;
+        }
+
+        storage_bench_result_t res;
+        if (!storage_bench(fs, size_kb, &res)) {
+            printf("%-9s failed\n", storage_fs_name(fs));
+            return 1;
+        }
+        printf("%-9s %9lld %14lld %13lld %11lu %11lu %11lu %11lu %9lu %10lu %10u\n",
+            storage_fs_name(fs),
+            res.format_us/1000,
+            res.mount_empty_us/1000,
+            res.mount_used_us/1000,
+            res.seq_write_kbps,
+            res.seq_read_kbps,
+            res.rand_write_iops,
+            res.rand_read_iops,
+            res.append_us,
+            res.rewrite_us,
+            res.used_after_wear
+            );
+    }
+
+    return 0;
+}
+
+
 
 /** -------------------------------------------------------------------------------
  * Time date commands
@@ -208,6 +644,29 @@ static int cmd_date(int argc, char **argv)
 
 
 
+static struct {
+    struct arg_lit *sync;
+    struct arg_end *end;
+} time_sync_args;
+
+static int cmd_time_sync(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &time_sync_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, time_sync_args.end, argv[0]);
+        return 1;
+    }
+    if (time_sync_args.sync->count) {
+        wifi_power_demand(WIFI_DEMAND_CONSOLE);
+        timekeeper_sync();
+        return 0;
+    }
+    timekeeper_print_stats();
+    return 0;
+}
+
+
+
 static struct {
     struct arg_str *tz;
     struct arg_end *end;
@@ -233,6 +692,13 @@ static int cmd_set_timezone(int argc, char **argv)
 }
 
 
+static int cmd_settings(int argc, char **argv)
+{
+    settings_print();
+    return 0;
+}
+
+
 static struct {
     struct arg_str *server;
     struct arg_end *end;
@@ -279,6 +745,7 @@ static int cmd_wifi_join(int argc, char **argv) {
         arg_print_errors(stderr, join_args.end, argv[0]);
         return 1;
     }
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
     ESP_LOGI(TAG, "Connecting to '%s'", join_args.ssid->sval[0]);
 
     /* set default value*/
@@ -324,6 +791,45 @@ static int cmd_wifi_set_country(int argc, char **argv) {
 }
 
 
+static int cmd_wifi_stats(int argc, char **argv) {
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    wifi_print_stats();
+    return 0;
+}
+
+
+static struct {
+    struct arg_str *policy;
+    struct arg_end *end;
+} power_args;
+
+static int cmd_wifi_power(int argc, char **argv) {
+    int nerrors = arg_parse(argc, argv, (void **) &power_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, power_args.end, argv[0]);
+        return 1;
+    }
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+
+    if (power_args.policy->count) {
+        wifi_power_policy_t policy;
+        if (!wifi_power_policy_from_name(power_args.policy->sval[0], &policy)) {
+            ESP_LOGW(TAG, "Unknown power policy '%s'", power_args.policy->sval[0]);
+            return 1;
+        }
+        if (!wifi_power_set_policy(policy)) {
+            ESP_LOGW(TAG, "Error storing power policy");
+            return 1;
+        }
+        ESP_LOGI(TAG, "Power policy set to %s", wifi_power_policy_name(policy));
+        return 0;
+    }
+
+    wifi_power_print_stats();
+    return 0;
+}
+
+
 static int cmd_wifi_restore(int argc, char **argv) {
     if (!wifi_restore()) {
         ESP_LOGW(TAG, "WiFi restore command failed");
@@ -336,6 +842,171 @@ static int cmd_wifi_restore(int argc, char **argv) {
 
 
 
+/** -------------------------------------------------------------------------------
+ * OTA commands
+ */
+
+static struct {
+    struct arg_str *url;
+    struct arg_lit *rollback;
+    struct arg_lit *no_restart;
+    struct arg_end *end;
+} ota_args;
+
+static int cmd_ota(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &ota_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, ota_args.end, argv[0]);
+        return 1;
+    }
+
+    if (ota_args.rollback->count) {
+        if (!ota_rollback()) {
+            return 1;
+        }
+    }
+    else if (ota_args.url->count) {
+        ota_report_t report;
+        auto res = ota_update(ota_args.url->sval[0], &report);
+        ota_print_report(report);
+        if (res!=ESP_OK) {
+            return 1;
+        }
+    }
+    else {
+        ota_print_status();
+        return 0;
+    }
+
+    if (ota_args.no_restart->count==0) {
+        ESP_LOGI(TAG, "Restarting");
+        vTaskDelay(pdMS_TO_TICKS(100));
+        esp_restart();
+    }
+    return 0;
+}
+
+
+
+
+/** -------------------------------------------------------------------------------
+ * Display commands
+ */
+
+static void print_display_config(const display_config_t &config)
+{
+    printf("Display config:\n");
+    printf("      Draw rows: %u (2x %u bytes)\n", config.draw_rows, config.draw_rows * lv_disp_get_hor_res(nullptr) * sizeof(lv_color_t));
+    printf("  Transfer rows: %u\n", config.transfer_rows);
+    printf("    Queue depth: %u\n", config.queue_depth);
+    printf("      SPI clock: %lu Hz\n", config.pclk_hz);
+}
+
+
+static struct {
+    struct arg_int *draw_rows;
+    struct arg_int *transfer_rows;
+    struct arg_int *queue_depth;
+    struct arg_int *clock;
+    struct arg_lit *save;
+    struct arg_lit *reset;
+    struct arg_end *end;
+} display_config_args;
+
+static int cmd_display_config(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &display_config_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, display_config_args.end, argv[0]);
+        return 1;
+    }
+
+    if (display_config_args.reset->count) {
+        if (!display_reset_config()) {
+            return 1;
+        }
+    }
+    else {
+        display_config_t config;
+        display_get_config(&config);
+        if (display_config_args.draw_rows->count) config.draw_rows = display_config_args.draw_rows->ival[0];
+        if (display_config_args.transfer_rows->count) config.transfer_rows = display_config_args.transfer_rows->ival[0];
+        if (display_config_args.queue_depth->count) config.queue_depth = display_config_args.queue_depth->ival[0];
+        if (display_config_args.clock->count) config.pclk_hz = display_config_args.clock->ival[0];
+        if (!display_set_config(config)) {
+            printf("Invalid or failed configuration\n");
+            return 1;
+        }
+        if (display_config_args.save->count && !display_save_config()) {
+            printf("Error saving configuration\n");
+            return 1;
+        }
+    }
+
+    display_config_t config;
+    display_get_config(&config);
+    print_display_config(config);
+    return 0;
+}
+
+
+static struct {
+    struct arg_lit *no_save;
+    struct arg_end *end;
+} display_tune_args;
+
+static int cmd_display_tune(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &display_tune_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, display_tune_args.end, argv[0]);
+        return 1;
+    }
+
+    display_config_t config;
+    if (!display_tune(&config)) {
+        printf("Tuning failed\n");
+        return 1;
+    }
+    print_display_config(config);
+    if (display_tune_args.no_save->count==0 && !display_save_config()) {
+        printf("Error saving configuration\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static struct {
+    struct arg_lit *no_save;
+    struct arg_end *end;
+} display_link_args;
+
+static int cmd_display_link(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &display_link_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, display_link_args.end, argv[0]);
+        return 1;
+    }
+
+    display_link_result_t result;
+    if (!display_link_test(&result)) {
+        printf(result.readback ? "No clock passed\n" : "No readback from the panel\n");
+        return 1;
+    }
+    printf("Using %lu Hz\n", result.pclk_hz);
+    if (display_link_args.no_save->count==0 && !display_save_config()) {
+        printf("Error saving configuration\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+
+
 /** -------------------------------------------------------------------------------
  * Global
  */
@@ -387,6 +1058,23 @@ static void register_commands()
         ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
     }
 
+    {
+        heapprof_args.action = arg_str1(nullptr, nullptr, "<start|stop|report|dump>", "Action");
+        heapprof_args.records = arg_int0("n", "records", "<n>", "Number of live allocations to track, at most 2048");
+        heapprof_args.interval = arg_int0("i", "interval", "<s>", "Seconds between periodic reports");
+        heapprof_args.path = arg_str0("f", "file", "<path>", "Dump file");
+        heapprof_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "heapprof",
+            .help = "Track live heap allocations per region and call site",
+            .hint = NULL,
+            .func = &cmd_heapprof,
+            .argtable = &heapprof_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
     {
         const esp_console_cmd_t cmd = {
             .command = "tasks",
@@ -398,6 +1086,204 @@ static void register_commands()
         ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
     }
 
+    {
+        top_args.window = arg_int0("w", "window", "<s>", "CPU usage window in seconds");
+        top_args.iterations = arg_int0("n", "iterations", "<n>", "Number of refreshes");
+        top_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "top",
+            .help = "Continuously show CPU usage and stack trends per task",
+            .hint = NULL,
+            .func = &cmd_top,
+            .argtable = &top_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "boot",
+            .help = "Print boot phase timeline",
+            .hint = NULL,
+            .func = &cmd_boot,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "events",
+            .help = "Print application event queue statistics",
+            .hint = NULL,
+            .func = &cmd_events,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "mirror",
+            .help = "Print framebuffer mirror bandwidth per screen",
+            .hint = NULL,
+            .func = &cmd_mirror,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "scene",
+            .help = "Print scene update statistics and widget ids",
+            .hint = NULL,
+            .func = &cmd_scene,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        bench_args.scene = arg_str0(nullptr, nullptr, "<scene>", "Run the scenes starting with this name");
+        bench_args.time = arg_int0("t", "time", "<ms>", "Time per scene");
+        bench_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "bench",
+            .help = "Benchmark rendering and flushing of a fixed scene suite",
+            .hint = NULL,
+            .func = &cmd_bench,
+            .argtable = &bench_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        compositor_args.state = arg_str0(nullptr, nullptr, "<on|off>", "Use the cached background layers");
+        compositor_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "compositor",
+            .help = "Switch the cached background layers, and print layer statistics",
+            .hint = NULL,
+            .func = &cmd_compositor,
+            .argtable = &compositor_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        refresh_args.state = arg_str0(nullptr, nullptr, "<on|off>", "Adapt the refresh rate, or keep the normal rate");
+        refresh_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "refresh",
+            .help = "Switch the refresh rate governor, and print time spent in each rate tier",
+            .hint = NULL,
+            .func = &cmd_refresh,
+            .argtable = &refresh_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        raster_args.state = arg_str0(nullptr, nullptr, "<on|off>", "Share large blends with the other core");
+        raster_args.min_px = arg_int0("m", "min", "<px>", "Smallest blend to split");
+        raster_args.verify = arg_lit0("v", "verify", "Compare the active screen rendered on one and two cores");
+        raster_args.end = arg_end(4);
+
+        const esp_console_cmd_t cmd = {
+            .command = "raster",
+            .help = "Switch dual-core rasterization, and print how many blends were split",
+            .hint = NULL,
+            .func = &cmd_raster,
+            .argtable = &raster_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        arena_args.name = arg_str0(nullptr, nullptr, "<arena>", "Arena to move (render, dma, ui, net)");
+        arena_args.place = arg_str0(nullptr, nullptr, "<internal|psram>", "Where to place it, stored");
+        arena_args.bench = arg_lit0("b", "bench", "Run the display benchmark with each movable arena in each place");
+        arena_args.scene = arg_str0("s", "scene", "<scene>", "Benchmark the scenes starting with this name");
+        arena_args.time = arg_int0("t", "time", "<ms>", "Time per scene");
+        arena_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "arena",
+            .help = "Print memory arena usage, move an arena, or benchmark arena placements",
+            .hint = NULL,
+            .func = &cmd_arena,
+            .argtable = &arena_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        face_args.name = arg_str0(nullptr, nullptr, "<name>", "Face stored as <name>.face");
+        face_args.close = arg_lit0("c", "close", "Delete the face and return to the clock");
+        face_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "face",
+            .help = "Load a watch face from storage, or print draw list statistics",
+            .hint = NULL,
+            .func = &cmd_face,
+            .argtable = &face_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        display_config_args.draw_rows = arg_int0("d", "draw-rows", "<rows>", "Rows in each LVGL draw buffer");
+        display_config_args.transfer_rows = arg_int0("t", "transfer-rows", "<rows>", "Largest SPI transaction in rows");
+        display_config_args.queue_depth = arg_int0("q", "queue", "<n>", "SPI transaction queue depth");
+        display_config_args.clock = arg_int0("c", "clock", "<hz>", "SPI clock");
+        display_config_args.save = arg_lit0("s", "save", "Use the configuration on the following boots");
+        display_config_args.reset = arg_lit0(nullptr, "reset", "Forget the stored configuration and use the defaults");
+        display_config_args.end = arg_end(4);
+
+        const esp_console_cmd_t cmd = {
+            .command = "display_config",
+            .help = "Print or change the draw buffer and SPI configuration",
+            .hint = NULL,
+            .func = &cmd_display_config,
+            .argtable = &display_config_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        display_tune_args.no_save = arg_lit0("n", "no-save", "Only use the result until the next boot");
+        display_tune_args.end = arg_end(1);
+
+        const esp_console_cmd_t cmd = {
+            .command = "display_tune",
+            .help = "Measure SPI throughput of draw buffer, transfer and queue sizes, and use the fastest",
+            .hint = NULL,
+            .func = &cmd_display_tune,
+            .argtable = &display_tune_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        display_link_args.no_save = arg_lit0("n", "no-save", "Only use the result until the next boot");
+        display_link_args.end = arg_end(1);
+
+        const esp_console_cmd_t cmd = {
+            .command = "display_link",
+            .help = "Test the panel SPI link with readback and use the fastest clock that passes",
+            .hint = NULL,
+            .func = &cmd_display_link,
+            .argtable = &display_link_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
     {
         const esp_console_cmd_t cmd = {
             .command = "date",
@@ -409,6 +1295,31 @@ static void register_commands()
         ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
     }
 
+    {
+        time_sync_args.sync = arg_lit0("s", "sync", "Synchronize now");
+        time_sync_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "time_sync",
+            .help = "Print time synchronization state, offsets per server and learned drift",
+            .hint = nullptr,
+            .func = &cmd_time_sync,
+            .argtable = &time_sync_args
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "settings",
+            .help = "Print persistent settings",
+            .hint = NULL,
+            .func = &cmd_settings,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
     {
         set_timezone_args.tz = arg_str1(nullptr, nullptr, "<tz>", "Timezone");
         set_timezone_args.end = arg_end(2);
@@ -424,12 +1335,12 @@ static void register_commands()
     }
 
     {
-        set_ntp_server_args.server = arg_str1(nullptr, nullptr, "<server>", "NTP server");
+        set_ntp_server_args.server = arg_str1(nullptr, nullptr, "<servers>", "NTP servers, comma separated");
         set_ntp_server_args.end = arg_end(2);
 
         const esp_console_cmd_t cmd = {
             .command = "set_ntp_server",
-            .help = "Set NTP server",
+            .help = "Set NTP servers",
             .hint = nullptr,
             .func = &cmd_set_ntp_server,
             .argtable = &set_ntp_server_args
@@ -438,6 +1349,39 @@ static void register_commands()
     }
 
 
+    // Storage -------------------------------------------------
+    {
+        storage_args.fs = arg_str0("f", "fs", "<fs>", "Filesystem to mount from the next boot (spiffs, littlefs)");
+        storage_args.erase = arg_lit0(nullptr, "erase", "Confirm formatting the storage partition");
+        storage_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "storage",
+            .help = "Print storage filesystem info or select the filesystem",
+            .hint = nullptr,
+            .func = &cmd_storage,
+            .argtable = &storage_args,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        storage_bench_args.fs = arg_strn(nullptr, nullptr, "<fs>", 1, 2, "Filesystems to benchmark (spiffs, littlefs)");
+        storage_bench_args.size = arg_int0("s", "size", "<kb>", "Size of test file in KB");
+        storage_bench_args.erase = arg_lit0(nullptr, "erase", "Confirm formatting the storage partition");
+        storage_bench_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "storage_bench",
+            .help = "Benchmark storage filesystems (erases all files)",
+            .hint = nullptr,
+            .func = &cmd_storage_bench,
+            .argtable = &storage_bench_args
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+
     // Wifi ----------------------------------------------------
     {
         join_args.timeout = arg_int0(nullptr, "timeout", "<t>", "Connection timeout, ms");
@@ -469,6 +1413,31 @@ static void register_commands()
         ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
     }
 
+    {
+        const esp_console_cmd_t cmd = {
+            .command = "wifi_stats",
+            .help = "Print wifi connect time and retry statistics",
+            .hint = nullptr,
+            .func = &cmd_wifi_stats,
+            .argtable = nullptr,
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
+    {
+        power_args.policy = arg_str0(nullptr, nullptr, "<policy>", "performance, balanced or clock");
+        power_args.end = arg_end(2);
+
+        const esp_console_cmd_t cmd = {
+            .command = "wifi_power",
+            .help = "Set the wifi power policy, or print radio-on time per power mode",
+            .hint = nullptr,
+            .func = &cmd_wifi_power,
+            .argtable = &power_args
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
     {
         const esp_console_cmd_t cmd = {
             .command = "wifi_restore",
@@ -480,6 +1449,24 @@ static void register_commands()
         ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
     }
 
+
+    // OTA -----------------------------------------------------
+    {
+        ota_args.url = arg_str0(nullptr, nullptr, "<url>", "Image to install, plain or compressed with tools/mkota.py");
+        ota_args.rollback = arg_lit0("r", "rollback", "Boot the previous image");
+        ota_args.no_restart = arg_lit0("n", "no-restart", "Do not restart after installing");
+        ota_args.end = arg_end(3);
+
+        const esp_console_cmd_t cmd = {
+            .command = "ota",
+            .help = "Install an image over HTTP, roll back, or print the app slots",
+            .hint = nullptr,
+            .func = &cmd_ota,
+            .argtable = &ota_args
+        };
+        ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    }
+
 }
 
 
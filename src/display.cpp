@@ -1,19 +1,28 @@
 #include "display.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
 #include <driver/gpio.h>
 #include <driver/spi_master.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
 #include <esp_err.h>
+#include <nvs.h>
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_vendor.h>
 #include <esp_lcd_panel_ops.h>
-#include <esp_lcd_gc9a01.h>
-
 #include "projectconfig.h"
+#include "display_driver.h"
+#include "arena.h"
 
 static constexpr char TAG[] = "display";
 
@@ -25,28 +34,111 @@ static constexpr gpio_num_t LCD_PIN_DIN { GPIO_NUM_9 };  // MOSI
 static constexpr gpio_num_t LCD_PIN_MISO { GPIO_NUM_8 };  // MISO
 static constexpr gpio_num_t LCD_PIN_CLK { GPIO_NUM_7 }; // SCK
 
-static constexpr uint LCD_H_RES { 240 };
-static constexpr uint LCD_V_RES { 240 };
-//static constexpr uint LCD_PIXEL_CLOCK_HZ { 20*1000*1000 };
-static constexpr uint LCD_PIXEL_CLOCK_HZ { 80*1000*1000 };
+using display_panel = display_driver<gc9a01_panel<240>, rgb565>;
+using pixel_t = display_panel::pixel_t;
+
+static constexpr uint LCD_H_RES { display_panel::WIDTH };
+static constexpr uint LCD_V_RES { display_panel::HEIGHT };
 static constexpr uint LCD_CMD_BITS { 8 };
 static constexpr uint LCD_PARAM_BITS { 8 };
 static constexpr uint32_t LCD_BK_LIGHT_ON_LEVEL { 1 };
 static constexpr uint32_t LCD_BK_LIGHT_OFF_LEVEL { !LCD_BK_LIGHT_ON_LEVEL };
 
-static constexpr uint LVGL_DRAW_BUFFER_ROWS { 80 };
-static constexpr uint LVGL_SPI_TRANSFER_ROWS { 96 };
+static constexpr display_config_t DISPLAY_DEFAULT_CONFIG {
+    .draw_rows = 80,
+    .transfer_rows = 96,
+    .queue_depth = 10,
+    .pclk_hz = 80*1000*1000,
+};
 static constexpr uint LVGL_TICK_PERIOD_MS { 2 };
+// Two buffers of half the screen are already more internal DMA RAM than the rest of the application uses
+static constexpr uint DISPLAY_MAX_DRAW_ROWS { LCD_V_RES/2 };
+
+static constexpr char DISPLAY_NVS_NAMESPACE[] { "display" };
+static constexpr char DISPLAY_NVS_KEY[] { "config" };
+
+// Tuning candidates, the draw buffers of the largest are allocated during the sweep
+static constexpr uint16_t TUNE_DRAW_ROWS[] { 20, 40, 60, 80, 96 };
+static constexpr uint16_t TUNE_TRANSFER_ROWS[] { 16, 32, 48, 64, 96, 120 };
+static constexpr uint8_t TUNE_QUEUE_DEPTHS[] { 2, 4, 10 };
+static constexpr uint TUNE_FRAMES { 4 };
+static constexpr uint TUNE_TOLERANCE_PCT { 3 };   // Slower configurations within this are preferred when they use less memory
+static_assert(*std::max_element(std::begin(TUNE_DRAW_ROWS), std::end(TUNE_DRAW_ROWS))<=DISPLAY_MAX_DRAW_ROWS);
+static_assert(DISPLAY_DEFAULT_CONFIG.draw_rows<=DISPLAY_MAX_DRAW_ROWS);
+
+// Link test, the SPI clock is derived from the 80 MHz APB clock by an integer divider
+static constexpr uint32_t LINK_CLOCKS_HZ[] { 80*1000*1000, 40*1000*1000, 80*1000*1000/3, 20*1000*1000, 16*1000*1000, 10*1000*1000 };
+static constexpr uint32_t LINK_READ_CLOCK_HZ { 5*1000*1000 };     // Panel register reads are specified well below the write clock
+static constexpr uint LINK_ROUNDS { 8 };
+static constexpr uint LINK_BAND_ROWS { 20 };
+// MADCTL values written and read back, bits 2-7 exist, BGR set like the driver does
+static constexpr uint8_t LINK_MADCTL_PATTERNS[] { 0x08, 0x48, 0x88, 0xc8, 0x28, 0xe8, 0x1c, 0xf4 };
+
+static constexpr uint32_t LCD_CONFIGURED_MAGIC { 0x9a01c0de };
+
+static constexpr char SPLASH_PARTITION_LABEL[] { "splash" };
+static constexpr uint32_t SPLASH_MAGIC { 0x31505053 }; // "SPP1"
+
+/**
+ * Splash partition layout, header followed by width*height RGB565 pixels in panel byte order.
+ * Generated with tools/mksplash.py
+ */
+struct splash_header_t {
+    uint32_t magic;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Survives software resets, tells if the panel registers are still configured
+RTC_NOINIT_ATTR static uint32_t g_panel_configured;
 
 
 static lv_disp_t *g_display = nullptr;
+static lv_disp_draw_buf_t g_disp_buf;   // contains internal graphic buffer(s) called draw buffer(s)
+static lv_disp_drv_t g_disp_drv;        // contains callback functions
+static esp_lcd_panel_io_handle_t g_io_handle = nullptr;
+static esp_lcd_panel_handle_t g_panel_handle = nullptr;
+static display_config_t g_config = DISPLAY_DEFAULT_CONFIG;
+static volatile bool g_tuning = false;
 static SemaphoreHandle_t g_display_sem = nullptr;
 static bool g_backlight = true;
+static volatile display_flush_tap_t g_flush_tap = nullptr;
+
+// Updated from LVGL callbacks, so protected by the display lock
+static struct {
+    uint32_t end_ms[DISPLAY_FRAME_SAMPLES];
+    uint16_t time_ms[DISPLAY_FRAME_SAMPLES];
+    uint32_t frames;
+    uint64_t time_sum_ms;
+    uint64_t flush_bytes;
+} g_frame_stats;
+
+// Bus timing, updated from the transfer done interrupt
+static portMUX_TYPE g_bus_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+    int64_t flush_start_us;
+    int64_t wait_start_us;          // Set while LVGL waits for a flush, 0 otherwise
+    uint64_t spi_busy_us;
+    uint64_t flush_wait_us;
+    uint32_t flushes;
+} g_bus_stats;
 
 static bool on_color_trans_done(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
 {
     lv_disp_drv_t *disp_driver = static_cast<lv_disp_drv_t*>(user_ctx);
-    lv_disp_flush_ready(disp_driver);
+    // Splash and tuning transfers are not LVGL flushes
+    if (disp_driver->draw_buf && !g_tuning) {
+        const int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL_ISR(&g_bus_lock);
+        g_bus_stats.spi_busy_us += now - g_bus_stats.flush_start_us;
+        g_bus_stats.flushes++;
+        if (g_bus_stats.wait_start_us) {
+            g_bus_stats.flush_wait_us += now - g_bus_stats.wait_start_us;
+            g_bus_stats.wait_start_us = 0;
+        }
+        portEXIT_CRITICAL_ISR(&g_bus_lock);
+        lv_disp_flush_ready(disp_driver);
+    }
     return false;
 }
 
@@ -58,37 +150,47 @@ static void on_lvgl_flush(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t
     int offsetx2 = area->x2;
     int offsety1 = area->y1;
     int offsety2 = area->y2;
+    portENTER_CRITICAL(&g_bus_lock);
+    g_bus_stats.flush_start_us = esp_timer_get_time();
+    // A wait that saw the transfer finish before it started is not counted
+    g_bus_stats.wait_start_us = 0;
+    portEXIT_CRITICAL(&g_bus_lock);
     // copy a buffer's content to a specific area of the display
     esp_lcd_panel_draw_bitmap(panel_handle, offsetx1, offsety1, offsetx2 + 1, offsety2 + 1, color_map);
+    g_frame_stats.flush_bytes += display_panel::area_bytes(area);
+
+    display_flush_tap_t tap = g_flush_tap;
+    if (tap) {
+        tap(area, color_map);
+    }
 }
 
 
-static void on_lvgl_drv_update(lv_disp_drv_t *drv)
+/** Called repeatedly while LVGL waits for the previous flush to finish */
+static void on_lvgl_wait(__unused lv_disp_drv_t *drv)
 {
-    esp_lcd_panel_handle_t panel_handle = static_cast<esp_lcd_panel_handle_t>(drv->user_data);
-
-    switch (drv->rotated) {
-    case LV_DISP_ROT_NONE:
-        // Rotate LCD display
-        esp_lcd_panel_swap_xy(panel_handle, false);
-        esp_lcd_panel_mirror(panel_handle, true, false);
-        break;
-    case LV_DISP_ROT_90:
-        // Rotate LCD display
-        esp_lcd_panel_swap_xy(panel_handle, true);
-        esp_lcd_panel_mirror(panel_handle, true, true);
-        break;
-    case LV_DISP_ROT_180:
-        // Rotate LCD display
-        esp_lcd_panel_swap_xy(panel_handle, false);
-        esp_lcd_panel_mirror(panel_handle, false, true);
-        break;
-    case LV_DISP_ROT_270:
-        // Rotate LCD display
-        esp_lcd_panel_swap_xy(panel_handle, true);
-        esp_lcd_panel_mirror(panel_handle, false, false);
-        break;
+    portENTER_CRITICAL(&g_bus_lock);
+    if (!g_bus_stats.wait_start_us) {
+        g_bus_stats.wait_start_us = esp_timer_get_time();
     }
+    portEXIT_CRITICAL(&g_bus_lock);
+}
+
+
+static void on_lvgl_monitor(__unused lv_disp_drv_t *drv, uint32_t time, __unused uint32_t px)
+{
+    auto &st = g_frame_stats;
+    uint slot = st.frames % DISPLAY_FRAME_SAMPLES;
+    st.end_ms[slot] = esp_timer_get_time() / 1000;
+    st.time_ms[slot] = std::min<uint32_t>(time, UINT16_MAX);
+    st.time_sum_ms += time;
+    st.frames++;
+}
+
+
+static void on_lvgl_drv_update(lv_disp_drv_t *drv)
+{
+    display_panel::set_orientation(static_cast<esp_lcd_panel_handle_t>(drv->user_data), static_cast<lv_disp_rot_t>(drv->rotated));
 }
 
 
@@ -98,25 +200,65 @@ static void on_lvgl_tick(__unused void *arg)
 }
 
 
+static bool panel_is_configured()
+{
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            // The panel is not reset together with the MCU
+            return g_panel_configured==LCD_CONFIGURED_MAGIC;
+        default:
+            return false;
+    }
+}
 
-lv_disp_t *display_init()
+
+static void draw_splash(esp_lcd_panel_handle_t panel_handle)
 {
-    static lv_disp_draw_buf_t disp_buf; // contains internal graphic buffer(s) called draw buffer(s)
-    static lv_disp_drv_t disp_drv;      // contains callback functions
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SPLASH_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGW(TAG, "No splash partition");
+        return;
+    }
 
-    ESP_LOGI(TAG, "Turn off LCD backlight");
-    static constexpr gpio_config_t bk_gpio_config = {
-        .pin_bit_mask = 1ULL << LCD_PIN_BK,
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    ESP_ERROR_CHECK(gpio_config(&bk_gpio_config));
-    gpio_set_level(LCD_PIN_BK, LCD_BK_LIGHT_OFF_LEVEL);
+    static constexpr size_t splash_size = sizeof(splash_header_t) + display_panel::FRAME_BYTES;
+    if (part->size<splash_size) {
+        ESP_LOGW(TAG, "Splash partition too small");
+        return;
+    }
+
+    const void *ptr = nullptr;
+    spi_flash_mmap_handle_t handle;
+    auto res = esp_partition_mmap(part, 0, splash_size, SPI_FLASH_MMAP_DATA, &ptr, &handle);
+    if (res!=ESP_OK) {
+        ESP_LOGW(TAG, "Error mapping splash partition: %s", esp_err_to_name(res));
+        return;
+    }
+
+    auto header = static_cast<const splash_header_t*>(ptr);
+    if (header->magic!=SPLASH_MAGIC || header->width!=LCD_H_RES || header->height!=LCD_V_RES) {
+        ESP_LOGW(TAG, "No valid splash image");
+    }
+    else {
+        ESP_ERROR_CHECK(display_panel::panel::draw_image(panel_handle, header+1));
+        ESP_LOGI(TAG, "Splash shown at %lld ms", esp_timer_get_time()/1000);
+    }
+
+    spi_flash_munmap(handle);
+}
 
-    ESP_LOGI(TAG, "Initialize SPI bus");
-    static spi_bus_config_t buscfg = {
+
+
+/** -------------------------------------------------------------------------------
+ * Bus and draw buffer configuration
+ */
+
+static esp_err_t create_io(const display_config_t &config)
+{
+    spi_bus_config_t buscfg = {
         .mosi_io_num = LCD_PIN_DIN,
         .miso_io_num = LCD_PIN_MISO,
         .sclk_io_num = LCD_PIN_CLK,
@@ -126,22 +268,23 @@ lv_disp_t *display_init()
         .data5_io_num = -1,     ///< GPIO pin for spi data5 signal in octal mode, or -1 if not used.
         .data6_io_num = -1,     ///< GPIO pin for spi data6 signal in octal mode, or -1 if not used.
         .data7_io_num = -1,     ///< GPIO pin for spi data7 signal in octal mode, or -1 if not used.
-        .max_transfer_sz = LCD_H_RES * LVGL_SPI_TRANSFER_ROWS * sizeof(uint16_t),  ///< Maximum transfer size, in bytes. Defaults to 4092 if 0 when DMA enabled, or to `SOC_SPI_MAXIMUM_BUFFER_SIZE` if DMA is disabled.
+        .max_transfer_sz = static_cast<int>(config.transfer_rows * display_panel::ROW_BYTES),  ///< Maximum transfer size, in bytes. Defaults to 4092 if 0 when DMA enabled, or to `SOC_SPI_MAXIMUM_BUFFER_SIZE` if DMA is disabled.
         .flags = 0,       ///< Abilities of bus to be checked by the driver. Or-ed value of ``SPICOMMON_BUSFLAG_*`` flags.
         .intr_flags = 0,       //< Interrupt flag for the bus to set the priority, and IRAM attribute, see
     };
-    ESP_ERROR_CHECK(spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO));
+    auto res = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
+    if (res!=ESP_OK) {
+        return res;
+    }
 
-    ESP_LOGI(TAG, "Install panel IO");
-    esp_lcd_panel_io_handle_t io_handle = nullptr;
-    static esp_lcd_panel_io_spi_config_t io_config = {
+    esp_lcd_panel_io_spi_config_t io_config = {
         .cs_gpio_num = LCD_PIN_CS,
         .dc_gpio_num = LCD_PIN_DC,
         .spi_mode = 0,
-        .pclk_hz = LCD_PIXEL_CLOCK_HZ,
-        .trans_queue_depth = 10,
+        .pclk_hz = config.pclk_hz,
+        .trans_queue_depth = config.queue_depth,
         .on_color_trans_done = on_color_trans_done,
-        .user_ctx = &disp_drv,
+        .user_ctx = &g_disp_drv,
         .lcd_cmd_bits = LCD_CMD_BITS,
         .lcd_param_bits = LCD_PARAM_BITS,
         .flags = {
@@ -154,28 +297,192 @@ lv_disp_t *display_init()
     };
 
     // Attach the LCD to the SPI bus
-    ESP_ERROR_CHECK(esp_lcd_new_panel_io_spi((esp_lcd_spi_bus_handle_t)SPI2_HOST, &io_config, &io_handle));
+    res = esp_lcd_new_panel_io_spi((esp_lcd_spi_bus_handle_t)SPI2_HOST, &io_config, &g_io_handle);
+    if (res!=ESP_OK) {
+        spi_bus_free(SPI2_HOST);
+    }
+    return res;
+}
 
-    esp_lcd_panel_handle_t panel_handle = nullptr;
-    static esp_lcd_panel_dev_config_t panel_config = {
-        .reset_gpio_num = LCD_PIN_RST,
-        .rgb_endian = LCD_RGB_ENDIAN_BGR,
-        .bits_per_pixel = 16,
-        .flags = {
-            .reset_active_high = 0
-        },
-        .vendor_config = nullptr,
+
+/** Recreate the bus and panel IO, no transfer may be in progress */
+static esp_err_t reconfigure_io(const display_config_t &config)
+{
+    esp_lcd_panel_io_del(g_io_handle);
+    g_io_handle = nullptr;
+    spi_bus_free(SPI2_HOST);
+
+    auto res = create_io(config);
+    if (res!=ESP_OK) {
+        ESP_LOGW(TAG, "Error configuring %u transfer rows, queue depth %u, %lu Hz: %s", config.transfer_rows, config.queue_depth, config.pclk_hz, esp_err_to_name(res));
+        // Fall back to the configuration that worked before
+        ESP_ERROR_CHECK(create_io(g_config));
+    }
+    ESP_ERROR_CHECK(display_panel::panel::set_io(g_panel_handle, g_io_handle));
+    return res;
+}
+
+
+static void free_draw_buffers()
+{
+    arena_free(ARENA_RENDER, g_disp_buf.buf1);
+    arena_free(ARENA_RENDER, g_disp_buf.buf2);
+    g_disp_buf.buf1 = g_disp_buf.buf2 = g_disp_buf.buf_act = nullptr;
+}
+
+/** Replace the draw buffers, the current ones are kept if the new ones can't be allocated */
+static esp_err_t alloc_draw_buffers(uint rows)
+{
+    const size_t size = rows * display_panel::ROW_BYTES;
+    auto buf1 = arena_alloc(ARENA_RENDER, size);
+    auto buf2 = arena_alloc(ARENA_RENDER, size);
+    if (!buf1 || !buf2) {
+        arena_free(ARENA_RENDER, buf1);
+        arena_free(ARENA_RENDER, buf2);
+        return ESP_ERR_NO_MEM;
+    }
+    free_draw_buffers();
+    lv_disp_draw_buf_init(&g_disp_buf, buf1, buf2, LCD_H_RES * rows);
+    return ESP_OK;
+}
+
+
+/** Wait for LVGL's last flush to complete, called with the display lock held */
+static void wait_flush_idle()
+{
+    while (g_disp_buf.flushing) {
+        vTaskDelay(1);
+    }
+}
+
+
+/**
+ * Draw rows are bounded, the draw buffers come from internal DMA RAM. Whether
+ * they fit right now is left to resize_draw_buffers().
+ */
+static bool config_valid(const display_config_t &config)
+{
+    return config.draw_rows>=1 && config.draw_rows<=DISPLAY_MAX_DRAW_ROWS
+        && config.transfer_rows>=1 && config.transfer_rows<=LCD_V_RES
+        && config.queue_depth>=1 && config.queue_depth<=32
+        && config.pclk_hz>=LINK_READ_CLOCK_HZ && config.pclk_hz<=LINK_CLOCKS_HZ[0];
+}
+
+
+static bool apply_io_config(const display_config_t &config)
+{
+    if (config.transfer_rows==g_config.transfer_rows && config.queue_depth==g_config.queue_depth && config.pclk_hz==g_config.pclk_hz) {
+        return true;
+    }
+    if (reconfigure_io(config)!=ESP_OK) {
+        return false;
+    }
+    g_config.transfer_rows = config.transfer_rows;
+    g_config.queue_depth = config.queue_depth;
+    g_config.pclk_hz = config.pclk_hz;
+    return true;
+}
+
+
+/**
+ * Change the draw buffer height, called with the display lock held and no
+ * flush in progress. The new buffers are allocated next to the current ones
+ * if the largest free blocks allow it. Otherwise only smaller buffers are
+ * allocated in place of the current ones, larger ones could leave the display
+ * without any.
+ */
+static bool resize_draw_buffers(uint rows)
+{
+    if (alloc_draw_buffers(rows)==ESP_OK) {
+        return true;
+    }
+    if (!g_disp_buf.buf1 || rows>g_config.draw_rows) {
+        return false;
+    }
+    free_draw_buffers();
+    if (alloc_draw_buffers(rows)==ESP_OK) {
+        return true;
+    }
+    ESP_ERROR_CHECK(alloc_draw_buffers(g_config.draw_rows));
+    return false;
+}
+
+
+/** Apply a configuration, called with the display lock held and no flush in progress */
+static bool apply_config(const display_config_t &config)
+{
+    bool ok = apply_io_config(config);
+    if (config.draw_rows!=g_config.draw_rows || !g_disp_buf.buf1) {
+        if (resize_draw_buffers(config.draw_rows)) {
+            g_config.draw_rows = config.draw_rows;
+        }
+        else {
+            ESP_LOGW(TAG, "No memory for %u draw buffer rows, largest DMA block %u bytes", config.draw_rows, heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+            // After tuning there are none, the previous height fit before
+            if (!g_disp_buf.buf1) {
+                ESP_ERROR_CHECK(alloc_draw_buffers(g_config.draw_rows));
+            }
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+/**
+ * Send full frames from the two buffers the way LVGL flushes them. Setting
+ * the window of a flush waits for the transfers before it, so a buffer is
+ * free again when it comes round.
+ */
+static int64_t tune_sweep(uint draw_rows, const pixel_t *bufs[2])
+{
+    int64_t start = esp_timer_get_time();
+    uint flush = 0;
+    for (uint frame=0; frame<TUNE_FRAMES; frame++) {
+        for (uint y=0; y<LCD_V_RES; y+=draw_rows, flush++) {
+            uint rows = std::min(draw_rows, LCD_V_RES-y);
+            if (esp_lcd_panel_draw_bitmap(g_panel_handle, 0, y, LCD_H_RES, y+rows, bufs[flush&1])!=ESP_OK) {
+                return -1;
+            }
+        }
+    }
+    // A command waits for the queued transfers
+    esp_lcd_panel_io_tx_param(g_io_handle, 0x00 /* NOP */, nullptr, 0);
+    return esp_timer_get_time() - start;
+}
+
+
+
+lv_disp_t *display_init()
+{
+    ESP_LOGI(TAG, "Turn off LCD backlight");
+    static constexpr gpio_config_t bk_gpio_config = {
+        .pin_bit_mask = 1ULL << LCD_PIN_BK,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
     };
+    ESP_ERROR_CHECK(gpio_config(&bk_gpio_config));
+    gpio_set_level(LCD_PIN_BK, LCD_BK_LIGHT_OFF_LEVEL);
+
+    ESP_LOGI(TAG, "Install panel IO");
+    ESP_ERROR_CHECK(create_io(g_config));
 
-    ESP_LOGI(TAG, "Install GC9A01 panel driver");
-    ESP_ERROR_CHECK(esp_lcd_new_panel_gc9a01(io_handle, &panel_config, &panel_handle));
+    bool warm = panel_is_configured();
+    g_panel_configured = 0;
+
+    ESP_LOGI(TAG, "Install %ux%u panel driver (%s)", LCD_H_RES, LCD_V_RES, warm ? "warm" : "cold");
+    ESP_ERROR_CHECK(display_panel::panel::create(g_io_handle, LCD_PIN_RST, display_panel::BITS_PER_PIXEL, warm, &g_panel_handle));
+    esp_lcd_panel_handle_t panel_handle = g_panel_handle;
     ESP_ERROR_CHECK(esp_lcd_panel_reset(panel_handle));
     ESP_ERROR_CHECK(esp_lcd_panel_init(panel_handle));
-    ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, true));
-    ESP_ERROR_CHECK(esp_lcd_panel_swap_xy(panel_handle, false));
-    ESP_ERROR_CHECK(esp_lcd_panel_mirror(panel_handle, true, false));
+    ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, display_panel::panel::INVERT_COLOR));
+    display_panel::set_orientation(panel_handle, LV_DISP_ROT_NONE);
+    g_panel_configured = LCD_CONFIGURED_MAGIC;
 
-    // user can flush pre-defined pattern to the screen before we turn on the screen or backlight
+    // flush splash to the screen before we turn on the screen or backlight
+    draw_splash(panel_handle);
     ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
 
 
@@ -186,30 +493,22 @@ lv_disp_t *display_init()
     ESP_LOGI(TAG, "Initialize LVGL library");
     lv_init();
 
-    // alloc draw buffers used by LVGL
+    // alloc draw buffers used by LVGL, they are reallocated when the configuration changes
     // it's recommended to choose the size of the draw buffer(s) to be at least 1/10 screen sized
-#if 0
-    lv_color_t *buf1 = static_cast<lv_color_t*>(heap_caps_malloc(LCD_H_RES * LVGL_DRAW_BUFFER_ROWS * sizeof(lv_color_t), MALLOC_CAP_DMA));
-    assert(buf1);
-    lv_color_t *buf2 = static_cast<lv_color_t*>(heap_caps_malloc(LCD_H_RES * LVGL_DRAW_BUFFER_ROWS * sizeof(lv_color_t), MALLOC_CAP_DMA));
-    assert(buf2);
-#else
-    DMA_ATTR static lv_color_t buf1[LCD_H_RES * LVGL_DRAW_BUFFER_ROWS];
-    DMA_ATTR static lv_color_t buf2[LCD_H_RES * LVGL_DRAW_BUFFER_ROWS];
-#endif
-
-    // initialize LVGL draw buffers
-    lv_disp_draw_buf_init(&disp_buf, buf1, buf2, LCD_H_RES * LVGL_DRAW_BUFFER_ROWS);
+    ESP_ERROR_CHECK(alloc_draw_buffers(g_config.draw_rows));
 
     ESP_LOGI(TAG, "Register display driver to LVGL");
-    lv_disp_drv_init(&disp_drv);
-    disp_drv.hor_res = LCD_H_RES;
-    disp_drv.ver_res = LCD_V_RES;
-    disp_drv.flush_cb = on_lvgl_flush;
-    disp_drv.drv_update_cb = on_lvgl_drv_update;
-    disp_drv.draw_buf = &disp_buf;
-    disp_drv.user_data = panel_handle;
-    g_display = lv_disp_drv_register(&disp_drv);
+    lv_disp_drv_init(&g_disp_drv);
+    g_disp_drv.hor_res = LCD_H_RES;
+    g_disp_drv.ver_res = LCD_V_RES;
+    g_disp_drv.flush_cb = on_lvgl_flush;
+    g_disp_drv.drv_update_cb = on_lvgl_drv_update;
+    g_disp_drv.rounder_cb = display_panel::ROUNDER;
+    g_disp_drv.monitor_cb = on_lvgl_monitor;
+    g_disp_drv.wait_cb = on_lvgl_wait;
+    g_disp_drv.draw_buf = &g_disp_buf;
+    g_disp_drv.user_data = panel_handle;
+    g_display = lv_disp_drv_register(&g_disp_drv);
     lv_disp_set_default(g_display);
 
     ESP_LOGI(TAG, "Install LVGL tick timer");
@@ -255,3 +554,368 @@ bool display_get_backlight()
 {
     return g_backlight;
 }
+
+
+void display_set_flush_tap(display_flush_tap_t tap)
+{
+    g_flush_tap = tap;
+}
+
+
+bool display_get_stats(display_stats_t *stats, TickType_t ticksToWait)
+{
+    uint16_t times[DISPLAY_FRAME_SAMPLES];
+    uint32_t fps = 0;
+
+    if (!display_acquire(ticksToWait)) {
+        return false;
+    }
+    const auto &st = g_frame_stats;
+    const uint count = std::min<uint32_t>(st.frames, DISPLAY_FRAME_SAMPLES);
+    const uint32_t since = esp_timer_get_time()/1000 - 1000;
+    for (uint i=0; i<count; i++) {
+        times[i] = st.time_ms[i];
+        if (static_cast<int32_t>(st.end_ms[i]-since)>0) {
+            fps++;
+        }
+    }
+    stats->frames = st.frames;
+    stats->frame_time_sum_ms = st.time_sum_ms;
+    stats->flush_bytes = st.flush_bytes;
+    display_release();
+
+    portENTER_CRITICAL(&g_bus_lock);
+    stats->spi_busy_us = g_bus_stats.spi_busy_us;
+    stats->flush_wait_us = g_bus_stats.flush_wait_us;
+    stats->flushes = g_bus_stats.flushes;
+    portEXIT_CRITICAL(&g_bus_lock);
+
+    stats->fps = fps;
+    if (count==0) {
+        stats->frame_time_p50_ms = stats->frame_time_p90_ms = stats->frame_time_p99_ms = stats->frame_time_max_ms = 0;
+        return true;
+    }
+    std::sort(times, times+count);
+    stats->frame_time_p50_ms = times[count*50/100];
+    stats->frame_time_p90_ms = times[count*90/100];
+    stats->frame_time_p99_ms = times[count*99/100];
+    stats->frame_time_max_ms = times[count-1];
+    return true;
+}
+
+
+
+uint32_t display_frame_count()
+{
+    return g_frame_stats.frames;
+}
+
+
+uint32_t display_min_refresh_period_ms()
+{
+    const uint64_t frame_bits = display_panel::FRAME_BYTES * 8;
+    return std::max<uint32_t>((frame_bits * 1000 + g_config.pclk_hz - 1) / g_config.pclk_hz, LVGL_TICK_PERIOD_MS);
+}
+
+
+void display_get_config(display_config_t *config)
+{
+    display_acquire();
+    *config = g_config;
+    display_release();
+}
+
+
+bool display_set_config(const display_config_t &config)
+{
+    if (!config_valid(config)) {
+        return false;
+    }
+    display_acquire();
+    wait_flush_idle();
+    bool ok = apply_config(config);
+    lv_obj_invalidate(lv_scr_act());
+    display_release();
+    ESP_LOGI(TAG, "Configured %u draw rows, %u transfer rows, queue depth %u, %lu Hz", g_config.draw_rows, g_config.transfer_rows, g_config.queue_depth, g_config.pclk_hz);
+    return ok;
+}
+
+
+void display_load_config()
+{
+    nvs_handle_t handle;
+    if (nvs_open(DISPLAY_NVS_NAMESPACE, NVS_READONLY, &handle)!=ESP_OK) {
+        return;
+    }
+    display_config_t config;
+    size_t len = sizeof(config);
+    auto res = nvs_get_blob(handle, DISPLAY_NVS_KEY, &config, &len);
+    nvs_close(handle);
+    if (res!=ESP_OK || len!=sizeof(config) || !config_valid(config)) {
+        ESP_LOGW(TAG, "Ignoring stored configuration");
+        return;
+    }
+    // A configuration that does not fit keeps the defaults instead of failing every boot
+    if (!display_set_config(config)) {
+        ESP_LOGW(TAG, "Stored configuration only partly applied");
+    }
+}
+
+
+bool display_save_config()
+{
+    display_config_t config;
+    display_get_config(&config);
+
+    nvs_handle_t handle;
+    if (nvs_open(DISPLAY_NVS_NAMESPACE, NVS_READWRITE, &handle)!=ESP_OK) {
+        ESP_LOGW(TAG, "Error opening NVS");
+        return false;
+    }
+    bool ok = nvs_set_blob(handle, DISPLAY_NVS_KEY, &config, sizeof(config))==ESP_OK && nvs_commit(handle)==ESP_OK;
+    nvs_close(handle);
+    return ok;
+}
+
+
+bool display_reset_config()
+{
+    nvs_handle_t handle;
+    if (nvs_open(DISPLAY_NVS_NAMESPACE, NVS_READWRITE, &handle)==ESP_OK) {
+        nvs_erase_key(handle, DISPLAY_NVS_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    return display_set_config(DISPLAY_DEFAULT_CONFIG);
+}
+
+
+bool display_tune(display_config_t *best)
+{
+    static constexpr uint16_t max_rows = *std::max_element(std::begin(TUNE_DRAW_ROWS), std::end(TUNE_DRAW_ROWS));
+    static constexpr size_t frame_bytes = TUNE_FRAMES * display_panel::FRAME_BYTES;
+
+    display_acquire();
+    wait_flush_idle();
+    g_tuning = true;
+
+    // The sweep draws black frames, keep them dark and let LVGL redraw afterwards
+    gpio_set_level(LCD_PIN_BK, LCD_BK_LIGHT_OFF_LEVEL);
+    const display_config_t previous = g_config;
+    free_draw_buffers();
+    const pixel_t *bufs[2] = {
+        static_cast<pixel_t*>(arena_calloc(ARENA_DMA, LCD_H_RES * max_rows, sizeof(pixel_t))),
+        static_cast<pixel_t*>(arena_calloc(ARENA_DMA, LCD_H_RES * max_rows, sizeof(pixel_t))),
+    };
+
+    struct result_t {
+        display_config_t config;
+        uint32_t kbps;
+    };
+    static result_t results[std::size(TUNE_TRANSFER_ROWS) * std::size(TUNE_QUEUE_DEPTHS) * std::size(TUNE_DRAW_ROWS)];
+    uint count = 0;
+    uint32_t best_kbps = 0;
+
+    if (bufs[0] && bufs[1]) {
+        printf("draw_rows transfer_rows queue_depth     kbps\n");
+        for (auto transfer_rows : TUNE_TRANSFER_ROWS) {
+            for (auto queue_depth : TUNE_QUEUE_DEPTHS) {
+                display_config_t config = { .draw_rows = 0, .transfer_rows = transfer_rows, .queue_depth = queue_depth, .pclk_hz = previous.pclk_hz };
+                if (apply_io_config(config)) {
+                    for (auto draw_rows : TUNE_DRAW_ROWS) {
+                        config.draw_rows = draw_rows;
+                        int64_t us = tune_sweep(draw_rows, bufs);
+                        if (us<=0) {
+                            printf("%9u %13u %11u   failed\n", draw_rows, transfer_rows, queue_depth);
+                            continue;
+                        }
+                        auto &r = results[count++];
+                        r = { config, static_cast<uint32_t>(frame_bytes * 1000000ull / 1024 / us) };
+                        best_kbps = std::max(best_kbps, r.kbps);
+                        printf("%9u %13u %11u %8lu\n", draw_rows, transfer_rows, queue_depth, r.kbps);
+                    }
+                }
+                else {
+                    printf("%9s %13u %11u   failed\n", "-", transfer_rows, queue_depth);
+                }
+            }
+        }
+    }
+    else {
+        ESP_LOGW(TAG, "No memory for tuning buffers");
+    }
+    arena_free(ARENA_DMA, const_cast<pixel_t*>(bufs[0]));
+    arena_free(ARENA_DMA, const_cast<pixel_t*>(bufs[1]));
+
+    // Of the configurations close to the fastest, take the one with the smallest buffers
+    display_config_t chosen = previous;
+    bool found = false;
+    for (uint i=0; i<count; i++) {
+        auto &r = results[i];
+        if (r.kbps*100 < best_kbps*(100-TUNE_TOLERANCE_PCT)) {
+            continue;
+        }
+        if (!found || r.config.draw_rows<chosen.draw_rows
+            || (r.config.draw_rows==chosen.draw_rows && r.config.queue_depth*r.config.transfer_rows<chosen.queue_depth*chosen.transfer_rows)) {
+            chosen = r.config;
+            found = true;
+        }
+    }
+    bool ok = found;
+    if (!apply_config(chosen)) {
+        ok = false;
+    }
+    g_tuning = false;
+    gpio_set_level(LCD_PIN_BK, g_backlight ? LCD_BK_LIGHT_ON_LEVEL : LCD_BK_LIGHT_OFF_LEVEL);
+    lv_obj_invalidate(lv_scr_act());
+    *best = g_config;
+    display_release();
+    return ok;
+}
+
+
+/** -------------------------------------------------------------------------------
+ * Link test
+ */
+
+// The panel clocks out a dummy bit before the data, found by link_align()
+static bool g_link_shifted = false;
+
+
+/** Read a one byte register, two bytes are read to cover the dummy bit */
+static bool link_read(uint8_t cmd, uint8_t *value)
+{
+    uint8_t buf[2] = { 0, 0 };
+    if (esp_lcd_panel_io_rx_param(g_io_handle, cmd, buf, sizeof(buf))!=ESP_OK) {
+        return false;
+    }
+    *value = g_link_shifted ? (buf[0]<<1) | (buf[1]>>7) : buf[0];
+    return true;
+}
+
+
+static bool link_set_clock(uint32_t pclk_hz)
+{
+    display_config_t config = g_config;
+    config.pclk_hz = pclk_hz;
+    return reconfigure_io(config)==ESP_OK;
+}
+
+
+/** Find the read alignment from a MADCTL value written at the read clock */
+static bool link_align()
+{
+    for (bool shifted : { false, true }) {
+        g_link_shifted = shifted;
+        bool match = true;
+        for (auto pattern : LINK_MADCTL_PATTERNS) {
+            uint8_t value;
+            esp_lcd_panel_io_tx_param(g_io_handle, display_panel::panel::CMD_MADCTL, &pattern, 1);
+            if (!link_read(display_panel::panel::CMD_RDDMADCTL, &value) || value!=pattern) {
+                match = false;
+                break;
+            }
+        }
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * One round at the clock under test: stream a pattern over the whole panel,
+ * write MADCTL, then read MADCTL, COLMOD and the ids back at the read clock.
+ * A corrupted stream or command shows up as a changed register.
+ */
+static bool link_round(uint32_t pclk_hz, uint round, const pixel_t *band, const display_link_result_t &ref)
+{
+    if (!link_set_clock(pclk_hz)) {
+        return false;
+    }
+    // Bands fit in one transaction of the configured size
+    const uint band_rows = std::min<uint>(LINK_BAND_ROWS, g_config.transfer_rows);
+    for (uint y=0; y<LCD_V_RES; y+=band_rows) {
+        if (esp_lcd_panel_draw_bitmap(g_panel_handle, 0, y, LCD_H_RES, std::min(y+band_rows, LCD_V_RES), band)!=ESP_OK) {
+            return false;
+        }
+    }
+    const uint8_t pattern = LINK_MADCTL_PATTERNS[round % std::size(LINK_MADCTL_PATTERNS)];
+    esp_lcd_panel_io_tx_param(g_io_handle, display_panel::panel::CMD_MADCTL, &pattern, 1);
+
+    if (!link_set_clock(LINK_READ_CLOCK_HZ)) {
+        return false;
+    }
+    uint8_t madctl, colmod, id[3];
+    return link_read(display_panel::panel::CMD_RDDMADCTL, &madctl) && madctl==pattern
+        && link_read(display_panel::panel::CMD_RDDCOLMOD, &colmod) && colmod==ref.colmod
+        && link_read(display_panel::panel::CMD_RDID[0], &id[0]) && link_read(display_panel::panel::CMD_RDID[1], &id[1]) && link_read(display_panel::panel::CMD_RDID[2], &id[2])
+        && memcmp(id, ref.id, sizeof(id))==0;
+}
+
+
+bool display_link_test(display_link_result_t *result)
+{
+    *result = {};
+
+    display_acquire();
+    wait_flush_idle();
+    g_tuning = true;
+    gpio_set_level(LCD_PIN_BK, LCD_BK_LIGHT_OFF_LEVEL);
+    const display_config_t previous = g_config;
+
+    // Alternating bits in both bytes of every pixel
+    auto band = static_cast<pixel_t*>(arena_alloc(ARENA_DMA, LINK_BAND_ROWS * display_panel::ROW_BYTES));
+    if (band) {
+        for (uint i=0; i<LCD_H_RES * LINK_BAND_ROWS; i++) {
+            band[i] = (i & 1) ? 0xaa55 : 0x55aa;
+        }
+    }
+
+    // Reference values at the read clock
+    if (band && link_set_clock(LINK_READ_CLOCK_HZ)) {
+        bool ok = link_read(display_panel::panel::CMD_RDID[0], &result->id[0]) && link_read(display_panel::panel::CMD_RDID[1], &result->id[1]) && link_read(display_panel::panel::CMD_RDID[2], &result->id[2]);
+        const uint8_t all = result->id[0] & result->id[1] & result->id[2];
+        const uint8_t any = result->id[0] | result->id[1] | result->id[2];
+        // A floating or unconnected MISO reads all ones or all zeroes
+        result->readback = ok && all!=0xff && any!=0x00 && link_align() && link_read(display_panel::panel::CMD_RDDCOLMOD, &result->colmod);
+    }
+
+    if (result->readback) {
+        printf("Panel id %02x %02x %02x, colmod %02x%s\n", result->id[0], result->id[1], result->id[2], result->colmod, g_link_shifted ? ", reads with dummy bit" : "");
+        printf("  clock_hz rounds errors\n");
+        for (auto pclk_hz : LINK_CLOCKS_HZ) {
+            uint errors = 0;
+            for (uint round=0; round<LINK_ROUNDS; round++) {
+                if (!link_round(pclk_hz, round, band, *result)) {
+                    errors++;
+                }
+            }
+            printf("%10lu %6u %6u\n", pclk_hz, LINK_ROUNDS, errors);
+            if (errors==0) {
+                result->pclk_hz = pclk_hz;
+                break;
+            }
+        }
+    }
+    else {
+        ESP_LOGW(TAG, "No readback from the panel, check MISO");
+    }
+    arena_free(ARENA_DMA, band);
+
+    // Back to the chosen clock, or the previous one, and the driver's MADCTL
+    display_config_t config = previous;
+    if (result->pclk_hz) {
+        config.pclk_hz = result->pclk_hz;
+    }
+    link_set_clock(config.pclk_hz);
+    g_config.pclk_hz = config.pclk_hz;
+    on_lvgl_drv_update(&g_disp_drv);
+
+    g_tuning = false;
+    gpio_set_level(LCD_PIN_BK, g_backlight ? LCD_BK_LIGHT_ON_LEVEL : LCD_BK_LIGHT_OFF_LEVEL);
+    lv_obj_invalidate(lv_scr_act());
+    display_release();
+    return result->pclk_hz!=0;
+}
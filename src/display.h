@@ -3,12 +3,95 @@
 #include <freertos/FreeRTOS.h>
 #include <lvgl.h>
 
+
+/**
+ * Draw buffer and SPI configuration. The defaults are used from boot until
+ * display_load_config() applies the one stored in NVS.
+ */
+struct display_config_t {
+    uint16_t draw_rows;             ///< Rows in each of the two LVGL draw buffers
+    uint16_t transfer_rows;         ///< Largest SPI transaction, in rows
+    uint8_t queue_depth;            ///< SPI transactions queued at once
+    uint32_t pclk_hz;               ///< SPI clock for writes
+};
+
 lv_disp_t *display_init();
 lv_disp_t *display_get();
 
+void display_get_config(display_config_t *config);
+bool display_set_config(const display_config_t &config);
+void display_load_config();
+bool display_save_config();
+bool display_reset_config();
+
+/**
+ * Sweep the candidate draw buffer heights, transfer sizes and queue depths
+ * by sending full frames through esp_lcd_panel_draw_bitmap, print the
+ * throughput of each and apply the fastest. Close results are decided by
+ * the smaller buffers. The screen is dark while it runs, about 10 seconds.
+ */
+bool display_tune(display_config_t *best);
+
+
+/**
+ * SPI link self-test. Reads the panel ids over MISO, then for each candidate
+ * clock from the fastest down streams a pattern over the panel, writes
+ * MADCTL and checks MADCTL, COLMOD and the ids read back at a low clock. The
+ * fastest clock that passes every round is applied, store it with
+ * display_save_config(). The GC9A01 has no memory read, so the pixel stream
+ * is only checked for side effects on the registers.
+ */
+struct display_link_result_t {
+    bool readback;                  ///< The panel answers register reads
+    uint8_t id[3];
+    uint8_t colmod;
+    uint32_t pclk_hz;               ///< Fastest clock that passed, 0 if none
+};
+
+bool display_link_test(display_link_result_t *result);
+
 void display_set_backlight(bool enable);
 bool display_get_backlight();
 
 bool display_acquire(TickType_t ticksToWait = portMAX_DELAY);
 void display_release();
 
+
+/**
+ * Flush tap, called from the LVGL task with every area sent to the panel.
+ * It runs after the transfer is queued, so it overlaps the SPI DMA, but it
+ * delays rendering of the next area and must be quick.
+ */
+using display_flush_tap_t = void (*)(const lv_area_t *area, const lv_color_t *pixels);
+
+void display_set_flush_tap(display_flush_tap_t tap);
+
+
+
+/**
+ * Rendering statistics over the last DISPLAY_FRAME_SAMPLES frames that
+ * LVGL actually redrew.
+ */
+static constexpr uint DISPLAY_FRAME_SAMPLES { 128 };
+
+struct display_stats_t {
+    uint32_t frames;                ///< Frames rendered since boot
+    uint64_t frame_time_sum_ms;     ///< Total render time since boot
+    uint64_t flush_bytes;           ///< Bytes sent to the panel since boot
+    uint64_t spi_busy_us;           ///< Time from queuing a flush until its transfer finished
+    uint64_t flush_wait_us;         ///< Time LVGL spent waiting for a flush to finish
+    uint32_t flushes;
+    uint32_t fps;                   ///< Frames rendered in the last second
+    uint32_t frame_time_p50_ms;
+    uint32_t frame_time_p90_ms;
+    uint32_t frame_time_p99_ms;
+    uint32_t frame_time_max_ms;
+};
+
+bool display_get_stats(display_stats_t *stats, TickType_t ticksToWait = portMAX_DELAY);
+
+/** Frames rendered since boot, only from the LVGL task */
+uint32_t display_frame_count();
+
+/** Shortest refresh period, the time to send a full frame at the current SPI clock */
+uint32_t display_min_refresh_period_ms();
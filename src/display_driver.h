@@ -0,0 +1,193 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <algorithm>
+#include <esp_err.h>
+#include <esp_lcd_panel_io.h>
+#include <esp_lcd_panel_ops.h>
+#include <esp_lcd_panel_vendor.h>
+#include <esp_lcd_gc9a01.h>
+#include <lvgl.h>
+
+/**
+ * Compile time specialized display driver
+ *
+ * A display_driver combines a panel type and a pixel format. Geometry, byte
+ * counts, the orientation of each LVGL rotation and, for round panels, the
+ * visible span of every row are constants of the instantiation, so the flush
+ * path has no runtime switches. Another panel is added as a panel type with
+ * the same members as gc9a01_panel.
+ */
+
+
+/** -------------------------------------------------------------------------------
+ * Pixel formats
+ */
+
+struct rgb565 {
+    using pixel_t = uint16_t;
+    static constexpr uint BITS { 16 };
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Panels
+ */
+
+struct display_orientation_t {
+    bool swap_xy;
+    bool mirror_x;
+    bool mirror_y;
+};
+
+/** GC9A01 class round panel of SIZE x SIZE pixels */
+template<uint SIZE>
+struct gc9a01_panel {
+    static constexpr uint WIDTH { SIZE };
+    static constexpr uint HEIGHT { SIZE };
+    static constexpr bool ROUND { true };
+    static constexpr lcd_rgb_endian_t RGB_ENDIAN { LCD_RGB_ENDIAN_BGR };
+    static constexpr bool INVERT_COLOR { true };
+
+    /** Indexed by lv_disp_rot_t */
+    static constexpr display_orientation_t ORIENTATIONS[4] {
+        { .swap_xy = false, .mirror_x = true,  .mirror_y = false },
+        { .swap_xy = true,  .mirror_x = true,  .mirror_y = true  },
+        { .swap_xy = false, .mirror_x = false, .mirror_y = true  },
+        { .swap_xy = true,  .mirror_x = false, .mirror_y = false },
+    };
+
+    // Register commands used by the link test
+    static constexpr uint8_t CMD_RDDMADCTL { 0x0b };
+    static constexpr uint8_t CMD_RDDCOLMOD { 0x0c };
+    static constexpr uint8_t CMD_MADCTL { 0x36 };
+    static constexpr uint8_t CMD_RDID[3] { 0xda, 0xdb, 0xdc };
+
+    static esp_err_t create(esp_lcd_panel_io_handle_t io, int reset_gpio, uint bits_per_pixel, bool warm, esp_lcd_panel_handle_t *panel)
+    {
+        gc9a01_vendor_config_t vendor_config = {
+            .flags = {
+                .warm_init = warm,
+            },
+        };
+        esp_lcd_panel_dev_config_t panel_config = {
+            .reset_gpio_num = reset_gpio,
+            .rgb_endian = RGB_ENDIAN,
+            .bits_per_pixel = bits_per_pixel,
+            .flags = {
+                .reset_active_high = 0
+            },
+            .vendor_config = &vendor_config,
+        };
+        return esp_lcd_new_panel_gc9a01(io, &panel_config, panel);
+    }
+
+    static esp_err_t set_io(esp_lcd_panel_handle_t panel, esp_lcd_panel_io_handle_t io)
+    {
+        return esp_lcd_gc9a01_set_io(panel, io);
+    }
+
+    static esp_err_t draw_image(esp_lcd_panel_handle_t panel, const void *image)
+    {
+        return esp_lcd_gc9a01_draw_image(panel, 0, 0, WIDTH, HEIGHT, image);
+    }
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Driver
+ */
+
+template<typename PANEL, typename FORMAT>
+class display_driver {
+    public:
+        using panel = PANEL;
+        using pixel_t = typename FORMAT::pixel_t;
+
+        static constexpr uint WIDTH { PANEL::WIDTH };
+        static constexpr uint HEIGHT { PANEL::HEIGHT };
+        static constexpr uint BITS_PER_PIXEL { FORMAT::BITS };
+        static constexpr size_t PIXEL_BYTES { FORMAT::BITS / 8 };
+        static constexpr size_t ROW_BYTES { WIDTH * PIXEL_BYTES };
+        static constexpr size_t FRAME_BYTES { ROW_BYTES * HEIGHT };
+
+        static_assert(sizeof(lv_color_t) == PIXEL_BYTES, "LVGL color depth does not match the pixel format");
+        static_assert(sizeof(pixel_t) == PIXEL_BYTES, "Pixel type does not match the pixel format");
+        static_assert(!PANEL::ROUND || WIDTH == HEIGHT, "Round panels must be square");
+
+        static constexpr size_t area_bytes(const lv_area_t *area)
+        {
+            return static_cast<size_t>(area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1) * PIXEL_BYTES;
+        }
+
+        static void set_orientation(esp_lcd_panel_handle_t panel, lv_disp_rot_t rotation)
+        {
+            const auto &o = PANEL::ORIENTATIONS[rotation];
+            esp_lcd_panel_swap_xy(panel, o.swap_xy);
+            esp_lcd_panel_mirror(panel, o.mirror_x, o.mirror_y);
+        }
+
+        /**
+         * LVGL rounder for round panels. Clips an invalidated area to the
+         * bounding box of the visible circle within it, so the pixels in the
+         * corners are neither rendered nor sent. An area entirely in a corner
+         * is left as it is.
+         */
+        static void round_area(__unused lv_disp_drv_t *drv, lv_area_t *area)
+        {
+            // The widest row and column of the area are the ones closest to the middle
+            const auto &row = SPANS[std::clamp<lv_coord_t>(HEIGHT/2, area->y1, area->y2)];
+            const lv_coord_t x1 = std::max<lv_coord_t>(area->x1, row.start);
+            const lv_coord_t x2 = std::min<lv_coord_t>(area->x2, row.end);
+            if (x1 > x2) {
+                return;
+            }
+            const auto &column = SPANS[std::clamp<lv_coord_t>(WIDTH/2, x1, x2)];
+            const lv_coord_t y1 = std::max<lv_coord_t>(area->y1, column.start);
+            const lv_coord_t y2 = std::min<lv_coord_t>(area->y2, column.end);
+            if (y1 > y2) {
+                return;
+            }
+            *area = { x1, y1, x2, y2 };
+        }
+
+        /** rounder_cb for the LVGL driver, none for rectangular panels */
+        static constexpr void (*ROUNDER)(lv_disp_drv_t *drv, lv_area_t *area) { PANEL::ROUND ? round_area : nullptr };
+
+    private:
+        struct span_t {
+            uint16_t start;
+            uint16_t end;       ///< Inclusive
+        };
+
+        static constexpr uint isqrt(uint v)
+        {
+            uint r = 0;
+            while ((r+1)*(r+1) <= v) {
+                r++;
+            }
+            return r;
+        }
+
+        /** Visible pixels of each row of a circle filling a SIZE x SIZE panel */
+        template<uint SIZE>
+        static constexpr std::array<span_t, SIZE> circle_spans()
+        {
+            std::array<span_t, SIZE> spans {};
+            for (uint i=0; i<SIZE; i++) {
+                // Doubled coordinates keep the pixel centers integral
+                const int d = 2*static_cast<int>(i) + 1 - static_cast<int>(SIZE);
+                const int half = isqrt(SIZE*SIZE - d*d);
+                // One pixel margin for the anti-aliased edge
+                const int start = std::max(0, (static_cast<int>(SIZE) - half)/2 - 1);
+                spans[i] = { static_cast<uint16_t>(start), static_cast<uint16_t>(SIZE - 1 - start) };
+            }
+            return spans;
+        }
+
+        static constexpr std::array<span_t, HEIGHT> SPANS { circle_spans<HEIGHT>() };
+};
@@ -0,0 +1,446 @@
+#include "face.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+#include <iterator>
+#include <esp_log.h>
+#include <lvgl.h>
+
+#include "display.h"
+#include "storage.h"
+#include "compositor.h"
+#include "arena.h"
+#include "ui/ui.h"
+
+static constexpr char TAG[] = "face";
+
+static constexpr uint32_t FACE_MAGIC { 0x31434657 }; // "WFC1"
+static constexpr uint32_t FACE_TICK_MS { 200 };
+static constexpr uint32_t FACE_FADE_MS { 300 };
+
+
+struct face_header_t {
+    uint32_t magic;
+    uint16_t background;
+    uint8_t count;
+    uint8_t reserved;
+    uint16_t strings_size;
+    uint16_t reserved2;
+};
+static_assert(sizeof(face_header_t)==12, "Face header layout");
+
+struct face_element_t {
+    face_kind_t kind;
+    face_cadence_t cadence;
+    face_binding_t binding;
+    face_font_t font;
+    int16_t x;
+    int16_t y;
+    int16_t width;
+    int16_t height;
+    uint16_t color;
+    uint16_t color2;
+    uint16_t arg;
+    uint16_t arg2;
+};
+static_assert(sizeof(face_element_t)==20, "Face element layout");
+
+
+/** A built element, kept together in draw lists ordered by cadence */
+struct face_item_t {
+    lv_obj_t *obj;
+    const face_element_t *element;
+    const char *format;
+    uint32_t last;                  ///< Value, or hash of the text, last shown
+};
+
+static struct {
+    char name[FACE_MAX_NAME];
+    uint8_t *data;
+    lv_obj_t *screen;
+    lv_obj_t *static_layer;         ///< Parent of all FACE_STATIC elements
+    lv_timer_t *timer;
+    face_item_t items[FACE_MAX_ELEMENTS];
+    uint count;
+    uint list_start[FACE_CADENCE_COUNT+1];
+    struct tm shown;
+    bool first_tick;
+    uint32_t runs[FACE_CADENCE_COUNT];
+    uint32_t changes[FACE_CADENCE_COUNT];
+} g_face;
+
+static const lv_font_t *const FONTS[] { &lv_font_montserrat_14, &lv_font_montserrat_48 };
+
+/** Fastest cadence each binding needs */
+static constexpr face_cadence_t BINDING_CADENCE[] {
+    FACE_STATIC,
+    FACE_EVERY_SECOND,
+    FACE_EVERY_MINUTE,
+    FACE_EVERY_HOUR,
+    FACE_EVERY_HOUR,
+};
+
+static constexpr const char *CADENCE_NAMES[FACE_CADENCE_COUNT] { "static", "second", "minute", "hour", "day" };
+
+
+
+/** -------------------------------------------------------------------------------
+ * Loading
+ */
+
+static lv_color_t to_color(uint16_t rgb565)
+{
+    return lv_color_make((rgb565 >> 8) & 0xf8, (rgb565 >> 3) & 0xfc, (rgb565 << 3) & 0xf8);
+}
+
+
+static bool valid_face(const uint8_t *data, size_t size)
+{
+    auto header = reinterpret_cast<const face_header_t*>(data);
+    if (size<sizeof(face_header_t) || header->magic!=FACE_MAGIC) {
+        ESP_LOGW(TAG, "Not a face");
+        return false;
+    }
+    if (header->count>FACE_MAX_ELEMENTS || size!=sizeof(face_header_t) + header->count*sizeof(face_element_t) + header->strings_size) {
+        ESP_LOGW(TAG, "Invalid face size");
+        return false;
+    }
+    auto elements = reinterpret_cast<const face_element_t*>(header+1);
+    auto strings = reinterpret_cast<const char*>(elements+header->count);
+    for (uint i=0; i<header->count; i++) {
+        const auto &e = elements[i];
+        bool ok = e.cadence<FACE_CADENCE_COUNT
+            && e.binding<std::size(BINDING_CADENCE)
+            && e.width>0 && e.height>0;
+        switch (e.kind) {
+            case FACE_RECT:
+                ok &= e.cadence==FACE_STATIC && e.binding==FACE_BIND_NONE;
+                break;
+            case FACE_ARC:
+                // A static arc is a ring, a bound one must be updated at least as often as its value changes
+                ok &= e.cadence==FACE_STATIC ? e.binding==FACE_BIND_NONE
+                    : e.binding!=FACE_BIND_NONE && e.cadence<=BINDING_CADENCE[e.binding];
+                break;
+            case FACE_TEXT:
+                ok &= e.binding==FACE_BIND_NONE && e.font<std::size(FONTS)
+                    && e.arg<header->strings_size
+                    && strnlen(strings+e.arg, header->strings_size-e.arg)<std::min<size_t>(header->strings_size-e.arg, FACE_MAX_TEXT);
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            ESP_LOGW(TAG, "Invalid element %u", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static uint8_t *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        ESP_LOGW(TAG, "No face %s", path);
+        return nullptr;
+    }
+    auto data = static_cast<uint8_t*>(arena_alloc(ARENA_UI, FACE_MAX_FILE_SIZE));
+    size_t size = data ? fread(data, 1, FACE_MAX_FILE_SIZE, f) : 0;
+    bool more = data && fgetc(f)!=EOF;
+    fclose(f);
+    if (!data || more || !valid_face(data, size)) {
+        ESP_LOGW(TAG, "Error reading %s", path);
+        arena_free(ARENA_UI, data);
+        return nullptr;
+    }
+    return data;
+}
+
+
+static uint8_t *read_face(const char *name)
+{
+    char path[64];
+    if (!face_path(name, path, sizeof(path))) {
+        ESP_LOGW(TAG, "Invalid face name");
+        return nullptr;
+    }
+    return read_file(path);
+}
+
+
+static lv_obj_t *create_element(lv_obj_t *parent, const face_element_t &e)
+{
+    lv_obj_t *obj = nullptr;
+    switch (e.kind) {
+        case FACE_RECT:
+            obj = lv_obj_create(parent);
+            lv_obj_remove_style_all(obj);
+            lv_obj_set_style_bg_color(obj, to_color(e.color), LV_PART_MAIN);
+            lv_obj_set_style_bg_opa(obj, LV_OPA_COVER, LV_PART_MAIN);
+            lv_obj_set_style_border_color(obj, to_color(e.color2), LV_PART_MAIN);
+            lv_obj_set_style_border_width(obj, e.arg, LV_PART_MAIN);
+            lv_obj_set_style_radius(obj, e.arg2, LV_PART_MAIN);
+            break;
+        case FACE_ARC:
+            obj = lv_arc_create(parent);
+            lv_obj_remove_style(obj, nullptr, LV_PART_KNOB);
+            lv_arc_set_rotation(obj, 270);
+            lv_arc_set_bg_angles(obj, 0, 360);
+            lv_arc_set_range(obj, 0, e.binding==FACE_BIND_HOUR ? 24 : e.binding==FACE_BIND_HOUR12 ? 12 : 60);
+            lv_arc_set_value(obj, 0);
+            lv_obj_set_style_arc_color(obj, to_color(e.color2), LV_PART_MAIN);
+            lv_obj_set_style_arc_width(obj, e.arg, LV_PART_MAIN);
+            lv_obj_set_style_arc_color(obj, to_color(e.color), LV_PART_INDICATOR);
+            lv_obj_set_style_arc_width(obj, e.arg, LV_PART_INDICATOR);
+            break;
+        case FACE_TEXT:
+            obj = lv_label_create(parent);
+            lv_label_set_long_mode(obj, LV_LABEL_LONG_CLIP);
+            lv_obj_set_style_text_color(obj, to_color(e.color), LV_PART_MAIN);
+            lv_obj_set_style_text_font(obj, FONTS[e.font], LV_PART_MAIN);
+            lv_obj_set_style_text_align(obj, LV_TEXT_ALIGN_CENTER, LV_PART_MAIN);
+            lv_label_set_text_static(obj, "");
+            break;
+    }
+    lv_obj_clear_flag(obj, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_clear_flag(obj, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_pos(obj, e.x, e.y);
+    lv_obj_set_size(obj, e.width, e.height);
+    return obj;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Updates
+ */
+
+static uint32_t hash_text(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    while (*text) {
+        hash = (hash ^ static_cast<uint8_t>(*text++)) * 16777619u;
+    }
+    return hash;
+}
+
+
+static uint32_t binding_value(face_binding_t binding, const struct tm &t)
+{
+    switch (binding) {
+        case FACE_BIND_SECOND: return t.tm_sec;
+        case FACE_BIND_MINUTE: return t.tm_min;
+        case FACE_BIND_HOUR:   return t.tm_hour;
+        case FACE_BIND_HOUR12: return t.tm_hour % 12;
+        default:               return 0;
+    }
+}
+
+
+static void run_list(face_cadence_t cadence, const struct tm &t)
+{
+    g_face.runs[cadence]++;
+    for (uint i=g_face.list_start[cadence]; i<g_face.list_start[cadence+1]; i++) {
+        auto &item = g_face.items[i];
+        uint32_t value;
+        char text[FACE_MAX_TEXT];
+        if (item.element->kind==FACE_TEXT) {
+            if (strftime(text, sizeof(text), item.format, &t)==0) {
+                text[0] = '\0';
+            }
+            value = hash_text(text);
+        }
+        else {
+            value = binding_value(item.element->binding, t);
+        }
+        if (value==item.last) {
+            continue;
+        }
+        item.last = value;
+        g_face.changes[cadence]++;
+        if (item.element->kind==FACE_TEXT) {
+            lv_label_set_text(item.obj, text);
+        }
+        else {
+            lv_arc_set_value(item.obj, value);
+        }
+    }
+}
+
+
+static void tick_timer_cb(lv_timer_t *timer)
+{
+    time_t now;
+    struct tm t;
+    time(&now);
+    localtime_r(&now, &t);
+
+    // Each cadence is due when its own or a slower field of the time changed
+    const auto &s = g_face.shown;
+    const bool first = g_face.first_tick;
+    const bool day = first || t.tm_yday!=s.tm_yday || t.tm_year!=s.tm_year;
+    const bool hour = day || t.tm_hour!=s.tm_hour;
+    const bool minute = hour || t.tm_min!=s.tm_min;
+    const bool second = minute || t.tm_sec!=s.tm_sec;
+    g_face.shown = t;
+    g_face.first_tick = false;
+
+    if (first) run_list(FACE_STATIC, t);
+    if (day) run_list(FACE_EVERY_DAY, t);
+    if (hour) run_list(FACE_EVERY_HOUR, t);
+    if (minute) run_list(FACE_EVERY_MINUTE, t);
+    if (second) run_list(FACE_EVERY_SECOND, t);
+}
+
+
+static void on_face_clicked(lv_event_t *e)
+{
+    lv_scr_load_anim(ui_Clock, LV_SCR_LOAD_ANIM_FADE_ON, FACE_FADE_MS, 0, false);
+}
+
+
+static void unload()
+{
+    display_acquire();
+    lv_obj_t *screen = g_face.screen;
+    if (screen) {
+        if (lv_scr_act()==screen) {
+            lv_scr_load(ui_Clock);
+        }
+        lv_timer_del(g_face.timer);
+    }
+    display_release();
+    if (!screen) {
+        return;
+    }
+
+    compositor_remove_screen(screen);
+
+    display_acquire();
+    lv_obj_del(screen);
+    arena_free(ARENA_UI, g_face.data);
+    g_face = {};
+    display_release();
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public
+ */
+
+bool face_path(const char *name, char *path, size_t len, const char *extension)
+{
+    const size_t name_len = strlen(name);
+    if (name_len==0 || name_len>=FACE_MAX_NAME) {
+        return false;
+    }
+    for (const char *p=name; *p; p++) {
+        if (!isalnum(static_cast<unsigned char>(*p)) && *p!='_' && *p!='-') {
+            return false;
+        }
+    }
+    return snprintf(path, len, "%s/%s.%s", STORAGE_BASE_PATH, name, extension)<static_cast<int>(len);
+}
+
+
+bool face_check(const char *path)
+{
+    uint8_t *data = read_file(path);
+    arena_free(ARENA_UI, data);
+    return data!=nullptr;
+}
+
+
+bool face_load(const char *name)
+{
+    uint8_t *data = read_face(name);
+    if (!data) {
+        return false;
+    }
+    auto header = reinterpret_cast<const face_header_t*>(data);
+    auto elements = reinterpret_cast<const face_element_t*>(header+1);
+    auto strings = reinterpret_cast<const char*>(elements+header->count);
+
+    unload();
+
+    display_acquire();
+    g_face.data = data;
+    strlcpy(g_face.name, name, sizeof(g_face.name));
+
+    g_face.screen = lv_obj_create(nullptr);
+    lv_obj_clear_flag(g_face.screen, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_style_bg_color(g_face.screen, to_color(header->background), LV_PART_MAIN);
+    lv_obj_set_style_bg_opa(g_face.screen, LV_OPA_COVER, LV_PART_MAIN);
+    lv_obj_add_event_cb(g_face.screen, on_face_clicked, LV_EVENT_CLICKED, nullptr);
+
+    g_face.static_layer = lv_obj_create(g_face.screen);
+    lv_obj_remove_style_all(g_face.static_layer);
+    lv_obj_clear_flag(g_face.static_layer, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_clear_flag(g_face.static_layer, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_size(g_face.static_layer, LV_PCT(100), LV_PCT(100));
+
+    // Counting sort into the draw lists, file order is kept within a list so later elements draw on top
+    uint counts[FACE_CADENCE_COUNT] {};
+    for (uint i=0; i<header->count; i++) {
+        counts[elements[i].cadence]++;
+    }
+    for (uint c=0; c<FACE_CADENCE_COUNT; c++) {
+        g_face.list_start[c+1] = g_face.list_start[c] + counts[c];
+        counts[c] = g_face.list_start[c];
+    }
+    for (uint i=0; i<header->count; i++) {
+        const auto &e = elements[i];
+        g_face.items[counts[e.cadence]++] = {
+            .obj = create_element(e.cadence==FACE_STATIC ? g_face.static_layer : g_face.screen, e),
+            .element = &e,
+            .format = e.kind==FACE_TEXT ? strings+e.arg : nullptr,
+            .last = UINT32_MAX,
+        };
+    }
+    g_face.count = header->count;
+
+    g_face.first_tick = true;
+    tick_timer_cb(nullptr);
+    g_face.timer = lv_timer_create(tick_timer_cb, FACE_TICK_MS, nullptr);
+    lv_scr_load_anim(g_face.screen, LV_SCR_LOAD_ANIM_FADE_ON, FACE_FADE_MS, 0, false);
+    display_release();
+
+    lv_obj_t *statics[] = { g_face.static_layer };
+    compositor_add_screen(g_face.screen, "face", statics, std::size(statics));
+
+    ESP_LOGI(TAG, "Loaded %s, %u elements, %u static", name, g_face.count, g_face.list_start[FACE_STATIC+1]);
+    return true;
+}
+
+
+void face_unload()
+{
+    unload();
+}
+
+
+void face_print_stats()
+{
+    display_acquire();
+    if (!g_face.screen) {
+        display_release();
+        printf("No face loaded\n");
+        return;
+    }
+    printf("Face %s, %u elements\n", g_face.name, g_face.count);
+    printf("Cadence   Elements      Runs   Changes\n");
+    for (uint c=0; c<FACE_CADENCE_COUNT; c++) {
+        printf("%-8s  %8u  %8lu  %8lu\n",
+            CADENCE_NAMES[c],
+            g_face.list_start[c+1] - g_face.list_start[c],
+            g_face.runs[c],
+            g_face.changes[c]
+            );
+    }
+    display_release();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Watch faces loaded at runtime
+ *
+ * A face is a compact binary description stored as <name>.face on the
+ * storage partition, compiled and previewed with tools/mkface.py. The loader
+ * validates it, builds the widgets and sorts them into one draw list per
+ * update cadence. A timer runs only the lists whose cadence has elapsed, and
+ * a widget is only changed, and so invalidated, when its value or text
+ * differs. Static elements are built into one layer that the compositor
+ * caches.
+ *
+ * File format, integers little endian:
+ *
+ *   header:   "WFC1" u16 background RGB565, u8 element count, u8 reserved,
+ *             u16 strings size, u16 reserved
+ *   element:  u8 kind, u8 cadence, u8 binding, u8 font,
+ *             i16 x, i16 y, i16 width, i16 height,
+ *             u16 color, u16 color2, u16 arg, u16 arg2
+ *   strings:  NUL terminated strftime formats
+ *
+ *   FACE_RECT  filled with color, border color2 of arg pixels, radius arg2
+ *   FACE_ARC   indicator color over a color2 track of arg pixels width,
+ *              showing binding as a part of a full turn
+ *   FACE_TEXT  strftime format at string offset arg, in color and font,
+ *              centered in the width
+ *
+ * Elements in FACE_STATIC are drawn once. An element may not declare a
+ * slower cadence than its binding changes at.
+ */
+static constexpr uint FACE_MAX_NAME { 24 };
+static constexpr uint FACE_MAX_ELEMENTS { 32 };
+static constexpr uint FACE_MAX_TEXT { 32 };
+static constexpr size_t FACE_MAX_FILE_SIZE { 4096 };
+
+enum face_kind_t : uint8_t {
+    FACE_RECT = 1,
+    FACE_ARC = 2,
+    FACE_TEXT = 3,
+};
+
+enum face_cadence_t : uint8_t {
+    FACE_STATIC = 0,
+    FACE_EVERY_SECOND = 1,
+    FACE_EVERY_MINUTE = 2,
+    FACE_EVERY_HOUR = 3,
+    FACE_EVERY_DAY = 4,
+    FACE_CADENCE_COUNT
+};
+
+enum face_binding_t : uint8_t {
+    FACE_BIND_NONE = 0,
+    FACE_BIND_SECOND = 1,       ///< 0-59
+    FACE_BIND_MINUTE = 2,       ///< 0-59
+    FACE_BIND_HOUR = 3,         ///< 0-23
+    FACE_BIND_HOUR12 = 4,       ///< 0-11
+};
+
+enum face_font_t : uint8_t {
+    FACE_FONT_14 = 0,
+    FACE_FONT_48 = 1,
+};
+
+/**
+ * Path of a face on the storage partition, false for an invalid name. Other
+ * extensions name the files of an upload in progress, they are no longer
+ * than the default so they fit the same name limits.
+ */
+bool face_path(const char *name, char *path, size_t len, const char *extension = "face");
+
+/** True if the file at path is a valid face */
+bool face_check(const char *path);
+
+/** Load and show a face from the storage partition, replacing the current one */
+bool face_load(const char *name);
+
+/** Delete the face and return to the clock screen */
+void face_unload();
+
+void face_print_stats();
@@ -0,0 +1,480 @@
+#include "heap_prof.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_heap_caps.h>
+#include <esp_heap_trace.h>
+#include <esp_memory_utils.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+#include "display.h"
+
+static constexpr char TAG[] = "heapprof";
+
+static constexpr uint HEAP_PROF_MAX_SITES { 64 };
+static constexpr uint32_t HEAP_PROF_TASK_STACK_SIZE { 4096 };
+static constexpr UBaseType_t HEAP_PROF_TASK_PRIORITY { 1 };
+static constexpr uint HEAP_PROF_REPORT_SITES { 16 };
+
+static constexpr uint32_t HEAP_PROF_DUMP_MAGIC { 0x31525048 };  // "HPR1"
+static constexpr uint16_t HEAP_PROF_DUMP_VERSION { 1 };
+
+static constexpr uint32_t REGION_CAPS[HEAP_PROF_REGION_COUNT] = { MALLOC_CAP_INTERNAL, MALLOC_CAP_DMA, MALLOC_CAP_SPIRAM };
+
+
+// Bytes in use at each of the last reports, oldest first
+struct trend_t {
+    uint32_t history[HEAP_PROF_TREND_REPORTS];
+    uint count;
+};
+
+struct site_t {
+    void *caller;
+    heap_prof_region_t region;
+    uint32_t allocs;
+    uint32_t bytes;
+    trend_t trend;
+};
+
+
+/** -------------------------------------------------------------------------------
+ * Dump format, little endian
+ */
+
+struct __attribute__((packed)) dump_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t depth;                 // Callers per record
+    uint32_t record_count;
+    int64_t time_us;
+    heap_prof_region_stats_t regions[HEAP_PROF_REGION_COUNT];
+    uint32_t lvgl_total;
+    uint32_t lvgl_free;
+};
+
+struct dump_record_t {
+    uint32_t address;
+    uint32_t size;
+    uint8_t region;
+    uint8_t reserved[3];
+    uint32_t callers[CONFIG_HEAP_TRACING_STACK_DEPTH];
+};
+
+
+
+static heap_trace_record_t *g_records = nullptr;
+static uint g_record_count = 0;
+static uint32_t g_interval_s = HEAP_PROF_DEFAULT_INTERVAL_S;
+static bool g_running = false;
+static site_t g_sites[HEAP_PROF_MAX_SITES];
+static uint g_site_count = 0;
+static trend_t g_region_trend[HEAP_PROF_REGION_COUNT];
+static SemaphoreHandle_t g_lock = nullptr;
+static TaskHandle_t g_task = nullptr;
+
+
+
+/** The heap aborts on a failed allocation, so check that it fits first */
+static void *try_alloc(size_t size, uint32_t caps)
+{
+    if (heap_caps_get_largest_free_block(caps)<size) {
+        return nullptr;
+    }
+    return heap_caps_malloc(size, caps);
+}
+
+
+static heap_prof_region_t region_of(const void *ptr)
+{
+    if (esp_ptr_external_ram(ptr)) {
+        return HEAP_PROF_REGION_PSRAM;
+    }
+    if (esp_ptr_dma_capable(ptr)) {
+        return HEAP_PROF_REGION_DMA;
+    }
+    return HEAP_PROF_REGION_INTERNAL;
+}
+
+
+static void lvgl_stats(uint32_t &total, uint32_t &free)
+{
+    // LVGL allocates from its own pool, so it never shows up in the heap trace
+    total = free = 0;
+    if (display_acquire(pdMS_TO_TICKS(100))) {
+        lv_mem_monitor_t mon;
+        lv_mem_monitor(&mon);
+        display_release();
+        total = mon.total_size;
+        free = mon.free_size;
+    }
+}
+
+
+static void trend_push(trend_t &trend, uint32_t bytes)
+{
+    if (trend.count==HEAP_PROF_TREND_REPORTS) {
+        memmove(trend.history, trend.history+1, sizeof(trend.history)-sizeof(trend.history[0]));
+        trend.count--;
+    }
+    trend.history[trend.count++] = bytes;
+}
+
+static int32_t trend_delta(const trend_t &trend)
+{
+    return trend.count<2 ? 0 : static_cast<int32_t>(trend.history[trend.count-1] - trend.history[trend.count-2]);
+}
+
+static bool trend_growing(const trend_t &trend)
+{
+    if (trend.count<HEAP_PROF_TREND_REPORTS) {
+        return false;
+    }
+    for (uint i=1; i<trend.count; i++) {
+        if (trend.history[i]<=trend.history[i-1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static site_t *find_site(void *caller, heap_prof_region_t region)
+{
+    for (uint i=0; i<g_site_count; i++) {
+        if (g_sites[i].caller==caller && g_sites[i].region==region) {
+            return &g_sites[i];
+        }
+    }
+    if (g_site_count<HEAP_PROF_MAX_SITES) {
+        auto &site = g_sites[g_site_count++];
+        site = { .caller = caller, .region = region, .allocs = 0, .bytes = 0, .trend = {} };
+        return &site;
+    }
+    return nullptr;
+}
+
+
+// Tracing is paused while the records are walked, so none move under us
+static void collect_sites(uint32_t *untracked_bytes)
+{
+    for (uint i=0; i<g_site_count; i++) {
+        g_sites[i].allocs = 0;
+        g_sites[i].bytes = 0;
+    }
+    *untracked_bytes = 0;
+
+    heap_trace_stop();
+    size_t count = heap_trace_get_count();
+    for (size_t i=0; i<count; i++) {
+        heap_trace_record_t rec;
+        if (heap_trace_get(i, &rec)!=ESP_OK) {
+            break;
+        }
+        auto site = find_site(rec.alloced_by[0], region_of(rec.address));
+        if (!site) {
+            *untracked_bytes += rec.size;
+            continue;
+        }
+        site->allocs++;
+        site->bytes += rec.size;
+    }
+    heap_trace_resume();
+}
+
+
+static void heap_prof_task(__unused void *param)
+{
+    while (true) {
+        TickType_t wait = g_running ? pdMS_TO_TICKS(g_interval_s*1000) : portMAX_DELAY;
+        if (ulTaskNotifyTake(pdTRUE, wait)==0 && g_running) {
+            heap_prof_report();
+        }
+    }
+}
+
+
+
+void heap_prof_init()
+{
+    static StaticSemaphore_t lock_buffer;
+    g_lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[HEAP_PROF_TASK_STACK_SIZE];
+    g_task = xTaskCreateStatic(heap_prof_task, "heapprof", HEAP_PROF_TASK_STACK_SIZE, nullptr, HEAP_PROF_TASK_PRIORITY, task_stack, &task_buffer);
+}
+
+
+const char *heap_prof_region_name(heap_prof_region_t region)
+{
+    static constexpr const char *REGION_NAMES[HEAP_PROF_REGION_COUNT] = { "internal", "dma", "psram" };
+    return REGION_NAMES[region];
+}
+
+
+void heap_prof_region_stats(heap_prof_region_t region, heap_prof_region_stats_t &stats)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, REGION_CAPS[region]);
+    stats.total = info.total_free_bytes + info.total_allocated_bytes;
+    stats.free = info.total_free_bytes;
+    stats.min_free = info.minimum_free_bytes;
+    stats.largest = info.largest_free_block;
+    if (region!=HEAP_PROF_REGION_INTERNAL) {
+        return;
+    }
+
+    // MALLOC_CAP_INTERNAL includes the DMA capable heaps, take those out to
+    // match region_of(). The heap API has no caps for the rest alone, so the
+    // low water mark and the largest block are bounded estimates.
+    multi_heap_info_t dma;
+    heap_caps_get_info(&dma, REGION_CAPS[HEAP_PROF_REGION_DMA]);
+    stats.total -= dma.total_free_bytes + dma.total_allocated_bytes;
+    stats.free -= dma.total_free_bytes;
+    stats.min_free = std::min<uint32_t>(stats.free, info.minimum_free_bytes > dma.minimum_free_bytes ? info.minimum_free_bytes - dma.minimum_free_bytes : 0);
+    stats.largest = std::min<uint32_t>(stats.free, info.largest_free_block);
+}
+
+
+esp_err_t heap_prof_start(uint records, uint32_t interval_s)
+{
+    if (records==0 || records>HEAP_PROF_MAX_RECORDS || interval_s<HEAP_PROF_MIN_INTERVAL_S || interval_s>HEAP_PROF_MAX_INTERVAL_S) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (g_running) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The tracer writes records from inside the allocator, they must live in internal RAM
+    g_records = static_cast<heap_trace_record_t*>(try_alloc(records*sizeof(heap_trace_record_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    if (!g_records) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(g_records, 0, records*sizeof(heap_trace_record_t));
+    g_record_count = records;
+    g_interval_s = interval_s;
+    g_site_count = 0;
+    memset(g_region_trend, 0, sizeof(g_region_trend));
+
+    esp_err_t res = heap_trace_init_standalone(g_records, g_record_count);
+    if (res==ESP_OK) {
+        res = heap_trace_start(HEAP_TRACE_LEAKS);
+    }
+    if (res!=ESP_OK) {
+        heap_caps_free(g_records);
+        g_records = nullptr;
+        xSemaphoreGive(g_lock);
+        return res;
+    }
+    g_running = true;
+    xSemaphoreGive(g_lock);
+
+    ESP_LOGI(TAG, "Tracking with %u records (%u bytes), report every %lu s", records, records*sizeof(heap_trace_record_t), interval_s);
+    xTaskNotifyGive(g_task);
+    return ESP_OK;
+}
+
+
+esp_err_t heap_prof_stop()
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (!g_running) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    heap_trace_stop();
+    g_running = false;
+    heap_caps_free(g_records);
+    g_records = nullptr;
+    xSemaphoreGive(g_lock);
+
+    xTaskNotifyGive(g_task);
+    ESP_LOGI(TAG, "Tracking stopped");
+    return ESP_OK;
+}
+
+
+bool heap_prof_running()
+{
+    return g_running;
+}
+
+
+void heap_prof_report()
+{
+    heap_prof_region_stats_t regions[HEAP_PROF_REGION_COUNT];
+    uint32_t lvgl_total, lvgl_free;
+
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        heap_prof_region_stats(static_cast<heap_prof_region_t>(i), regions[i]);
+    }
+    lvgl_stats(lvgl_total, lvgl_free);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    printf("Region        Total     Used    Delta  Min free  Largest\n");
+    printf("--------------------------------------------------------\n");
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        auto &st = regions[i];
+        auto &trend = g_region_trend[i];
+        trend_push(trend, st.total - st.free);
+        printf("%-10s %8lu %8lu %+8ld %9lu %8lu%s\n",
+            heap_prof_region_name(static_cast<heap_prof_region_t>(i)),
+            st.total,
+            st.total - st.free,
+            trend_delta(trend),
+            st.min_free,
+            st.largest,
+            trend_growing(trend) ? "  GROWING" : ""
+            );
+    }
+    printf("%-10s %8lu %8lu\n", "lvgl pool", lvgl_total, lvgl_total - lvgl_free);
+
+    if (!g_running) {
+        xSemaphoreGive(g_lock);
+        printf("\nAllocation tracking not running\n");
+        return;
+    }
+
+    uint32_t untracked;
+    collect_sites(&untracked);
+
+    // Keep the biggest sites first so the table shows what matters
+    for (uint i=0; i<g_site_count; i++) {
+        trend_push(g_sites[i].trend, g_sites[i].bytes);
+    }
+    qsort(g_sites, g_site_count, sizeof(site_t), [](auto a_, auto b_) {
+        auto a = static_cast<const site_t*>(a_);
+        auto b = static_cast<const site_t*>(b_);
+        if (a->bytes==b->bytes) {
+            return 0;
+        }
+        return a->bytes>b->bytes ? -1 : 1;
+    });
+    // Freed sites make room for new ones
+    while (g_site_count>0 && g_sites[g_site_count-1].bytes==0) {
+        g_site_count--;
+    }
+
+    printf("\nCall site   Region    Allocs    Bytes    Delta\n");
+    printf("----------------------------------------------\n");
+    uint growing = 0;
+    for (uint i=0; i<g_site_count; i++) {
+        auto &site = g_sites[i];
+        bool grows = trend_growing(site.trend);
+        if (grows) {
+            growing++;
+        }
+        if (i>=HEAP_PROF_REPORT_SITES && !grows) {
+            continue;
+        }
+        printf("%p  %-8s %7lu %8lu %+8ld%s\n",
+            site.caller,
+            heap_prof_region_name(site.region),
+            site.allocs,
+            site.bytes,
+            trend_delta(site.trend),
+            grows ? "  GROWING" : ""
+            );
+    }
+    if (untracked) {
+        printf("(%lu bytes from call sites beyond the first %u)\n", untracked, HEAP_PROF_MAX_SITES);
+    }
+    if (heap_trace_get_count()>=g_record_count) {
+        printf("(record buffer full, newer allocations are not tracked)\n");
+    }
+    xSemaphoreGive(g_lock);
+
+    if (growing) {
+        ESP_LOGW(TAG, "%u call sites grew in each of the last %u reports", growing, HEAP_PROF_TREND_REPORTS);
+    }
+}
+
+
+esp_err_t heap_prof_dump(const char *path)
+{
+    dump_header_t header = {
+        .magic = HEAP_PROF_DUMP_MAGIC,
+        .version = HEAP_PROF_DUMP_VERSION,
+        .depth = CONFIG_HEAP_TRACING_STACK_DEPTH,
+        .record_count = 0,
+        .time_us = esp_timer_get_time(),
+        .regions = {},
+        .lvgl_total = 0,
+        .lvgl_free = 0,
+    };
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        heap_prof_region_stats_t stats;
+        heap_prof_region_stats(static_cast<heap_prof_region_t>(i), stats);
+        header.regions[i] = stats;
+    }
+    uint32_t lvgl_total, lvgl_free;
+    lvgl_stats(lvgl_total, lvgl_free);
+    header.lvgl_total = lvgl_total;
+    header.lvgl_free = lvgl_free;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (!g_running) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Snapshot the records first, writing the file allocates and takes a while
+    auto records = static_cast<dump_record_t*>(try_alloc(g_record_count*sizeof(dump_record_t), MALLOC_CAP_SPIRAM));
+    if (!records) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    heap_trace_stop();
+    size_t count = heap_trace_get_count();
+    for (size_t i=0; i<count; i++) {
+        heap_trace_record_t rec;
+        if (heap_trace_get(i, &rec)!=ESP_OK) {
+            break;
+        }
+        auto &out = records[header.record_count++];
+        out = {
+            .address = reinterpret_cast<uintptr_t>(rec.address),
+            .size = rec.size,
+            .region = static_cast<uint8_t>(region_of(rec.address)),
+            .reserved = {},
+            .callers = {},
+        };
+        for (uint d=0; d<CONFIG_HEAP_TRACING_STACK_DEPTH; d++) {
+            out.callers[d] = reinterpret_cast<uintptr_t>(rec.alloced_by[d]);
+        }
+    }
+    heap_trace_resume();
+    xSemaphoreGive(g_lock);
+
+    esp_err_t res = ESP_OK;
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "Error opening %s", path);
+        res = ESP_FAIL;
+    }
+    else {
+        if (fwrite(&header, sizeof(header), 1, f)!=1 || fwrite(records, sizeof(dump_record_t), header.record_count, f)!=header.record_count) {
+            ESP_LOGE(TAG, "Error writing %s", path);
+            res = ESP_FAIL;
+        }
+        fclose(f);
+    }
+    heap_caps_free(records);
+
+    if (res==ESP_OK) {
+        ESP_LOGI(TAG, "Wrote %lu records to %s", header.record_count, path);
+    }
+    return res;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <esp_err.h>
+
+/**
+ * Heap allocation profiler
+ *
+ * While tracking, the IDF standalone heap tracer keeps a record with the
+ * call site of every allocation that has not been freed yet. Reports group
+ * these by heap region and call site, compare them with the previous report
+ * and flag anything that grew in each of the last HEAP_PROF_TREND_REPORTS
+ * reports. A report is logged every interval while tracking.
+ *
+ * The binary dump holds the raw records, tools/heapprof.py resolves the call
+ * sites against the firmware ELF and tags them by subsystem.
+ */
+enum heap_prof_region_t {
+    HEAP_PROF_REGION_INTERNAL,      ///< Internal RAM that is not DMA capable
+    HEAP_PROF_REGION_DMA,           ///< DMA capable internal RAM
+    HEAP_PROF_REGION_PSRAM,
+    HEAP_PROF_REGION_COUNT
+};
+
+struct heap_prof_region_stats_t {
+    uint32_t total;
+    uint32_t free;
+    uint32_t min_free;
+    uint32_t largest;
+};
+
+static constexpr uint HEAP_PROF_DEFAULT_RECORDS { 512 };
+static constexpr uint HEAP_PROF_MAX_RECORDS { 2048 };           // Records live in internal RAM
+static constexpr uint32_t HEAP_PROF_DEFAULT_INTERVAL_S { 600 };
+static constexpr uint32_t HEAP_PROF_MIN_INTERVAL_S { 1 };
+static constexpr uint32_t HEAP_PROF_MAX_INTERVAL_S { 24*60*60 };
+static constexpr uint HEAP_PROF_TREND_REPORTS { 6 };
+static constexpr char HEAP_PROF_DUMP_PATH[] { "/storage/heapprof.bin" };
+
+void heap_prof_init();
+
+const char *heap_prof_region_name(heap_prof_region_t region);
+
+/**
+ * Size and free space of a region as heap_prof_region_t divides them, the
+ * internal region without the DMA capable heaps. Shared with /metrics so
+ * both report the same numbers under the same name.
+ */
+void heap_prof_region_stats(heap_prof_region_t region, heap_prof_region_stats_t &stats);
+
+/**
+ * ESP_ERR_INVALID_ARG outside the limits above, ESP_ERR_NO_MEM if the records
+ * don't fit in one block of internal RAM.
+ */
+esp_err_t heap_prof_start(uint records = HEAP_PROF_DEFAULT_RECORDS, uint32_t interval_s = HEAP_PROF_DEFAULT_INTERVAL_S);
+esp_err_t heap_prof_stop();
+bool heap_prof_running();
+
+/** Print region and call site usage and their change since the last report */
+void heap_prof_report();
+
+esp_err_t heap_prof_dump(const char *path = HEAP_PROF_DUMP_PATH);
@@ -0,0 +1,106 @@
+#include "http_server.h"
+
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_log.h>
+
+#include "wifi.h"
+
+static constexpr char TAG[] = "http";
+
+static constexpr uint32_t HTTP_SERVER_STACK_SIZE { 6144 };
+
+/**
+ * Sockets are shared with the other network services, out of
+ * CONFIG_LWIP_MAX_SOCKETS:
+ *
+ *   httpd       clients + listen + control
+ *   mirror      listen + client
+ *   scene       listen + client
+ *   timekeeper  NTP query
+ *   ota         download
+ *
+ * Idle clients are purged when the server runs out, so a browser holding
+ * connections open does not lock out the streams.
+ */
+static constexpr uint HTTP_SERVER_MAX_OPEN_SOCKETS { 5 };
+static constexpr uint HTTP_SERVER_OTHER_SOCKETS { 2 + 2 + 2 + 1 + 1 };
+static_assert(HTTP_SERVER_MAX_OPEN_SOCKETS + HTTP_SERVER_OTHER_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS, "Raise CONFIG_LWIP_MAX_SOCKETS");
+
+
+static httpd_handle_t g_server = nullptr;
+static const httpd_uri_t *g_handlers[HTTP_SERVER_MAX_HANDLERS];
+static uint g_handler_count = 0;
+static SemaphoreHandle_t g_lock = nullptr;
+
+
+static void start_server()
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (g_server) {
+        xSemaphoreGive(g_lock);
+        return;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.stack_size = HTTP_SERVER_STACK_SIZE;
+    config.max_uri_handlers = HTTP_SERVER_MAX_HANDLERS;
+    config.max_open_sockets = HTTP_SERVER_MAX_OPEN_SOCKETS;
+    config.lru_purge_enable = true;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+
+    esp_err_t res = httpd_start(&g_server, &config);
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "Error starting server: %s", esp_err_to_name(res));
+        g_server = nullptr;
+        xSemaphoreGive(g_lock);
+        return;
+    }
+    for (uint i=0; i<g_handler_count; i++) {
+        ESP_ERROR_CHECK(httpd_register_uri_handler(g_server, g_handlers[i]));
+    }
+    xSemaphoreGive(g_lock);
+
+    ESP_LOGI(TAG, "Server started on port %u", config.server_port);
+}
+
+
+static void on_got_ip(__unused void* arg, __unused esp_event_base_t event_base, __unused int32_t event_id, __unused void *event_data)
+{
+    start_server();
+}
+
+
+
+void http_server_init()
+{
+    static StaticSemaphore_t lock_buffer;
+    g_lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+    ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, nullptr) );
+
+    // The address may have been assigned before the handler was registered
+    if (wifi_has_ip()) {
+        start_server();
+    }
+}
+
+
+bool http_server_register(const httpd_uri_t *uri)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (g_handler_count>=HTTP_SERVER_MAX_HANDLERS) {
+        xSemaphoreGive(g_lock);
+        ESP_LOGE(TAG, "Too many handlers");
+        return false;
+    }
+    g_handlers[g_handler_count++] = uri;
+    if (g_server) {
+        ESP_ERROR_CHECK(httpd_register_uri_handler(g_server, uri));
+    }
+    xSemaphoreGive(g_lock);
+    return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <sys/types.h>
+#include <esp_http_server.h>
+
+/**
+ * Embedded HTTP server
+ *
+ * Modules register their URI handlers during boot. The server is started
+ * when the station first gets an IP address and keeps running after that.
+ * All handlers run in the single server task. URIs may end in a * wildcard,
+ * handlers are matched in the order they were registered.
+ */
+static constexpr uint HTTP_SERVER_MAX_HANDLERS { 12 };
+
+void http_server_init();
+
+/** The handler struct must stay valid, it is registered again if the server is started later */
+bool http_server_register(const httpd_uri_t *uri);
@@ -10,7 +10,7 @@
 
 
 #include "projectconfig.h"
-#include "app_base.h"
+#include "app_events.h"
 
 static constexpr char TAG[] = "touch";
 
@@ -33,6 +33,8 @@ struct input_event_t {
     bool pressed;
 };
 
+static uint32_t g_event_count = 0;
+
 
 static void input_task(__unused void *param)
 {
@@ -65,11 +67,13 @@ static void input_task(__unused void *param)
 
     static struct {
         TickType_t change;
+        TickType_t press;
         bool pressed;
     } button_state[TOUCH_BUTTON_COUNT];
 
     for (uint i=0; i<TOUCH_BUTTON_COUNT; i++) {
         button_state[i].change = 0;
+        button_state[i].press = 0;
         button_state[i].pressed = false;
     }
 
@@ -97,6 +101,16 @@ static void input_task(__unused void *param)
                     .pressed = pressed
                 };
                 xQueueSend(queue, &event, portMAX_DELAY);
+                g_event_count++;
+
+                if (pressed) {
+                    current.press = now;
+                }
+                app_event_publish(app_input_event_t {
+                    .pad = i,
+                    .pressed = pressed,
+                    .long_press = !pressed && (now-current.press >= TOUCH_LONG_PRESS),
+                });
             }
         }
         vTaskDelay(pdMS_TO_TICKS(10));
@@ -161,3 +175,9 @@ void input_init()
     }
 }
 
+
+
+uint32_t input_event_count()
+{
+    return g_event_count;
+}
@@ -1,3 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+
 void input_init();
+
+/** Number of touch presses and releases since boot */
+uint32_t input_event_count();
@@ -1,14 +1,32 @@
 #include "projectconfig.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <iterator>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_log.h>
 
 #include "app_base.h"
+#include "boot.h"
+#include "profiler.h"
+#include "heap_prof.h"
+#include "app_events.h"
 #include "display.h"
 #include "wifi.h"
+#include "wifi_power.h"
+#include "timekeeper.h"
+#include "http_server.h"
+#include "metrics.h"
+#include "web.h"
+#include "ota.h"
+#include "mirror.h"
+#include "scene.h"
+#include "compositor.h"
+#include "refresh.h"
+#include "raster.h"
+#include "arena.h"
 #include "input.h"
 #include "console.h"
 #include "ui/ui.h"
@@ -82,55 +100,23 @@ void example_lvgl_demo_ui()
 }
 
 
-#if 0
-static void on_input(void* arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
-{
-    input_event_data_t *data = static_cast<input_event_data_t*>(event_data);
-    switch (event_id) {
-        case EVENT_BUTTON_LEFT:
-            //ESP_LOGI(TAG, "LEFT Button %s", data->long_press?"long":"short");
-            if (!data->long_press) {
-                display_acquire();
-                switch (lv_disp_get_rotation(nullptr)) {
-                    case LV_DISP_ROT_NONE:
-                        ESP_LOGI(TAG, "Display rotate 90");
-                        lv_disp_set_rotation(nullptr, LV_DISP_ROT_90);
-                        break;
-                    case LV_DISP_ROT_90:
-                        ESP_LOGI(TAG, "Display rotate 180");
-                        lv_disp_set_rotation(nullptr, LV_DISP_ROT_180);
-                        break;
-                    case LV_DISP_ROT_180:
-                        ESP_LOGI(TAG, "Display rotate 270");
-                        lv_disp_set_rotation(nullptr, LV_DISP_ROT_270);
-                        break;
-                    case LV_DISP_ROT_270:
-                        ESP_LOGI(TAG, "Display rotate NONE");
-                        lv_disp_set_rotation(nullptr, LV_DISP_ROT_NONE);
-                        break;
-                }
-
-                display_release();
-            }
-            break;
-        case EVENT_BUTTON_RIGHT:
-            ESP_LOGI(TAG, "RIGHT Button %s", data->long_press?"long":"short");
-            if (!data->long_press) {
-                if (!display_get_backlight()) {
-                    display_set_backlight(true);
-                }
-            }
-            else {
-                ESP_LOGI(TAG, "Toggle backlight");
-                display_set_backlight(!display_get_backlight());
-            }
-            break;
+static void on_input(const app_input_event_t &event)
+{
+    // Any touch wakes the display, a long press on the right button toggles the backlight
+    if (event.pressed) {
+        refresh_boost();
+        if (!display_get_backlight()) {
+            display_set_backlight(true);
+        }
+    }
+    else if (event.pad==1 && event.long_press) {
+        ESP_LOGI(TAG, "Toggle backlight");
+        display_set_backlight(!display_get_backlight());
     }
 }
-#endif
 
 
-static lv_timer_t *clock_timer;
+static lv_timer_t *clock_timer = nullptr;
 
 
 static void clock_timer_cb(lv_timer_t *timer)
@@ -146,8 +132,11 @@ static void clock_timer_cb(lv_timer_t *timer)
     
     strftime(strftime_buf, sizeof(strftime_buf), "%H:%M", &timeinfo);
 
+    // Setting the same text still invalidates the label, which keeps the refresh governor out of idle
     lv_arc_set_value(ui_clock_seconds, timeinfo.tm_sec);
-    lv_label_set_text(ui_clock_label, strftime_buf);
+    if (strcmp(lv_label_get_text(ui_clock_label), strftime_buf)!=0) {
+        lv_label_set_text(ui_clock_label, strftime_buf);
+    }
 }
 
 void clock_loaded(lv_event_t * e)
@@ -163,36 +152,177 @@ void clock_unloaded(lv_event_t * e)
     ESP_LOGI(TAG, "Clock unloaded");
 
     lv_timer_del(clock_timer);
+    clock_timer = nullptr;
+}
+
+
+static void on_time_sync(const app_time_sync_event_t &event)
+{
+    // Show the corrected time right away instead of at the next tick
+    if (clock_timer) {
+        clock_timer_cb(clock_timer);
+    }
 }
 
 
+static constexpr int64_t UI_EVENT_BUDGET_US { 2000 };
+
+using ui_event_bus = app_event_bus<
+    app_event_route<app_input_event_t, on_input>,
+    app_event_route<app_wifi_event_t>,
+    app_event_route<app_time_sync_event_t, on_time_sync>
+>;
+
+
+
+/** -------------------------------------------------------------------------------
+ * Boot phases
+ */
+
+enum : uint {
+    PHASE_PROFILER,
+    PHASE_BASE,
+    PHASE_DISPLAY,
+    PHASE_UI,
+    PHASE_WIFI,
+    PHASE_TIME,
+    PHASE_WIFI_POWER,
+    PHASE_INPUT,
+    PHASE_STORAGE,
+    PHASE_CONSOLE,
+    PHASE_HTTP,
+    PHASE_OTA,
+    PHASE_SCREENS,
+    PHASE_MIRROR,
+    PHASE_SCENE,
+    PHASE_DISPLAY_CFG,
+    PHASE_COMPOSITOR,
+    PHASE_REFRESH,
+    PHASE_RASTER,
+    PHASE_ARENA,
+    PHASE_COUNT
+};
+
+
+static void boot_profiling()
+{
+    profiler_init();
+    heap_prof_init();
+}
 
-extern "C" void app_main() 
+static void boot_http()
 {
-    app_base_init();
-    display_init();
-    wifi_init();
+    http_server_init();
+    metrics_init();
+    web_init();
+}
+
+static void boot_ui()
+{
+    // Build and show the first screen only, the rest are created by the screens phase
+    display_acquire();
+    lv_disp_t *disp = lv_disp_get_default();
+    lv_theme_t *theme = lv_theme_default_init(disp, lv_palette_main(LV_PALETTE_BLUE), lv_palette_main(LV_PALETTE_RED), true, LV_FONT_DEFAULT);
+    lv_disp_set_theme(disp, theme);
+    ui_Clock_screen_init();
+    lv_disp_load_scr(ui_Clock);
+    display_release();
+}
+
+static void boot_input()
+{
+    display_acquire();
     input_init();
+    display_release();
+}
+
+static void boot_screens()
+{
+    // Screens may already have been created on demand by a screen change
+    display_acquire();
+    if (!ui_Demo) ui_Demo_screen_init();
+    if (!ui_Demo1) ui_Demo1_screen_init();
+    if (!ui_Demo2) ui_Demo2_screen_init();
+    ui____initial_actions0 = lv_obj_create(nullptr);
+    display_release();
+}
 
+static void boot_mirror()
+{
+    mirror_init();
+    mirror_name_screen(ui_Clock, "clock");
+    mirror_name_screen(ui_Demo, "demo");
+    mirror_name_screen(ui_Demo1, "demo1");
+    mirror_name_screen(ui_Demo2, "demo2");
+}
+
+static void boot_refresh()
+{
+    display_acquire();
+    refresh_init();
+    display_release();
+}
 
-    ESP_LOGI(TAG, "Display init");
+static void boot_raster()
+{
     display_acquire();
-    ui_init();
-    //example_lvgl_demo_ui();
+    raster_init();
     display_release();
+}
+
+static void boot_compositor()
+{
+    // The corner panels are invisible touch areas, they never change
+    compositor_init();
+    lv_obj_t *clock_statics[] = { ui_left_panel_1, ui_right_panel_1 };
+    compositor_add_screen(ui_Clock, "clock", clock_statics, std::size(clock_statics));
+    lv_obj_t *demo2_statics[] = { ui_left_panel_4, ui_right_panel_4 };
+    compositor_add_screen(ui_Demo2, "demo2", demo2_statics, std::size(demo2_statics));
+}
 
-    console_init();
 
+static constexpr boot_phase_t BOOT_PHASES[PHASE_COUNT] = {
+    { "profiler", boot_profiling,                0,                                               0 },
+    { "base",     app_base_init,                 0,                                               0 },
+    { "display",  []() { display_init(); },      0,                                               1 },
+    { "ui",       boot_ui,                       boot_dep(PHASE_DISPLAY),                         1 },
+    { "wifi",     wifi_init,                     boot_dep(PHASE_BASE),                            0 },
+    { "time",     timekeeper_init,               boot_dep(PHASE_WIFI),                            0 },
+    { "wifi_ps",  wifi_power_init,               boot_dep(PHASE_TIME),                            0 },
+    { "input",    boot_input,                    boot_dep(PHASE_DISPLAY),                         1 },
+    { "storage",  app_storage_init,              0,                                               0 },
+    { "console",  console_init,                  boot_dep(PHASE_BASE) | boot_dep(PHASE_WIFI),     0 },
+    { "http",     boot_http,                     boot_dep(PHASE_WIFI) | boot_dep(PHASE_PROFILER), 0 },
+    { "ota",      ota_init,                      boot_dep(PHASE_WIFI),                            0 },
+    { "screens",  boot_screens,                  boot_dep(PHASE_UI),                              1 },
+    { "mirror",   boot_mirror,                   boot_dep(PHASE_SCREENS) | boot_dep(PHASE_WIFI),  0 },
+    { "scene",    scene_init,                    boot_dep(PHASE_SCREENS) | boot_dep(PHASE_WIFI),  0 },
+    { "disp_cfg", display_load_config,           boot_dep(PHASE_DISPLAY) | boot_dep(PHASE_BASE),  1 },
+    { "compose",  boot_compositor,               boot_dep(PHASE_SCREENS),                         1 },
+    { "refresh",  boot_refresh,                  boot_dep(PHASE_UI),                              1 },
+    { "raster",   boot_raster,                   boot_dep(PHASE_DISPLAY),                         1 },
+    { "arena",    arena_init,                    boot_dep(PHASE_BASE) | boot_dep(PHASE_COMPOSITOR) | boot_dep(PHASE_MIRROR), 0 },
+};
+
+
+
+extern "C" void app_main() 
+{
+    boot_start(BOOT_PHASES, PHASE_COUNT);
+
+    // Start rendering as soon as the first screen is ready
+    boot_wait(boot_dep(PHASE_UI));
 
     ESP_LOGI(TAG, "Running");
 
     TickType_t lastWakeTime = xTaskGetTickCount();
     while (true) {
+        uint32_t poll_ms = 1;
         if (display_acquire(pdMS_TO_TICKS(10))) {
-            lv_timer_handler();
-            //app_event_loop_run(pdMS_TO_TICKS(5));
+            poll_ms = refresh_poll_ms(lv_timer_handler());
+            ui_event_bus::dispatch(UI_EVENT_BUDGET_US);
             display_release();
         }
-        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(1));
+        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(poll_ms));
     }
 }
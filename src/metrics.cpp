@@ -0,0 +1,248 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "http_server.h"
+#include "display.h"
+#include "refresh.h"
+#include "profiler.h"
+#include "wifi.h"
+#include "wifi_power.h"
+#include "timekeeper.h"
+#include "input.h"
+#include "heap_prof.h"
+
+static constexpr char TAG[] = "metrics";
+
+static constexpr uint METRICS_CORE_COUNT { portNUM_PROCESSORS };
+
+// Only used from the HTTP server task
+static char g_buffer[METRICS_BUFFER_SIZE];
+static profiler_task_usage_t g_tasks[PROFILER_MAX_TASKS];
+
+
+class metrics_writer {
+    public:
+        metrics_writer(char *buf, size_t len) : m_buf(buf), m_len(len), m_pos(0) {}
+
+        void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+        {
+            if (m_pos>=m_len) {
+                return;
+            }
+            va_list args;
+            va_start(args, fmt);
+            int res = vsnprintf(m_buf+m_pos, m_len-m_pos, fmt, args);
+            va_end(args);
+            m_pos = res<0 ? m_len : m_pos+res;
+        }
+
+        void header(const char *name, const char *type, const char *help)
+        {
+            printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        }
+
+        bool overflow() const { return m_pos>=m_len; }
+        size_t length() const { return m_pos; }
+
+    private:
+        char *m_buf;
+        size_t m_len;
+        size_t m_pos;
+};
+
+
+static void render_display(metrics_writer &w)
+{
+    display_stats_t st;
+    if (!display_get_stats(&st, pdMS_TO_TICKS(100))) {
+        return;
+    }
+
+    w.header("display_frame_time_seconds", "summary", "LVGL render time, quantiles over the last frames");
+    w.printf("display_frame_time_seconds{quantile=\"0.5\"} %lu.%03lu\n", st.frame_time_p50_ms/1000, st.frame_time_p50_ms%1000);
+    w.printf("display_frame_time_seconds{quantile=\"0.9\"} %lu.%03lu\n", st.frame_time_p90_ms/1000, st.frame_time_p90_ms%1000);
+    w.printf("display_frame_time_seconds{quantile=\"0.99\"} %lu.%03lu\n", st.frame_time_p99_ms/1000, st.frame_time_p99_ms%1000);
+    w.printf("display_frame_time_seconds{quantile=\"1\"} %lu.%03lu\n", st.frame_time_max_ms/1000, st.frame_time_max_ms%1000);
+    w.printf("display_frame_time_seconds_sum %llu.%03llu\n", st.frame_time_sum_ms/1000, st.frame_time_sum_ms%1000);
+    w.printf("display_frame_time_seconds_count %lu\n", st.frames);
+
+    w.header("display_fps", "gauge", "Frames rendered in the last second");
+    w.printf("display_fps %lu\n", st.fps);
+
+    w.header("display_flush_bytes_total", "counter", "Pixel bytes sent to the panel");
+    w.printf("display_flush_bytes_total %llu\n", st.flush_bytes);
+
+    w.header("display_spi_busy_seconds_total", "counter", "Time from queuing a flush until its transfer finished");
+    w.printf("display_spi_busy_seconds_total %llu.%06llu\n", st.spi_busy_us/1000000, st.spi_busy_us%1000000);
+
+    w.header("display_flush_wait_seconds_total", "counter", "Time LVGL spent waiting for a flush to finish");
+    w.printf("display_flush_wait_seconds_total %llu.%06llu\n", st.flush_wait_us/1000000, st.flush_wait_us%1000000);
+
+    refresh_stats_t refresh;
+    refresh_get_stats(&refresh);
+    w.header("display_refresh_tier_seconds_total", "counter", "Time spent in each refresh rate tier");
+    for (uint i=0; i<REFRESH_TIER_COUNT; i++) {
+        auto tier = static_cast<refresh_tier_t>(i);
+        w.printf("display_refresh_tier_seconds_total{tier=\"%s\"} %llu.%03llu\n", refresh_tier_name(tier), refresh.tier_ms[i]/1000, refresh.tier_ms[i]%1000);
+    }
+    w.header("display_refresh_tier_frames_total", "counter", "Frames rendered in each refresh rate tier");
+    for (uint i=0; i<REFRESH_TIER_COUNT; i++) {
+        auto tier = static_cast<refresh_tier_t>(i);
+        w.printf("display_refresh_tier_frames_total{tier=\"%s\"} %lu\n", refresh_tier_name(tier), refresh.tier_frames[i]);
+    }
+}
+
+
+static void render_heap(metrics_writer &w)
+{
+    heap_prof_region_stats_t stats[HEAP_PROF_REGION_COUNT];
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        heap_prof_region_stats(static_cast<heap_prof_region_t>(i), stats[i]);
+    }
+    auto name = [](uint i) { return heap_prof_region_name(static_cast<heap_prof_region_t>(i)); };
+
+    w.header("heap_size_bytes", "gauge", "Heap size per region, internal excludes the DMA capable heaps");
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        w.printf("heap_size_bytes{region=\"%s\"} %lu\n", name(i), stats[i].total);
+    }
+    w.header("heap_free_bytes", "gauge", "Free heap per region");
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        w.printf("heap_free_bytes{region=\"%s\"} %lu\n", name(i), stats[i].free);
+    }
+    w.header("heap_min_free_bytes", "gauge", "Lowest free heap per region since boot, estimated for internal");
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        w.printf("heap_min_free_bytes{region=\"%s\"} %lu\n", name(i), stats[i].min_free);
+    }
+    w.header("heap_largest_free_block_bytes", "gauge", "Largest free block per region, bounded by the free space for internal");
+    for (uint i=0; i<HEAP_PROF_REGION_COUNT; i++) {
+        w.printf("heap_largest_free_block_bytes{region=\"%s\"} %lu\n", name(i), stats[i].largest);
+    }
+}
+
+
+static void render_tasks(metrics_writer &w)
+{
+    uint32_t window_ms = METRICS_TASK_WINDOW_MS;
+    uint32_t core_load[METRICS_CORE_COUNT];
+    uint count = profiler_get_usage(&window_ms, g_tasks, PROFILER_MAX_TASKS, core_load);
+    if (count==0) {
+        return;
+    }
+
+    w.header("cpu_core_load_ratio", "gauge", "Load per core over the profiler window");
+    for (uint core=0; core<METRICS_CORE_COUNT; core++) {
+        w.printf("cpu_core_load_ratio{core=\"%u\"} %lu.%03lu\n", core, core_load[core]/1000, core_load[core]%1000);
+    }
+
+    w.header("task_cpu_ratio", "gauge", "CPU time per task over the profiler window, fraction of one core");
+    for (uint i=0; i<count; i++) {
+        auto &task = g_tasks[i];
+        char core = task.core==tskNO_AFFINITY ? '-' : ('0'+task.core);
+        w.printf("task_cpu_ratio{task=\"%s\",core=\"%c\"} %lu.%03lu\n", task.name, core, task.cpu/1000, task.cpu%1000);
+    }
+
+    w.header("task_stack_free_bytes", "gauge", "Stack high water mark per task");
+    for (uint i=0; i<count; i++) {
+        w.printf("task_stack_free_bytes{task=\"%s\"} %lu\n", g_tasks[i].name, g_tasks[i].stack);
+    }
+}
+
+
+static void render_wifi(metrics_writer &w)
+{
+    wifi_stats_t st;
+    wifi_get_stats(&st);
+
+    w.header("wifi_connected", "gauge", "Station associated with an AP");
+    w.printf("wifi_connected %d\n", st.connected);
+
+    w.header("wifi_rssi_dbm", "gauge", "Signal strength of the current AP");
+    if (st.connected) {
+        w.printf("wifi_rssi_dbm %d\n", st.rssi);
+    }
+    else {
+        w.printf("wifi_rssi_dbm NaN\n");
+    }
+
+    w.header("wifi_reconnects_total", "counter", "Reconnect attempts after losing the AP");
+    w.printf("wifi_reconnects_total %lu\n", st.reconnects);
+}
+
+
+static void render_time(metrics_writer &w)
+{
+    timekeeper_stats_t st;
+    timekeeper_get_stats(&st);
+
+    w.header("sntp_sync_age_seconds", "gauge", "Time since the last SNTP synchronization");
+    if (st.last_sync_us) {
+        w.printf("sntp_sync_age_seconds %lld\n", (esp_timer_get_time() - st.last_sync_us) / 1000000);
+    }
+    else {
+        w.printf("sntp_sync_age_seconds NaN\n");
+    }
+
+    w.header("sntp_offset_microseconds", "gauge", "Clock offset measured by the last synchronization");
+    w.printf("sntp_offset_microseconds %lld\n", st.offset_us);
+
+    w.header("sntp_interval_seconds", "gauge", "Current synchronization interval");
+    w.printf("sntp_interval_seconds %lu\n", st.interval_s);
+
+    w.header("clock_drift_ppb", "gauge", "Learned crystal drift correction");
+    w.printf("clock_drift_ppb %ld\n", st.drift_ppb);
+
+    w.header("sntp_steps_total", "counter", "Clock steps instead of slews");
+    w.printf("sntp_steps_total %lu\n", st.steps);
+}
+
+
+size_t metrics_render(char *buf, size_t len)
+{
+    metrics_writer w(buf, len);
+
+    w.header("uptime_seconds", "counter", "Time since boot");
+    w.printf("uptime_seconds %lld\n", esp_timer_get_time() / 1000000);
+
+    render_display(w);
+    render_heap(w);
+    render_tasks(w);
+    render_wifi(w);
+    render_time(w);
+
+    w.header("input_touch_events_total", "counter", "Touch button presses and releases");
+    w.printf("input_touch_events_total %lu\n", input_event_count());
+
+    return w.overflow() ? 0 : w.length();
+}
+
+
+static esp_err_t on_metrics(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_METRICS);
+    size_t len = metrics_render(g_buffer, sizeof(g_buffer));
+    if (len==0) {
+        ESP_LOGE(TAG, "Metrics exceed %u bytes", sizeof(g_buffer));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Metrics buffer too small");
+    }
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    return httpd_resp_send(req, g_buffer, len);
+}
+
+
+
+void metrics_init()
+{
+    static constexpr httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = on_metrics,
+        .user_ctx = nullptr,
+    };
+    http_server_register(&uri);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Prometheus metrics
+ *
+ * Serves GET /metrics in the Prometheus text format from the HTTP server.
+ * Metrics are rendered into a static buffer, a scrape does not allocate.
+ */
+static constexpr size_t METRICS_BUFFER_SIZE { 8192 };
+static constexpr uint32_t METRICS_TASK_WINDOW_MS { 10000 };
+
+void metrics_init();
+
+/** Render all metrics, returns the length or 0 if the buffer was too small */
+size_t metrics_render(char *buf, size_t len);
@@ -0,0 +1,386 @@
+#include "mirror.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lwip/sockets.h>
+
+#include "mirror_codec.h"
+#include "display.h"
+#include "wifi_power.h"
+#include "arena.h"
+
+static constexpr char TAG[] = "mirror";
+
+static constexpr uint32_t MIRROR_TASK_STACK_SIZE { 4096 };
+static constexpr UBaseType_t MIRROR_TASK_PRIORITY { 1 };
+static constexpr uint MIRROR_MAX_ROWS { 480 };
+static constexpr uint MIRROR_MAX_COLUMNS { 480 };
+static constexpr size_t MIRROR_SEND_BUFFER_SIZE { 4096 };
+static constexpr uint32_t MIRROR_SEND_TIMEOUT_MS { 5000 };
+static constexpr uint32_t MIRROR_IDLE_POLL_MS { 1000 };
+
+
+
+struct screen_stats_t {
+    const lv_obj_t *screen;
+    const char *name;
+    uint64_t bytes;
+    uint64_t time_us;
+    uint32_t frames;
+};
+
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t g_task = nullptr;
+static uint g_width = 0;
+static uint g_height = 0;
+static lv_color_t *g_pending = nullptr;     // Written by the flush tap
+static lv_color_t *g_shadow = nullptr;      // What the client has
+static uint32_t g_dirty[MIRROR_MAX_ROWS/32];
+
+static struct {
+    bool connected;
+    uint32_t sessions;
+    uint32_t frames;
+    uint64_t sent_bytes;
+    uint64_t flushed_bytes;
+    uint64_t session_start_us;
+    screen_stats_t screens[MIRROR_MAX_SCREENS];
+    uint screen_count;
+} g_stats;
+
+// Only used from the mirror task
+static int g_client = -1;
+static uint8_t g_out[MIRROR_SEND_BUFFER_SIZE];
+static size_t g_out_len = 0;
+static uint64_t g_out_total = 0;
+static bool g_send_error = false;
+static lv_color_t g_row[MIRROR_MAX_COLUMNS];
+
+
+/** -------------------------------------------------------------------------------
+ * Flush tap
+ */
+
+static void on_flush(const lv_area_t *area, const lv_color_t *pixels)
+{
+    // Clip to the mirrored framebuffer, the source rows keep the flushed width
+    const int x1 = std::max<int>(area->x1, 0);
+    const int x2 = std::min<int>(area->x2, g_width-1);
+    const int y1 = std::max<int>(area->y1, 0);
+    const int y2 = std::min<int>(area->y2, g_height-1);
+    if (x1>x2 || y1>y2) {
+        return;
+    }
+    const uint stride = area->x2 - area->x1 + 1;
+    const uint w = x2 - x1 + 1;
+    pixels += (y1 - area->y1)*stride + (x1 - area->x1);
+    for (int y=y1; y<=y2; y++) {
+        memcpy(g_pending + y*g_width + x1, pixels, w*sizeof(lv_color_t));
+        pixels += stride;
+    }
+    // Marked after the copy, a row cleared by the encoder meanwhile is sent again
+    portENTER_CRITICAL(&g_lock);
+    for (int y=y1; y<=y2; y++) {
+        g_dirty[y/32] |= 1ul << (y%32);
+    }
+    g_stats.flushed_bytes += (y2 - y1 + 1) * w * sizeof(lv_color_t);
+    portEXIT_CRITICAL(&g_lock);
+
+    xTaskNotifyGive(g_task);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Encoder
+ */
+
+static void flush_out()
+{
+    size_t pos = 0;
+    while (pos<g_out_len && !g_send_error) {
+        int res = send(g_client, g_out+pos, g_out_len-pos, 0);
+        if (res<=0) {
+            g_send_error = true;
+            break;
+        }
+        pos += res;
+    }
+    g_out_len = 0;
+}
+
+
+static void out(const void *data, size_t len)
+{
+    if (g_out_len+len>sizeof(g_out)) {
+        flush_out();
+    }
+    memcpy(g_out+g_out_len, data, len);
+    g_out_len += len;
+    g_out_total += len;
+}
+
+static inline void out_u8(uint8_t value)
+{
+    mirror_out_u8(out, value);
+}
+
+static inline void out_u16(uint16_t value)
+{
+    mirror_out_u16(out, value);
+}
+
+
+/** Encode a row against the shadow, returns false if nothing changed */
+static bool encode_row(uint y, const lv_color_t *cur, lv_color_t *prev)
+{
+    static_assert(sizeof(lv_color_t)==sizeof(uint16_t), "The mirror stream carries RGB565 pixels");
+    return mirror_encode_row(out, y, reinterpret_cast<const uint16_t*>(cur), reinterpret_cast<uint16_t*>(prev), g_width);
+}
+
+
+/** Send the rows changed since the last frame, returns the encoded size */
+static size_t send_frame()
+{
+    const uint64_t start = g_out_total;
+    bool any = false;
+    for (uint y=0; y<g_height; y++) {
+        const uint32_t mask = 1ul << (y%32);
+        portENTER_CRITICAL(&g_lock);
+        bool dirty = g_dirty[y/32] & mask;
+        g_dirty[y/32] &= ~mask;
+        portEXIT_CRITICAL(&g_lock);
+        if (!dirty) {
+            continue;
+        }
+        // Work on a copy, the tap may write the row again while it is encoded
+        memcpy(g_row, g_pending + y*g_width, g_width*sizeof(lv_color_t));
+        any |= encode_row(y, g_row, g_shadow + y*g_width);
+    }
+    if (!any) {
+        return 0;
+    }
+    out_u16(MIRROR_END_OF_FRAME);
+    flush_out();
+    return g_out_total - start;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Sessions
+ */
+
+/** Statistics slot of a screen, call with the lock held */
+static screen_stats_t *screen_stats(const lv_obj_t *screen)
+{
+    for (uint i=0; i<g_stats.screen_count; i++) {
+        if (g_stats.screens[i].screen==screen) {
+            return &g_stats.screens[i];
+        }
+    }
+    if (g_stats.screen_count<MIRROR_MAX_SCREENS) {
+        auto &slot = g_stats.screens[g_stats.screen_count++];
+        slot = { .screen = screen, .name = nullptr, .bytes = 0, .time_us = 0, .frames = 0 };
+        return &slot;
+    }
+    return nullptr;
+}
+
+
+static void run_session()
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&g_lock);
+    g_stats.connected = true;
+    g_stats.sessions++;
+    g_stats.session_start_us = now;
+    memset(g_dirty, 0, sizeof(g_dirty));
+    portEXIT_CRITICAL(&g_lock);
+
+    // The client starts out black, like the shadow
+    memset(g_shadow, 0, g_width*g_height*sizeof(lv_color_t));
+    g_send_error = false;
+    g_out_len = 0;
+    out(MIRROR_MAGIC, sizeof(MIRROR_MAGIC));
+    out_u16(g_width);
+    out_u16(g_height);
+    out_u8(LV_COLOR_16_SWAP ? 0x01 : 0x00);
+    flush_out();
+
+    // Redraw everything once so the pending framebuffer is complete
+    display_set_flush_tap(on_flush);
+    display_acquire();
+    lv_obj_invalidate(lv_scr_act());
+    display_release();
+
+    int64_t next_frame = 0;
+    int64_t last_account = now;
+    while (!g_send_error) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MIRROR_IDLE_POLL_MS));
+        now = esp_timer_get_time();
+        if (now<next_frame) {
+            vTaskDelay(pdMS_TO_TICKS((next_frame-now)/1000) + 1);
+            now = esp_timer_get_time();
+        }
+
+        // Notice a closed connection even when nothing changes on screen
+        char probe;
+        int res = recv(g_client, &probe, sizeof(probe), MSG_DONTWAIT);
+        if (res==0 || (res<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)) {
+            break;
+        }
+
+        // Read without the display lock, only the pointer is used
+        const lv_obj_t *active = lv_disp_get_scr_act(nullptr);
+        size_t bytes = send_frame();
+
+        portENTER_CRITICAL(&g_lock);
+        screen_stats_t *screen = screen_stats(active);
+        if (screen) {
+            screen->time_us += now - last_account;
+        }
+        if (bytes) {
+            g_stats.frames++;
+            g_stats.sent_bytes += bytes;
+            if (screen) {
+                screen->frames++;
+                screen->bytes += bytes;
+            }
+        }
+        portEXIT_CRITICAL(&g_lock);
+        last_account = now;
+        if (bytes==0) {
+            continue;
+        }
+        wifi_power_demand(WIFI_DEMAND_MIRROR);
+
+        // Rate limit by frame count and by bandwidth
+        next_frame = now + std::max<int64_t>(1000000/MIRROR_MAX_FPS, bytes*1000000ull/MIRROR_MAX_RATE);
+    }
+
+    display_set_flush_tap(nullptr);
+    portENTER_CRITICAL(&g_lock);
+    g_stats.connected = false;
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+static void mirror_task(__unused void *param)
+{
+    int server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(MIRROR_PORT);
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (server<0 || bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))!=0 || listen(server, 1)!=0) {
+        ESP_LOGE(TAG, "Error listening on port %u", MIRROR_PORT);
+        vTaskDelete(nullptr);
+        return;
+    }
+    ESP_LOGI(TAG, "Listening on port %u", MIRROR_PORT);
+
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        g_client = accept(server, reinterpret_cast<struct sockaddr*>(&peer), &peer_len);
+        if (g_client<0) {
+            continue;
+        }
+        int nodelay = 1;
+        setsockopt(g_client, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        struct timeval timeout = { .tv_sec = MIRROR_SEND_TIMEOUT_MS/1000, .tv_usec = 0 };
+        setsockopt(g_client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        ESP_LOGI(TAG, "Client %s connected", ip);
+        run_session();
+        ESP_LOGI(TAG, "Client %s disconnected", ip);
+
+        close(g_client);
+        g_client = -1;
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public interface
+ */
+
+void mirror_init()
+{
+    lv_disp_t *disp = display_get();
+    // Larger panels are mirrored cropped to the top left corner
+    g_width = std::min<uint>(lv_disp_get_hor_res(disp), MIRROR_MAX_COLUMNS);
+    g_height = std::min<uint>(lv_disp_get_ver_res(disp), MIRROR_MAX_ROWS);
+
+    const size_t size = g_width*g_height*sizeof(lv_color_t);
+    g_pending = static_cast<lv_color_t*>(arena_calloc(ARENA_NET, 1, size));
+    g_shadow = static_cast<lv_color_t*>(arena_calloc(ARENA_NET, 1, size));
+    if (!g_pending || !g_shadow) {
+        ESP_LOGE(TAG, "Error allocating framebuffers");
+        return;
+    }
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[MIRROR_TASK_STACK_SIZE];
+    g_task = xTaskCreateStatic(mirror_task, "mirror", MIRROR_TASK_STACK_SIZE, nullptr, MIRROR_TASK_PRIORITY, task_stack, &task_buffer);
+}
+
+
+void mirror_name_screen(const lv_obj_t *screen, const char *name)
+{
+    portENTER_CRITICAL(&g_lock);
+    screen_stats_t *stats = screen_stats(screen);
+    if (stats) {
+        stats->name = name;
+    }
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+void mirror_print_stats()
+{
+    portENTER_CRITICAL(&g_lock);
+    auto st = g_stats;
+    portEXIT_CRITICAL(&g_lock);
+
+    printf("Port %u, %s, %lu sessions\n", MIRROR_PORT, st.connected ? "client connected" : "no client", st.sessions);
+    if (st.sessions==0) {
+        return;
+    }
+    printf("Frames %lu, sent %llu bytes for %llu flushed", st.frames, st.sent_bytes, st.flushed_bytes);
+    if (st.flushed_bytes) {
+        printf(" (%llu%%)", st.sent_bytes*100/st.flushed_bytes);
+    }
+    printf("\n\nScreen         Time s   Frames   Avg bytes     kB/s\n");
+    printf("---------------------------------------------------\n");
+    for (uint i=0; i<st.screen_count; i++) {
+        const auto &screen = st.screens[i];
+        if (screen.time_us==0) {
+            continue;
+        }
+        char name[16];
+        if (screen.name) {
+            snprintf(name, sizeof(name), "%s", screen.name);
+        }
+        else {
+            snprintf(name, sizeof(name), "%p", screen.screen);
+        }
+        printf("%-12s %8llu %8lu %11llu %8llu\n", name, screen.time_us/1000000, screen.frames,
+            screen.frames ? screen.bytes/screen.frames : 0,
+            screen.bytes*1000000/screen.time_us/1024);
+    }
+}
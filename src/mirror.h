@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <lvgl.h>
+
+/**
+ * Framebuffer mirror
+ *
+ * Streams what the panel shows to one TCP client on MIRROR_PORT, view it with
+ * tools/mirror_view.py. While a client is connected a display flush tap copies
+ * every flushed area into a PSRAM framebuffer and marks its rows dirty. A low
+ * priority task encodes the dirty rows against the last frame sent, so the
+ * rendering and SPI path never wait on the network. Frames are limited to
+ * MIRROR_MAX_FPS and MIRROR_MAX_RATE bytes per second, updates in between are
+ * coalesced.
+ *
+ * Stream format, integers little endian:
+ *
+ *   hello:  "DBM1" u16 width, u16 height, u8 flags (bit 0: pixels byte swapped)
+ *   frame:  rows, then u16 0xffff
+ *   row:    u16 y, ops, then 0x00
+ *   ops:    0x01-0x7f          skip n unchanged pixels
+ *           0x80-0xbf + u16    n-0x7f pixels of one color
+ *           0xc0-0xff + pixels n-0xbf literal RGB565 pixels
+ *
+ * The encoder is in mirror_codec.h.
+ */
+static constexpr uint16_t MIRROR_PORT { 5555 };
+static constexpr uint MIRROR_MAX_FPS { 10 };
+static constexpr uint32_t MIRROR_MAX_RATE { 256*1024 };
+static constexpr uint MIRROR_MAX_SCREENS { 8 };
+
+void mirror_init();
+
+/** Name a screen for the per screen bandwidth statistics */
+void mirror_name_screen(const lv_obj_t *screen, const char *name);
+
+void mirror_print_stats();
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+
+/**
+ * Mirror stream encoder
+ *
+ * Encodes rows of 16 bit pixels against the client's copy in the format
+ * described in mirror.h. It has no IDF or LVGL dependencies, so the host
+ * tests in test/ run the same code as the device. Output goes to a callable
+ * out(const void *data, size_t len), pixels are written as they are in
+ * memory.
+ */
+static constexpr char MIRROR_MAGIC[4] = { 'D', 'B', 'M', '1' };
+static constexpr uint16_t MIRROR_END_OF_FRAME { 0xffff };
+static constexpr uint8_t MIRROR_OP_END_OF_ROW { 0x00 };
+static constexpr uint MIRROR_OP_MAX_SKIP { 0x7f };
+static constexpr uint8_t MIRROR_OP_RUN { 0x80 };
+static constexpr uint8_t MIRROR_OP_LITERAL { 0xc0 };
+static constexpr uint MIRROR_OP_MAX_COUNT { 0x40 };
+static constexpr uint MIRROR_RUN_MIN_LENGTH { 3 };      // Shorter runs are cheaper as literals
+static constexpr uint MIRROR_SKIP_MIN_LENGTH { 2 };     // A single unchanged pixel is sent as part of a literal
+
+
+template<typename OUT>
+static inline void mirror_out_u8(OUT &out, uint8_t value)
+{
+    out(&value, sizeof(value));
+}
+
+template<typename OUT>
+static inline void mirror_out_u16(OUT &out, uint16_t value)
+{
+    uint8_t le[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value>>8) };
+    out(le, sizeof(le));
+}
+
+
+/** Encode pixels [x, end) that differ from the client's copy */
+template<typename OUT>
+void mirror_encode_changed(OUT &out, const uint16_t *cur, uint x, uint end)
+{
+    while (x<end) {
+        uint run = 1;
+        while (x+run<end && run<MIRROR_OP_MAX_COUNT && cur[x+run]==cur[x]) {
+            run++;
+        }
+        if (run>=MIRROR_RUN_MIN_LENGTH) {
+            mirror_out_u8(out, MIRROR_OP_RUN | (run-1));
+            out(&cur[x], sizeof(uint16_t));
+            x += run;
+            continue;
+        }
+        // Literal up to the next run worth encoding
+        uint len = 0;
+        while (x+len<end && len<MIRROR_OP_MAX_COUNT) {
+            if (x+len+MIRROR_RUN_MIN_LENGTH<=end && cur[x+len]==cur[x+len+1] && cur[x+len]==cur[x+len+2]) {
+                break;
+            }
+            len++;
+        }
+        mirror_out_u8(out, MIRROR_OP_LITERAL | (len-1));
+        out(&cur[x], len*sizeof(uint16_t));
+        x += len;
+    }
+}
+
+
+/**
+ * Encode row y against prev, the client's copy, and update prev. Returns
+ * false without output if nothing changed.
+ */
+template<typename OUT>
+bool mirror_encode_row(OUT &out, uint y, const uint16_t *cur, uint16_t *prev, uint width)
+{
+    if (memcmp(cur, prev, width*sizeof(uint16_t))==0) {
+        return false;
+    }
+
+    mirror_out_u16(out, y);
+    // Starts at the left edge, the decoder places spans by the skips before them
+    uint x = 0;
+    while (x<width) {
+        uint skip = 0;
+        while (x+skip<width && cur[x+skip]==prev[x+skip]) {
+            skip++;
+        }
+        if (x+skip==width) {
+            break;
+        }
+        x += skip;
+        while (skip>0) {
+            uint n = std::min(skip, MIRROR_OP_MAX_SKIP);
+            mirror_out_u8(out, n);
+            skip -= n;
+        }
+
+        // Changed span ends at the first stretch of unchanged pixels worth skipping
+        uint end = x;
+        uint same = 0;
+        while (end+same<width && same<MIRROR_SKIP_MIN_LENGTH) {
+            if (cur[end+same]==prev[end+same]) {
+                same++;
+            }
+            else {
+                end += same + 1;
+                same = 0;
+            }
+        }
+        mirror_encode_changed(out, cur, x, end);
+        x = end;
+    }
+    mirror_out_u8(out, MIRROR_OP_END_OF_ROW);
+
+    memcpy(prev, cur, width*sizeof(uint16_t));
+    return true;
+}
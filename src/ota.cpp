@@ -0,0 +1,341 @@
+#include "ota.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_ota_ops.h>
+#include <esp_http_client.h>
+#include <esp_heap_caps.h>
+#include <esp_app_desc.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <rom/miniz.h>
+
+#include "boot.h"
+#include "display.h"
+#include "wifi.h"
+#include "wifi_power.h"
+#include "arena.h"
+
+static constexpr char TAG[] = "ota";
+
+static constexpr uint32_t OTA_HEALTH_STACK_SIZE { 3072 };
+static constexpr UBaseType_t OTA_HEALTH_PRIORITY { 1 };
+static constexpr uint32_t OTA_HEALTH_POLL_MS { 500 };
+static constexpr int OTA_HTTP_TIMEOUT_MS { 10000 };
+static constexpr uint8_t ESP_IMAGE_MAGIC { 0xE9 };
+
+
+// State of an update in progress
+struct ota_session_t {
+    esp_ota_handle_t handle;
+    ota_report_t *report;
+    tinfl_decompressor *inflator;
+    uint8_t *window;            // TINFL_LZ_DICT_SIZE ring the inflator writes into
+    size_t window_pos;
+    size_t free_internal;
+    size_t free_psram;
+    size_t min_internal;
+    size_t min_psram;
+};
+
+
+static inline uint32_t elapsed_ms(int64_t start)
+{
+    return (esp_timer_get_time() - start) / 1000;
+}
+
+
+static void track_heap(ota_session_t &s)
+{
+    s.min_internal = std::min(s.min_internal, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    s.min_psram = std::min(s.min_psram, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+
+static esp_err_t flash(ota_session_t &s, const uint8_t *data, size_t len)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t res = esp_ota_write(s.handle, data, len);
+    s.report->flash_ms += elapsed_ms(start);
+    s.report->image_bytes += len;
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "Error writing flash: %s", esp_err_to_name(res));
+    }
+    return res;
+}
+
+
+/** Feed compressed input, flashing output whenever the inflator produces some */
+static esp_err_t inflate(ota_session_t &s, const uint8_t *data, size_t len, bool last)
+{
+    const mz_uint32 flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (last ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+    while (true) {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - s.window_pos;
+
+        int64_t start = esp_timer_get_time();
+        tinfl_status status = tinfl_decompress(s.inflator, data, &in_bytes, s.window, s.window+s.window_pos, &out_bytes, flags);
+        s.report->inflate_ms += elapsed_ms(start);
+        data += in_bytes;
+        len -= in_bytes;
+
+        if (out_bytes) {
+            esp_err_t res = flash(s, s.window+s.window_pos, out_bytes);
+            if (res!=ESP_OK) {
+                return res;
+            }
+            s.window_pos = (s.window_pos + out_bytes) & (TINFL_LZ_DICT_SIZE-1);
+        }
+        if (status<TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupt compressed image (%d)", status);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (status==TINFL_STATUS_DONE) {
+            return len==0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+        }
+        if (status==TINFL_STATUS_NEEDS_MORE_INPUT && len==0) {
+            return last ? ESP_ERR_INVALID_SIZE : ESP_OK;
+        }
+    }
+}
+
+
+static esp_err_t stream(ota_session_t &s, esp_http_client_handle_t client, uint8_t *buffer)
+{
+    bool first = true;
+    while (true) {
+        int64_t start = esp_timer_get_time();
+        int len = esp_http_client_read(client, reinterpret_cast<char*>(buffer), OTA_BUFFER_SIZE);
+        s.report->network_ms += elapsed_ms(start);
+        if (len<0) {
+            ESP_LOGE(TAG, "Error reading response");
+            return ESP_FAIL;
+        }
+        bool last = len==0;
+        if (last && !esp_http_client_is_complete_data_received(client)) {
+            ESP_LOGE(TAG, "Connection closed after %u bytes", s.report->download_bytes);
+            return ESP_FAIL;
+        }
+        s.report->download_bytes += len;
+        wifi_power_demand(WIFI_DEMAND_INGEST);
+
+        if (first && len>0) {
+            first = false;
+            // Plain images start with the image header, anything else must be a zlib stream
+            s.report->compressed = buffer[0]!=ESP_IMAGE_MAGIC;
+            if (s.report->compressed) {
+                s.inflator = static_cast<tinfl_decompressor*>(arena_alloc(ARENA_NET, sizeof(tinfl_decompressor)));
+                s.window = static_cast<uint8_t*>(arena_alloc(ARENA_NET, TINFL_LZ_DICT_SIZE));
+                if (!s.inflator || !s.window) {
+                    ESP_LOGE(TAG, "Error allocating inflate buffers");
+                    return ESP_ERR_NO_MEM;
+                }
+                tinfl_init(s.inflator);
+            }
+        }
+
+        esp_err_t res = ESP_OK;
+        if (s.report->compressed) {
+            res = inflate(s, buffer, len, last);
+        }
+        else if (len>0) {
+            res = flash(s, buffer, len);
+        }
+        track_heap(s);
+        if (res!=ESP_OK || last) {
+            return res;
+        }
+    }
+}
+
+
+static void health_task(__unused void *param)
+{
+    int64_t start = esp_timer_get_time();
+    bool healthy = boot_wait_all(pdMS_TO_TICKS(OTA_HEALTH_TIMEOUT_MS));
+    while (healthy) {
+        // The image must render and be able to fetch the next update
+        display_stats_t st;
+        if (wifi_has_ip() && display_get_stats(&st, pdMS_TO_TICKS(OTA_HEALTH_POLL_MS)) && st.frames>0) {
+            break;
+        }
+        if (elapsed_ms(start)>=OTA_HEALTH_TIMEOUT_MS) {
+            healthy = false;
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTA_HEALTH_POLL_MS));
+    }
+
+    if (healthy) {
+        ESP_LOGI(TAG, "Health check passed after %lu ms, image confirmed", elapsed_ms(start));
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+    else {
+        ESP_LOGE(TAG, "Health check failed, rolling back");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+    vTaskDelete(nullptr);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public interface
+ */
+
+void ota_init()
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state)!=ESP_OK || state!=ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Verifying new image in %s", running->label);
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[OTA_HEALTH_STACK_SIZE];
+    xTaskCreateStatic(health_task, "ota_health", OTA_HEALTH_STACK_SIZE, nullptr, OTA_HEALTH_PRIORITY, task_stack, &task_buffer);
+}
+
+
+esp_err_t ota_update(const char *url, ota_report_t *report)
+{
+    memset(report, 0, sizeof(*report));
+    int64_t start = esp_timer_get_time();
+
+    const esp_partition_t *part = esp_ota_get_next_update_partition(nullptr);
+    if (!part) {
+        ESP_LOGE(TAG, "No update partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ota_session_t s;
+    memset(&s, 0, sizeof(s));
+    s.report = report;
+    s.free_internal = s.min_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    s.free_psram = s.min_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+
+    uint8_t *buffer = static_cast<uint8_t*>(arena_alloc(ARENA_DMA, OTA_BUFFER_SIZE));
+    if (!buffer) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.timeout_ms = OTA_HTTP_TIMEOUT_MS;
+    config.buffer_size = OTA_BUFFER_SIZE;
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+
+    esp_err_t res = esp_http_client_open(client, 0);
+    if (res==ESP_OK) {
+        int64_t content_length = esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        if (status!=200) {
+            ESP_LOGE(TAG, "HTTP status %d", status);
+            res = ESP_ERR_NOT_FOUND;
+        }
+        else {
+            ESP_LOGI(TAG, "Writing %lld bytes from %s to %s", content_length, url, part->label);
+            int64_t erase_start = esp_timer_get_time();
+            // Sequential writes erase sector by sector, no up front erase of the whole slot
+            res = esp_ota_begin(part, OTA_WITH_SEQUENTIAL_WRITES, &s.handle);
+            report->flash_ms += elapsed_ms(erase_start);
+            if (res==ESP_OK) {
+                res = stream(s, client, buffer);
+                int64_t end_start = esp_timer_get_time();
+                if (res==ESP_OK) {
+                    // Verifies the image checksum
+                    res = esp_ota_end(s.handle);
+                }
+                else {
+                    esp_ota_abort(s.handle);
+                }
+                report->flash_ms += elapsed_ms(end_start);
+            }
+        }
+    }
+    else {
+        ESP_LOGE(TAG, "Error connecting: %s", esp_err_to_name(res));
+    }
+    track_heap(s);
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    arena_free(ARENA_NET, s.window);
+    arena_free(ARENA_NET, s.inflator);
+    arena_free(ARENA_DMA, buffer);
+
+    if (res==ESP_OK) {
+        res = esp_ota_set_boot_partition(part);
+    }
+    report->total_ms = elapsed_ms(start);
+    report->peak_internal_bytes = s.free_internal - s.min_internal;
+    report->peak_psram_bytes = s.free_psram - s.min_psram;
+
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "Update failed: %s", esp_err_to_name(res));
+    }
+    return res;
+}
+
+
+bool ota_rollback()
+{
+    const esp_partition_t *part = esp_ota_get_next_update_partition(nullptr);
+    // Refuses partitions without a valid image
+    esp_err_t res = part ? esp_ota_set_boot_partition(part) : ESP_ERR_NOT_FOUND;
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "No image to roll back to: %s", esp_err_to_name(res));
+        return false;
+    }
+    ESP_LOGI(TAG, "Booting %s at next restart", part->label);
+    return true;
+}
+
+
+void ota_print_report(const ota_report_t &report)
+{
+    uint32_t kbps = report.total_ms ? report.download_bytes / report.total_ms : 0;
+    printf("  Download: %u bytes, %s\n", report.download_bytes, report.compressed ? "compressed" : "plain");
+    // A failed download may not have produced any image bytes
+    if (report.compressed && report.image_bytes) {
+        printf("     Image: %u bytes, ratio %u%%\n", report.image_bytes, report.download_bytes*100/report.image_bytes);
+    }
+    printf("      Time: %lu ms total, %lu kB/s\n", report.total_ms, kbps);
+    printf("            network %lu ms, inflate %lu ms, flash %lu ms\n", report.network_ms, report.inflate_ms, report.flash_ms);
+    printf("  Peak RAM: internal %u bytes, psram %u bytes\n", report.peak_internal_bytes, report.peak_psram_bytes);
+}
+
+
+static const char *state_name(esp_ota_img_states_t state)
+{
+    // ESP_OTA_IMG_UNDEFINED is 0xFFFFFFFF, the other states count up from 0
+    static constexpr const char *STATE_NAMES[] = { "new", "pending verify", "valid", "invalid", "aborted" };
+    if (state==ESP_OTA_IMG_UNDEFINED) {
+        return "undefined";
+    }
+    return static_cast<uint32_t>(state)<std::size(STATE_NAMES) ? STATE_NAMES[state] : "-";
+}
+
+
+void ota_print_status()
+{
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    const esp_app_desc_t *desc = esp_app_get_description();
+    printf("Running: %s, version %s\n", running->label, desc->version);
+
+    for (auto it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, nullptr); it; it = esp_partition_next(it)) {
+        const esp_partition_t *part = esp_partition_get(it);
+        esp_ota_img_states_t state;
+        const char *name = esp_ota_get_state_partition(part, &state)==ESP_OK ? state_name(state) : "-";
+        printf("  %-6s 0x%06lx %-14s%s%s\n", part->label, part->address, name,
+            part==running ? " running" : "",
+            part==boot ? " boot" : "");
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+/**
+ * Over the air updates
+ *
+ * Updates stream an image from an HTTP URL into the inactive app slot. Images
+ * compressed with tools/mkota.py are inflated on the fly through a 32 KB
+ * window, nothing but the window and one network buffer is held in RAM.
+ * Plain firmware.bin images are written as they arrive.
+ *
+ * A new image boots pending verification. Unless the health check passes
+ * within OTA_HEALTH_TIMEOUT_MS the image is marked invalid and the previous
+ * one is booted again, as it is if the new image resets before that.
+ */
+static constexpr size_t OTA_BUFFER_SIZE { 4096 };
+static constexpr uint32_t OTA_HEALTH_TIMEOUT_MS { 60000 };
+
+struct ota_report_t {
+    size_t download_bytes;      ///< Bytes received, compressed size for compressed images
+    size_t image_bytes;         ///< Bytes written to flash
+    bool compressed;
+    uint32_t total_ms;
+    uint32_t network_ms;        ///< Waiting for data
+    uint32_t inflate_ms;
+    uint32_t flash_ms;          ///< Erasing and writing, including the final image check
+    size_t peak_internal_bytes; ///< Largest drop in free internal heap during the update
+    size_t peak_psram_bytes;
+};
+
+void ota_init();
+
+/** Download and flash an image, the new image boots at the next restart */
+esp_err_t ota_update(const char *url, ota_report_t *report);
+
+/** Boot the previous image at the next restart */
+bool ota_rollback();
+
+void ota_print_report(const ota_report_t &report);
+void ota_print_status();
@@ -0,0 +1,235 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+static constexpr char TAG[] = "profiler";
+
+static constexpr uint PROFILER_CORE_COUNT { portNUM_PROCESSORS };
+static constexpr uint32_t PROFILER_TASK_STACK_SIZE { 3072 };
+static constexpr UBaseType_t PROFILER_TASK_PRIORITY { 1 };
+
+
+struct sample_entry_t {
+    TaskHandle_t handle;
+    uint32_t runtime;
+    uint32_t stack;         // High water mark in bytes
+};
+
+struct sample_t {
+    uint32_t total_runtime;
+    uint count;
+    sample_entry_t tasks[PROFILER_MAX_TASKS];
+};
+
+// Details of the tasks in the newest sample, same order as its entries
+struct task_info_t {
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+static sample_t *g_samples = nullptr;
+static uint g_head = 0;                 // Next slot to write
+static uint g_sample_count = 0;
+static task_info_t g_info[PROFILER_MAX_TASKS];
+static TaskStatus_t g_status[PROFILER_MAX_TASKS];
+static TaskHandle_t g_idle[PROFILER_CORE_COUNT];
+static profiler_task_usage_t g_rows[PROFILER_MAX_TASKS];
+static SemaphoreHandle_t g_lock = nullptr;
+
+
+static inline const sample_t &sample_back(uint age)
+{
+    return g_samples[(g_head + PROFILER_SAMPLES - 1 - age) % PROFILER_SAMPLES];
+}
+
+
+static const sample_entry_t *find_entry(const sample_t &sample, TaskHandle_t handle)
+{
+    for (uint i=0; i<sample.count; i++) {
+        if (sample.tasks[i].handle==handle) {
+            return &sample.tasks[i];
+        }
+    }
+    return nullptr;
+}
+
+
+static inline uint32_t runtime_delta(const sample_entry_t &now, const sample_entry_t *then)
+{
+    // A missing entry means a new task. The 32 bit counters wrap about every
+    // 71 minutes, modular subtraction covers one wrap per window
+    if (!then) {
+        return now.runtime;
+    }
+    return now.runtime - then->runtime;
+}
+
+
+static void take_sample()
+{
+    uint32_t total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(g_status, PROFILER_MAX_TASKS, &total_runtime);
+    if (count==0) {
+        ESP_LOGW(TAG, "More than %u tasks, sample skipped", PROFILER_MAX_TASKS);
+        return;
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    auto &sample = g_samples[g_head];
+    sample.total_runtime = total_runtime;
+    sample.count = count;
+    for (uint i=0; i<count; i++) {
+        auto &st = g_status[i];
+        sample.tasks[i] = {
+            .handle = st.xHandle,
+            .runtime = st.ulRunTimeCounter,
+            .stack = st.usStackHighWaterMark,
+        };
+        auto &info = g_info[i];
+        strlcpy(info.name, st.pcTaskName, sizeof(info.name));
+        info.priority = st.uxCurrentPriority;
+        info.core = st.xCoreID;
+    }
+    g_head = (g_head + 1) % PROFILER_SAMPLES;
+    if (g_sample_count<PROFILER_SAMPLES) {
+        g_sample_count++;
+    }
+    xSemaphoreGive(g_lock);
+}
+
+
+static void profiler_task(__unused void *param)
+{
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    while (true) {
+        take_sample();
+        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(PROFILER_SAMPLE_INTERVAL_MS));
+    }
+}
+
+
+
+void profiler_init()
+{
+    static StaticSemaphore_t lock_buffer;
+    g_lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+    // The history is large, keep it out of internal RAM when possible. A
+    // failed allocation aborts, so the fallback is chosen before allocating.
+    const uint32_t caps = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM)>=PROFILER_SAMPLES*sizeof(sample_t) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT;
+    g_samples = static_cast<sample_t*>(heap_caps_calloc(PROFILER_SAMPLES, sizeof(sample_t), caps));
+    assert(g_samples);
+
+    for (uint core=0; core<PROFILER_CORE_COUNT; core++) {
+        g_idle[core] = xTaskGetIdleTaskHandleForCPU(core);
+    }
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[PROFILER_TASK_STACK_SIZE];
+    xTaskCreateStatic(profiler_task, "profiler", PROFILER_TASK_STACK_SIZE, nullptr, PROFILER_TASK_PRIORITY, task_stack, &task_buffer);
+
+    ESP_LOGI(TAG, "Sampling every %lu ms, %u KB history", PROFILER_SAMPLE_INTERVAL_MS, (PROFILER_SAMPLES*sizeof(sample_t))/1024);
+}
+
+
+uint32_t profiler_history_ms()
+{
+    return g_sample_count>1 ? (g_sample_count-1) * PROFILER_SAMPLE_INTERVAL_MS : 0;
+}
+
+
+uint profiler_get_usage(uint32_t *window_ms, profiler_task_usage_t *tasks, uint max_tasks, uint32_t *core_load)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (g_sample_count<2) {
+        xSemaphoreGive(g_lock);
+        return 0;
+    }
+
+    uint age = *window_ms / PROFILER_SAMPLE_INTERVAL_MS;
+    if (age<1) {
+        age = 1;
+    }
+    if (age>g_sample_count-1) {
+        age = g_sample_count-1;
+    }
+    const auto &now = sample_back(0);
+    const auto &then = sample_back(age);
+    const auto &oldest = sample_back(g_sample_count-1);
+    const uint32_t elapsed = now.total_runtime - then.total_runtime;
+    *window_ms = age * PROFILER_SAMPLE_INTERVAL_MS;
+
+    for (uint core=0; core<PROFILER_CORE_COUNT; core++) {
+        auto entry = find_entry(now, g_idle[core]);
+        uint32_t idle = entry ? runtime_delta(*entry, find_entry(then, g_idle[core])) : 0;
+        core_load[core] = elapsed>idle ? 1000ull * (elapsed-idle) / elapsed : 0;
+    }
+
+    uint count = 0;
+    for (uint i=0; i<now.count && count<max_tasks; i++) {
+        auto &entry = now.tasks[i];
+        auto &info = g_info[i];
+        auto first = find_entry(oldest, entry.handle);
+        auto &task = tasks[count++];
+        strlcpy(task.name, info.name, sizeof(task.name));
+        task.priority = info.priority;
+        task.core = info.core;
+        task.cpu = elapsed ? static_cast<uint32_t>(1000ull * runtime_delta(entry, find_entry(then, entry.handle)) / elapsed) : 0;
+        task.stack = entry.stack;
+        task.trend = first ? static_cast<int32_t>(entry.stack) - static_cast<int32_t>(first->stack) : 0;
+    }
+    xSemaphoreGive(g_lock);
+
+    qsort(tasks, count, sizeof(profiler_task_usage_t), [](auto a_, auto b_) {
+        auto a = static_cast<const profiler_task_usage_t*>(a_);
+        auto b = static_cast<const profiler_task_usage_t*>(b_);
+        if (a->cpu==b->cpu) {
+            return strcmp(a->name, b->name);
+        }
+        return a->cpu>b->cpu ? -1 : 1;
+    });
+
+    return count;
+}
+
+
+bool profiler_print_top(uint32_t window_ms)
+{
+    uint32_t core_load[PROFILER_CORE_COUNT];
+
+    // Only the console prints, so the static row buffer is not shared
+    uint count = profiler_get_usage(&window_ms, g_rows, PROFILER_MAX_TASKS, core_load);
+    if (count==0) {
+        return false;
+    }
+
+    printf("Window %lu.%lu s, history %lu s\n", window_ms/1000, (window_ms%1000)/100, profiler_history_ms()/1000);
+    for (uint core=0; core<PROFILER_CORE_COUNT; core++) {
+        printf("Core %u: %3lu.%lu%%   ", core, core_load[core]/10, core_load[core]%10);
+    }
+    printf("\n\n");
+
+    printf("Name             Pri  Core     CPU   Stack  Trend\n");
+    printf("-------------------------------------------------\n");
+    for (uint i=0; i<count; i++) {
+        auto &row = g_rows[i];
+        printf("%-16s %3u     %c  %3lu.%lu%% %7lu %+6ld\n",
+            row.name,
+            row.priority,
+            row.core==tskNO_AFFINITY ? '-' : ('0'+row.core),
+            row.cpu/10, row.cpu%10,
+            row.stack,
+            row.trend
+            );
+    }
+
+    return true;
+}
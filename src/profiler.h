@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <freertos/FreeRTOS.h>
+
+/**
+ * Sampling task profiler
+ *
+ * A low priority task snapshots the run time counter and stack high water
+ * mark of every task at a fixed interval into a ring allocated once at init.
+ * CPU usage per task and per core is computed from the difference between
+ * two snapshots, so any window up to the length of the history can be shown.
+ */
+static constexpr uint32_t PROFILER_SAMPLE_INTERVAL_MS { 500 };
+static constexpr uint PROFILER_SAMPLES { 121 };         ///< 60 s of history
+static constexpr uint PROFILER_MAX_TASKS { 32 };
+
+void profiler_init();
+
+/** Time span covered by the samples collected so far */
+uint32_t profiler_history_ms();
+
+struct profiler_task_usage_t {
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    BaseType_t core;        ///< tskNO_AFFINITY when not pinned
+    uint32_t cpu;           ///< Tenths of a percent of one core
+    uint32_t stack;         ///< Free stack high water mark in bytes
+    int32_t trend;          ///< Change of the free stack over the whole history
+};
+
+/**
+ * Task and core usage over the last window_ms, tasks sorted by CPU usage.
+ * core_load must have room for portNUM_PROCESSORS entries, in tenths of a
+ * percent. Returns the number of tasks, 0 until at least two samples exist.
+ */
+uint profiler_get_usage(uint32_t *window_ms, profiler_task_usage_t *tasks, uint max_tasks, uint32_t *core_load);
+
+/**
+ * Print core load and per task CPU usage over the last window_ms, together
+ * with how much each task's stack high water mark moved over the whole
+ * history. Returns false until at least two samples exist.
+ */
+bool profiler_print_top(uint32_t window_ms);
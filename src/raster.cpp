@@ -0,0 +1,266 @@
+#include "raster.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "raster_split.h"
+#include "display.h"
+#include "arena.h"
+
+static constexpr char TAG[] = "raster";
+
+static constexpr uint32_t RASTER_TASK_STACK_SIZE { 3072 };
+static constexpr UBaseType_t RASTER_TASK_PRIORITY { 5 };
+static constexpr uint RASTER_CORE_COUNT { portNUM_PROCESSORS };
+
+
+using blend_fn_t = void (*)(lv_draw_ctx_t *draw_ctx, const lv_draw_sw_blend_dsc_t *dsc);
+
+/** Lower stripe of a split blend */
+static struct {
+    lv_draw_sw_ctx_t ctx;           ///< Copy of the caller's context, clipped to clip
+    lv_area_t clip;
+    const lv_draw_sw_blend_dsc_t *dsc;
+    blend_fn_t blend;
+} g_job;
+
+static raster_job g_job_claim;
+static TaskHandle_t g_workers[RASTER_CORE_COUNT];
+static SemaphoreHandle_t g_done = nullptr;
+static void (*g_default_ctx_init)(lv_disp_drv_t *drv, lv_draw_ctx_t *draw_ctx) = nullptr;
+static blend_fn_t g_default_blend = nullptr;
+
+// Only used from the LVGL task
+static bool g_enabled = false;
+static uint32_t g_min_px = RASTER_DEFAULT_MIN_PX;
+static raster_stats_t g_stats;
+
+
+
+/** -------------------------------------------------------------------------------
+ * Split blend
+ */
+
+static void run_job()
+{
+    g_job.blend(&g_job.ctx.base_draw, g_job.dsc);
+}
+
+
+static void worker_task(__unused void *param)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        g_job_claim.work(run_job, [] { xSemaphoreGive(g_done); });
+    }
+}
+
+
+static void split_blend(lv_draw_ctx_t *draw_ctx, const lv_draw_sw_blend_dsc_t *dsc)
+{
+    auto sw_ctx = reinterpret_cast<lv_draw_sw_ctx_t*>(draw_ctx);
+    lv_area_t area;
+    raster_stripes_t stripes;
+    g_stats.blends++;
+    if (!g_enabled || !_lv_area_intersect(&area, dsc->blend_area, draw_ctx->clip_area)) {
+        g_default_blend(draw_ctx, dsc);
+        return;
+    }
+    // Masked shapes, such as arcs and rounded corners, are blended one row at a time
+    if (!raster_split_rows(area.y1, area.y2, &stripes)) {
+        g_stats.single_rows++;
+        g_default_blend(draw_ctx, dsc);
+        return;
+    }
+    if (lv_area_get_size(&area)<g_min_px) {
+        g_default_blend(draw_ctx, dsc);
+        return;
+    }
+    g_stats.splits++;
+    g_stats.split_px += lv_area_get_size(&area);
+
+    g_job.ctx = *sw_ctx;
+    g_job.clip = { area.x1, static_cast<lv_coord_t>(stripes.lower_y1), area.x2, static_cast<lv_coord_t>(stripes.lower_y2) };
+    g_job.ctx.base_draw.clip_area = &g_job.clip;
+    g_job.dsc = dsc;
+    g_job.blend = g_default_blend;
+
+    lv_draw_sw_ctx_t upper = *sw_ctx;
+    const lv_area_t upper_clip = { area.x1, static_cast<lv_coord_t>(stripes.upper_y1), area.x2, static_cast<lv_coord_t>(stripes.upper_y2) };
+    upper.base_draw.clip_area = &upper_clip;
+
+    // LVGL may only go on once both stripes are in the draw buffer
+    const bool taken_back = g_job_claim.run(
+        [] { xTaskNotifyGive(g_workers[!xPortGetCoreID()]); },
+        [&upper, dsc] { g_default_blend(&upper.base_draw, dsc); },
+        run_job,
+        [] { xSemaphoreTake(g_done, portMAX_DELAY); }
+        );
+    g_stats.taken_back += taken_back;
+}
+
+
+static void hook_ctx(lv_draw_ctx_t *draw_ctx)
+{
+    auto sw_ctx = reinterpret_cast<lv_draw_sw_ctx_t*>(draw_ctx);
+    if (!g_default_blend) {
+        g_default_blend = sw_ctx->blend;
+    }
+    sw_ctx->blend = split_blend;
+}
+
+
+/** Also used by LVGL for the contexts of snapshots */
+static void init_ctx(lv_disp_drv_t *drv, lv_draw_ctx_t *draw_ctx)
+{
+    g_default_ctx_init(drv, draw_ctx);
+    hook_ctx(draw_ctx);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Verification
+ */
+
+static bool snapshot(lv_obj_t *screen, void *buf, uint32_t size, int64_t *us)
+{
+    lv_img_dsc_t dsc;
+    const int64_t start = esp_timer_get_time();
+    bool ok = lv_snapshot_take_to_buf(screen, LV_IMG_CF_TRUE_COLOR, &dsc, buf, size)==LV_RES_OK;
+    *us = esp_timer_get_time() - start;
+    return ok;
+}
+
+
+bool raster_verify()
+{
+    display_acquire();
+    lv_obj_t *screen = lv_scr_act();
+    const uint32_t size = lv_snapshot_buf_size_needed(screen, LV_IMG_CF_TRUE_COLOR);
+    auto single = static_cast<lv_color_t*>(arena_alloc(ARENA_UI, size));
+    auto split = static_cast<lv_color_t*>(arena_alloc(ARENA_UI, size));
+    if (!single || !split) {
+        display_release();
+        arena_free(ARENA_UI, single);
+        arena_free(ARENA_UI, split);
+        printf("No memory for snapshots\n");
+        return false;
+    }
+
+    const bool enabled = g_enabled;
+    const uint32_t min_px = g_min_px;
+    const uint32_t splits = g_stats.splits;
+    int64_t single_us, split_us;
+    g_enabled = false;
+    bool ok = snapshot(screen, single, size, &single_us);
+    g_enabled = true;
+    g_min_px = 0;
+    ok = ok && snapshot(screen, split, size, &split_us);
+    g_enabled = enabled;
+    g_min_px = min_px;
+    const uint32_t verify_splits = g_stats.splits - splits;
+    const uint32_t width = lv_obj_get_width(screen);
+    display_release();
+
+    uint32_t differ = 0;
+    const uint32_t pixels = size / sizeof(lv_color_t);
+    int32_t first = -1;
+    for (uint32_t i=0; ok && i<pixels; i++) {
+        if (single[i].full!=split[i].full) {
+            if (first<0) {
+                first = i;
+            }
+            differ++;
+        }
+    }
+    arena_free(ARENA_UI, single);
+    arena_free(ARENA_UI, split);
+
+    if (!ok) {
+        printf("Snapshot failed\n");
+        return false;
+    }
+    printf("Single core %lld us, split %lld us with %lu split blends\n", single_us, split_us, verify_splits);
+    if (differ) {
+        printf("%lu pixels differ, first at %ld,%ld\n", differ, first % width, first / width);
+        return false;
+    }
+    printf("Identical\n");
+    return true;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public
+ */
+
+void raster_init()
+{
+    static StaticSemaphore_t sem_buffer;
+    g_done = xSemaphoreCreateBinaryStatic(&sem_buffer);
+
+    static StaticTask_t task_buffers[RASTER_CORE_COUNT];
+    static StackType_t task_stacks[RASTER_CORE_COUNT][RASTER_TASK_STACK_SIZE];
+    for (uint core=0; core<RASTER_CORE_COUNT; core++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "raster%u", core);
+        // Above the LVGL task, so a split blend is picked up at once
+        g_workers[core] = xTaskCreateStaticPinnedToCore(worker_task, name, RASTER_TASK_STACK_SIZE, nullptr, RASTER_TASK_PRIORITY, task_stacks[core], &task_buffers[core], core);
+    }
+    ESP_LOGI(TAG, "Blends of %lu pixels or more can be split over %u cores, %s", g_min_px, RASTER_CORE_COUNT, g_enabled ? "enabled" : "disabled");
+
+    auto disp = display_get();
+    hook_ctx(disp->driver->draw_ctx);
+    g_default_ctx_init = disp->driver->draw_ctx_init;
+    disp->driver->draw_ctx_init = init_ctx;
+}
+
+
+void raster_set_enabled(bool enable)
+{
+    display_acquire();
+    g_enabled = enable;
+    display_release();
+}
+
+
+void raster_set_min_px(uint32_t min_px)
+{
+    display_acquire();
+    g_min_px = min_px;
+    display_release();
+}
+
+
+void raster_get_stats(raster_stats_t *stats)
+{
+    display_acquire();
+    *stats = g_stats;
+    stats->enabled = g_enabled;
+    stats->min_px = g_min_px;
+    display_release();
+}
+
+
+void raster_print_stats()
+{
+    raster_stats_t st;
+    raster_get_stats(&st);
+    printf("Split blends %s, at least %lu pixels\n", st.enabled ? "enabled" : "disabled", st.min_px);
+    printf("Blends: %lu, split: %lu (%lu%%), single row: %lu (%lu%%), taken back: %lu, split pixels: %llu\n",
+        st.blends,
+        st.splits,
+        st.blends ? st.splits*100/st.blends : 0,
+        st.single_rows,
+        st.blends ? st.single_rows*100/st.blends : 0,
+        st.taken_back,
+        st.split_px
+        );
+}
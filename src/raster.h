@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <lvgl.h>
+
+/**
+ * Dual-core rasterization
+ *
+ * LVGL 8 walks the object tree, builds masks and allocates from its heap on
+ * the task that refreshes, none of which may run twice at once. Its last
+ * step, blending colors, images and mask lines into the draw buffer, only
+ * touches pixels inside the draw context's clip area. The software blend is
+ * therefore split into two horizontal stripes by giving each a copy of the
+ * draw context with half the clip area. The lower stripe is handed to a
+ * worker pinned to the other core, the upper one is blended by the caller,
+ * and both meet at a barrier before LVGL continues. Every pixel is written
+ * by the same blend function with the same inputs, so the result is
+ * identical to single-core rendering, raster_verify() checks that on the
+ * device.
+ *
+ * Small blends cost more to hand over than to do, only blends of at least
+ * the minimum number of pixels are split. If the worker has not started
+ * when the caller is done, for instance because Wi-Fi occupies the other
+ * core, the caller takes the lower stripe back. The split and hand-over are
+ * in raster_split.h and tested on the host.
+ *
+ * Only plain fills and images are blended as areas. LVGL blends masked
+ * shapes, such as arcs, rounded corners and anti-aliased edges, one row at
+ * a time, and those stay on one core. The split is off by default until
+ * raster_verify() timings on a screen show a gain.
+ */
+static constexpr uint32_t RASTER_DEFAULT_MIN_PX { 4096 };
+
+struct raster_stats_t {
+    bool enabled;
+    uint32_t min_px;
+    uint32_t blends;
+    uint32_t splits;                ///< Blends shared with the other core
+    uint32_t taken_back;            ///< Splits the caller finished alone
+    uint32_t single_rows;           ///< Blends of one row, never split
+    uint64_t split_px;
+};
+
+/** Call with the display lock held */
+void raster_init();
+
+void raster_set_enabled(bool enable);
+void raster_set_min_px(uint32_t min_px);
+
+/**
+ * Render the active screen once on one core and once with every blend of two
+ * or more rows split, compare the two and print render times. Returns false
+ * if any pixel differs.
+ */
+bool raster_verify();
+
+void raster_get_stats(raster_stats_t *stats);
+void raster_print_stats();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Stripe split and hand-over of a split blend
+ *
+ * Free of FreeRTOS and LVGL so the host tests in test/ run the protocol
+ * with threads. The caller posts the lower stripe, wakes the worker and
+ * blends the upper stripe. Whoever claims the posted job first blends the
+ * lower stripe, the caller waits for the worker only if the worker claimed
+ * it.
+ */
+struct raster_stripes_t {
+    int32_t upper_y1, upper_y2;
+    int32_t lower_y1, lower_y2;
+};
+
+/** Split rows y1..y2 in two halves, false if there are fewer than two rows */
+static inline bool raster_split_rows(int32_t y1, int32_t y2, raster_stripes_t *stripes)
+{
+    const int32_t height = y2 - y1 + 1;
+    if (height<2) {
+        return false;
+    }
+    const int32_t mid = y1 + height/2;
+    *stripes = { y1, mid-1, mid, y2 };
+    return true;
+}
+
+
+class raster_job {
+    public:
+        /** Make the lower stripe claimable, after it has been filled in */
+        void post() { m_state.store(POSTED); }
+
+        /** Claim the posted job, false if the other side has it */
+        bool take()
+        {
+            int expected = POSTED;
+            return m_state.compare_exchange_strong(expected, TAKEN);
+        }
+
+        /** Ready for the next post, after both stripes are done */
+        void reset() { m_state.store(NONE); }
+
+        /**
+         * Caller side. notify() wakes the worker, upper() and lower() blend
+         * the stripes, wait() blocks until the worker signals it is done.
+         * Returns true if the caller took the lower stripe back.
+         */
+        template<typename NOTIFY, typename UPPER, typename LOWER, typename WAIT>
+        bool run(NOTIFY &&notify, UPPER &&upper, LOWER &&lower, WAIT &&wait)
+        {
+            post();
+            notify();
+            upper();
+            // Barrier, both stripes must be in the buffer before the caller goes on
+            const bool taken_back = take();
+            if (taken_back) {
+                lower();
+            }
+            else {
+                wait();
+            }
+            reset();
+            return taken_back;
+        }
+
+        /** Worker side, after a wakeup. A late wakeup finds the job already taken back. */
+        template<typename LOWER, typename DONE>
+        bool work(LOWER &&lower, DONE &&done)
+        {
+            if (!take()) {
+                return false;
+            }
+            lower();
+            done();
+            return true;
+        }
+
+    private:
+        enum : int {
+            NONE,
+            POSTED,
+            TAKEN,
+        };
+
+        std::atomic<int> m_state { NONE };
+};
@@ -0,0 +1,226 @@
+#include "refresh.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lvgl.h>
+
+#include "display.h"
+
+static constexpr char TAG[] = "refresh";
+
+static constexpr uint32_t REFRESH_EVAL_INTERVAL_MS { 100 };
+static constexpr uint32_t REFRESH_WINDOW_MS { 1000 };
+static constexpr uint32_t REFRESH_HOLD_MS { 1000 };             // Fast after the last animation or input
+static constexpr uint32_t REFRESH_SATURATED_PCT { 90 };         // Samples with a refresh waiting
+static constexpr uint32_t REFRESH_IDLE_PERIOD_MS { 1000 };
+static constexpr uint32_t REFRESH_IDLE_POLL_MS { 20 };          // Input latency in the idle tier
+
+static constexpr const char *TIER_NAMES[REFRESH_TIER_COUNT] = { "fast", "normal", "idle" };
+
+
+static lv_timer_t *g_eval_timer = nullptr;
+static refresh_tier_t g_tier = REFRESH_NORMAL;
+static bool g_enabled = true;
+static volatile uint32_t g_boost_until = 0;
+static uint32_t g_last_active = 0;
+static uint32_t g_last_eval = 0;
+static uint32_t g_last_frames = 0;
+
+static struct {
+    uint32_t start;
+    uint32_t frames;
+    uint32_t samples;
+    uint32_t pending;
+} g_window;
+
+static portMUX_TYPE g_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static refresh_stats_t g_stats;
+
+
+static inline uint32_t now_ms()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+
+static uint32_t tier_period_ms(refresh_tier_t tier)
+{
+    switch (tier) {
+        case REFRESH_FAST:   return display_min_refresh_period_ms();
+        case REFRESH_IDLE:   return REFRESH_IDLE_PERIOD_MS;
+        default:             return CONFIG_LV_DISP_DEF_REFR_PERIOD;
+    }
+}
+
+
+static void account(uint32_t now)
+{
+    const uint32_t frames = display_frame_count();
+    portENTER_CRITICAL(&g_stats_lock);
+    g_stats.tier_ms[g_tier] += now - g_last_eval;
+    g_stats.tier_frames[g_tier] += frames - g_last_frames;
+    portEXIT_CRITICAL(&g_stats_lock);
+    g_last_eval = now;
+    g_last_frames = frames;
+}
+
+
+static void start_window(uint32_t now)
+{
+    g_window = {
+        .start = now,
+        .frames = display_frame_count(),
+        .samples = 0,
+        .pending = 0,
+    };
+}
+
+
+static void apply_tier(refresh_tier_t tier, uint32_t now)
+{
+    lv_timer_set_period(display_get()->refr_timer, tier_period_ms(tier));
+    if (tier!=g_tier) {
+        ESP_LOGD(TAG, "Tier %s -> %s", TIER_NAMES[g_tier], TIER_NAMES[tier]);
+        portENTER_CRITICAL(&g_stats_lock);
+        g_stats.switches++;
+        portEXIT_CRITICAL(&g_stats_lock);
+    }
+    g_tier = tier;
+    start_window(now);
+}
+
+
+static refresh_tier_t select_tier(uint32_t now)
+{
+    if (lv_anim_count_running()>0 || static_cast<int32_t>(g_boost_until-now)>0) {
+        g_last_active = now;
+    }
+    if (now - g_last_active < REFRESH_HOLD_MS) {
+        return REFRESH_FAST;
+    }
+
+    const uint32_t elapsed = now - g_window.start;
+    if (elapsed < REFRESH_WINDOW_MS) {
+        return g_tier;
+    }
+    const uint32_t frames = display_frame_count() - g_window.frames;
+    const bool saturated = g_window.pending*100 >= g_window.samples*REFRESH_SATURATED_PCT;
+    if (saturated && g_tier>REFRESH_FAST) {
+        return static_cast<refresh_tier_t>(g_tier-1);
+    }
+    if (g_tier<REFRESH_IDLE) {
+        const auto lower = static_cast<refresh_tier_t>(g_tier+1);
+        if (frames*tier_period_ms(lower) <= elapsed) {
+            return lower;
+        }
+    }
+    start_window(now);
+    return g_tier;
+}
+
+
+static void eval_timer_cb(lv_timer_t *timer)
+{
+    const uint32_t now = now_ms();
+    account(now);
+    if (!g_enabled) {
+        return;
+    }
+
+    // A waiting refresh means the rate held back invalidated areas
+    g_window.samples++;
+    if (!display_get()->refr_timer->paused) {
+        g_window.pending++;
+    }
+
+    refresh_tier_t tier = select_tier(now);
+    if (tier!=g_tier) {
+        apply_tier(tier, now);
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public
+ */
+
+void refresh_init()
+{
+    g_last_eval = now_ms();
+    g_last_frames = display_frame_count();
+    apply_tier(REFRESH_NORMAL, g_last_eval);
+    g_eval_timer = lv_timer_create(eval_timer_cb, REFRESH_EVAL_INTERVAL_MS, nullptr);
+}
+
+
+void refresh_set_enabled(bool enable)
+{
+    display_acquire();
+    const uint32_t now = now_ms();
+    account(now);
+    g_enabled = enable;
+    apply_tier(REFRESH_NORMAL, now);
+    display_release();
+}
+
+
+void refresh_boost()
+{
+    g_boost_until = now_ms() + REFRESH_HOLD_MS;
+}
+
+
+uint32_t refresh_poll_ms(uint32_t next_timer_ms)
+{
+    if (!g_enabled || g_tier!=REFRESH_IDLE) {
+        return 1;
+    }
+    return std::clamp<uint32_t>(next_timer_ms, 1, REFRESH_IDLE_POLL_MS);
+}
+
+
+const char *refresh_tier_name(refresh_tier_t tier)
+{
+    return TIER_NAMES[tier];
+}
+
+
+void refresh_get_stats(refresh_stats_t *stats)
+{
+    portENTER_CRITICAL(&g_stats_lock);
+    *stats = g_stats;
+    stats->tier = g_tier;
+    stats->enabled = g_enabled;
+    // Include the time since the last evaluation
+    stats->tier_ms[g_tier] += now_ms() - g_last_eval;
+    portEXIT_CRITICAL(&g_stats_lock);
+}
+
+
+void refresh_print_stats()
+{
+    refresh_stats_t st;
+    refresh_get_stats(&st);
+    uint64_t total = 0;
+    for (auto ms : st.tier_ms) {
+        total += ms;
+    }
+
+    printf("Governor %s, tier: %s, fast period %lu ms\n\n", st.enabled ? "enabled" : "disabled", TIER_NAMES[st.tier], tier_period_ms(REFRESH_FAST));
+    printf("Tier      Time s  Share   Frames    FPS\n");
+    printf("---------------------------------------\n");
+    for (uint i=0; i<REFRESH_TIER_COUNT; i++) {
+        printf("%-8s %7llu %5llu%%  %7lu  %5.1f\n",
+            TIER_NAMES[i],
+            st.tier_ms[i]/1000,
+            total ? st.tier_ms[i]*100/total : 0,
+            st.tier_frames[i],
+            st.tier_ms[i] ? st.tier_frames[i]*1000.0f/st.tier_ms[i] : 0.0f
+            );
+    }
+    printf("\nSwitches: %lu\n", st.switches);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Refresh rate governor
+ *
+ * Sets the period of the LVGL refresh timer from what the UI is doing:
+ *
+ *  - fast:   the time to send a full frame at the current SPI clock, while
+ *            animations run, such as transitions and spinners, for a hold
+ *            time after input and while the normal rate is saturated, as
+ *            when a chart streams
+ *  - normal: CONFIG_LV_DISP_DEF_REFR_PERIOD
+ *  - idle:   1 Hz, once at most one frame per second was needed
+ *
+ * The rate is stepped up when invalidated areas were waiting for the refresh
+ * timer in most samples of a window, and down when the frames of a window
+ * would fit the lower rate. LVGL only runs the refresh timer when something
+ * was invalidated, so every tier draws on events only and a static screen
+ * costs no frames. In the idle tier the LVGL task also polls less often.
+ */
+enum refresh_tier_t {
+    REFRESH_FAST,
+    REFRESH_NORMAL,
+    REFRESH_IDLE,
+    REFRESH_TIER_COUNT
+};
+
+struct refresh_stats_t {
+    refresh_tier_t tier;
+    bool enabled;
+    uint64_t tier_ms[REFRESH_TIER_COUNT];
+    uint32_t tier_frames[REFRESH_TIER_COUNT];
+    uint32_t switches;
+};
+
+/** Call from the LVGL task with the display lock held */
+void refresh_init();
+
+/** Fixed normal rate while disabled, for benchmarks */
+void refresh_set_enabled(bool enable);
+
+/** Run at the fast rate for a while, on user input */
+void refresh_boost();
+
+/** Time the LVGL task may sleep, given the time until its next timer */
+uint32_t refresh_poll_ms(uint32_t next_timer_ms);
+
+const char *refresh_tier_name(refresh_tier_t tier);
+
+void refresh_get_stats(refresh_stats_t *stats);
+void refresh_print_stats();
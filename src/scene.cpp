@@ -0,0 +1,470 @@
+#include "scene.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lwip/sockets.h>
+#include <lvgl.h>
+
+#include "display.h"
+#include "wifi_power.h"
+#include "ui/ui.h"
+
+static constexpr char TAG[] = "scene";
+
+static constexpr uint32_t SCENE_TASK_STACK_SIZE { 4096 };
+static constexpr UBaseType_t SCENE_TASK_PRIORITY { 2 };
+static constexpr uint32_t SCENE_APPLY_PERIOD_MS { CONFIG_LV_DISP_DEF_REFR_PERIOD };
+static constexpr uint32_t SCENE_SYNC_TIMEOUT_MS { 1000 };
+static constexpr size_t SCENE_HEADER_SIZE { 4 };
+static constexpr size_t SCENE_RX_BUFFER_SIZE { 2*(SCENE_HEADER_SIZE+SCENE_MAX_PAYLOAD) };
+
+
+enum widget_kind_t : uint8_t {
+    KIND_SCREEN,
+    KIND_LABEL,
+    KIND_ARC,
+    KIND_COLORWHEEL,
+    KIND_CHART,
+};
+
+struct widget_t {
+    scene_widget_t id;
+    widget_kind_t kind;
+    const char *name;
+    lv_obj_t **obj;
+};
+
+static constexpr widget_t WIDGETS[] = {
+    { SCENE_SCREEN_CLOCK,       KIND_SCREEN,     "clock",            &ui_Clock },
+    { SCENE_SCREEN_DEMO,        KIND_SCREEN,     "demo",             &ui_Demo },
+    { SCENE_SCREEN_DEMO1,       KIND_SCREEN,     "demo1",            &ui_Demo1 },
+    { SCENE_SCREEN_DEMO2,       KIND_SCREEN,     "demo2",            &ui_Demo2 },
+    { SCENE_CLOCK_LABEL,        KIND_LABEL,      "clock_label",      &ui_clock_label },
+    { SCENE_CLOCK_SECONDS,      KIND_ARC,        "clock_seconds",    &ui_clock_seconds },
+    { SCENE_DEMO1_COLORWHEEL,   KIND_COLORWHEEL, "demo1_colorwheel", &ui_Colorwheel1 },
+    { SCENE_DEMO2_LABEL,        KIND_LABEL,      "demo2_label",      &ui_Label2 },
+    { SCENE_DEMO2_CHART,        KIND_CHART,      "demo2_chart",      &ui_Chart2 },
+};
+static constexpr uint WIDGET_COUNT { sizeof(WIDGETS)/sizeof(WIDGETS[0]) };
+
+enum : uint8_t {
+    STAGED_TEXT = 0x01,
+    STAGED_VALUE = 0x02,
+    STAGED_POINTS = 0x04,
+};
+
+/** Latest state of a widget received since the last apply */
+struct staged_t {
+    uint8_t flags;
+    int32_t value;
+    char text[SCENE_MAX_TEXT];
+    int16_t points[SCENE_MAX_POINTS];   // Ring, written at point_count % SCENE_MAX_POINTS
+    uint32_t point_count;
+};
+
+struct scene_t {
+    staged_t widgets[WIDGET_COUNT];
+    int screen;                         // Index into WIDGETS or -1
+    lv_scr_load_anim_t screen_anim;
+    uint16_t screen_anim_ms;
+    bool sync;
+    uint32_t sync_token;
+};
+
+struct stats_t {
+    bool connected;
+    uint32_t sessions;
+    uint32_t messages;
+    uint64_t bytes;
+    uint32_t errors;
+    uint32_t batches;
+    uint32_t updates;
+    uint64_t apply_time_us;
+    uint32_t apply_time_max_us;
+};
+
+
+static SemaphoreHandle_t g_lock = nullptr;
+static TaskHandle_t g_task = nullptr;
+static scene_t g_staged;                // Written by the scene task
+static scene_t g_apply;                 // Only used from the LVGL task
+static stats_t g_stats;
+static uint32_t g_synced_token = 0;
+static uint32_t g_synced_messages = 0;
+static uint32_t g_synced_batches = 0;
+
+// Only used from the scene task
+static int g_client = -1;
+static uint8_t g_rx[SCENE_RX_BUFFER_SIZE];
+
+
+static void clear(scene_t &scene)
+{
+    for (auto &widget : scene.widgets) {
+        widget.flags = 0;
+        widget.point_count = 0;
+    }
+    scene.screen = -1;
+    scene.sync = false;
+}
+
+
+static int widget_index(uint8_t id)
+{
+    for (uint i=0; i<WIDGET_COUNT; i++) {
+        if (WIDGETS[i].id==id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Apply
+ */
+
+static void apply_widget(const widget_t &widget, const staged_t &staged)
+{
+    lv_obj_t *obj = *widget.obj;
+    if (!obj) {
+        return;
+    }
+    switch (widget.kind) {
+        case KIND_LABEL:
+            lv_label_set_text(obj, staged.text);
+            break;
+        case KIND_ARC:
+            lv_arc_set_value(obj, staged.value);
+            break;
+        case KIND_COLORWHEEL:
+            lv_colorwheel_set_rgb(obj, lv_color_hex(staged.value));
+            break;
+        case KIND_CHART: {
+            lv_chart_series_t *series = lv_chart_get_series_next(obj, nullptr);
+            if (!series) {
+                break;
+            }
+            const uint32_t count = std::min<uint32_t>(staged.point_count, SCENE_MAX_POINTS);
+            for (uint32_t i=staged.point_count-count; i<staged.point_count; i++) {
+                lv_chart_set_next_value(obj, series, staged.points[i % SCENE_MAX_POINTS]);
+            }
+            break;
+        }
+        case KIND_SCREEN:
+            break;
+    }
+}
+
+
+/** Runs in the LVGL task once per refresh period */
+static void apply_timer_cb(__unused lv_timer_t *timer)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool pending = g_staged.screen>=0 || g_staged.sync;
+    for (const auto &widget : g_staged.widgets) {
+        pending |= widget.flags!=0;
+    }
+    if (!pending) {
+        xSemaphoreGive(g_lock);
+        return;
+    }
+    g_apply = g_staged;
+    clear(g_staged);
+    const uint32_t messages = g_stats.messages;
+    xSemaphoreGive(g_lock);
+
+    const int64_t start = esp_timer_get_time();
+    uint updates = 0;
+    for (uint i=0; i<WIDGET_COUNT; i++) {
+        if (g_apply.widgets[i].flags) {
+            apply_widget(WIDGETS[i], g_apply.widgets[i]);
+            updates++;
+        }
+    }
+    if (g_apply.screen>=0 && *WIDGETS[g_apply.screen].obj) {
+        lv_scr_load_anim(*WIDGETS[g_apply.screen].obj, g_apply.screen_anim, g_apply.screen_anim_ms, 0, false);
+        updates++;
+    }
+    const uint32_t time_us = esp_timer_get_time() - start;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_stats.batches++;
+    g_stats.updates += updates;
+    g_stats.apply_time_us += time_us;
+    g_stats.apply_time_max_us = std::max(g_stats.apply_time_max_us, time_us);
+    if (g_apply.sync) {
+        g_synced_token = g_apply.sync_token;
+        g_synced_messages = messages;
+        g_synced_batches = g_stats.batches;
+    }
+    xSemaphoreGive(g_lock);
+
+    if (g_apply.sync) {
+        xTaskNotifyGive(g_task);
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Receive
+ */
+
+static inline uint16_t get_u16(const uint8_t *data)
+{
+    return data[0] | (data[1]<<8);
+}
+
+static inline uint32_t get_u32(const uint8_t *data)
+{
+    return data[0] | (data[1]<<8) | (data[2]<<16) | (static_cast<uint32_t>(data[3])<<24);
+}
+
+
+/** Stage one message, call with the lock held. Returns false if the message is invalid */
+static bool stage(uint8_t type, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    if (type==SCENE_SYNC) {
+        if (len!=sizeof(uint32_t)) {
+            return false;
+        }
+        g_staged.sync = true;
+        g_staged.sync_token = get_u32(payload);
+        return true;
+    }
+
+    int index = widget_index(id);
+    if (index<0) {
+        return false;
+    }
+    const auto kind = WIDGETS[index].kind;
+    auto &staged = g_staged.widgets[index];
+
+    switch (type) {
+        case SCENE_SET_TEXT: {
+            if (kind!=KIND_LABEL) {
+                return false;
+            }
+            uint n = std::min<uint>(len, SCENE_MAX_TEXT-1);
+            // Do not cut a UTF-8 sequence in half
+            if (n<len) {
+                while (n>0 && (payload[n] & 0xc0)==0x80) {
+                    n--;
+                }
+            }
+            memcpy(staged.text, payload, n);
+            staged.text[n] = '\0';
+            staged.flags |= STAGED_TEXT;
+            return true;
+        }
+        case SCENE_SET_VALUE:
+            if ((kind!=KIND_ARC && kind!=KIND_COLORWHEEL) || len!=sizeof(int32_t)) {
+                return false;
+            }
+            staged.value = static_cast<int32_t>(get_u32(payload));
+            staged.flags |= STAGED_VALUE;
+            return true;
+        case SCENE_CHART_APPEND:
+            if (kind!=KIND_CHART || len%sizeof(int16_t)) {
+                return false;
+            }
+            for (uint i=0; i<len; i+=sizeof(int16_t)) {
+                staged.points[staged.point_count++ % SCENE_MAX_POINTS] = static_cast<int16_t>(get_u16(payload+i));
+            }
+            staged.flags |= STAGED_POINTS;
+            return true;
+        case SCENE_SHOW_SCREEN:
+            if (kind!=KIND_SCREEN || (len!=0 && len!=3) || (len && payload[0]>LV_SCR_LOAD_ANIM_OUT_BOTTOM)) {
+                return false;
+            }
+            g_staged.screen = index;
+            g_staged.screen_anim = len ? static_cast<lv_scr_load_anim_t>(payload[0]) : LV_SCR_LOAD_ANIM_NONE;
+            g_staged.screen_anim_ms = len ? get_u16(payload+1) : 0;
+            return true;
+    }
+    return false;
+}
+
+
+/** Stage all complete messages in the buffer, returns the bytes consumed */
+static size_t stage_buffer(const uint8_t *data, size_t len, bool *sync)
+{
+    size_t pos = 0;
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    while (len-pos>=SCENE_HEADER_SIZE) {
+        const uint8_t type = data[pos];
+        const uint8_t id = data[pos+1];
+        const uint16_t payload_len = get_u16(data+pos+2);
+        if (len-pos<SCENE_HEADER_SIZE+payload_len) {
+            break;
+        }
+        if (!stage(type, id, data+pos+SCENE_HEADER_SIZE, payload_len)) {
+            g_stats.errors++;
+        }
+        g_stats.messages++;
+        pos += SCENE_HEADER_SIZE + payload_len;
+        if (type==SCENE_SYNC) {
+            // Answered before anything later is staged
+            *sync = true;
+            break;
+        }
+    }
+    g_stats.bytes += pos;
+    xSemaphoreGive(g_lock);
+    return pos;
+}
+
+
+static bool send_sync()
+{
+    if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCENE_SYNC_TIMEOUT_MS))) {
+        ESP_LOGW(TAG, "Sync not applied in time");
+        return false;
+    }
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    const uint32_t values[] = { g_synced_token, g_synced_messages, g_synced_batches };
+    xSemaphoreGive(g_lock);
+
+    uint8_t reply[1+sizeof(values)] = { SCENE_SYNC };
+    for (uint i=0; i<sizeof(values)/sizeof(values[0]); i++) {
+        for (uint b=0; b<sizeof(uint32_t); b++) {
+            reply[1+i*sizeof(uint32_t)+b] = values[i] >> (b*8);
+        }
+    }
+    return send(g_client, reply, sizeof(reply), 0)==sizeof(reply);
+}
+
+
+static void run_session()
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_stats.connected = true;
+    g_stats.sessions++;
+    xSemaphoreGive(g_lock);
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    size_t fill = 0;
+    while (true) {
+        int res = recv(g_client, g_rx+fill, sizeof(g_rx)-fill, 0);
+        if (res<=0) {
+            break;
+        }
+        fill += res;
+        wifi_power_demand(WIFI_DEMAND_INGEST);
+
+        size_t pos = 0;
+        bool ok = true;
+        while (ok) {
+            bool sync = false;
+            size_t used = stage_buffer(g_rx+pos, fill-pos, &sync);
+            pos += used;
+            if (sync) {
+                ok = send_sync();
+            }
+            else if (used==0) {
+                break;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        if (fill-pos>=SCENE_HEADER_SIZE && get_u16(g_rx+pos+2)>SCENE_MAX_PAYLOAD) {
+            ESP_LOGW(TAG, "Message too long (%u bytes)", get_u16(g_rx+pos+2));
+            break;
+        }
+        memmove(g_rx, g_rx+pos, fill-pos);
+        fill -= pos;
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_stats.connected = false;
+    xSemaphoreGive(g_lock);
+}
+
+
+static void scene_task(__unused void *param)
+{
+    int server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(SCENE_PORT);
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (server<0 || bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))!=0 || listen(server, 1)!=0) {
+        ESP_LOGE(TAG, "Error listening on port %u", SCENE_PORT);
+        vTaskDelete(nullptr);
+        return;
+    }
+    ESP_LOGI(TAG, "Listening on port %u", SCENE_PORT);
+
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        g_client = accept(server, reinterpret_cast<struct sockaddr*>(&peer), &peer_len);
+        if (g_client<0) {
+            continue;
+        }
+        int nodelay = 1;
+        setsockopt(g_client, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        ESP_LOGI(TAG, "Client %s connected", ip);
+        run_session();
+        ESP_LOGI(TAG, "Client %s disconnected", ip);
+
+        close(g_client);
+        g_client = -1;
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public interface
+ */
+
+void scene_init()
+{
+    static StaticSemaphore_t lock_buffer;
+    g_lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+    clear(g_staged);
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[SCENE_TASK_STACK_SIZE];
+    g_task = xTaskCreateStatic(scene_task, "scene", SCENE_TASK_STACK_SIZE, nullptr, SCENE_TASK_PRIORITY, task_stack, &task_buffer);
+
+    display_acquire();
+    lv_timer_create(apply_timer_cb, SCENE_APPLY_PERIOD_MS, nullptr);
+    display_release();
+}
+
+
+void scene_print_stats()
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    auto st = g_stats;
+    xSemaphoreGive(g_lock);
+
+    printf("Port %u, %s, %lu sessions\n", SCENE_PORT, st.connected ? "client connected" : "no client", st.sessions);
+    printf("Messages %lu (%llu bytes, %lu invalid)\n", st.messages, st.bytes, st.errors);
+    printf("Batches  %lu, %lu widget updates", st.batches, st.updates);
+    if (st.batches) {
+        printf(", %lu messages per batch, apply avg %llu us max %lu us",
+            st.messages/st.batches, st.apply_time_us/st.batches, st.apply_time_max_us);
+    }
+    printf("\n\nWidget  Name\n");
+    for (const auto &widget : WIDGETS) {
+        printf("%6u  %s\n", widget.id, widget.name);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Scene updates
+ *
+ * Lets a server drive the UI over TCP on SCENE_PORT, one client at a time,
+ * see tools/scene_replay.py. Widgets are addressed by the stable ids below,
+ * which map to the SquareLine ui_* objects.
+ *
+ * Messages are staged as they arrive and applied to LVGL once per display
+ * refresh period, only the latest text or value of a widget is kept, so a
+ * burst of updates costs one redraw.
+ *
+ * Message format, integers little endian:
+ *
+ *   u8 type, u8 widget, u16 payload length, payload
+ *
+ *   SCENE_SET_TEXT      UTF-8 text, up to SCENE_MAX_TEXT-1 bytes are used
+ *   SCENE_SET_VALUE     i32
+ *   SCENE_CHART_APPEND  N x i16 points, the last SCENE_MAX_POINTS are kept
+ *   SCENE_SHOW_SCREEN   optional u8 lv_scr_load_anim_t, u16 time in ms,
+ *                       widget is a screen
+ *   SCENE_SYNC          u32 token, widget 0
+ *
+ * SYNC is answered when everything received before it is on screen with
+ * u8 SCENE_SYNC, u32 token, u32 messages received, u32 batches applied.
+ */
+static constexpr uint16_t SCENE_PORT { 5556 };
+static constexpr uint SCENE_MAX_TEXT { 64 };
+static constexpr uint SCENE_MAX_POINTS { 32 };
+static constexpr uint SCENE_MAX_PAYLOAD { 1024 };
+
+enum scene_message_t : uint8_t {
+    SCENE_SET_TEXT = 0x01,
+    SCENE_SET_VALUE = 0x02,
+    SCENE_CHART_APPEND = 0x03,
+    SCENE_SHOW_SCREEN = 0x04,
+    SCENE_SYNC = 0x05,
+};
+
+enum scene_widget_t : uint8_t {
+    SCENE_SCREEN_CLOCK = 1,
+    SCENE_SCREEN_DEMO = 2,
+    SCENE_SCREEN_DEMO1 = 3,
+    SCENE_SCREEN_DEMO2 = 4,
+    SCENE_CLOCK_LABEL = 16,         ///< Text
+    SCENE_CLOCK_SECONDS = 17,       ///< Arc value
+    SCENE_DEMO1_COLORWHEEL = 18,    ///< Value, 0xRRGGBB
+    SCENE_DEMO2_LABEL = 19,         ///< Text
+    SCENE_DEMO2_CHART = 20,         ///< Chart points
+};
+
+/** Call after the screens are created */
+void scene_init();
+
+void scene_print_stats();
@@ -0,0 +1,339 @@
+#include "settings.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_log.h>
+#include <nvs.h>
+
+static constexpr char TAG[] = "settings";
+
+static constexpr char SETTINGS_NVS_NAMESPACE[] { "env" };
+static constexpr uint64_t SETTINGS_COMMIT_DELAY_US { 2000*1000 };
+static constexpr uint64_t SETTINGS_RETRY_DELAY_US { 30*1000*1000 };
+static constexpr uint SETTINGS_MAX_LISTENERS { 16 };
+
+
+struct setting_def_t {
+    const char *key;            // NVS key, max 15 characters
+    setting_type_t type;
+    int32_t default_int;
+    const char *default_str;
+};
+
+static constexpr setting_def_t SETTINGS[SETTING_COUNT] = {
+    { "TZ",           SETTING_TYPE_STR, 0, ""                                              },
+    { "NTP_SERVER",   SETTING_TYPE_STR, 0, "0.pool.ntp.org,1.pool.ntp.org,2.pool.ntp.org" },
+    { "WIFI_POWER",   SETTING_TYPE_INT, 1, ""                                              },
+    // Memory arena placements, 0 internal, 1 PSRAM
+    { "ARENA_RENDER", SETTING_TYPE_INT, 0, ""                                              },
+    { "ARENA_DMA",    SETTING_TYPE_INT, 0, ""                                              },
+    { "ARENA_UI",     SETTING_TYPE_INT, 1, ""                                              },
+    { "ARENA_NET",    SETTING_TYPE_INT, 1, ""                                              },
+    // Storage backend, 0 SPIFFS, 1 LittleFS, applied on the next boot
+    { "STORAGE_FS",   SETTING_TYPE_INT, 0, ""                                              },
+};
+
+struct setting_value_t {
+    int32_t i;
+    char s[SETTINGS_MAX_STR_LEN];
+};
+
+struct listener_t {
+    setting_id_t id;
+    settings_listener_t func;
+    void *arg;
+};
+
+static setting_value_t g_values[SETTING_COUNT];
+static uint32_t g_dirty = 0;
+static listener_t g_listeners[SETTINGS_MAX_LISTENERS];
+static uint g_listener_count = 0;
+static nvs_handle_t g_handle = 0;
+static SemaphoreHandle_t g_lock = nullptr;
+static esp_timer_handle_t g_commit_timer = nullptr;
+
+static_assert(SETTING_COUNT<=32, "Dirty mask too small");
+
+
+
+static void load(setting_id_t id)
+{
+    auto &def = SETTINGS[id];
+    auto &val = g_values[id];
+
+    val.i = def.default_int;
+    strlcpy(val.s, def.default_str, sizeof(val.s));
+
+    if (!g_handle) {
+        return;
+    }
+
+    esp_err_t res = ESP_OK;
+    switch (def.type) {
+        case SETTING_TYPE_INT:
+            res = nvs_get_i32(g_handle, def.key, &val.i);
+            break;
+        case SETTING_TYPE_STR:
+            {
+                size_t len = sizeof(val.s);
+                res = nvs_get_str(g_handle, def.key, val.s, &len);
+                if (res!=ESP_OK) {
+                    strlcpy(val.s, def.default_str, sizeof(val.s));
+                }
+            }
+            break;
+    }
+
+    if (res!=ESP_OK && res!=ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Error reading %s: %s", def.key, esp_err_to_name(res));
+    }
+}
+
+
+static void migrate()
+{
+    // Older firmware stored the timezone under the wrong key
+    char tz[SETTINGS_MAX_STR_LEN];
+    size_t len = sizeof(tz);
+    if (nvs_get_str(g_handle, "TS", tz, &len)==ESP_OK) {
+        if (nvs_get_str(g_handle, SETTINGS[SETTING_TIMEZONE].key, nullptr, &len)!=ESP_OK) {
+            ESP_LOGI(TAG, "Migrating timezone setting");
+            strlcpy(g_values[SETTING_TIMEZONE].s, tz, sizeof(g_values[SETTING_TIMEZONE].s));
+            g_dirty |= 1u << SETTING_TIMEZONE;
+        }
+        nvs_erase_key(g_handle, "TS");
+    }
+}
+
+
+static void commit()
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    uint32_t dirty = g_dirty;
+    setting_value_t values[SETTING_COUNT];
+    for (uint i=0; i<SETTING_COUNT; i++) {
+        if (dirty & (1u << i)) {
+            values[i] = g_values[i];
+        }
+    }
+    g_dirty = 0;
+    xSemaphoreGive(g_lock);
+
+    if (!dirty || !g_handle) {
+        return;
+    }
+
+    uint count = 0;
+    uint32_t failed = 0;
+    for (uint i=0; i<SETTING_COUNT; i++) {
+        if (!(dirty & (1u << i))) {
+            continue;
+        }
+        auto &def = SETTINGS[i];
+        esp_err_t res = ESP_FAIL;
+        switch (def.type) {
+            case SETTING_TYPE_INT:
+                res = nvs_set_i32(g_handle, def.key, values[i].i);
+                break;
+            case SETTING_TYPE_STR:
+                res = nvs_set_str(g_handle, def.key, values[i].s);
+                break;
+        }
+        if (res!=ESP_OK) {
+            ESP_LOGE(TAG, "Error storing NVS setting %s: err=%d", def.key, res);
+            failed |= 1u << i;
+        }
+        count++;
+    }
+
+    esp_err_t res = nvs_commit(g_handle);
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "NVS commit failed: err=%d", res);
+        failed = dirty;
+    }
+    if (failed) {
+        // Retried with the values current by then, so flash catches up with the cache
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        g_dirty |= failed;
+        xSemaphoreGive(g_lock);
+        esp_timer_stop(g_commit_timer);
+        esp_timer_start_once(g_commit_timer, SETTINGS_RETRY_DELAY_US);
+        ESP_LOGW(TAG, "Retrying %u settings in %llu s", __builtin_popcount(failed), SETTINGS_RETRY_DELAY_US/1000000);
+        return;
+    }
+    ESP_LOGI(TAG, "Committed %u settings", count);
+}
+
+
+static void on_commit_timer(__unused void *arg)
+{
+    commit();
+}
+
+
+static void changed(setting_id_t id)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_dirty |= 1u << id;
+    xSemaphoreGive(g_lock);
+
+    // Restart the delay so a burst of changes ends up in a single commit
+    esp_timer_stop(g_commit_timer);
+    esp_timer_start_once(g_commit_timer, SETTINGS_COMMIT_DELAY_US);
+
+    for (uint i=0; i<g_listener_count; i++) {
+        auto &l = g_listeners[i];
+        if (l.id==id) {
+            l.func(id, l.arg);
+        }
+    }
+}
+
+
+
+void settings_init()
+{
+    static StaticSemaphore_t lock_buffer;
+    g_lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+    static constexpr esp_timer_create_args_t commit_timer_args = {
+        .callback = on_commit_timer,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "settings_commit",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&commit_timer_args, &g_commit_timer));
+
+    esp_err_t res = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &g_handle);
+    if (res!=ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS store: err=%d", res);
+        g_handle = 0;
+    }
+
+    for (uint i=0; i<SETTING_COUNT; i++) {
+        load(static_cast<setting_id_t>(i));
+    }
+
+    if (g_handle) {
+        migrate();
+    }
+
+    // Pending changes must not be lost on restart
+    esp_register_shutdown_handler(settings_flush);
+
+    if (g_dirty) {
+        commit();
+    }
+}
+
+
+void settings_flush()
+{
+    esp_timer_stop(g_commit_timer);
+    commit();
+}
+
+
+setting_type_t settings_type(setting_id_t id)
+{
+    return SETTINGS[id].type;
+}
+
+const char *settings_key(setting_id_t id)
+{
+    return SETTINGS[id].key;
+}
+
+
+int32_t settings_get_int(setting_id_t id)
+{
+    assert(SETTINGS[id].type==SETTING_TYPE_INT);
+    // Aligned 32 bit reads are atomic
+    return g_values[id].i;
+}
+
+
+size_t settings_get_str(setting_id_t id, char *buf, size_t len)
+{
+    assert(SETTINGS[id].type==SETTING_TYPE_STR);
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    size_t res = strlcpy(buf, g_values[id].s, len);
+    xSemaphoreGive(g_lock);
+    return res;
+}
+
+
+bool settings_set_int(setting_id_t id, int32_t value)
+{
+    assert(SETTINGS[id].type==SETTING_TYPE_INT);
+    if (g_values[id].i==value) {
+        return true;
+    }
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_values[id].i = value;
+    xSemaphoreGive(g_lock);
+
+    changed(id);
+    return true;
+}
+
+
+bool settings_set_str(setting_id_t id, const char *value)
+{
+    assert(SETTINGS[id].type==SETTING_TYPE_STR);
+    auto &val = g_values[id];
+    if (strlen(value)>=sizeof(val.s)) {
+        ESP_LOGE(TAG, "Value for %s too long", SETTINGS[id].key);
+        return false;
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool same = strcmp(val.s, value)==0;
+    if (!same) {
+        strlcpy(val.s, value, sizeof(val.s));
+    }
+    xSemaphoreGive(g_lock);
+
+    if (!same) {
+        changed(id);
+    }
+    return true;
+}
+
+
+bool settings_subscribe(setting_id_t id, settings_listener_t listener, void *arg)
+{
+    if (g_listener_count>=SETTINGS_MAX_LISTENERS) {
+        ESP_LOGE(TAG, "Too many listeners");
+        return false;
+    }
+    g_listeners[g_listener_count++] = { id, listener, arg };
+    return true;
+}
+
+
+void settings_print()
+{
+    printf("Key              Value\n");
+    printf("----------------------------------------------\n");
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    for (uint i=0; i<SETTING_COUNT; i++) {
+        auto &def = SETTINGS[i];
+        auto &val = g_values[i];
+        switch (def.type) {
+            case SETTING_TYPE_INT:
+                printf("%-16s %ld%s\n", def.key, val.i, g_dirty & (1u << i) ? " *" : "");
+                break;
+            case SETTING_TYPE_STR:
+                printf("%-16s \"%s\"%s\n", def.key, val.s, g_dirty & (1u << i) ? " *" : "");
+                break;
+        }
+    }
+    xSemaphoreGive(g_lock);
+    printf("(* = not yet committed)\n");
+}
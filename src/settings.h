@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Persistent settings
+ *
+ * All settings are loaded from NVS once at boot and served from RAM. Changes
+ * are written back to NVS in a single commit shortly after the last change.
+ * New settings are added to setting_id_t and the table in settings.cpp.
+ */
+enum setting_id_t {
+    SETTING_TIMEZONE,
+    SETTING_NTP_SERVER,
+    SETTING_WIFI_POWER,
+    SETTING_ARENA_RENDER,
+    SETTING_ARENA_DMA,
+    SETTING_ARENA_UI,
+    SETTING_ARENA_NET,
+    SETTING_STORAGE_FS,
+    SETTING_COUNT
+};
+
+enum setting_type_t {
+    SETTING_TYPE_INT,
+    SETTING_TYPE_STR,
+};
+
+static constexpr size_t SETTINGS_MAX_STR_LEN { 64 };
+
+void settings_init();
+void settings_flush();
+
+setting_type_t settings_type(setting_id_t id);
+const char *settings_key(setting_id_t id);
+
+int32_t settings_get_int(setting_id_t id);
+size_t settings_get_str(setting_id_t id, char *buf, size_t len);
+
+bool settings_set_int(setting_id_t id, int32_t value);
+bool settings_set_str(setting_id_t id, const char *value);
+
+
+/**
+ * Change notification, called from the context of the task changing the setting.
+ */
+using settings_listener_t = void (*)(setting_id_t id, void *arg);
+
+bool settings_subscribe(setting_id_t id, settings_listener_t listener, void *arg);
+
+void settings_print();
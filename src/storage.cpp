@@ -0,0 +1,221 @@
+#include "storage.h"
+
+#include <string.h>
+#include <esp_spiffs.h>
+#include <esp_littlefs.h>
+#include <esp_log.h>
+
+static constexpr char TAG[] = "storage";
+
+static constexpr size_t STORAGE_MAX_FILES { 5 };
+
+
+struct storage_backend_t {
+    const char *name;
+    esp_err_t (*mount)(bool format_if_mount_failed);
+    esp_err_t (*unmount)();
+    esp_err_t (*format)();
+    esp_err_t (*info)(size_t *total, size_t *used);
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * SPIFFS
+ */
+
+static esp_err_t spiffs_mount(bool format_if_mount_failed)
+{
+    esp_err_t ret;
+
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = STORAGE_PARTITION_LABEL,
+        .max_files = STORAGE_MAX_FILES,
+        .format_if_mount_failed = format_if_mount_failed
+    };
+
+    ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_t total = 0, used = 0;
+    ret = esp_spiffs_info(conf.partition_label, &total, &used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s). Formatting...", esp_err_to_name(ret));
+        return esp_spiffs_format(conf.partition_label);
+    }
+
+    // Check consistency of reported partiton size info.
+    if (used > total) {
+        ESP_LOGW(TAG, "Number of used bytes cannot be larger than total. Performing SPIFFS_check().");
+        ret = esp_spiffs_check(conf.partition_label);
+        // Could be also used to mend broken files, to clean unreferenced pages, etc.
+        // More info at https://github.com/pellepl/spiffs/wiki/FAQ#powerlosses-contd-when-should-i-run-spiffs_check
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "SPIFFS_check() failed (%s)", esp_err_to_name(ret));
+        } else {
+            ESP_LOGI(TAG, "SPIFFS_check() successful");
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t spiffs_unmount()
+{
+    return esp_vfs_spiffs_unregister(STORAGE_PARTITION_LABEL);
+}
+
+static esp_err_t spiffs_format()
+{
+    return esp_spiffs_format(STORAGE_PARTITION_LABEL);
+}
+
+static esp_err_t spiffs_info(size_t *total, size_t *used)
+{
+    return esp_spiffs_info(STORAGE_PARTITION_LABEL, total, used);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * LittleFS
+ */
+
+static esp_err_t littlefs_mount(bool format_if_mount_failed)
+{
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = STORAGE_PARTITION_LABEL,
+        .format_if_mount_failed = format_if_mount_failed,
+        .dont_mount = false,
+    };
+    return esp_vfs_littlefs_register(&conf);
+}
+
+static esp_err_t littlefs_unmount()
+{
+    return esp_vfs_littlefs_unregister(STORAGE_PARTITION_LABEL);
+}
+
+static esp_err_t littlefs_format()
+{
+    return esp_littlefs_format(STORAGE_PARTITION_LABEL);
+}
+
+static esp_err_t littlefs_info(size_t *total, size_t *used)
+{
+    return esp_littlefs_info(STORAGE_PARTITION_LABEL, total, used);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Storage
+ */
+
+static constexpr storage_backend_t BACKENDS[] = {
+    { "spiffs",   spiffs_mount,   spiffs_unmount,   spiffs_format,   spiffs_info },
+    { "littlefs", littlefs_mount, littlefs_unmount, littlefs_format, littlefs_info },
+};
+
+static const storage_backend_t *g_backend = nullptr;
+static storage_fs_t g_type = storage_fs_t::SPIFFS;
+
+
+static inline const storage_backend_t &backend(storage_fs_t fs)
+{
+    return BACKENDS[static_cast<uint>(fs)];
+}
+
+
+esp_err_t storage_mount(storage_fs_t fs, bool format_if_mount_failed)
+{
+    if (g_backend) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    auto &be = backend(fs);
+    ESP_LOGI(TAG, "Mounting %s on %s", be.name, STORAGE_BASE_PATH);
+
+    auto ret = be.mount(format_if_mount_failed);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount or format filesystem");
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to find storage partition");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize %s (%s)", be.name, esp_err_to_name(ret));
+        }
+        return ret;
+    }
+
+    g_backend = &be;
+    g_type = fs;
+
+    size_t total = 0, used = 0;
+    if (storage_info(&total, &used) == ESP_OK) {
+        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t storage_unmount()
+{
+    if (!g_backend) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    auto ret = g_backend->unmount();
+    if (ret == ESP_OK) {
+        g_backend = nullptr;
+    }
+    return ret;
+}
+
+
+esp_err_t storage_format(storage_fs_t fs)
+{
+    if (g_backend && g_type != fs) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return backend(fs).format();
+}
+
+
+esp_err_t storage_info(size_t *total, size_t *used)
+{
+    if (!g_backend) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return g_backend->info(total, used);
+}
+
+
+bool storage_mounted()
+{
+    return g_backend != nullptr;
+}
+
+storage_fs_t storage_type()
+{
+    return g_type;
+}
+
+const char *storage_fs_name(storage_fs_t fs)
+{
+    return backend(fs).name;
+}
+
+bool storage_fs_from_name(const char *name, storage_fs_t *fs)
+{
+    for (uint i=0; i<sizeof(BACKENDS)/sizeof(BACKENDS[0]); i++) {
+        if (strcmp(name, BACKENDS[i].name) == 0) {
+            *fs = static_cast<storage_fs_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
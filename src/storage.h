@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <esp_err.h>
+
+/**
+ * Filesystem on the storage partition
+ *
+ * The partition can be mounted with any of the backends, files are always
+ * found below STORAGE_BASE_PATH. Switching backend formats the partition.
+ */
+enum class storage_fs_t {
+    SPIFFS,
+    LITTLEFS,
+};
+
+static constexpr char STORAGE_BASE_PATH[] { "/storage" };
+static constexpr char STORAGE_PARTITION_LABEL[] { "storage" };
+
+esp_err_t storage_mount(storage_fs_t fs, bool format_if_mount_failed = true);
+esp_err_t storage_unmount();
+esp_err_t storage_format(storage_fs_t fs);
+esp_err_t storage_info(size_t *total, size_t *used);
+
+bool storage_mounted();
+storage_fs_t storage_type();
+const char *storage_fs_name(storage_fs_t fs);
+bool storage_fs_from_name(const char *name, storage_fs_t *fs);
+
+
+/**
+ * Benchmark a backend on the storage partition.
+ *
+ * The partition is formatted, the previously mounted backend is formatted
+ * and mounted again afterwards, so all files are lost.
+ */
+struct storage_bench_result_t {
+    int64_t format_us;
+    int64_t mount_empty_us;
+    int64_t mount_used_us;
+    uint32_t seq_write_kbps;
+    uint32_t seq_read_kbps;
+    uint32_t rand_write_iops;
+    uint32_t rand_read_iops;
+    uint32_t append_us;          ///< Average time of an open/append/close cycle
+    uint32_t rewrite_us;         ///< Average time of rewriting a small file
+    size_t used_after_wear;      ///< Bytes in use after the append/rewrite cycles
+};
+
+/** The test file is read and written in blocks of this size */
+static constexpr size_t STORAGE_BENCH_BLOCK_KB { 4 };
+
+/** file_kb must be a non-zero multiple of STORAGE_BENCH_BLOCK_KB */
+bool storage_bench(storage_fs_t fs, size_t file_kb, storage_bench_result_t *result);
@@ -0,0 +1,219 @@
+#include "storage.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <esp_log.h>
+
+static constexpr char TAG[] = "storage";
+
+static constexpr size_t BENCH_BLOCK_SIZE { STORAGE_BENCH_BLOCK_KB * 1024 };
+static constexpr size_t BENCH_RANDOM_BLOCK_SIZE { 256 };
+static constexpr uint BENCH_RANDOM_OPS { 256 };
+static constexpr uint BENCH_APPEND_OPS { 500 };
+static constexpr size_t BENCH_APPEND_SIZE { 64 };
+static constexpr uint BENCH_REWRITE_OPS { 200 };
+static constexpr size_t BENCH_REWRITE_SIZE { 256 };
+
+static uint8_t g_bench_buffer[BENCH_BLOCK_SIZE];
+
+
+static inline uint32_t kbps(size_t bytes, int64_t us)
+{
+    return us>0 ? (bytes * 1000000ull / 1024) / us : 0;
+}
+
+static inline uint32_t iops(uint ops, int64_t us)
+{
+    return us>0 ? ops * 1000000ull / us : 0;
+}
+
+
+static bool bench_seq_write(const char *path, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    for (size_t done=0; done<size; done+=BENCH_BLOCK_SIZE) {
+        if (fwrite(g_bench_buffer, 1, BENCH_BLOCK_SIZE, f)!=BENCH_BLOCK_SIZE) {
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static bool bench_seq_read(const char *path, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    for (size_t done=0; done<size; done+=BENCH_BLOCK_SIZE) {
+        if (fread(g_bench_buffer, 1, BENCH_BLOCK_SIZE, f)!=BENCH_BLOCK_SIZE) {
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static bool bench_random(const char *path, size_t size, bool write)
+{
+    FILE *f = fopen(path, write ? "r+b" : "rb");
+    if (!f) {
+        return false;
+    }
+    const uint blocks = size / BENCH_RANDOM_BLOCK_SIZE;
+    for (uint i=0; i<BENCH_RANDOM_OPS; i++) {
+        long offset = (esp_random() % blocks) * BENCH_RANDOM_BLOCK_SIZE;
+        fseek(f, offset, SEEK_SET);
+        size_t res = write ? fwrite(g_bench_buffer, 1, BENCH_RANDOM_BLOCK_SIZE, f) : fread(g_bench_buffer, 1, BENCH_RANDOM_BLOCK_SIZE, f);
+        if (res!=BENCH_RANDOM_BLOCK_SIZE) {
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// Log style workload, a record appended to a growing file
+static bool bench_append(const char *path)
+{
+    for (uint i=0; i<BENCH_APPEND_OPS; i++) {
+        FILE *f = fopen(path, "ab");
+        if (!f) {
+            return false;
+        }
+        fwrite(g_bench_buffer, 1, BENCH_APPEND_SIZE, f);
+        fclose(f);
+    }
+    return true;
+}
+
+// Settings style workload, the same small file replaced over and over
+static bool bench_rewrite(const char *path)
+{
+    for (uint i=0; i<BENCH_REWRITE_OPS; i++) {
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            return false;
+        }
+        fwrite(g_bench_buffer, 1, BENCH_REWRITE_SIZE, f);
+        fclose(f);
+    }
+    return true;
+}
+
+
+bool storage_bench(storage_fs_t fs, size_t file_kb, storage_bench_result_t *result)
+{
+    if (file_kb==0 || file_kb % STORAGE_BENCH_BLOCK_KB) {
+        ESP_LOGE(TAG, "Benchmark file size must be a multiple of %u KB", STORAGE_BENCH_BLOCK_KB);
+        return false;
+    }
+    const size_t size = file_kb * 1024;
+    const bool was_mounted = storage_mounted();
+    const storage_fs_t original = storage_type();
+    bool ok = false;
+    int64_t start;
+
+    char data_path[32], append_path[32], rewrite_path[32];
+    snprintf(data_path, sizeof(data_path), "%s/bench.bin", STORAGE_BASE_PATH);
+    snprintf(append_path, sizeof(append_path), "%s/bench.log", STORAGE_BASE_PATH);
+    snprintf(rewrite_path, sizeof(rewrite_path), "%s/bench.cfg", STORAGE_BASE_PATH);
+
+    memset(result, 0, sizeof(*result));
+    for (size_t i=0; i<sizeof(g_bench_buffer); i++) {
+        g_bench_buffer[i] = i;
+    }
+
+    if (was_mounted) {
+        storage_unmount();
+    }
+
+    ESP_LOGI(TAG, "Benchmarking %s with %u KB", storage_fs_name(fs), file_kb);
+
+    start = esp_timer_get_time();
+    if (storage_format(fs)!=ESP_OK) {
+        ESP_LOGE(TAG, "Format failed");
+        goto restore;
+    }
+    result->format_us = esp_timer_get_time()-start;
+
+    start = esp_timer_get_time();
+    if (storage_mount(fs, false)!=ESP_OK) {
+        goto restore;
+    }
+    result->mount_empty_us = esp_timer_get_time()-start;
+
+    start = esp_timer_get_time();
+    if (!bench_seq_write(data_path, size)) {
+        ESP_LOGE(TAG, "Sequential write failed");
+        goto restore;
+    }
+    result->seq_write_kbps = kbps(size, esp_timer_get_time()-start);
+
+    start = esp_timer_get_time();
+    if (!bench_seq_read(data_path, size)) {
+        ESP_LOGE(TAG, "Sequential read failed");
+        goto restore;
+    }
+    result->seq_read_kbps = kbps(size, esp_timer_get_time()-start);
+
+    start = esp_timer_get_time();
+    if (!bench_random(data_path, size, true)) {
+        ESP_LOGE(TAG, "Random write failed");
+        goto restore;
+    }
+    result->rand_write_iops = iops(BENCH_RANDOM_OPS, esp_timer_get_time()-start);
+
+    start = esp_timer_get_time();
+    if (!bench_random(data_path, size, false)) {
+        ESP_LOGE(TAG, "Random read failed");
+        goto restore;
+    }
+    result->rand_read_iops = iops(BENCH_RANDOM_OPS, esp_timer_get_time()-start);
+
+    start = esp_timer_get_time();
+    if (!bench_append(append_path)) {
+        ESP_LOGE(TAG, "Append failed");
+        goto restore;
+    }
+    result->append_us = (esp_timer_get_time()-start) / BENCH_APPEND_OPS;
+
+    start = esp_timer_get_time();
+    if (!bench_rewrite(rewrite_path)) {
+        ESP_LOGE(TAG, "Rewrite failed");
+        goto restore;
+    }
+    result->rewrite_us = (esp_timer_get_time()-start) / BENCH_REWRITE_OPS;
+
+    size_t total;
+    storage_info(&total, &result->used_after_wear);
+
+    // Mount time with files present
+    storage_unmount();
+    start = esp_timer_get_time();
+    if (storage_mount(fs, false)!=ESP_OK) {
+        goto restore;
+    }
+    result->mount_used_us = esp_timer_get_time()-start;
+
+    ok = true;
+
+restore:
+    if (storage_mounted()) {
+        storage_unmount();
+    }
+    if (was_mounted) {
+        storage_format(original);
+        storage_mount(original);
+    }
+    return ok;
+}
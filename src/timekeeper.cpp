@@ -0,0 +1,519 @@
+#include "timekeeper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <nvs.h>
+
+#include "wifi.h"
+#include "app_events.h"
+
+static constexpr char TAG[] = "timekeeper";
+
+static constexpr uint32_t TIMEKEEPER_TASK_STACK_SIZE { 4096 };
+static constexpr UBaseType_t TIMEKEEPER_TASK_PRIORITY { 2 };
+static constexpr uint TIMEKEEPER_POLL_MIN { 8 };                        // 2^8 s, about 4 minutes
+static constexpr uint TIMEKEEPER_POLL_MAX { 15 };                       // 2^15 s, about 9 hours
+static constexpr uint32_t TIMEKEEPER_RETRY_S { 30 };
+static constexpr int64_t TIMEKEEPER_COMP_PERIOD_US { 16*1000000LL };    // Drift compensation period
+static constexpr int64_t TIMEKEEPER_LEARN_MIN_US { 60*1000000LL };      // Shortest interval used for drift learning
+static constexpr int32_t TIMEKEEPER_MAX_DRIFT_PPB { 500000 };
+static constexpr int32_t TIMEKEEPER_SAVE_DRIFT_PPB { 200 };             // Change in drift before it is stored again
+static constexpr char TIMEKEEPER_NVS_NAMESPACE[] { "timekeeper" };
+static constexpr char TIMEKEEPER_NVS_KEY[] { "state" };
+
+static constexpr char NTP_PORT[] { "123" };
+static constexpr uint32_t NTP_UNIX_OFFSET { 2208988800UL };             // Seconds from 1900 to 1970
+static constexpr uint NTP_SAMPLES { 4 };                                // Requests per server and sync
+static constexpr uint32_t NTP_TIMEOUT_MS { 1000 };
+static constexpr int64_t NTP_MAX_DELAY_US { 500000 };
+static constexpr uint NTP_SERVER_NAME_LEN { 32 };
+
+
+struct ntp_packet_t {
+    uint8_t li_vn_mode;
+    uint8_t stratum;
+    uint8_t poll;
+    int8_t precision;
+    uint32_t root_delay;
+    uint32_t root_dispersion;
+    uint32_t ref_id;
+    uint32_t ref_ts[2];
+    uint32_t orig_ts[2];
+    uint32_t rx_ts[2];
+    uint32_t tx_ts[2];
+};
+static_assert(sizeof(ntp_packet_t)==48, "NTP packet size");
+
+struct ntp_sample_t {
+    int64_t offset_us;
+    int64_t delay_us;
+};
+
+struct server_result_t {
+    char name[NTP_SERVER_NAME_LEN];
+    bool valid;
+    ntp_sample_t sample;
+};
+
+// Stored in NVS so a restart begins with the learned values
+struct persist_t {
+    int32_t drift_ppb;
+    uint8_t poll;
+};
+
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static char g_servers[64] = "";
+static bool g_sync_requested = false;
+static int64_t g_next_sync_us = 0;
+static TaskHandle_t g_task = nullptr;
+
+static timekeeper_stats_t g_stats;
+static server_result_t g_results[TIMEKEEPER_MAX_SERVERS];
+static uint g_result_count = 0;
+
+// Only used from the timekeeper task
+static uint g_poll = TIMEKEEPER_POLL_MIN;
+static int64_t g_ref_us = 0;                // esp_timer time of the last correction, 0 after a step
+static uint g_drift_samples = 0;
+static int64_t g_comp_rem_ns = 0;
+static uint g_fail_streak = 0;
+static persist_t g_saved;
+
+
+/** -------------------------------------------------------------------------------
+ * NTP client
+ */
+
+static inline int64_t wallclock_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec*1000000LL + tv.tv_usec;
+}
+
+
+static inline int64_t ntp_to_us(const uint32_t ts[2])
+{
+    uint64_t sec = ntohl(ts[0]);
+    // Era 1 starts in 2036, it has the top bit clear
+    if (sec < 0x80000000UL) {
+        sec += 0x100000000ULL;
+    }
+    return static_cast<int64_t>(sec - NTP_UNIX_OFFSET)*1000000LL + static_cast<int64_t>((static_cast<uint64_t>(ntohl(ts[1]))*1000000ULL) >> 32);
+}
+
+
+static bool query(int sock, const struct sockaddr_in &addr, ntp_sample_t *sample)
+{
+    ntp_packet_t req;
+    memset(&req, 0, sizeof(req));
+    req.li_vn_mode = (4<<3) | 3;    // Version 4, client
+    // Random transmit timestamp, the server echoes it as the origin of its reply
+    req.tx_ts[0] = esp_random();
+    req.tx_ts[1] = esp_random();
+
+    int64_t t1 = wallclock_us();
+    if (sendto(sock, &req, sizeof(req), 0, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr))!=sizeof(req)) {
+        return false;
+    }
+    ntp_packet_t resp;
+    int len = recv(sock, &resp, sizeof(resp), 0);
+    int64_t t4 = wallclock_us();
+    if (len!=sizeof(resp) || memcmp(resp.orig_ts, req.tx_ts, sizeof(req.tx_ts))!=0) {
+        return false;
+    }
+    uint8_t mode = resp.li_vn_mode & 0x07;
+    uint8_t leap = resp.li_vn_mode >> 6;
+    if (mode!=4 || leap==3 || resp.stratum==0 || resp.stratum>15) {
+        return false;
+    }
+
+    int64_t t2 = ntp_to_us(resp.rx_ts);
+    int64_t t3 = ntp_to_us(resp.tx_ts);
+    sample->offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+    sample->delay_us = (t4 - t1) - (t3 - t2);
+    return sample->delay_us>=0 && sample->delay_us<=NTP_MAX_DELAY_US;
+}
+
+
+/** Query a server NTP_SAMPLES times and keep the sample with the lowest delay */
+static bool sample_server(const char *name, ntp_sample_t *best)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *res = nullptr;
+    if (getaddrinfo(name, NTP_PORT, &hints, &res)!=0 || !res) {
+        ESP_LOGW(TAG, "Error resolving %s", name);
+        return false;
+    }
+    struct sockaddr_in addr;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock<0) {
+        ESP_LOGE(TAG, "Error creating socket");
+        return false;
+    }
+    struct timeval timeout = { .tv_sec = NTP_TIMEOUT_MS/1000, .tv_usec = (NTP_TIMEOUT_MS%1000)*1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint valid = 0;
+    for (uint i=0; i<NTP_SAMPLES; i++) {
+        ntp_sample_t sample;
+        if (!query(sock, addr, &sample)) {
+            continue;
+        }
+        if (valid==0 || sample.delay_us<best->delay_us) {
+            *best = sample;
+        }
+        valid++;
+    }
+    close(sock);
+
+    ESP_LOGD(TAG, "%s: %u/%u samples", name, valid, NTP_SAMPLES);
+    return valid>0;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Clock discipline
+ */
+
+static void slew(int64_t delta_us)
+{
+    struct timeval delta = { .tv_sec = static_cast<time_t>(delta_us/1000000), .tv_usec = static_cast<suseconds_t>(delta_us%1000000) };
+    adjtime(&delta, nullptr);
+}
+
+
+static void load_state()
+{
+    g_saved = { .drift_ppb = 0, .poll = TIMEKEEPER_POLL_MIN };
+
+    nvs_handle_t handle;
+    if (nvs_open(TIMEKEEPER_NVS_NAMESPACE, NVS_READONLY, &handle)!=ESP_OK) {
+        return;
+    }
+    persist_t state;
+    size_t len = sizeof(state);
+    if (nvs_get_blob(handle, TIMEKEEPER_NVS_KEY, &state, &len)==ESP_OK && len==sizeof(state)) {
+        g_saved.drift_ppb = std::clamp(state.drift_ppb, -TIMEKEEPER_MAX_DRIFT_PPB, TIMEKEEPER_MAX_DRIFT_PPB);
+        g_saved.poll = std::clamp<uint8_t>(state.poll, TIMEKEEPER_POLL_MIN, TIMEKEEPER_POLL_MAX);
+        // A stored drift counts as a first estimate
+        g_drift_samples = 1;
+    }
+    nvs_close(handle);
+}
+
+
+static void save_state()
+{
+    if (g_poll==g_saved.poll && abs(g_stats.drift_ppb - g_saved.drift_ppb)<TIMEKEEPER_SAVE_DRIFT_PPB) {
+        return;
+    }
+    persist_t state = { .drift_ppb = g_stats.drift_ppb, .poll = static_cast<uint8_t>(g_poll) };
+
+    nvs_handle_t handle;
+    if (nvs_open(TIMEKEEPER_NVS_NAMESPACE, NVS_READWRITE, &handle)!=ESP_OK) {
+        ESP_LOGW(TAG, "Error opening NVS");
+        return;
+    }
+    if (nvs_set_blob(handle, TIMEKEEPER_NVS_KEY, &state, sizeof(state))==ESP_OK && nvs_commit(handle)==ESP_OK) {
+        g_saved = state;
+    }
+    nvs_close(handle);
+}
+
+
+/** Add the learned drift for the elapsed time to any adjustment still in progress */
+static void compensate(int64_t elapsed_us)
+{
+    if (!g_stats.synced || g_stats.drift_ppb==0) {
+        return;
+    }
+    int64_t ns = static_cast<int64_t>(g_stats.drift_ppb) * elapsed_us / 1000000 + g_comp_rem_ns;
+    g_comp_rem_ns = ns % 1000;
+    int64_t us = ns / 1000;
+    if (us==0) {
+        return;
+    }
+    struct timeval remaining;
+    adjtime(nullptr, &remaining);
+    slew(remaining.tv_sec*1000000LL + remaining.tv_usec + us);
+}
+
+
+static void step(int64_t offset_us)
+{
+    int64_t t = wallclock_us() + offset_us;
+    struct timeval tv = { .tv_sec = static_cast<time_t>(t/1000000), .tv_usec = static_cast<suseconds_t>(t%1000000) };
+    slew(0);
+    settimeofday(&tv, nullptr);
+
+    char strftime_buf[64];
+    struct tm timeinfo;
+    localtime_r(&tv.tv_sec, &timeinfo);
+    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
+    ESP_LOGI(TAG, "Time set to %s, offset %lld ms", strftime_buf, offset_us/1000);
+
+    app_event_publish(app_time_sync_event_t { .tv = tv });
+}
+
+
+static void discipline(int64_t offset_us, int64_t now_us)
+{
+    if (!g_stats.synced || llabs(offset_us)>TIMEKEEPER_STEP_THRESHOLD_US) {
+        step(offset_us);
+        g_stats.steps++;
+        // The drift can't be measured across a step
+        g_ref_us = now_us;
+        g_comp_rem_ns = 0;
+        return;
+    }
+
+    // With the drift compensated the remaining offset is the error of the estimate
+    int64_t elapsed_us = now_us - g_ref_us;
+    if (elapsed_us>=TIMEKEEPER_LEARN_MIN_US) {
+        int64_t error_ppb = offset_us * 1000000000LL / elapsed_us;
+        int64_t drift = g_stats.drift_ppb + (g_drift_samples==0 ? error_ppb : error_ppb/2);
+        g_stats.drift_ppb = std::clamp<int64_t>(drift, -TIMEKEEPER_MAX_DRIFT_PPB, TIMEKEEPER_MAX_DRIFT_PPB);
+        g_drift_samples++;
+
+        // Stretch the interval while the prediction holds, shrink it when it does not
+        if (llabs(offset_us)>TIMEKEEPER_TARGET_US/2) {
+            g_poll = std::max(g_poll-1, TIMEKEEPER_POLL_MIN);
+        }
+        else if (llabs(offset_us)<TIMEKEEPER_TARGET_US/4 && g_drift_samples>=2) {
+            g_poll = std::min(g_poll+1, TIMEKEEPER_POLL_MAX);
+        }
+    }
+    // Replaces any adjustment in progress, the offset already includes it
+    slew(offset_us);
+    g_ref_us = now_us;
+}
+
+
+static void synchronize()
+{
+    char servers[sizeof(g_servers)];
+    portENTER_CRITICAL(&g_lock);
+    memcpy(servers, g_servers, sizeof(servers));
+    g_sync_requested = false;
+    portEXIT_CRITICAL(&g_lock);
+
+    server_result_t results[TIMEKEEPER_MAX_SERVERS];
+    ntp_sample_t samples[TIMEKEEPER_MAX_SERVERS];
+    uint result_count = 0;
+    uint count = 0;
+
+    char *save = nullptr;
+    for (char *name = strtok_r(servers, ", ", &save); name && result_count<TIMEKEEPER_MAX_SERVERS; name = strtok_r(nullptr, ", ", &save)) {
+        auto &res = results[result_count++];
+        strlcpy(res.name, name, sizeof(res.name));
+        res.valid = sample_server(name, &res.sample);
+        if (res.valid) {
+            samples[count++] = res.sample;
+        }
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t next;
+    if (count==0) {
+        ESP_LOGW(TAG, "No server answered");
+        g_fail_streak++;
+        next = now + std::min<int64_t>(static_cast<int64_t>(TIMEKEEPER_RETRY_S) << std::min(g_fail_streak, 6u), 1LL << g_poll) * 1000000LL;
+    }
+    else {
+        // Median offset, resists a single falseticker
+        std::sort(samples, samples+count, [](const ntp_sample_t &a, const ntp_sample_t &b) { return a.offset_us<b.offset_us; });
+        ntp_sample_t sample = samples[count/2];
+        if (count%2==0) {
+            sample.offset_us = (samples[count/2-1].offset_us + samples[count/2].offset_us) / 2;
+        }
+        discipline(sample.offset_us, now);
+        g_fail_streak = 0;
+        next = now + (1LL << g_poll) * 1000000LL;
+        ESP_LOGI(TAG, "Offset %lld us, delay %lld us, %u servers, drift %ld ppb, next sync in %u s",
+            sample.offset_us, sample.delay_us, count, g_stats.drift_ppb, 1u << g_poll);
+
+        portENTER_CRITICAL(&g_lock);
+        g_stats.synced = true;
+        g_stats.last_sync_us = now;
+        g_stats.offset_us = sample.offset_us;
+        g_stats.delay_us = sample.delay_us;
+        g_stats.interval_s = 1u << g_poll;
+        g_stats.servers = count;
+        g_stats.syncs++;
+        portEXIT_CRITICAL(&g_lock);
+        save_state();
+    }
+
+    portENTER_CRITICAL(&g_lock);
+    if (count==0) {
+        g_stats.failures++;
+    }
+    g_stats.last_attempt_us = now;
+    g_next_sync_us = next;
+    memcpy(g_results, results, sizeof(results[0])*result_count);
+    g_result_count = result_count;
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+static void timekeeper_task(__unused void *param)
+{
+    int64_t last_comp = esp_timer_get_time();
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        int64_t wake = last_comp + TIMEKEEPER_COMP_PERIOD_US;
+        portENTER_CRITICAL(&g_lock);
+        bool due = g_sync_requested || now>=g_next_sync_us;
+        int64_t next_sync = g_next_sync_us;
+        portEXIT_CRITICAL(&g_lock);
+        if (due && wifi_has_ip()) {
+            synchronize();
+            continue;
+        }
+        // Without a network wait for the address instead of the sync time
+        if (!due) {
+            wake = std::min(wake, next_sync);
+        }
+
+        ulTaskNotifyTake(pdTRUE, wake>now ? pdMS_TO_TICKS((wake-now)/1000) + 1 : 0);
+
+        now = esp_timer_get_time();
+        if (now - last_comp >= TIMEKEEPER_COMP_PERIOD_US) {
+            compensate(now - last_comp);
+            last_comp = now;
+        }
+    }
+}
+
+
+static void on_got_ip(__unused void* arg, __unused esp_event_base_t event_base, __unused int32_t event_id, __unused void *event_data)
+{
+    xTaskNotifyGive(g_task);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public interface
+ */
+
+void timekeeper_init()
+{
+    load_state();
+    g_poll = g_saved.poll;
+    g_stats.drift_ppb = g_saved.drift_ppb;
+    g_stats.interval_s = 1u << g_poll;
+    ESP_LOGI(TAG, "Drift %ld ppb, interval %lu s", g_stats.drift_ppb, g_stats.interval_s);
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[TIMEKEEPER_TASK_STACK_SIZE];
+    g_task = xTaskCreateStatic(timekeeper_task, "timekeeper", TIMEKEEPER_TASK_STACK_SIZE, nullptr, TIMEKEEPER_TASK_PRIORITY, task_stack, &task_buffer);
+
+    ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, nullptr) );
+}
+
+
+void timekeeper_set_servers(const char *servers)
+{
+    portENTER_CRITICAL(&g_lock);
+    strlcpy(g_servers, servers, sizeof(g_servers));
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+void timekeeper_sync()
+{
+    portENTER_CRITICAL(&g_lock);
+    g_sync_requested = true;
+    portEXIT_CRITICAL(&g_lock);
+    if (g_task) {
+        xTaskNotifyGive(g_task);
+    }
+}
+
+
+int64_t timekeeper_next_sync_us()
+{
+    portENTER_CRITICAL(&g_lock);
+    int64_t next = g_next_sync_us;
+    portEXIT_CRITICAL(&g_lock);
+    return next;
+}
+
+
+void timekeeper_get_stats(timekeeper_stats_t *stats)
+{
+    portENTER_CRITICAL(&g_lock);
+    *stats = g_stats;
+    portEXIT_CRITICAL(&g_lock);
+}
+
+
+/** Format a value in thousandths with three decimals */
+static const char *format_milli(char *buf, size_t len, int64_t value)
+{
+    snprintf(buf, len, "%c%lld.%03lld", value<0 ? '-' : '+', llabs(value)/1000, llabs(value)%1000);
+    return buf;
+}
+
+
+void timekeeper_print_stats()
+{
+    timekeeper_stats_t st;
+    server_result_t results[TIMEKEEPER_MAX_SERVERS];
+    portENTER_CRITICAL(&g_lock);
+    st = g_stats;
+    uint result_count = g_result_count;
+    memcpy(results, g_results, sizeof(results[0])*result_count);
+    int64_t next = g_next_sync_us;
+    portEXIT_CRITICAL(&g_lock);
+
+    int64_t now = esp_timer_get_time();
+    char buf1[24], buf2[24];
+
+    if (st.synced) {
+        printf("Last sync %lld s ago, next in %lld s, interval %lu s\n", (now - st.last_sync_us)/1000000, std::max<int64_t>(next - now, 0)/1000000, st.interval_s);
+        printf("   Offset: %s ms, delay %s ms, %u servers\n", format_milli(buf1, sizeof(buf1), st.offset_us), format_milli(buf2, sizeof(buf2), st.delay_us), st.servers);
+    }
+    else {
+        printf("Not synchronized\n");
+    }
+    printf("    Drift: %s ppm\n", format_milli(buf1, sizeof(buf1), st.drift_ppb));
+    printf("    Syncs: %lu, steps %lu, failures %lu\n", st.syncs, st.steps, st.failures);
+
+    if (result_count) {
+        printf("\nServer                           Offset ms     Delay ms\n");
+        printf("-------------------------------------------------------\n");
+        for (uint i=0; i<result_count; i++) {
+            if (results[i].valid) {
+                printf("%-31s %11s %12s\n", results[i].name,
+                    format_milli(buf1, sizeof(buf1), results[i].sample.offset_us),
+                    format_milli(buf2, sizeof(buf2), results[i].sample.delay_us));
+            }
+            else {
+                printf("%-31s %11s %12s\n", results[i].name, "-", "-");
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Timekeeper
+ *
+ * SNTP client replacing the IDF poll mode client. Each sync queries every
+ * configured server several times, keeps the lowest delay sample per server
+ * and uses the median offset. Offsets below TIMEKEEPER_STEP_THRESHOLD_US are
+ * slewed with adjtime() so the displayed time never jumps, larger ones step
+ * the clock and publish an app_time_sync_event_t.
+ *
+ * The residual offset after each interval is used to learn the crystal drift,
+ * which is compensated continuously and stored in NVS. The sync interval is
+ * doubled while the residual stays well inside TIMEKEEPER_TARGET_US and
+ * halved when it exceeds it.
+ */
+static constexpr uint TIMEKEEPER_MAX_SERVERS { 4 };
+static constexpr int64_t TIMEKEEPER_STEP_THRESHOLD_US { 500000 };
+static constexpr int64_t TIMEKEEPER_TARGET_US { 50000 };
+
+void timekeeper_init();
+
+/** Comma separated list of NTP servers, takes effect at the next sync */
+void timekeeper_set_servers(const char *servers);
+
+/** Synchronize as soon as the network is available */
+void timekeeper_sync();
+
+/** esp_timer time of the next scheduled sync */
+int64_t timekeeper_next_sync_us();
+
+
+struct timekeeper_stats_t {
+    bool synced;                ///< Time has been set since boot
+    int64_t last_sync_us;       ///< esp_timer time of the last successful sync, 0 if never
+    int64_t last_attempt_us;    ///< esp_timer time of the last sync attempt, 0 if never
+    int64_t offset_us;          ///< Offset measured by the last sync
+    uint32_t delay_us;          ///< Round trip delay of the selected sample
+    int32_t drift_ppb;          ///< Learned drift correction
+    uint32_t interval_s;        ///< Current sync interval
+    uint servers;               ///< Servers that answered the last sync
+    uint32_t syncs;
+    uint32_t steps;
+    uint32_t failures;
+};
+
+void timekeeper_get_stats(timekeeper_stats_t *stats);
+void timekeeper_print_stats();
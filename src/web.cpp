@@ -0,0 +1,750 @@
+#include "web.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <esp_partition.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "http_server.h"
+#include "app_base.h"
+#include "settings.h"
+#include "display.h"
+#include "wifi.h"
+#include "wifi_power.h"
+#include "timekeeper.h"
+#include "face.h"
+
+static constexpr char TAG[] = "web";
+
+static constexpr char WWW_PARTITION_LABEL[] { "www" };
+static constexpr uint32_t WWW_MAGIC { 0x31575744 }; // "DWW1"
+static constexpr uint32_t WWW_FLAG_GZIP { 0x01 };
+static constexpr char WWW_INDEX[] { "/index.html" };
+static constexpr uint WEB_JOIN_TIMEOUT_MS { 10000 };
+static constexpr size_t WEB_MAX_SSID_LEN { 32 };
+static constexpr size_t WEB_MAX_PASSWORD_LEN { 64 };
+static constexpr size_t WEB_MAX_KEY_LEN { 16 };
+
+/**
+ * www partition layout, header, entries, then the file data.
+ * Generated with tools/mkwww.py
+ */
+struct www_header_t {
+    uint32_t magic;
+    uint32_t count;
+};
+
+struct www_entry_t {
+    char path[48];
+    char type[32];
+    uint32_t offset;            // From the start of the partition
+    uint32_t size;
+    uint32_t etag;
+    uint32_t flags;
+};
+
+
+enum join_state_t : int {
+    JOIN_NONE,
+    JOIN_CONNECTING,
+    JOIN_CONNECTED,
+    JOIN_FAILED,
+};
+
+static constexpr const char *JOIN_STATE_NAMES[] = { "none", "connecting", "connected", "failed" };
+
+
+static const www_entry_t *g_entries = nullptr;
+static uint g_entry_count = 0;
+static const uint8_t *g_www = nullptr;
+
+// Only used from the HTTP server task
+static char g_body[WEB_BODY_BUFFER_SIZE+1];
+static char g_response[WEB_RESPONSE_BUFFER_SIZE];
+static char g_etag[16];
+static char g_if_none_match[16];
+static char g_join_ssid[WEB_MAX_SSID_LEN+1];
+
+// Result of the last POST /api/wifi, set by the join timer
+static std::atomic<int> g_join_state { JOIN_NONE };
+static esp_timer_handle_t g_join_timer = nullptr;
+
+
+
+/** -------------------------------------------------------------------------------
+ * JSON
+ */
+
+class json_writer {
+    public:
+        json_writer(char *buf, size_t len) : m_buf(buf), m_len(len), m_pos(0), m_first(true) {}
+
+        void begin() { put('{'); }
+        void end() { put('}'); }
+
+        void str(const char *name, const char *value)
+        {
+            key(name);
+            put('"');
+            for (const char *c=value; *c; c++) {
+                if (*c=='"' || *c=='\\') {
+                    put('\\');
+                    put(*c);
+                }
+                else if (static_cast<uint8_t>(*c)<0x20) {
+                    printf("\\u%04x", *c);
+                }
+                else {
+                    put(*c);
+                }
+            }
+            put('"');
+        }
+
+        void num(const char *name, int64_t value)
+        {
+            key(name);
+            printf("%lld", value);
+        }
+
+        void boolean(const char *name, bool value)
+        {
+            key(name);
+            printf("%s", value ? "true" : "false");
+        }
+
+        bool overflow() const { return m_pos>=m_len; }
+        size_t length() const { return m_pos; }
+
+    private:
+        void key(const char *name)
+        {
+            if (!m_first) {
+                put(',');
+            }
+            m_first = false;
+            printf("\"%s\":", name);
+        }
+
+        void put(char c)
+        {
+            if (m_pos<m_len) {
+                m_buf[m_pos++] = c;
+            }
+        }
+
+        void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+        {
+            if (m_pos>=m_len) {
+                return;
+            }
+            va_list args;
+            va_start(args, fmt);
+            int res = vsnprintf(m_buf+m_pos, m_len-m_pos, fmt, args);
+            va_end(args);
+            m_pos = res<0 ? m_len : m_pos+res;
+        }
+
+        char *m_buf;
+        size_t m_len;
+        size_t m_pos;
+        bool m_first;
+};
+
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p<end && (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n')) {
+        p++;
+    }
+    return p;
+}
+
+
+static int hex_value(char c)
+{
+    if (c>='0' && c<='9') return c - '0';
+    if (c>='a' && c<='f') return c - 'a' + 10;
+    if (c>='A' && c<='F') return c - 'A' + 10;
+    return -1;
+}
+
+
+/** Parse a string into out, returns the position after it or nullptr */
+static const char *parse_string(const char *p, const char *end, char *out, size_t len)
+{
+    if (p>=end || *p!='"') {
+        return nullptr;
+    }
+    p++;
+    size_t pos = 0;
+    auto emit = [&](char c) {
+        if (pos+1>=len) {
+            return false;
+        }
+        out[pos++] = c;
+        return true;
+    };
+    while (p<end && *p!='"') {
+        char c = *p++;
+        if (c!='\\') {
+            if (!emit(c)) return nullptr;
+            continue;
+        }
+        if (p>=end) {
+            return nullptr;
+        }
+        c = *p++;
+        switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                if (end-p<4) {
+                    return nullptr;
+                }
+                uint32_t cp = 0;
+                for (uint i=0; i<4; i++) {
+                    int v = hex_value(*p++);
+                    if (v<0) {
+                        return nullptr;
+                    }
+                    cp = (cp<<4) | v;
+                }
+                // Basic multilingual plane only, surrogate pairs are not needed for settings
+                if (cp>=0xd800 && cp<0xe000) {
+                    return nullptr;
+                }
+                if (cp<0x80) {
+                    if (!emit(cp)) return nullptr;
+                }
+                else if (cp<0x800) {
+                    if (!emit(0xc0 | (cp>>6)) || !emit(0x80 | (cp & 0x3f))) return nullptr;
+                }
+                else {
+                    if (!emit(0xe0 | (cp>>12)) || !emit(0x80 | ((cp>>6) & 0x3f)) || !emit(0x80 | (cp & 0x3f))) return nullptr;
+                }
+                continue;
+            }
+            default:
+                break;
+        }
+        if (!emit(c)) return nullptr;
+    }
+    if (p>=end) {
+        return nullptr;
+    }
+    out[pos] = '\0';
+    return p+1;
+}
+
+
+/**
+ * Call field(key, value, quoted) for every member of a flat JSON object.
+ * Values must be strings or literals, nested objects and arrays are rejected.
+ */
+template<typename F>
+static bool parse_object(const char *p, const char *end, F &&field)
+{
+    char key[WEB_MAX_KEY_LEN];
+    char value[SETTINGS_MAX_STR_LEN+1];
+
+    p = skip_ws(p, end);
+    if (p>=end || *p++!='{') {
+        return false;
+    }
+    p = skip_ws(p, end);
+    if (p<end && *p=='}') {
+        return true;
+    }
+    while (p<end) {
+        p = parse_string(p, end, key, sizeof(key));
+        if (!p) {
+            return false;
+        }
+        p = skip_ws(p, end);
+        if (p>=end || *p++!=':') {
+            return false;
+        }
+        p = skip_ws(p, end);
+        bool quoted = p<end && *p=='"';
+        if (quoted) {
+            p = parse_string(p, end, value, sizeof(value));
+            if (!p) {
+                return false;
+            }
+        }
+        else {
+            size_t len = 0;
+            while (p<end && *p!=',' && *p!='}' && *p!=' ' && *p!='\r' && *p!='\n' && *p!='\t') {
+                if (*p=='{' || *p=='[' || len+1>=sizeof(value)) {
+                    return false;
+                }
+                value[len++] = *p++;
+            }
+            value[len] = '\0';
+        }
+        if (!field(key, value, quoted)) {
+            return false;
+        }
+        p = skip_ws(p, end);
+        if (p<end && *p==',') {
+            p = skip_ws(p+1, end);
+            continue;
+        }
+        return p<end && *p=='}';
+    }
+    return false;
+}
+
+
+static bool parse_bool(const char *value, bool quoted, bool *out)
+{
+    if (quoted) {
+        return false;
+    }
+    if (strcmp(value, "true")==0) {
+        *out = true;
+        return true;
+    }
+    if (strcmp(value, "false")==0) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Request helpers
+ */
+
+/** Read the request body into g_body, sends an error response on failure */
+static bool read_body(httpd_req_t *req, size_t *len)
+{
+    if (req->content_len>WEB_BODY_BUFFER_SIZE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body too large");
+        return false;
+    }
+    size_t pos = 0;
+    while (pos<req->content_len) {
+        int res = httpd_req_recv(req, g_body+pos, req->content_len-pos);
+        if (res==HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (res<=0) {
+            return false;
+        }
+        pos += res;
+    }
+    g_body[pos] = '\0';
+    *len = pos;
+    return true;
+}
+
+
+static esp_err_t send_json(httpd_req_t *req, const json_writer &w)
+{
+    if (w.overflow()) {
+        ESP_LOGE(TAG, "Response exceeds %u bytes", sizeof(g_response));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response buffer too small");
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, g_response, w.length());
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * API
+ */
+
+static void render_config(json_writer &w)
+{
+    char value[SETTINGS_MAX_STR_LEN];
+
+    w.begin();
+    settings_get_str(SETTING_TIMEZONE, value, sizeof(value));
+    w.str("timezone", value);
+    settings_get_str(SETTING_NTP_SERVER, value, sizeof(value));
+    w.str("ntp_server", value);
+    w.str("wifi_power", wifi_power_policy_name(wifi_power_get_policy()));
+    w.boolean("backlight", display_get_backlight());
+    w.end();
+}
+
+
+static esp_err_t on_get_config(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    json_writer w(g_response, sizeof(g_response));
+    render_config(w);
+    return send_json(req, w);
+}
+
+
+static esp_err_t on_post_config(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    size_t len;
+    if (!read_body(req, &len)) {
+        return ESP_FAIL;
+    }
+
+    // Validate everything before changing anything
+    static struct {
+        char timezone[SETTINGS_MAX_STR_LEN];
+        char ntp_server[SETTINGS_MAX_STR_LEN];
+        wifi_power_policy_t wifi_power;
+        bool backlight;
+        bool has_timezone, has_ntp_server, has_wifi_power, has_backlight;
+    } update;
+    memset(&update, 0, sizeof(update));
+
+    bool valid = parse_object(g_body, g_body+len, [](const char *key, const char *value, bool quoted) {
+        if (strcmp(key, "timezone")==0 && quoted) {
+            update.has_timezone = strlcpy(update.timezone, value, sizeof(update.timezone))<sizeof(update.timezone);
+            return update.has_timezone;
+        }
+        if (strcmp(key, "ntp_server")==0 && quoted) {
+            update.has_ntp_server = strlcpy(update.ntp_server, value, sizeof(update.ntp_server))<sizeof(update.ntp_server);
+            return update.has_ntp_server;
+        }
+        if (strcmp(key, "wifi_power")==0 && quoted) {
+            update.has_wifi_power = wifi_power_policy_from_name(value, &update.wifi_power);
+            return update.has_wifi_power;
+        }
+        if (strcmp(key, "backlight")==0) {
+            update.has_backlight = parse_bool(value, quoted, &update.backlight);
+            return update.has_backlight;
+        }
+        return false;
+    });
+    if (!valid) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid config");
+    }
+
+    bool ok = true;
+    if (update.has_timezone) {
+        ESP_LOGI(TAG, "Set timezone '%s'", update.timezone);
+        ok &= app_set_timezone(update.timezone);
+    }
+    if (update.has_ntp_server) {
+        ESP_LOGI(TAG, "Set NTP server '%s'", update.ntp_server);
+        ok &= app_set_ntp_server(update.ntp_server);
+    }
+    if (update.has_wifi_power) {
+        ok &= wifi_power_set_policy(update.wifi_power);
+    }
+    if (update.has_backlight) {
+        display_set_backlight(update.backlight);
+    }
+    if (!ok) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error storing settings");
+    }
+
+    json_writer w(g_response, sizeof(g_response));
+    render_config(w);
+    return send_json(req, w);
+}
+
+
+static esp_err_t on_post_wifi(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    size_t len;
+    if (!read_body(req, &len)) {
+        return ESP_FAIL;
+    }
+
+    static char ssid[WEB_MAX_SSID_LEN+1];
+    static char password[WEB_MAX_PASSWORD_LEN+1];
+    ssid[0] = '\0';
+    password[0] = '\0';
+    bool valid = parse_object(g_body, g_body+len, [](const char *key, const char *value, bool quoted) {
+        if (strcmp(key, "ssid")==0 && quoted) {
+            return strlcpy(ssid, value, sizeof(ssid))<sizeof(ssid);
+        }
+        if (strcmp(key, "password")==0 && quoted) {
+            return strlcpy(password, value, sizeof(password))<sizeof(password);
+        }
+        return false;
+    });
+    if (!valid || ssid[0]=='\0') {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid network");
+    }
+
+    // Answer first, joining another network drops this connection
+    json_writer w(g_response, sizeof(g_response));
+    w.begin();
+    w.str("joining", ssid);
+    w.end();
+    httpd_resp_set_status(req, "202 Accepted");
+    esp_err_t res = send_json(req, w);
+
+    // Only starts the connect, the server task must not wait for it. The result is in /api/status.
+    ESP_LOGI(TAG, "Connecting to '%s'", ssid);
+    strlcpy(g_join_ssid, ssid, sizeof(g_join_ssid));
+    g_join_state.store(JOIN_CONNECTING);
+    esp_timer_stop(g_join_timer);
+    wifi_join(ssid, password, 0);
+    esp_timer_start_once(g_join_timer, WEB_JOIN_TIMEOUT_MS*1000ull);
+    return res;
+}
+
+
+static void on_join_timer(__unused void *arg)
+{
+    wifi_stats_t wifi;
+    wifi_get_stats(&wifi);
+    if (wifi.connected && wifi.has_ip) {
+        g_join_state.store(JOIN_CONNECTED);
+        ESP_LOGI(TAG, "Connected");
+    }
+    else {
+        g_join_state.store(JOIN_FAILED);
+        ESP_LOGW(TAG, "Connection timed out");
+    }
+}
+
+
+/** Store the body as a face, see tools/mkface.py, and show it */
+static esp_err_t on_put_face(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    char query[64];
+    char name[FACE_MAX_NAME];
+    char path[64];
+    char tmp_path[64];
+    char old_path[64];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query))!=ESP_OK
+        || httpd_query_key_value(query, "name", name, sizeof(name))!=ESP_OK
+        || !face_path(name, path, sizeof(path))
+        || !face_path(name, tmp_path, sizeof(tmp_path), "tmp")
+        || !face_path(name, old_path, sizeof(old_path), "old")) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid face name");
+    }
+    if (req->content_len>FACE_MAX_FILE_SIZE) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Face too large");
+    }
+
+    // Written next to the current face and only swapped in once valid, a bad upload keeps the old one
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Storage not available");
+    }
+    size_t pos = 0;
+    while (pos<req->content_len) {
+        int res = httpd_req_recv(req, g_body, std::min(req->content_len-pos, WEB_BODY_BUFFER_SIZE));
+        if (res==HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (res<=0 || fwrite(g_body, 1, res, f)!=static_cast<size_t>(res)) {
+            break;
+        }
+        pos += res;
+    }
+    fclose(f);
+    if (pos<req->content_len) {
+        remove(tmp_path);
+        return ESP_FAIL;
+    }
+    if (!face_check(tmp_path)) {
+        remove(tmp_path);
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid face");
+    }
+
+    // Not every filesystem renames over an existing file, so the old face is moved aside first
+    remove(old_path);
+    const bool replaced = rename(path, old_path)==0;
+    if (rename(tmp_path, path)!=0) {
+        if (replaced) {
+            rename(old_path, path);
+        }
+        remove(tmp_path);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error storing face");
+    }
+    remove(old_path);
+
+    ESP_LOGI(TAG, "Stored face %s, %u bytes", name, pos);
+    if (!face_load(name)) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error loading face");
+    }
+    json_writer w(g_response, sizeof(g_response));
+    w.begin();
+    w.str("face", name);
+    w.end();
+    return send_json(req, w);
+}
+
+
+static esp_err_t on_get_status(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    const int64_t now = esp_timer_get_time();
+    json_writer w(g_response, sizeof(g_response));
+    w.begin();
+    w.num("uptime_s", now/1000000);
+    w.num("heap_internal_free", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    w.num("heap_psram_free", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+
+    display_stats_t display;
+    if (display_get_stats(&display, pdMS_TO_TICKS(100))) {
+        w.num("display_fps", display.fps);
+        w.num("display_frame_p90_ms", display.frame_time_p90_ms);
+    }
+
+    wifi_stats_t wifi;
+    wifi_get_stats(&wifi);
+    w.boolean("wifi_connected", wifi.has_ip);
+    w.num("wifi_rssi", wifi.rssi);
+    w.num("wifi_reconnects", wifi.reconnects);
+    const int join = g_join_state.load();
+    if (join!=JOIN_NONE) {
+        w.str("wifi_join_ssid", g_join_ssid);
+        w.str("wifi_join", JOIN_STATE_NAMES[join]);
+    }
+
+    timekeeper_stats_t time;
+    timekeeper_get_stats(&time);
+    w.boolean("time_synced", time.synced);
+    if (time.last_sync_us) {
+        w.num("time_sync_age_s", (now-time.last_sync_us)/1000000);
+        w.num("time_offset_us", time.offset_us);
+    }
+    w.end();
+    return send_json(req, w);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Static assets
+ */
+
+static const www_entry_t *find_entry(const char *uri)
+{
+    size_t len = strcspn(uri, "?#");
+    if (len==1 && uri[0]=='/') {
+        uri = WWW_INDEX;
+        len = strlen(WWW_INDEX);
+    }
+    for (uint i=0; i<g_entry_count; i++) {
+        const auto &entry = g_entries[i];
+        if (strncmp(entry.path, uri, len)==0 && entry.path[len]=='\0') {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+
+static esp_err_t on_asset(httpd_req_t *req)
+{
+    wifi_power_demand(WIFI_DEMAND_CONSOLE);
+    const www_entry_t *entry = g_www ? find_entry(req->uri) : nullptr;
+    if (!entry) {
+        return httpd_resp_send_404(req);
+    }
+
+    snprintf(g_etag, sizeof(g_etag), "\"%08lx\"", entry->etag);
+    httpd_resp_set_hdr(req, "ETag", g_etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", g_if_none_match, sizeof(g_if_none_match))==ESP_OK
+        && strcmp(g_if_none_match, g_etag)==0) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    httpd_resp_set_type(req, entry->type);
+    if (entry->flags & WWW_FLAG_GZIP) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+    // Sent from the flash mapping, no copy on our side
+    return httpd_resp_send(req, reinterpret_cast<const char*>(g_www+entry->offset), entry->size);
+}
+
+
+/** Map the www partition for the lifetime of the application */
+static void map_assets()
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, WWW_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGW(TAG, "No www partition");
+        return;
+    }
+
+    const void *ptr = nullptr;
+    spi_flash_mmap_handle_t handle;
+    auto res = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &ptr, &handle);
+    if (res!=ESP_OK) {
+        ESP_LOGW(TAG, "Error mapping www partition: %s", esp_err_to_name(res));
+        return;
+    }
+
+    auto header = static_cast<const www_header_t*>(ptr);
+    // Count is checked before the multiplication, a corrupt count could wrap it
+    if (header->magic!=WWW_MAGIC || header->count>(part->size-sizeof(www_header_t))/sizeof(www_entry_t)) {
+        ESP_LOGW(TAG, "No valid www image");
+        spi_flash_munmap(handle);
+        return;
+    }
+    auto entries = reinterpret_cast<const www_entry_t*>(header+1);
+    for (uint i=0; i<header->count; i++) {
+        if (entries[i].offset>part->size || entries[i].size>part->size-entries[i].offset
+            || strnlen(entries[i].path, sizeof(entries[i].path))==sizeof(entries[i].path)
+            || strnlen(entries[i].type, sizeof(entries[i].type))==sizeof(entries[i].type)) {
+            ESP_LOGW(TAG, "Invalid www entry %u", i);
+            spi_flash_munmap(handle);
+            return;
+        }
+    }
+
+    g_www = static_cast<const uint8_t*>(ptr);
+    g_entries = entries;
+    g_entry_count = header->count;
+    ESP_LOGI(TAG, "%u assets", g_entry_count);
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Public interface
+ */
+
+void web_init()
+{
+    map_assets();
+
+    static constexpr esp_timer_create_args_t join_timer_args = {
+        .callback = on_join_timer,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "web_join",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&join_timer_args, &g_join_timer));
+
+    static constexpr httpd_uri_t uris[] = {
+        { .uri = "/api/config", .method = HTTP_GET,  .handler = on_get_config,  .user_ctx = nullptr },
+        { .uri = "/api/config", .method = HTTP_POST, .handler = on_post_config, .user_ctx = nullptr },
+        { .uri = "/api/wifi",   .method = HTTP_POST, .handler = on_post_wifi,   .user_ctx = nullptr },
+        { .uri = "/api/status", .method = HTTP_GET,  .handler = on_get_status,  .user_ctx = nullptr },
+        { .uri = "/api/face",   .method = HTTP_PUT,  .handler = on_put_face,    .user_ctx = nullptr },
+        // Matches everything, so it must be registered last
+        { .uri = "/*",          .method = HTTP_GET,  .handler = on_asset,       .user_ctx = nullptr },
+    };
+    for (const auto &uri : uris) {
+        http_server_register(&uri);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Web configuration UI
+ *
+ * Static assets are packed into the "www" partition with tools/mkwww.py,
+ * gzip compressed, and served straight from the memory mapped partition with
+ * Content-Encoding: gzip and an ETag, so they are never copied or inflated on
+ * the device.
+ *
+ * JSON endpoints:
+ *
+ *   GET  /api/config   timezone, ntp_server, wifi_power, backlight
+ *   POST /api/config   any of the above, answers with the new config
+ *   POST /api/wifi     ssid, password, answered before joining
+ *   GET  /api/status   uptime, heap, display, wifi and time state, and
+ *                      the result of the last join once one was requested
+ *
+ * Requests and responses use static buffers, handlers run in the single HTTP
+ * server task and do not allocate.
+ */
+static constexpr size_t WEB_BODY_BUFFER_SIZE { 512 };
+static constexpr size_t WEB_RESPONSE_BUFFER_SIZE { 1024 };
+
+void web_init();
@@ -2,23 +2,28 @@
 
 #include "wifi.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <esp_wpa2.h>
 #include <esp_event.h>
 #include <esp_system.h>
+#include <esp_random.h>
 #include <esp_netif.h>
 #include <esp_rrm.h>
 #include <esp_wnm.h>
-#include <esp_sntp.h>
 #include <esp_console.h>
 #include <argtable3/argtable3.h>
 #include <nvs.h>
 
+#include "app_events.h"
+
 
 static constexpr const char* TAG = "wifi";
 
@@ -32,21 +37,216 @@ static constexpr int WIFI_ENABLE_BIT      = BIT0;
 static constexpr int WIFI_CONNECTED_BIT   = BIT1;
 static constexpr int WIFI_IP_BIT          = BIT2;
 
-static char g_sntp_server[64] = "";
+static constexpr char WIFI_CACHE_NVS_NAMESPACE[] { "wifi_cache" };
+static constexpr char WIFI_CACHE_NVS_KEY[] { "ap" };
+static constexpr uint32_t WIFI_BACKOFF_MIN_MS { 250 };
+static constexpr uint32_t WIFI_BACKOFF_MAX_MS { 60*1000 };
+static constexpr uint WIFI_FAST_CONNECT_ATTEMPTS { 2 };
+static constexpr uint16_t WIFI_LISTEN_INTERVAL { 10 };    // Beacons between wakeups in max modem sleep
+
+// Last AP we were connected to, lets the next connect skip the scan
+struct wifi_ap_cache_t {
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t version;            // Caches of older firmware were written without storing the PMK
+};
+static constexpr uint8_t WIFI_CACHE_VERSION { 2 };
+
+static wifi_ap_cache_t g_ap_cache;
+static bool g_ap_cache_valid = false;
+static bool g_fast_connect = false;
+static uint g_attempt = 0;                  // Failed attempts since the last connection
+static int64_t g_connect_start = 0;
+static esp_timer_handle_t g_retry_timer = nullptr;
+static wifi_storage_t g_storage = WIFI_STORAGE_FLASH;
+
+static struct {
+    uint32_t connects;
+    uint32_t fast_connects;
+    uint32_t retries;
+    uint32_t backoff_ms;
+    uint32_t last_connect_ms;
+    uint32_t min_connect_ms;
+    uint32_t max_connect_ms;
+    uint64_t total_connect_ms;
+} g_stats;
+
+
+static void publish_state()
+{
+    auto bits = xEventGroupGetBits(s_wifi_event_group);
+    app_event_publish(app_wifi_event_t {
+        .connected = (bits & WIFI_CONNECTED_BIT) != 0,
+        .has_ip = (bits & WIFI_IP_BIT) != 0,
+    });
+}
+
+
+/** -------------------------------------------------------------------------------
+ * Connection handling
+ */
+
+static void set_storage(wifi_storage_t storage)
+{
+    if (storage!=g_storage) {
+        ESP_ERROR_CHECK( esp_wifi_set_storage(storage) );
+        g_storage = storage;
+    }
+}
+
+
+static void cache_load()
+{
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle)!=ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(g_ap_cache);
+    g_ap_cache_valid = nvs_get_blob(handle, WIFI_CACHE_NVS_KEY, &g_ap_cache, &len)==ESP_OK && len==sizeof(g_ap_cache) && g_ap_cache.version==WIFI_CACHE_VERSION;
+    nvs_close(handle);
+}
+
+
+static void cache_store(const wifi_event_sta_connected_t *event)
+{
+    wifi_ap_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.ssid, event->ssid, std::min<size_t>(event->ssid_len, sizeof(cache.ssid)));
+    memcpy(cache.bssid, event->bssid, sizeof(cache.bssid));
+    cache.channel = event->channel;
+    cache.version = WIFI_CACHE_VERSION;
+
+    // Only write when the AP changed, to spare the flash
+    if (g_ap_cache_valid && memcmp(&cache, &g_ap_cache, sizeof(cache))==0) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t res = nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (res==ESP_OK) {
+        res = nvs_set_blob(handle, WIFI_CACHE_NVS_KEY, &cache, sizeof(cache));
+        if (res==ESP_OK) {
+            res = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (res!=ESP_OK) {
+        ESP_LOGW(TAG, "Error storing AP cache: %s", esp_err_to_name(res));
+        return;
+    }
+    g_ap_cache = cache;
+    g_ap_cache_valid = true;
+}
+
+
+static void cache_clear()
+{
+    g_ap_cache_valid = false;
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle)==ESP_OK) {
+        nvs_erase_key(handle, WIFI_CACHE_NVS_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+
+static void connect()
+{
+    wifi_config_t config;
+    ESP_ERROR_CHECK( esp_wifi_get_config(WIFI_IF_STA, &config) );
+    auto &sta = config.sta;
+
+    // Go straight to the cached AP first, fall back to a full scan when it does not answer
+    bool fast = g_ap_cache_valid && g_attempt<WIFI_FAST_CONNECT_ATTEMPTS && memcmp(sta.ssid, g_ap_cache.ssid, sizeof(sta.ssid))==0;
+    if (fast) {
+        sta.bssid_set = true;
+        memcpy(sta.bssid, g_ap_cache.bssid, sizeof(sta.bssid));
+        sta.channel = g_ap_cache.channel;
+        sta.scan_method = WIFI_FAST_SCAN;
+    }
+    else {
+        sta.bssid_set = false;
+        sta.channel = 0;
+        sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    sta.listen_interval = WIFI_LISTEN_INTERVAL;
+    ESP_ERROR_CHECK( esp_wifi_set_config(WIFI_IF_STA, &config) );
+    g_fast_connect = fast;
+
+    if (!g_connect_start) {
+        g_connect_start = esp_timer_get_time();
+    }
+    auto res = esp_wifi_connect();
+    if (res==ESP_ERR_WIFI_SSID) {
+        ESP_LOGW(TAG, "SSID is invalid");
+    }
+}
 
 
-static void time_sync_notification_cb(struct timeval *tv)
+/** Disconnect from the AP, the power governor may have stopped the radio */
+static void disconnect()
 {
-    char strftime_buf[64];
-    struct tm timeinfo;
-   
-    localtime_r(&tv->tv_sec, &timeinfo);
-    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
+    auto res = esp_wifi_disconnect();
+    if (res!=ESP_ERR_WIFI_NOT_STARTED) {
+        ESP_ERROR_CHECK( res );
+    }
+}
+
 
-    ESP_LOGI(TAG, "Time synchronized %s", strftime_buf);
+static void schedule_retry()
+{
+    uint32_t backoff = std::min<uint32_t>(WIFI_BACKOFF_MAX_MS, WIFI_BACKOFF_MIN_MS << std::min(g_attempt, 16u));
+    // Random delay in the upper half of the backoff, so devices that lost the AP together don't retry together
+    uint32_t delay = backoff/2 + esp_random() % (backoff/2 + 1);
+
+    g_attempt++;
+    g_stats.retries++;
+    g_stats.backoff_ms = delay;
+    ESP_LOGI(TAG, "Retry %u in %lu ms", g_attempt, delay);
+
+    esp_timer_stop(g_retry_timer);
+    ESP_ERROR_CHECK( esp_timer_start_once(g_retry_timer, delay*1000ull) );
 }
 
 
+static void on_retry_timer(__unused void *arg)
+{
+    if (xEventGroupGetBits(s_wifi_event_group) & WIFI_ENABLE_BIT) {
+        connect();
+    }
+}
+
+
+static void connected()
+{
+    uint32_t ms = (esp_timer_get_time() - g_connect_start) / 1000;
+    g_connect_start = 0;
+    g_attempt = 0;
+    g_stats.backoff_ms = 0;
+
+    g_stats.connects++;
+    if (g_fast_connect) {
+        g_stats.fast_connects++;
+    }
+    g_stats.last_connect_ms = ms;
+    g_stats.total_connect_ms += ms;
+    if (g_stats.connects==1 || ms<g_stats.min_connect_ms) {
+        g_stats.min_connect_ms = ms;
+    }
+    if (ms>g_stats.max_connect_ms) {
+        g_stats.max_connect_ms = ms;
+    }
+    ESP_LOGI(TAG, "Connected in %lu ms (%s)", ms, g_fast_connect ? "cached AP" : "scan");
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Events
+ */
+
 static inline void wifi_event_handler(int32_t event_id, void *event_data)
 {
     switch (event_id) {
@@ -54,10 +254,7 @@ static inline void wifi_event_handler(int32_t event_id, void *event_data)
             {
                 ESP_LOGI(TAG, "WIFI started");
                 if (xEventGroupGetBits(s_wifi_event_group) & WIFI_ENABLE_BIT) {
-                    auto res = esp_wifi_connect();
-                    if (res==ESP_ERR_WIFI_SSID) {
-                        ESP_LOGW(TAG, "SSID is invalid");
-                    }
+                    connect();
                 }
             }
             break;
@@ -67,6 +264,10 @@ static inline void wifi_event_handler(int32_t event_id, void *event_data)
                 wifi_event_sta_connected_t *event = static_cast<wifi_event_sta_connected_t*>(event_data);
                 ESP_LOGI(TAG, "WIFI connected:   ssid=%s,  channel=%d,  authmode=%d", event->ssid, (int)event->channel, (int)event->authmode);
                 xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+                publish_state();
+                cache_store(event);
+                // The driver has stored the PMK derived for this connection, later connects only rewrite BSSID and scan settings
+                set_storage(WIFI_STORAGE_RAM);
 
                 if (esp_rrm_is_rrm_supported_connection()) {
                     ESP_LOGI(TAG,"RRM supported");
@@ -90,8 +291,9 @@ static inline void wifi_event_handler(int32_t event_id, void *event_data)
                 else {
                     ESP_LOGW(TAG, "WIFI disconnected    reason=%d", (int)event->reason);
                     xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+                    publish_state();
                     if (xEventGroupGetBits(s_wifi_event_group) & WIFI_ENABLE_BIT) {
-                        esp_wifi_connect();
+                        schedule_retry();
                     }
                 }
             }
@@ -112,15 +314,15 @@ static inline void ip_event_handler(int32_t event_id, void *event_data)
                 ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
                 ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
                 xEventGroupSetBits(s_wifi_event_group, WIFI_IP_BIT);
-                if (sntp_get_sync_status()!=SNTP_SYNC_STATUS_COMPLETED) {
-                    esp_sntp_restart();
-                }
+                publish_state();
+                connected();
             }
             break;
 
         case IP_EVENT_STA_LOST_IP:
             ESP_LOGW(TAG, "Lost IP");
             xEventGroupClearBits(s_wifi_event_group, WIFI_IP_BIT);
+            publish_state();
             break;
 
         default:
@@ -145,22 +347,6 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
 }
 
 
-static void wifi_sntp_init()
-{
-    esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, g_sntp_server);
-    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-    esp_sntp_init();
-}
-
-void wifi_sntp_set_server(const char *servername)
-{
-    strncpy(g_sntp_server, servername, sizeof(g_sntp_server));
-    g_sntp_server[sizeof(g_sntp_server)-1] = '\0';
-}
-
-
-
 void wifi_init()
 {
     ESP_LOGI(TAG, "Initializing wifi");
@@ -174,6 +360,19 @@ void wifi_init()
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+    // Flash storage until the first connect has stored the PMK, then the connect path only rewrites BSSID and scan settings
+    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_FLASH) );
+    g_storage = WIFI_STORAGE_FLASH;
+
+    static constexpr esp_timer_create_args_t retry_timer_args = {
+        .callback = on_retry_timer,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "wifi_retry",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&retry_timer_args, &g_retry_timer) );
+    cache_load();
 
     ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL) );
     ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL) );
@@ -184,6 +383,10 @@ void wifi_init()
     wifi_config_t wifi_config;
     ESP_ERROR_CHECK( esp_wifi_get_config(WIFI_IF_STA, &wifi_config) );
     ESP_LOGI(TAG, "Configured SSID: %s", wifi_config.sta.ssid);
+    // A cached AP for the configured SSID means an earlier connect with flash storage has stored its PMK
+    if (g_ap_cache_valid && memcmp(wifi_config.sta.ssid, g_ap_cache.ssid, sizeof(g_ap_cache.ssid))==0) {
+        set_storage(WIFI_STORAGE_RAM);
+    }
     //ESP_LOGI(TAG, "PASSWORD: %s", wifi_config.sta.password);
 
     char cc[3] { 0 };
@@ -192,10 +395,6 @@ void wifi_init()
     ESP_LOGI(TAG, "Configured Country: %s", cc);
 
 
-    ESP_LOGI(TAG, "Initializing SNTP service");
-    wifi_sntp_init();
-
-
     ESP_LOGI(TAG, "Starting WiFi");
 
     xEventGroupSetBits(s_wifi_event_group, WIFI_ENABLE_BIT);
@@ -220,16 +419,30 @@ bool wifi_join(const char *ssid, const char *password, uint timeout_ms)
 
 
     sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    sta.bssid_set = false;
+    sta.channel = 0;
     strlcpy((char *)sta.ssid, ssid, sizeof(sta.ssid));
     if (password) {
         strlcpy((char *) sta.password, password, sizeof(sta.password));
     }
 
+    const bool started = wifi_radio_enabled();
     xEventGroupClearBits(s_wifi_event_group, WIFI_ENABLE_BIT);
-    ESP_ERROR_CHECK( esp_wifi_disconnect() );
+    esp_timer_stop(g_retry_timer);
+    disconnect();
+    // Stays on flash storage until connected, so the PMK of the new network is stored too
+    set_storage(WIFI_STORAGE_FLASH);
     ESP_ERROR_CHECK( esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
-    xEventGroupSetBits(s_wifi_event_group, WIFI_ENABLE_BIT);
-    ESP_ERROR_CHECK( esp_wifi_connect() );
+    g_attempt = 0;
+    g_connect_start = 0;
+    if (started) {
+        xEventGroupSetBits(s_wifi_event_group, WIFI_ENABLE_BIT);
+        connect();
+    }
+    else {
+        // Switched off by the power governor, connects once the station has started
+        wifi_radio_enable(true);
+    }
 
     auto bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_IP_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
     return (bits & WIFI_CONNECTED_BIT) != 0;
@@ -239,8 +452,14 @@ bool wifi_join(const char *ssid, const char *password, uint timeout_ms)
 bool wifi_restore()
 {
     xEventGroupClearBits(s_wifi_event_group, WIFI_ENABLE_BIT);
-    ESP_ERROR_CHECK( esp_wifi_disconnect() );
+    esp_timer_stop(g_retry_timer);
+    disconnect();
+    cache_clear();
+    // Erases the stored configuration only with flash storage
+    const wifi_storage_t storage = g_storage;
+    set_storage(WIFI_STORAGE_FLASH);
     auto res = esp_wifi_restore();
+    set_storage(storage);
     if (res!=ESP_OK) {
         ESP_LOGW(TAG, "Error restoring configuration  res=%d", (int)res);
         return false;
@@ -248,3 +467,82 @@ bool wifi_restore()
     ESP_LOGI(TAG, "Wifi configuration restored to default");
     return true;
 }
+
+
+bool wifi_has_ip()
+{
+    return (xEventGroupGetBits(s_wifi_event_group) & WIFI_IP_BIT) != 0;
+}
+
+
+void wifi_get_stats(wifi_stats_t *stats)
+{
+    auto bits = xEventGroupGetBits(s_wifi_event_group);
+    stats->connected = (bits & WIFI_CONNECTED_BIT) != 0;
+    stats->has_ip = (bits & WIFI_IP_BIT) != 0;
+    stats->rssi = 0;
+    stats->reconnects = g_stats.retries;
+    stats->last_connect_ms = g_stats.last_connect_ms;
+
+    wifi_ap_record_t ap;
+    if (stats->connected && esp_wifi_sta_get_ap_info(&ap)==ESP_OK) {
+        stats->rssi = ap.rssi;
+    }
+}
+
+
+void wifi_print_stats()
+{
+    printf("WiFi connection stats:\n");
+    printf("    Connects: %lu (%lu from cached AP)\n", g_stats.connects, g_stats.fast_connects);
+    printf("     Retries: %lu\n", g_stats.retries);
+    if (g_stats.connects) {
+        printf("Connect time: last %lu ms, min %lu ms, avg %llu ms, max %lu ms\n",
+            g_stats.last_connect_ms, g_stats.min_connect_ms, g_stats.total_connect_ms/g_stats.connects, g_stats.max_connect_ms);
+    }
+    if (g_attempt) {
+        printf("     Backoff: attempt %u, next retry within %lu ms\n", g_attempt, g_stats.backoff_ms);
+    }
+    if (g_ap_cache_valid) {
+        printf("   Cached AP: %.32s %02x:%02x:%02x:%02x:%02x:%02x channel %u\n",
+            g_ap_cache.ssid,
+            g_ap_cache.bssid[0], g_ap_cache.bssid[1], g_ap_cache.bssid[2], g_ap_cache.bssid[3], g_ap_cache.bssid[4], g_ap_cache.bssid[5],
+            g_ap_cache.channel);
+    }
+}
+
+
+void wifi_radio_enable(bool enable)
+{
+    if (enable==wifi_radio_enabled()) {
+        return;
+    }
+    if (enable) {
+        ESP_LOGI(TAG, "Radio on");
+        g_attempt = 0;
+        g_connect_start = 0;
+        xEventGroupSetBits(s_wifi_event_group, WIFI_ENABLE_BIT);
+        ESP_ERROR_CHECK( esp_wifi_start() );
+    }
+    else {
+        ESP_LOGI(TAG, "Radio off");
+        // Clear first so the disconnect does not schedule a retry
+        xEventGroupClearBits(s_wifi_event_group, WIFI_ENABLE_BIT);
+        esp_timer_stop(g_retry_timer);
+        ESP_ERROR_CHECK( esp_wifi_stop() );
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_IP_BIT);
+        publish_state();
+    }
+}
+
+
+bool wifi_radio_enabled()
+{
+    return (xEventGroupGetBits(s_wifi_event_group) & WIFI_ENABLE_BIT) != 0;
+}
+
+
+uint16_t wifi_listen_interval()
+{
+    return WIFI_LISTEN_INTERVAL;
+}
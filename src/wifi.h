@@ -1,10 +1,34 @@
 #pragma once
 
 #include <unistd.h>
+#include <stdint.h>
 
 void wifi_init();
 
+/**
+ * Returns true if connected within timeout_ms, with 0 it only starts connecting.
+ * Starts the radio if the power governor switched it off.
+ */
 bool wifi_join(const char *ssid, const char *password, uint timeout_ms);
 bool wifi_restore();
 
-void wifi_sntp_set_server(const char *servername);
+/** Stop or start the radio, the station reconnects when started again */
+void wifi_radio_enable(bool enable);
+bool wifi_radio_enabled();
+
+/** Beacon intervals between wakeups in max modem sleep */
+uint16_t wifi_listen_interval();
+
+
+struct wifi_stats_t {
+    bool connected;
+    bool has_ip;
+    int8_t rssi;                ///< Signal of the current AP, 0 when not connected
+    uint32_t reconnects;        ///< Connect retries after a failed attempt or losing the AP
+    uint32_t last_connect_ms;   ///< Duration of the last connect, from start to IP address
+};
+
+bool wifi_has_ip();
+void wifi_get_stats(wifi_stats_t *stats);
+
+void wifi_print_stats();
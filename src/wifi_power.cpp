@@ -0,0 +1,277 @@
+#include "wifi_power.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_log.h>
+
+#include "wifi.h"
+#include "settings.h"
+#include "timekeeper.h"
+
+static constexpr char TAG[] = "wifi_power";
+
+static constexpr uint32_t WIFI_POWER_TASK_STACK_SIZE { 3072 };
+static constexpr UBaseType_t WIFI_POWER_TASK_PRIORITY { 2 };
+static constexpr uint32_t WIFI_POWER_EVAL_INTERVAL_MS { 1000 };
+static constexpr uint32_t WIFI_POWER_OFF_DELAY_MS { 5*60*1000 };        // Idle time before the radio goes off
+static constexpr uint32_t WIFI_POWER_SYNC_TIMEOUT_MS { 60*1000 };
+static constexpr uint32_t WIFI_BEACON_INTERVAL_US { 102400 };           // 100 TU, the common AP default
+
+static constexpr uint32_t DEMAND_HOLD_MS[WIFI_DEMAND_COUNT] = {
+    5*1000,         // Ingest
+    60*1000,        // Metrics, longer than common scrape intervals
+    120*1000,       // Console
+    5*1000,         // Mirror, refreshed with every frame sent
+};
+static constexpr const char *DEMAND_NAMES[WIFI_DEMAND_COUNT] = { "ingest", "metrics", "console", "mirror" };
+
+static constexpr const char *POLICY_NAMES[WIFI_POWER_POLICY_COUNT] = { "performance", "balanced", "clock" };
+
+
+enum power_mode_t {
+    MODE_ACTIVE,
+    MODE_INTERACTIVE,
+    MODE_IDLE,
+    MODE_OFF,
+    MODE_COUNT
+};
+
+static constexpr const char *MODE_NAMES[MODE_COUNT] = { "active", "interactive", "idle", "off" };
+static constexpr wifi_ps_type_t MODE_PS[MODE_COUNT] = { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM, WIFI_PS_NONE };
+
+
+static uint32_t g_demand[WIFI_DEMAND_COUNT];        // Time of last activity, 0 if never
+static power_mode_t g_mode = MODE_IDLE;
+static uint32_t g_last_eval = 0;
+static uint32_t g_sync_wake_start = 0;
+static bool g_sync_wake = false;
+static bool g_waking = false;
+static TaskHandle_t g_task = nullptr;
+
+static struct {
+    uint64_t mode_ms[MODE_COUNT];
+    uint32_t switches;
+    uint32_t wakes;
+    uint64_t wake_latency_ms;
+} g_stats;
+
+
+static inline uint32_t now_ms()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+
+static inline bool demand_active(wifi_power_demand_t source, uint32_t now)
+{
+    return g_demand[source] && now - g_demand[source] < DEMAND_HOLD_MS[source];
+}
+
+
+static wifi_power_policy_t policy()
+{
+    int32_t value = settings_get_int(SETTING_WIFI_POWER);
+    return value>=0 && value<WIFI_POWER_POLICY_COUNT ? static_cast<wifi_power_policy_t>(value) : WIFI_POWER_BALANCED;
+}
+
+
+static bool sync_attempted()
+{
+    timekeeper_stats_t st;
+    timekeeper_get_stats(&st);
+    return st.last_attempt_us/1000 > g_sync_wake_start;
+}
+
+
+static power_mode_t select_mode(uint32_t now)
+{
+    auto pol = policy();
+    if (pol==WIFI_POWER_PERFORMANCE || demand_active(WIFI_DEMAND_INGEST, now)) {
+        return MODE_ACTIVE;
+    }
+    if (demand_active(WIFI_DEMAND_METRICS, now) || demand_active(WIFI_DEMAND_CONSOLE, now) || demand_active(WIFI_DEMAND_MIRROR, now)) {
+        return MODE_INTERACTIVE;
+    }
+    if (pol!=WIFI_POWER_CLOCK) {
+        g_sync_wake = false;
+        return MODE_IDLE;
+    }
+
+    if (g_sync_wake) {
+        if (!sync_attempted() && now - g_sync_wake_start < WIFI_POWER_SYNC_TIMEOUT_MS) {
+            return MODE_IDLE;
+        }
+        g_sync_wake = false;
+    }
+
+    uint32_t last = *std::max_element(g_demand, g_demand+WIFI_DEMAND_COUNT);
+    if (now - last < WIFI_POWER_OFF_DELAY_MS) {
+        return MODE_IDLE;
+    }
+    // The timekeeper syncs by itself once the station has an address
+    if (esp_timer_get_time() >= timekeeper_next_sync_us()) {
+        g_sync_wake = true;
+        g_sync_wake_start = now;
+        return MODE_IDLE;
+    }
+    return MODE_OFF;
+}
+
+
+static void apply_mode(power_mode_t mode)
+{
+    if (mode==MODE_OFF) {
+        wifi_radio_enable(false);
+    }
+    else {
+        if (!wifi_radio_enabled()) {
+            wifi_radio_enable(true);
+            g_waking = true;
+        }
+        esp_wifi_set_ps(MODE_PS[mode]);
+    }
+    ESP_LOGI(TAG, "Mode %s -> %s", MODE_NAMES[g_mode], MODE_NAMES[mode]);
+    g_mode = mode;
+    g_stats.switches++;
+}
+
+
+static void evaluate()
+{
+    uint32_t now = now_ms();
+    g_stats.mode_ms[g_mode] += now - g_last_eval;
+    g_last_eval = now;
+
+    if (g_waking && wifi_has_ip()) {
+        wifi_stats_t st;
+        wifi_get_stats(&st);
+        g_waking = false;
+        g_stats.wakes++;
+        g_stats.wake_latency_ms += st.last_connect_ms;
+    }
+
+    power_mode_t mode = select_mode(now);
+    // wifi_join() starts the radio by itself, switch it off again when nothing needs it
+    if (mode!=g_mode || (mode==MODE_OFF && wifi_radio_enabled())) {
+        apply_mode(mode);
+    }
+}
+
+
+static void governor_task(__unused void *param)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WIFI_POWER_EVAL_INTERVAL_MS));
+        evaluate();
+    }
+}
+
+
+static void on_policy_changed(__unused setting_id_t id, __unused void *arg)
+{
+    xTaskNotifyGive(g_task);
+}
+
+
+
+void wifi_power_init()
+{
+    g_last_eval = now_ms();
+    g_mode = MODE_IDLE;
+    apply_mode(select_mode(g_last_eval));
+
+    settings_subscribe(SETTING_WIFI_POWER, on_policy_changed, nullptr);
+
+    static StaticTask_t task_buffer;
+    static StackType_t task_stack[WIFI_POWER_TASK_STACK_SIZE];
+    g_task = xTaskCreateStatic(governor_task, "wifi_power", WIFI_POWER_TASK_STACK_SIZE, nullptr, WIFI_POWER_TASK_PRIORITY, task_stack, &task_buffer);
+}
+
+
+void wifi_power_demand(wifi_power_demand_t source)
+{
+    bool was_active = demand_active(source, now_ms());
+    // Never 0, that means no demand yet
+    g_demand[source] = std::max<uint32_t>(now_ms(), 1);
+    if (!was_active && g_task) {
+        xTaskNotifyGive(g_task);
+    }
+}
+
+
+bool wifi_power_set_policy(wifi_power_policy_t policy)
+{
+    return settings_set_int(SETTING_WIFI_POWER, policy);
+}
+
+wifi_power_policy_t wifi_power_get_policy()
+{
+    return policy();
+}
+
+const char *wifi_power_policy_name(wifi_power_policy_t policy)
+{
+    return POLICY_NAMES[policy];
+}
+
+bool wifi_power_policy_from_name(const char *name, wifi_power_policy_t *policy)
+{
+    for (uint i=0; i<WIFI_POWER_POLICY_COUNT; i++) {
+        if (strcmp(name, POLICY_NAMES[i])==0) {
+            *policy = static_cast<wifi_power_policy_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void wifi_power_print_stats()
+{
+    uint32_t now = now_ms();
+    uint64_t total = 0, radio_on = 0;
+    for (uint i=0; i<MODE_COUNT; i++) {
+        uint64_t ms = g_stats.mode_ms[i] + (i==g_mode ? now - g_last_eval : 0);
+        total += ms;
+        if (i!=MODE_OFF) {
+            radio_on += ms;
+        }
+    }
+    const uint32_t listen_ms = wifi_listen_interval() * WIFI_BEACON_INTERVAL_US / 1000;
+
+    printf("Policy: %s, mode: %s\n", POLICY_NAMES[policy()], MODE_NAMES[g_mode]);
+    printf("Radio on %llu%% of %llu s\n\n", total ? radio_on*100/total : 0, total/1000);
+
+    printf("Mode          Time s  Share  Added RX latency\n");
+    printf("---------------------------------------------\n");
+    for (uint i=0; i<MODE_COUNT; i++) {
+        uint64_t ms = g_stats.mode_ms[i] + (i==g_mode ? now - g_last_eval : 0);
+        printf("%-12s %7llu %5llu%%  ", MODE_NAMES[i], ms/1000, total ? ms*100/total : 0);
+        switch (i) {
+            case MODE_ACTIVE:       printf("none\n"); break;
+            case MODE_INTERACTIVE:  printf("up to one DTIM period\n"); break;
+            case MODE_IDLE:         printf("up to %lu ms\n", listen_ms); break;
+            case MODE_OFF:          printf("unreachable\n"); break;
+        }
+    }
+
+    printf("\nSwitches: %lu, radio wakeups: %lu", g_stats.switches, g_stats.wakes);
+    if (g_stats.wakes) {
+        printf(", avg reconnect %llu ms", g_stats.wake_latency_ms / g_stats.wakes);
+    }
+    printf("\nLast demand:");
+    for (uint i=0; i<WIFI_DEMAND_COUNT; i++) {
+        if (g_demand[i]) {
+            printf(" %s %lu s ago", DEMAND_NAMES[i], (now - g_demand[i])/1000);
+        }
+        else {
+            printf(" %s never", DEMAND_NAMES[i]);
+        }
+    }
+    printf("\n");
+}
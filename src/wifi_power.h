@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Wi-Fi power governor
+ *
+ * Picks the radio power mode from recent network demand. Modules report
+ * demand with wifi_power_demand(), each source keeps the radio responsive
+ * for a hold time after its last activity:
+ *
+ *  - ingest:  no power save, lowest latency
+ *  - metrics, console and mirror: min modem sleep, wakes every DTIM
+ *  - none: max modem sleep, wakes every wifi_listen_interval() beacons
+ *
+ * With the clock policy the radio is switched off entirely after a longer
+ * idle time and only started again when the timekeeper is due to sync. Nothing can
+ * reach the device while it is off, so only use it when it just shows time.
+ */
+enum wifi_power_policy_t {
+    WIFI_POWER_PERFORMANCE,     ///< Never sleep
+    WIFI_POWER_BALANCED,        ///< Modem sleep depending on demand
+    WIFI_POWER_CLOCK,           ///< As balanced, radio off between time syncs when idle
+    WIFI_POWER_POLICY_COUNT
+};
+
+enum wifi_power_demand_t {
+    WIFI_DEMAND_INGEST,
+    WIFI_DEMAND_METRICS,
+    WIFI_DEMAND_CONSOLE,
+    WIFI_DEMAND_MIRROR,
+    WIFI_DEMAND_COUNT
+};
+
+void wifi_power_init();
+
+/** Report network activity, safe to call from any task */
+void wifi_power_demand(wifi_power_demand_t source);
+
+bool wifi_power_set_policy(wifi_power_policy_t policy);
+wifi_power_policy_t wifi_power_get_policy();
+const char *wifi_power_policy_name(wifi_power_policy_t policy);
+bool wifi_power_policy_from_name(const char *name, wifi_power_policy_t *policy);
+
+void wifi_power_print_stats();
@@ -0,0 +1,70 @@
+/**
+ * LVGL configuration of the host golden test
+ *
+ * Follows the LVGL settings in sdkconfig that change what the screens look
+ * like, so the host renders the same pixels as the device. Everything not
+ * set here keeps the default of lv_conf_internal.h.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Colors, ui.c requires 16 bit swapped */
+#define LV_COLOR_DEPTH 16
+#define LV_COLOR_16_SWAP 1
+#define LV_COLOR_SCREEN_TRANSP 0
+#define LV_COLOR_MIX_ROUND_OFS 128
+#define LV_COLOR_CHROMA_KEY lv_color_hex(0x00ff00)
+
+/* Memory, the host heap instead of the 32 kB pool, pointers are twice as large */
+#define LV_MEM_CUSTOM 1
+#define LV_MEM_CUSTOM_INCLUDE <stdlib.h>
+#define LV_MEM_CUSTOM_ALLOC malloc
+#define LV_MEM_CUSTOM_FREE free
+#define LV_MEM_CUSTOM_REALLOC realloc
+
+/* Time comes from lv_tick_inc() only, so animations are reproducible */
+#define LV_TICK_CUSTOM 0
+#define LV_DISP_DEF_REFR_PERIOD 30
+#define LV_INDEV_DEF_READ_PERIOD 30
+#define LV_DPI_DEF 130
+
+/* Drawing */
+#define LV_DRAW_COMPLEX 1
+#define LV_SHADOW_CACHE_SIZE 0
+#define LV_CIRCLE_CACHE_SIZE 4
+#define LV_IMG_CACHE_DEF_SIZE 0
+#define LV_GRADIENT_MAX_STOPS 2
+#define LV_GRAD_CACHE_DEF_SIZE 0
+#define LV_DITHER_GRADIENT 0
+#define LV_LAYER_SIMPLE_BUF_SIZE (24*1024)
+#define LV_DISP_ROT_MAX_BUF (10*1024)
+#define LV_USE_GPU_SDL 0
+
+/* Logging and asserts */
+#define LV_USE_LOG 0
+#define LV_USE_ASSERT_NULL 1
+#define LV_USE_ASSERT_MALLOC 1
+#define LV_USE_PERF_MONITOR 0
+#define LV_USE_MEM_MONITOR 0
+
+/* Fonts */
+#define LV_FONT_MONTSERRAT_14 1
+#define LV_FONT_MONTSERRAT_48 1
+#define LV_FONT_DEFAULT &lv_font_montserrat_14
+
+/* Widgets used by the SquareLine screens */
+#define LV_USE_ARC 1
+#define LV_USE_LABEL 1
+#define LV_USE_CHART 1
+#define LV_USE_COLORWHEEL 1
+#define LV_USE_SPINNER 1
+#define LV_USE_SNAPSHOT 1
+
+/* Themes */
+#define LV_USE_THEME_DEFAULT 1
+#define LV_THEME_DEFAULT_DARK 0
+#define LV_THEME_DEFAULT_GROW 1
+#define LV_THEME_DEFAULT_TRANSITION_TIME 80
+
+#define LV_BUILD_EXAMPLES 0
@@ -0,0 +1,598 @@
+/**
+ * Host golden image test of the SquareLine screens
+ *
+ * Renders src/ui with LVGL into a 240x240 framebuffer and walks the screens
+ * through the same transitions as tools/golden.py does on the device. LVGL
+ * time only advances by lv_tick_inc() here, so every frame, the transition
+ * frames and the spinner included, is reproducible and compared pixel for
+ * pixel with the PNGs in test/golden/.
+ *
+ * Every frame also reports the LVGL refreshes, render time, rendered and
+ * flushed pixels. The cost of each transition and of each screen by itself
+ * is compared with the baseline in test/golden/cost.txt, in the columns of
+ * tools/golden.py. Rendering is deterministic, so refreshes and flushed area
+ * are always compared, render time depends on the machine and is only
+ * compared with --time.
+ *
+ *     test_golden <golden dir> <output dir>             compare
+ *     test_golden --time <golden dir> <output dir>      also compare render time
+ *     test_golden --update <golden dir> <output dir>    record images and baseline
+ *
+ * Checks that need no recorded images always run: each transition frame
+ * moves, screens without animations flush nothing once settled and the clock
+ * looks the same after the round trip. Frames that differ are written to the
+ * output directory together with an image marking the differing pixels.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "lvgl.h"
+#include "ui/ui.h"
+
+static constexpr uint WIDTH { 240 };
+static constexpr uint HEIGHT { 240 };
+static constexpr uint TRANSITION_MS { 500 };
+static constexpr uint FRAME_MS { 100 };         // Transition frames are taken at this interval
+static constexpr uint SETTLE_MS { 1000 };
+static constexpr uint STEADY_MS { 2000 };
+static constexpr double COST_TOLERANCE { 0.1 };       // Allowed growth over the baseline, as tools/golden.py
+static constexpr char COST_FILE[] { "cost.txt" };
+
+struct step_t {
+    const char *from;
+    const char *to;
+    lv_obj_t **screen;
+    bool animated;              // Target redraws by itself, the spinner
+};
+
+// Same order and animations as the right hand touch panels
+static const step_t STEPS[] = {
+    { "clock", "demo", &ui_Demo, true },
+    { "demo", "demo1", &ui_Demo1, false },
+    { "demo1", "demo2", &ui_Demo2, false },
+    { "demo2", "clock", &ui_Clock, false },
+};
+
+// Since the last reset, filled in by the display driver
+struct cost_t {
+    uint frames;                // LVGL refreshes that drew something
+    uint64_t render_us;
+    uint64_t rendered_px;
+    uint64_t flushed_px;
+};
+
+using image_t = std::vector<uint8_t>;          // RGB, 8 bits per channel
+
+static lv_color_t g_framebuffer[WIDTH*HEIGHT];
+static lv_color_t g_draw_buffer[WIDTH*HEIGHT];
+static cost_t g_cost;
+
+
+
+/** -------------------------------------------------------------------------------
+ * UI events implemented by main.cpp on the device
+ */
+
+void clock_loaded(lv_event_t *)
+{
+}
+
+void clock_unloaded(lv_event_t *)
+{
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * PNG
+ */
+
+static void png_u32(std::vector<uint8_t> &out, uint32_t value)
+{
+    const uint8_t be[4] = { static_cast<uint8_t>(value>>24), static_cast<uint8_t>(value>>16), static_cast<uint8_t>(value>>8), static_cast<uint8_t>(value) };
+    out.insert(out.end(), be, be+sizeof(be));
+}
+
+
+static void png_chunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data)
+{
+    png_u32(out, data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type+4);
+    out.insert(out.end(), data.begin(), data.end());
+    png_u32(out, crc32(0, &out[start], out.size()-start));
+}
+
+
+static bool png_write(const std::string &path, const image_t &rgb)
+{
+    static constexpr uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<uint8_t> png(SIGNATURE, SIGNATURE+sizeof(SIGNATURE));
+
+    std::vector<uint8_t> header;
+    png_u32(header, WIDTH);
+    png_u32(header, HEIGHT);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });         // 8 bit RGB, not interlaced
+    png_chunk(png, "IHDR", header);
+
+    // Every row with filter type none
+    std::vector<uint8_t> raw;
+    for (uint y=0; y<HEIGHT; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), &rgb[y*WIDTH*3], &rgb[(y+1)*WIDTH*3]);
+    }
+    uLongf size = compressBound(raw.size());
+    std::vector<uint8_t> data(size);
+    if (compress2(data.data(), &size, raw.data(), raw.size(), Z_BEST_COMPRESSION)!=Z_OK) {
+        return false;
+    }
+    data.resize(size);
+    png_chunk(png, "IDAT", data);
+    png_chunk(png, "IEND", {});
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    const bool ok = fwrite(png.data(), 1, png.size(), f)==png.size();
+    return fclose(f)==0 && ok;
+}
+
+
+static uint8_t png_paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa<=pb && pa<=pc) {
+        return a;
+    }
+    return pb<=pc ? b : c;
+}
+
+
+/**
+ * Read an 8 bit RGB or RGBA PNG of the screen size, as written by png_write()
+ * or re-saved by an image editor. Alpha is dropped. False if missing or in
+ * another format.
+ */
+static bool png_read(const std::string &path, image_t &rgb)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    std::vector<uint8_t> png;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f))>0) {
+        png.insert(png.end(), buf, buf+n);
+    }
+    fclose(f);
+
+    auto u32 = [&png](size_t pos) {
+        return static_cast<uint32_t>(png[pos]<<24 | png[pos+1]<<16 | png[pos+2]<<8 | png[pos+3]);
+    };
+    if (png.size()<8 || memcmp(png.data(), "\x89PNG\r\n\x1a\n", 8)!=0) {
+        return false;
+    }
+    uint channels = 0;
+    std::vector<uint8_t> data;
+    size_t pos = 8;
+    while (pos+12<=png.size()) {
+        const uint32_t len = u32(pos);
+        if (len>png.size()-pos-12) {
+            return false;
+        }
+        const uint8_t *type = &png[pos+4];
+        const uint8_t *chunk = &png[pos+8];
+        if (memcmp(type, "IHDR", 4)==0) {
+            if (len<13 || u32(pos+8)!=WIDTH || u32(pos+12)!=HEIGHT || chunk[8]!=8 || chunk[12]!=0) {
+                return false;
+            }
+            channels = chunk[9]==2 ? 3 : chunk[9]==6 ? 4 : 0;
+        }
+        else if (memcmp(type, "IDAT", 4)==0) {
+            data.insert(data.end(), chunk, chunk+len);
+        }
+        else if (memcmp(type, "IEND", 4)==0) {
+            break;
+        }
+        pos += len + 12;
+    }
+    if (channels==0) {
+        return false;
+    }
+
+    const size_t stride = WIDTH*channels;
+    std::vector<uint8_t> raw(HEIGHT*(stride+1));
+    uLongf size = raw.size();
+    if (uncompress(raw.data(), &size, data.data(), data.size())!=Z_OK || size!=raw.size()) {
+        return false;
+    }
+
+    // Undo the row filters in place, the previous row is already unfiltered
+    std::vector<uint8_t> pixels(HEIGHT*stride);
+    for (uint y=0; y<HEIGHT; y++) {
+        const uint8_t filter = raw[y*(stride+1)];
+        const uint8_t *src = &raw[y*(stride+1) + 1];
+        uint8_t *row = &pixels[y*stride];
+        const uint8_t *up = y>0 ? &pixels[(y-1)*stride] : nullptr;
+        for (size_t i=0; i<stride; i++) {
+            const uint8_t a = i>=channels ? row[i-channels] : 0;
+            const uint8_t b = up ? up[i] : 0;
+            const uint8_t c = up && i>=channels ? up[i-channels] : 0;
+            switch (filter) {
+                case 0: row[i] = src[i]; break;
+                case 1: row[i] = src[i] + a; break;
+                case 2: row[i] = src[i] + b; break;
+                case 3: row[i] = src[i] + (a+b)/2; break;
+                case 4: row[i] = src[i] + png_paeth(a, b, c); break;
+                default: return false;
+            }
+        }
+    }
+
+    rgb.resize(WIDTH*HEIGHT*3);
+    for (uint p=0; p<WIDTH*HEIGHT; p++) {
+        memcpy(&rgb[p*3], &pixels[p*channels], 3);
+    }
+    return true;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Display
+ */
+
+static void flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_p)
+{
+    const uint width = lv_area_get_width(area);
+    for (int32_t y=area->y1; y<=area->y2; y++) {
+        memcpy(&g_framebuffer[y*WIDTH + area->x1], color_p, width*sizeof(lv_color_t));
+        color_p += width;
+    }
+    g_cost.flushed_px += lv_area_get_size(area);
+    lv_disp_flush_ready(drv);
+}
+
+
+/** Called after every refresh that drew something, time is in LVGL ticks and always 0 here */
+static void monitor_cb(lv_disp_drv_t *, uint32_t, uint32_t px)
+{
+    g_cost.frames++;
+    g_cost.rendered_px += px;
+}
+
+
+static lv_disp_t *display_init()
+{
+    static lv_disp_draw_buf_t draw_buf;
+    static lv_disp_drv_t drv;
+
+    lv_disp_draw_buf_init(&draw_buf, g_draw_buffer, nullptr, WIDTH*HEIGHT);
+    lv_disp_drv_init(&drv);
+    drv.hor_res = WIDTH;
+    drv.ver_res = HEIGHT;
+    drv.flush_cb = flush_cb;
+    drv.monitor_cb = monitor_cb;
+    drv.draw_buf = &draw_buf;
+    return lv_disp_drv_register(&drv);
+}
+
+
+/** Advance LVGL time, run its timers and render what was invalidated */
+static void advance(lv_disp_t *disp, uint ms)
+{
+    const auto start = std::chrono::steady_clock::now();
+    while (ms>0) {
+        const uint step = std::min(ms, static_cast<uint>(LV_DISP_DEF_REFR_PERIOD));
+        lv_tick_inc(step);
+        lv_timer_handler();
+        ms -= step;
+    }
+    lv_refr_now(disp);
+    g_cost.render_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static cost_t take_cost()
+{
+    const cost_t cost = g_cost;
+    g_cost = {};
+    return cost;
+}
+
+
+static image_t capture()
+{
+    image_t rgb(WIDTH*HEIGHT*3);
+    for (uint p=0; p<WIDTH*HEIGHT; p++) {
+        const uint32_t c = lv_color_to32(g_framebuffer[p]);
+        rgb[p*3 + 0] = c>>16;
+        rgb[p*3 + 1] = c>>8;
+        rgb[p*3 + 2] = c;
+    }
+    return rgb;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Render cost
+ */
+
+// Per frame averages of a phase, the columns of tools/golden.py
+struct phase_cost_t {
+    uint frames;
+    double render_ms;
+    uint32_t area_px;
+};
+
+using cost_table_t = std::map<std::string, phase_cost_t>;      // "<step> <phase>"
+
+
+static phase_cost_t phase_cost(const cost_t &cost)
+{
+    if (cost.frames==0) {
+        return { 0, 0.0, 0 };
+    }
+    return { cost.frames, cost.render_us / 1000.0 / cost.frames, static_cast<uint32_t>(cost.flushed_px / cost.frames) };
+}
+
+
+static void print_frame(const std::string &name, const cost_t &cost)
+{
+    printf("%-20s %6u %10.2f %11llu %10llu\n", name.c_str(), cost.frames, cost.render_us/1000.0,
+        (unsigned long long)cost.rendered_px, (unsigned long long)cost.flushed_px);
+}
+
+
+/** Whitespace separated with a header line, like the output of the bench command */
+static bool cost_write(const std::string &path, const cost_table_t &table)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "step phase frames render_ms area_px\n");
+    for (auto &[key, cost] : table) {
+        fprintf(f, "%s %u %.3f %lu\n", key.c_str(), cost.frames, cost.render_ms, (unsigned long)cost.area_px);
+    }
+    return fclose(f)==0;
+}
+
+
+static bool cost_read(const std::string &path, cost_table_t &table)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) {
+        return false;
+    }
+    char line[128];
+    fgets(line, sizeof(line), f);
+    char step[48], phase[16];
+    phase_cost_t cost;
+    unsigned long area;
+    while (fscanf(f, "%47s %15s %u %lf %lu", step, phase, &cost.frames, &cost.render_ms, &area)==5) {
+        cost.area_px = area;
+        table[std::string(step) + " " + phase] = cost;
+    }
+    fclose(f);
+    return true;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Test
+ */
+
+struct golden_t {
+    bool update;
+    bool time;
+    std::string golden_dir;
+    std::string out_dir;
+    std::set<std::string> recorded;
+    uint frames;
+    uint missing;
+    uint failures;
+};
+
+#define FAIL(g, ...) do { printf("FAIL "); printf(__VA_ARGS__); printf("\n"); (g).failures++; } while (0)
+
+
+static uint count_differences(const image_t &a, const image_t &b, image_t *diff)
+{
+    uint differ = 0;
+    for (uint p=0; p<WIDTH*HEIGHT; p++) {
+        if (memcmp(&a[p*3], &b[p*3], 3)!=0) {
+            if (diff) {
+                (*diff)[p*3] = 255;
+            }
+            differ++;
+        }
+    }
+    return differ;
+}
+
+
+/**
+ * Compare a frame with its golden image. The clock is checked again after
+ * the round trip against the same image, so in update mode only the first
+ * frame of a name is recorded and later ones are compared with it.
+ */
+static void check(golden_t &g, const std::string &name, const image_t &rgb)
+{
+    g.frames++;
+    const std::string golden_path = g.golden_dir + "/" + name + ".png";
+    if (g.update && g.recorded.insert(name).second) {
+        if (!png_write(golden_path, rgb)) {
+            FAIL(g, "%s: cannot write %s", name.c_str(), golden_path.c_str());
+        }
+        return;
+    }
+
+    image_t golden;
+    if (!png_read(golden_path, golden)) {
+        g.missing++;
+        return;
+    }
+    image_t diff(WIDTH*HEIGHT*3, 0);
+    const uint differ = count_differences(rgb, golden, &diff);
+    if (differ>0) {
+        FAIL(g, "%s: %u pixels differ from the golden image", name.c_str(), differ);
+        png_write(g.out_dir + "/" + name + ".png", rgb);
+        png_write(g.out_dir + "/" + name + "-diff.png", diff);
+    }
+}
+
+
+static void check_cost(golden_t &g, const cost_table_t &costs)
+{
+    const std::string path = g.golden_dir + "/" + COST_FILE;
+    if (g.update) {
+        if (!cost_write(path, costs)) {
+            FAIL(g, "cannot write %s", path.c_str());
+        }
+        return;
+    }
+
+    cost_table_t baseline;
+    if (!cost_read(path, baseline)) {
+        printf("No render cost baseline in %s\n", path.c_str());
+        return;
+    }
+    for (auto &[key, cost] : costs) {
+        auto it = baseline.find(key);
+        if (it==baseline.end()) {
+            continue;
+        }
+        auto &base = it->second;
+        auto grew = [](double value, double base) { return base>0 && value>base*(1+COST_TOLERANCE); };
+        if (cost.frames>base.frames) {
+            FAIL(g, "%s: %u frames, baseline %u", key.c_str(), cost.frames, base.frames);
+        }
+        if (grew(cost.area_px, base.area_px) || (base.area_px==0 && cost.area_px>0)) {
+            FAIL(g, "%s: area_px %lu, baseline %lu", key.c_str(), (unsigned long)cost.area_px, (unsigned long)base.area_px);
+        }
+        if (g.time && grew(cost.render_ms, base.render_ms)) {
+            FAIL(g, "%s: render_ms %.3f, baseline %.3f", key.c_str(), cost.render_ms, base.render_ms);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    golden_t g {};
+    int arg = 1;
+    for (; arg<argc && strncmp(argv[arg], "--", 2)==0; arg++) {
+        if (strcmp(argv[arg], "--update")==0) {
+            g.update = true;
+        }
+        else if (strcmp(argv[arg], "--time")==0) {
+            g.time = true;
+        }
+        else {
+            break;
+        }
+    }
+    if (argc-arg!=2) {
+        printf("usage: %s [--update] [--time] <golden dir> <output dir>\n", argv[0]);
+        return 2;
+    }
+    g.golden_dir = argv[arg];
+    g.out_dir = argv[arg+1];
+    if (g.update) {
+        mkdir(g.golden_dir.c_str(), 0777);
+    }
+    mkdir(g.out_dir.c_str(), 0777);
+
+    lv_init();
+    lv_disp_t *disp = display_init();
+    ui_init();
+    advance(disp, SETTLE_MS);
+    take_cost();
+    const image_t first = capture();
+    check(g, STEPS[0].from, first);
+
+    printf("%-20s %6s %10s %11s %10s\n", "Frame", "Frames", "Render ms", "Rendered px", "Flushed px");
+    cost_table_t costs;
+    image_t last = first;
+    for (auto &step : STEPS) {
+        const std::string name = std::string(step.from) + "-" + step.to;
+        lv_scr_load_anim(*step.screen, LV_SCR_LOAD_ANIM_MOVE_LEFT, TRANSITION_MS, 0, false);
+        cost_t transition {};
+        uint t = FRAME_MS;
+        for (; t<TRANSITION_MS; t+=FRAME_MS) {
+            advance(disp, FRAME_MS);
+            const cost_t cost = take_cost();
+            char frame[64];
+            snprintf(frame, sizeof(frame), "%s-%03u", name.c_str(), t);
+            print_frame(frame, cost);
+            transition.frames += cost.frames;
+            transition.render_us += cost.render_us;
+            transition.flushed_px += cost.flushed_px;
+
+            const image_t rgb = capture();
+            if (cost.flushed_px==0 || count_differences(rgb, last, nullptr)==0) {
+                FAIL(g, "%s: the transition did not move", frame);
+            }
+            check(g, frame, rgb);
+            last = rgb;
+        }
+        advance(disp, TRANSITION_MS - (t-FRAME_MS) + SETTLE_MS);
+        const cost_t end = take_cost();
+        print_frame(step.to, end);
+        transition.frames += end.frames;
+        transition.render_us += end.render_us;
+        transition.flushed_px += end.flushed_px;
+        last = capture();
+        check(g, step.to, last);
+
+        // The screen by itself
+        advance(disp, STEADY_MS);
+        const cost_t steady = take_cost();
+        print_frame(std::string(step.to) + " steady", steady);
+        if (!step.animated && steady.flushed_px>0) {
+            FAIL(g, "%s: %llu pixels flushed on a screen without animations", step.to, (unsigned long long)steady.flushed_px);
+        }
+        if (step.animated) {
+            last = capture();
+        }
+        costs[name + " transition"] = phase_cost(transition);
+        costs[name + " steady"] = phase_cost(steady);
+    }
+
+    const uint differ = count_differences(first, last, nullptr);
+    if (differ>0) {
+        FAIL(g, "clock: %u pixels differ after the round trip", differ);
+    }
+    check_cost(g, costs);
+
+    if (g.update) {
+        printf("%zu golden images and the render cost written to %s, %u failures\n", g.recorded.size(), g.golden_dir.c_str(), g.failures);
+        return g.failures ? 1 : 0;
+    }
+    printf("%u frames, %u without golden image, %u failures\n", g.frames, g.missing, g.failures);
+    if (g.missing==g.frames) {
+        printf("No golden images, record them with --update\n");
+    }
+    else if (g.missing) {
+        FAIL(g, "%u frames have no golden image, record them with --update", g.missing);
+    }
+    return g.failures ? 1 : 0;
+}
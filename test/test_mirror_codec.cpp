@@ -0,0 +1,244 @@
+/**
+ * Host test of the mirror stream encoder
+ *
+ * Encodes synthetic frames with the encoder the device uses, decodes them
+ * again and compares every frame with its source. With two file arguments
+ * the stream and the expected framebuffers are also written, for
+ * tools/mirror_view.py --check to decode them with the viewer's decoder.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <random>
+
+#include "mirror_codec.h"
+
+static constexpr uint WIDTH { 240 };
+static constexpr uint HEIGHT { 240 };
+
+using frame_t = std::vector<uint16_t>;
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_failures++; } } while (0)
+
+
+
+/** -------------------------------------------------------------------------------
+ * Decoder
+ */
+
+struct decoder_t {
+    const std::vector<uint8_t> &data;
+    size_t pos;
+    frame_t fb;
+
+    bool u8(uint8_t *value)
+    {
+        if (pos+1>data.size()) {
+            return false;
+        }
+        *value = data[pos++];
+        return true;
+    }
+
+    bool u16(uint16_t *value)
+    {
+        if (pos+2>data.size()) {
+            return false;
+        }
+        *value = data[pos] | (data[pos+1]<<8);
+        pos += 2;
+        return true;
+    }
+
+    bool pixels(uint16_t *dst, uint count)
+    {
+        if (pos+count*sizeof(uint16_t)>data.size()) {
+            return false;
+        }
+        memcpy(dst, &data[pos], count*sizeof(uint16_t));
+        pos += count*sizeof(uint16_t);
+        return true;
+    }
+
+    /** Apply one frame, false on a malformed stream */
+    bool frame()
+    {
+        while (true) {
+            uint16_t y;
+            if (!u16(&y)) {
+                return false;
+            }
+            if (y==MIRROR_END_OF_FRAME) {
+                return true;
+            }
+            if (y>=HEIGHT) {
+                return false;
+            }
+            uint16_t *row = &fb[y*WIDTH];
+            uint x = 0;
+            while (true) {
+                uint8_t op;
+                if (!u8(&op)) {
+                    return false;
+                }
+                if (op==MIRROR_OP_END_OF_ROW) {
+                    break;
+                }
+                if (op<MIRROR_OP_RUN) {
+                    x += op;
+                    continue;
+                }
+                const uint n = (op & 0x3f) + 1;
+                if (x+n>WIDTH) {
+                    return false;
+                }
+                if (op<MIRROR_OP_LITERAL) {
+                    uint16_t color;
+                    if (!pixels(&color, 1)) {
+                        return false;
+                    }
+                    std::fill_n(row+x, n, color);
+                }
+                else if (!pixels(row+x, n)) {
+                    return false;
+                }
+                x += n;
+            }
+        }
+    }
+};
+
+
+
+/** -------------------------------------------------------------------------------
+ * Frames
+ */
+
+static void hline(frame_t &fb, uint y, uint x0, uint x1, uint16_t color)
+{
+    std::fill(fb.begin()+y*WIDTH+x0, fb.begin()+y*WIDTH+x1, color);
+}
+
+
+static std::vector<frame_t> make_frames()
+{
+    std::vector<frame_t> frames;
+    frame_t fb(WIDTH*HEIGHT, 0x0000);
+
+    // Spans starting past the left edge, the first beyond one skip op
+    hline(fb, 10, 100, 110, 0xf800);
+    hline(fb, 11, 200, 240, 0x07e0);
+    fb[12*WIDTH + WIDTH-1] = 0x001f;
+    frames.push_back(fb);
+
+    // A change of a row that already differs from black
+    hline(fb, 10, 104, 106, 0xffff);
+    frames.push_back(fb);
+
+    // Runs longer than one op, literals and single unchanged pixels inside a span
+    hline(fb, 20, 0, 200, 0x1234);
+    for (uint x=30; x<90; x++) {
+        fb[21*WIDTH + x] = x * 0x0101;
+    }
+    for (uint x=50; x<150; x+=2) {
+        fb[22*WIDTH + x] = 0xabcd;
+    }
+    frames.push_back(fb);
+
+    // Nothing changed
+    frames.push_back(fb);
+
+    // Random sparse updates, as a moving hand or seconds digits
+    std::mt19937 rng(1);
+    for (uint i=0; i<50; i++) {
+        for (uint j=0; j<20; j++) {
+            const uint y = rng() % HEIGHT;
+            const uint x0 = rng() % WIDTH;
+            const uint x1 = std::min<uint>(WIDTH, x0 + 1 + rng() % 80);
+            const uint16_t color = rng() % 4==0 ? rng() : rng() % 4 * 0x4208;
+            if (rng() % 2) {
+                hline(fb, y, x0, x1, color);
+            }
+            else {
+                for (uint x=x0; x<x1; x++) {
+                    fb[y*WIDTH + x] = rng() % 3 ? color : rng();
+                }
+            }
+        }
+        frames.push_back(fb);
+    }
+    return frames;
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Test
+ */
+
+int main(int argc, char **argv)
+{
+    const auto frames = make_frames();
+
+    std::vector<uint8_t> stream;
+    auto out = [&stream](const void *data, size_t len) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        stream.insert(stream.end(), bytes, bytes+len);
+    };
+    out(MIRROR_MAGIC, sizeof(MIRROR_MAGIC));
+    mirror_out_u16(out, WIDTH);
+    mirror_out_u16(out, HEIGHT);
+    mirror_out_u8(out, 0x00);
+    const size_t hello_size = stream.size();
+
+    frame_t shadow(WIDTH*HEIGHT, 0x0000);
+    decoder_t decoder { stream, hello_size, frame_t(WIDTH*HEIGHT, 0x0000) };
+    for (uint i=0; i<frames.size(); i++) {
+        const size_t start = stream.size();
+        uint rows = 0;
+        for (uint y=0; y<HEIGHT; y++) {
+            rows += mirror_encode_row(out, y, &frames[i][y*WIDTH], &shadow[y*WIDTH], WIDTH);
+        }
+        mirror_out_u16(out, MIRROR_END_OF_FRAME);
+
+        CHECK(shadow==frames[i], "frame %u: shadow not updated", i);
+        if (i>0 && frames[i]==frames[i-1]) {
+            CHECK(rows==0 && stream.size()-start==2, "frame %u: unchanged frame encoded %u rows", i, rows);
+        }
+        if (!decoder.frame()) {
+            CHECK(false, "frame %u: malformed at byte %zu", i, decoder.pos);
+            break;
+        }
+        CHECK(decoder.pos==stream.size(), "frame %u: %zu bytes left", i, stream.size()-decoder.pos);
+        for (uint p=0; p<WIDTH*HEIGHT; p++) {
+            if (decoder.fb[p]!=frames[i][p]) {
+                CHECK(false, "frame %u: pixel %u,%u is %04x, expected %04x", i, p % WIDTH, p / WIDTH, decoder.fb[p], frames[i][p]);
+                break;
+            }
+        }
+    }
+
+    if (argc==3) {
+        FILE *f = fopen(argv[1], "wb");
+        FILE *e = fopen(argv[2], "wb");
+        CHECK(f && e, "cannot write %s and %s", argv[1], argv[2]);
+        if (f && e) {
+            fwrite(stream.data(), 1, stream.size(), f);
+            for (auto &fb : frames) {
+                fwrite(fb.data(), sizeof(uint16_t), fb.size(), e);
+            }
+        }
+        if (f) {
+            fclose(f);
+        }
+        if (e) {
+            fclose(e);
+        }
+    }
+
+    printf("%zu frames, %zu bytes, %d failures\n", frames.size(), stream.size(), g_failures);
+    return g_failures ? 1 : 0;
+}
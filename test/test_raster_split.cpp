@@ -0,0 +1,186 @@
+/**
+ * Host test of the split blend hand-over
+ *
+ * Runs the stripe split and claim protocol of raster_split.h with a worker
+ * thread, the way raster.cpp runs it with a worker task on the other core,
+ * and compares every frame with the same blends done by one thread. Delays
+ * on either side make both the worker and the take-back path happen, and a
+ * slow worker stripe checks that the caller waits for it.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+#include "raster_split.h"
+
+static constexpr int32_t WIDTH { 240 };
+static constexpr int32_t HEIGHT { 240 };
+static constexpr uint ROUNDS { 2000 };
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_failures++; } } while (0)
+
+
+
+/** -------------------------------------------------------------------------------
+ * Blend
+ */
+
+struct area_t {
+    int32_t x1, y1, x2, y2;
+};
+
+struct blend_t {
+    area_t area;
+    uint16_t color;
+    uint8_t opa;
+};
+
+/** Like the LVGL software blend, only writes pixels inside clip */
+static void blend(uint16_t *buf, const area_t &clip, const blend_t &dsc)
+{
+    const int32_t x1 = std::max(clip.x1, dsc.area.x1);
+    const int32_t x2 = std::min(clip.x2, dsc.area.x2);
+    const int32_t y1 = std::max(clip.y1, dsc.area.y1);
+    const int32_t y2 = std::min(clip.y2, dsc.area.y2);
+    for (int32_t y=y1; y<=y2; y++) {
+        for (int32_t x=x1; x<=x2; x++) {
+            uint16_t &p = buf[y*WIDTH + x];
+            const uint32_t r = (((dsc.color>>11) & 0x1f)*dsc.opa + ((p>>11) & 0x1f)*(255-dsc.opa)) / 255;
+            const uint32_t g = (((dsc.color>>5) & 0x3f)*dsc.opa + ((p>>5) & 0x3f)*(255-dsc.opa)) / 255;
+            const uint32_t b = ((dsc.color & 0x1f)*dsc.opa + (p & 0x1f)*(255-dsc.opa)) / 255;
+            p = (r<<11) | (g<<5) | b;
+        }
+    }
+}
+
+
+
+/** -------------------------------------------------------------------------------
+ * Test
+ */
+
+static void test_split_rows()
+{
+    raster_stripes_t s;
+    CHECK(!raster_split_rows(5, 5, &s), "one row split");
+    CHECK(raster_split_rows(5, 6, &s) && s.upper_y1==5 && s.upper_y2==5 && s.lower_y1==6 && s.lower_y2==6, "two rows");
+    CHECK(raster_split_rows(0, 238, &s) && s.upper_y2+1==s.lower_y1 && s.upper_y2-s.upper_y1+1==119 && s.lower_y2-s.lower_y1+1==120, "odd rows");
+    CHECK(raster_split_rows(-10, 9, &s) && s.upper_y1==-10 && s.upper_y2==-1 && s.lower_y1==0 && s.lower_y2==9, "negative rows");
+}
+
+
+static void test_threads()
+{
+    std::vector<uint16_t> single(WIDTH*HEIGHT, 0);
+    std::vector<uint16_t> split(WIDTH*HEIGHT, 0);
+
+    raster_job claim;
+    std::counting_semaphore<> wake(0);
+    std::binary_semaphore done(0);
+    std::atomic<bool> stop { false };
+    std::atomic<bool> worker_late { false };
+    std::atomic<bool> worker_slow { false };
+
+    // The lower stripe, filled in before each post like g_job
+    struct {
+        area_t clip;
+        blend_t dsc;
+    } job;
+    auto lower = [&] { blend(split.data(), job.clip, job.dsc); };
+
+    uint worked = 0;
+    std::thread worker([&] {
+        while (true) {
+            wake.acquire();
+            if (stop.load()) {
+                return;
+            }
+            if (worker_late.load()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+            auto slow_lower = [&] {
+                if (worker_slow.load()) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+                }
+                lower();
+            };
+            worked += claim.work(slow_lower, [&] { done.release(); });
+        }
+    });
+
+    std::mt19937 rng(1);
+    uint taken_back = 0;
+    uint splits = 0;
+    for (uint i=0; i<ROUNDS; i++) {
+        blend_t dsc;
+        dsc.area.x1 = rng() % WIDTH - 20;
+        dsc.area.y1 = rng() % HEIGHT - 20;
+        dsc.area.x2 = dsc.area.x1 + rng() % 120;
+        dsc.area.y2 = dsc.area.y1 + rng() % 120;
+        dsc.color = rng();
+        dsc.opa = rng() % 4==0 ? 255 : rng();
+        const area_t screen = { 0, 0, WIDTH-1, HEIGHT-1 };
+        const area_t area = {
+            std::max(screen.x1, dsc.area.x1), std::max(screen.y1, dsc.area.y1),
+            std::min(screen.x2, dsc.area.x2), std::min(screen.y2, dsc.area.y2),
+        };
+        blend(single.data(), screen, dsc);
+
+        raster_stripes_t stripes;
+        if (area.x1>area.x2 || !raster_split_rows(area.y1, area.y2, &stripes)) {
+            blend(split.data(), screen, dsc);
+            continue;
+        }
+        splits++;
+        job.clip = { area.x1, stripes.lower_y1, area.x2, stripes.lower_y2 };
+        job.dsc = dsc;
+        const area_t upper_clip = { area.x1, stripes.upper_y1, area.x2, stripes.upper_y2 };
+        worker_late.store(i % 4==0);
+        const bool caller_late = i % 4==1 || i % 4==2;
+        worker_slow.store(i % 4==2);
+        taken_back += claim.run(
+            [&] { wake.release(); },
+            [&] {
+                blend(split.data(), upper_clip, dsc);
+                if (caller_late) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+                }
+            },
+            lower,
+            [&] { done.acquire(); }
+            );
+
+        // The caller may only go on with both stripes in the buffer
+        if (memcmp(single.data(), split.data(), single.size()*sizeof(uint16_t))!=0) {
+            CHECK(false, "round %u: split blend differs", i);
+            break;
+        }
+    }
+
+    stop.store(true);
+    wake.release();
+    worker.join();
+
+    CHECK(worked + taken_back==splits, "%u by the worker and %u taken back of %u splits", worked, taken_back, splits);
+    CHECK(worked>0, "worker never blended a stripe");
+    CHECK(taken_back>0, "no stripe was taken back");
+    printf("%u splits, %u by the worker, %u taken back\n", splits, worked, taken_back);
+}
+
+
+int main()
+{
+    test_split_rows();
+    test_threads();
+    printf("%d failures\n", g_failures);
+    return g_failures ? 1 : 0;
+}
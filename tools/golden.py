@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+Golden image and render cost check of the SquareLine screens on a device.
+
+Walks the screens through the same transitions as the UI with scene updates,
+captures them through the framebuffer mirror and reads render time and
+flushed area from /metrics. Settled screens are compared pixel for pixel with
+golden PNGs, regions that animate by themselves are masked. Transition
+frames are saved for review.
+
+    golden.py <address> --update            record the golden images
+    golden.py <address>                     compare, exit status 1 on a difference
+    golden.py <address> --save cost.json    store the render cost
+    golden.py <address> --baseline cost.json
+                                            also fail when render time or area
+                                            grew by more than --tolerance
+
+The mirror samples at most 10 frames per second and is not locked to the
+display refresh, so transition frames are not compared here. test/test_golden.cpp
+compares them on the host with LVGL time under its control.
+"""
+import argparse
+import json
+import math
+import os
+import socket
+import sys
+import threading
+import time
+import urllib.request
+
+from PIL import Image
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mirror_view  # noqa: E402
+import scene_replay  # noqa: E402
+
+TRANSITION_MS = 500
+SETTLE_S = 1.0
+STEADY_S = 2.0
+DEFAULT_GOLDEN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "golden")
+
+# Same order and animations as the right hand touch panels
+STEPS = [
+    ("clock", "demo", scene_replay.ANIM_MOVE_LEFT),
+    ("demo", "demo1", scene_replay.ANIM_MOVE_LEFT),
+    ("demo1", "demo2", scene_replay.ANIM_MOVE_LEFT),
+    ("demo2", "clock", scene_replay.ANIM_MOVE_LEFT),
+]
+
+# Outside the round panel, the display driver does not redraw the corners
+PANEL_MASK = ("outside", 120, 120, 120)
+
+# Regions that change without input, generous to cover anti-aliasing
+MASKS = {
+    "clock": [("rect", 40, 80, 200, 160), ("ring", 120, 120, 104, 121)],  # Time label, seconds arc
+    "demo": [("rect", 76, 76, 164, 164)],                                  # Spinner
+}
+
+
+class Mirror:
+    """Keeps the latest mirrored framebuffer and the frames received since mark()"""
+
+    def __init__(self, host):
+        self.reader = mirror_view.Reader(socket.create_connection((host, mirror_view.PORT)))
+        self.decoder = mirror_view.Decoder(self.reader)
+        self.lock = threading.Lock()
+        self.frames = []
+        self.latest = self.decoder.rgb()
+        threading.Thread(target=self.receive, daemon=True).start()
+
+    def receive(self):
+        while True:
+            self.decoder.frame()
+            rgb = self.decoder.rgb()
+            with self.lock:
+                self.frames.append(rgb)
+                self.latest = rgb
+
+    def mark(self):
+        with self.lock:
+            self.frames = []
+
+    def take(self):
+        with self.lock:
+            frames, self.frames = self.frames, []
+        return frames
+
+    def image(self, rgb=None):
+        with self.lock:
+            rgb = rgb or self.latest
+        return Image.frombytes("RGB", (self.decoder.width, self.decoder.height), rgb)
+
+
+def scrape(host):
+    values = {}
+    with urllib.request.urlopen(f"http://{host}/metrics", timeout=5) as res:
+        for line in res.read().decode().splitlines():
+            if line and not line.startswith("#"):
+                name, value = line.rsplit(" ", 1)
+                values[name] = float(value)
+    return values
+
+
+def cost(before, after):
+    frames = after["display_frame_time_seconds_count"] - before["display_frame_time_seconds_count"]
+    if frames <= 0:
+        return {"frames": 0, "render_ms": 0.0, "area_px": 0}
+    render = after["display_frame_time_seconds_sum"] - before["display_frame_time_seconds_sum"]
+    flushed = after["display_flush_bytes_total"] - before["display_flush_bytes_total"]
+    return {"frames": int(frames), "render_ms": render * 1000 / frames, "area_px": int(flushed / 2 / frames)}
+
+
+def masked(name, x, y):
+    for mask in [PANEL_MASK] + MASKS.get(name, []):
+        if mask[0] == "rect" and mask[1] <= x < mask[3] and mask[2] <= y < mask[4]:
+            return True
+        if mask[0] == "ring" and mask[3] <= math.hypot(x + 0.5 - mask[1], y + 0.5 - mask[2]) <= mask[4]:
+            return True
+        if mask[0] == "outside" and math.hypot(x + 0.5 - mask[1], y + 0.5 - mask[2]) > mask[3]:
+            return True
+    return False
+
+
+def compare(name, image, golden):
+    """Returns the differing pixels outside the masks and a diff image"""
+    if golden.size != image.size:
+        return image.size[0] * image.size[1], None
+    width, height = image.size
+    a = image.tobytes()
+    b = golden.convert("RGB").tobytes()
+    diff = Image.new("RGB", image.size)
+    pixels = diff.load()
+    count = 0
+    for y in range(height):
+        for x in range(width):
+            i = (y * width + x) * 3
+            if a[i:i + 3] != b[i:i + 3] and not masked(name, x, y):
+                pixels[x, y] = (255, 0, 0)
+                count += 1
+    return count, diff
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", help="Device address")
+    parser.add_argument("--golden", default=DEFAULT_GOLDEN, help="Golden image directory")
+    parser.add_argument("--out", default="golden_out", help="Directory for captured frames and diffs")
+    parser.add_argument("--update", action="store_true", help="Store the captured screens as golden images")
+    parser.add_argument("--save", metavar="FILE", help="Store the render cost as JSON")
+    parser.add_argument("--baseline", metavar="FILE", help="Render cost to compare with")
+    parser.add_argument("--tolerance", type=float, default=0.1, help="Allowed render cost growth")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    if args.update:
+        os.makedirs(args.golden, exist_ok=True)
+
+    mirror = Mirror(args.host)
+    scene = scene_replay.Connection(args.host, scene_replay.PORT)
+    scene.send(scene_replay.show_screen(STEPS[0][0]))
+    scene.sync()
+    time.sleep(SETTLE_S)
+
+    results = {}
+    failed = False
+    print(f"{'Step':16} {'Frames':>6} {'Render ms':>10} {'Area px':>8}   {'Steady':>6} {'Render ms':>10} {'Area px':>8}  Image")
+    for source, target, anim in STEPS:
+        step = f"{source}-{target}"
+        before = scrape(args.host)
+        mirror.mark()
+        scene.send(scene_replay.show_screen(target, anim, TRANSITION_MS))
+        scene.sync()
+        time.sleep(TRANSITION_MS / 1000 + SETTLE_S)
+        settled = scrape(args.host)
+        for i, rgb in enumerate(mirror.take()):
+            mirror.image(rgb).save(os.path.join(args.out, f"{step}-{i:02}.png"))
+
+        # Cost of the screen by itself, after the transition
+        time.sleep(STEADY_S)
+        after = scrape(args.host)
+        image = mirror.image()
+        image.save(os.path.join(args.out, f"{target}.png"))
+
+        golden_path = os.path.join(args.golden, f"{target}.png")
+        if args.update:
+            image.save(golden_path)
+            status = "updated"
+        elif not os.path.exists(golden_path):
+            status = "no golden"
+            failed = True
+        else:
+            count, diff = compare(target, image, Image.open(golden_path))
+            status = "ok" if count == 0 else f"{count} px differ"
+            if count:
+                failed = True
+                if diff:
+                    diff.save(os.path.join(args.out, f"{target}-diff.png"))
+
+        transition = cost(before, settled)
+        steady = cost(settled, after)
+        results[step] = {"transition": transition, "steady": steady}
+        print(f"{step:16} {transition['frames']:6} {transition['render_ms']:10.1f} {transition['area_px']:8}   "
+              f"{steady['frames']:6} {steady['render_ms']:10.1f} {steady['area_px']:8}  {status}")
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        for step, phases in results.items():
+            for phase, value in phases.items():
+                base = baseline.get(step, {}).get(phase)
+                if not base:
+                    continue
+                for key in ("render_ms", "area_px"):
+                    if base[key] and value[key] > base[key] * (1 + args.tolerance):
+                        print(f"{step} {phase}: {key} {value[key]:.1f}, baseline {base[key]:.1f}")
+                        failed = True
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Summarize heap profiler dumps.
+
+The firmware writes the live allocations recorded by "heapprof dump" to
+/storage/heapprof.bin. Call sites are resolved against the firmware ELF with
+addr2line and tagged with the subsystem owning the source file. With two dumps
+the second is compared against the first, which shows what grew in between.
+
+Fetch a dump with:
+    parttool.py read_partition --partition-name=storage --output=storage.bin
+or copy it off the device any other way, then:
+    heapprof.py .pio/build/seeed_xiao_esp32s3/firmware.elf old.bin new.bin
+"""
+import argparse
+import collections
+import shutil
+import struct
+import subprocess
+import sys
+
+DUMP_MAGIC = 0x31525048  # "HPR1"
+DUMP_VERSION = 1
+HEADER = struct.Struct("<IHHIq" + "IIII" * 3 + "II")
+REGIONS = ("internal", "dma", "psram")
+
+ADDR2LINE = "xtensa-esp32s3-elf-addr2line"
+
+# First match on the resolved source path wins
+TAGS = (
+    ("lvgl", ("/lvgl/",)),
+    ("wifi", ("/esp_wifi/", "/lwip/", "/wpa_supplicant/", "/esp_netif/", "/esp_phy/", "/mbedtls/")),
+    ("console", ("/console/", "/argtable3/", "/linenoise/", "/vfs/")),
+    ("app", ("/src/", "/components/esp_lcd_gc9a01/")),
+)
+
+# Frames inside these are skipped to find the real call site
+ALLOCATORS = ("malloc", "calloc", "realloc", "operator new", "heap_caps_", "_malloc_r", "_calloc_r", "strdup", "lv_mem_")
+
+
+Dump = collections.namedtuple("Dump", "time_us regions lvgl records")
+Record = collections.namedtuple("Record", "address size region callers")
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    fields = HEADER.unpack_from(data)
+    magic, version, depth, count, time_us = fields[:5]
+    if magic != DUMP_MAGIC or version != DUMP_VERSION:
+        sys.exit(f"{path}: not a heap profiler dump")
+    regions = [fields[5 + i * 4:9 + i * 4] for i in range(len(REGIONS))]
+    lvgl = fields[-2:]
+
+    record = struct.Struct("<IIB3x" + "I" * depth)
+    records = []
+    for i in range(count):
+        address, size, region, *callers = record.unpack_from(data, HEADER.size + i * record.size)
+        records.append(Record(address, size, region, tuple(callers)))
+    return Dump(time_us, regions, lvgl, records)
+
+
+def code_address(raw):
+    # Xtensa return addresses carry the window size in the top bits and point past the call
+    if raw == 0:
+        return 0
+    if raw & 0xc0000000 != 0x40000000:
+        raw = (raw & 0x3fffffff) | 0x40000000
+    return raw - 3
+
+
+class Symbolizer:
+    def __init__(self, elf):
+        self.elf = elf
+        self.cache = {}
+
+    def resolve(self, addresses):
+        missing = sorted({a for a in addresses if a and a not in self.cache})
+        if missing and self.elf:
+            out = subprocess.run([ADDR2LINE, "-f", "-C", "-e", self.elf] + [hex(a) for a in missing],
+                                 capture_output=True, text=True, check=True).stdout.splitlines()
+            for address, func, location in zip(missing, out[0::2], out[1::2]):
+                self.cache[address] = (func, location)
+        for a in missing:
+            self.cache.setdefault(a, (hex(a), "??"))
+
+    def site(self, callers):
+        """Return (function, location, tag) of the first frame outside the allocator"""
+        frames = [self.cache.get(code_address(c), (hex(c), "??")) for c in callers if c]
+        if not frames:
+            return ("??", "??", "other")
+        func, location = frames[-1]
+        for f, loc in frames:
+            if not f.startswith(ALLOCATORS):
+                func, location = f, loc
+                break
+        for tag, patterns in TAGS:
+            if any(p in location for p in patterns):
+                return (func, location, tag)
+        return (func, location, "system")
+
+
+def summarize(dump, symbolizer):
+    sites = collections.Counter()
+    counts = collections.Counter()
+    tags = collections.Counter()
+    for rec in dump.records:
+        func, location, tag = symbolizer.site(rec.callers)
+        key = (tag, REGIONS[rec.region], func, location)
+        sites[key] += rec.size
+        counts[key] += 1
+        tags[(tag, REGIONS[rec.region])] += rec.size
+    return sites, counts, tags
+
+
+def print_regions(dump):
+    print(f"Dump at {dump.time_us / 1e6:.0f} s, {len(dump.records)} live allocations")
+    print(f"{'Region':<10} {'Total':>8} {'Used':>8} {'Min free':>9} {'Largest':>8}")
+    for name, (total, free, min_free, largest) in zip(REGIONS, dump.regions):
+        print(f"{name:<10} {total:>8} {total - free:>8} {min_free:>9} {largest:>8}")
+    print(f"{'lvgl pool':<10} {dump.lvgl[0]:>8} {dump.lvgl[0] - dump.lvgl[1]:>8}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="Firmware ELF the dumps were taken with")
+    parser.add_argument("dumps", nargs="+", help="One dump, or an older and a newer dump to compare")
+    parser.add_argument("-n", "--sites", type=int, default=20, help="Number of call sites to list")
+    args = parser.parse_args()
+
+    if len(args.dumps) > 2:
+        parser.error("at most two dumps")
+    if not shutil.which(ADDR2LINE):
+        print(f"{ADDR2LINE} not found, call sites are not resolved", file=sys.stderr)
+        args.elf = None
+
+    dumps = [load(path) for path in args.dumps]
+    symbolizer = Symbolizer(args.elf)
+    symbolizer.resolve(code_address(c) for d in dumps for r in d.records for c in r.callers)
+
+    new = dumps[-1]
+    print_regions(new)
+    sites, counts, tags = summarize(new, symbolizer)
+    if len(dumps) == 2:
+        old_sites, _, old_tags = summarize(dumps[0], symbolizer)
+        sites.subtract(old_sites)
+        tags.subtract(old_tags)
+        print(f"\nGrowth over {(new.time_us - dumps[0].time_us) / 1e6:.0f} s")
+
+    print(f"\n{'Tag':<8} {'Region':<9} {'Bytes':>9}")
+    for (tag, region), size in sorted(tags.items(), key=lambda kv: -kv[1]):
+        if size:
+            print(f"{tag:<8} {region:<9} {size:>+9}" if len(dumps) == 2 else f"{tag:<8} {region:<9} {size:>9}")
+
+    print(f"\n{'Tag':<8} {'Region':<9} {'Allocs':>6} {'Bytes':>9}  Call site")
+    for (tag, region, func, location), size in sites.most_common(args.sites):
+        if size <= 0:
+            break
+        print(f"{tag:<8} {region:<9} {counts[(tag, region, func, location)]:>6} {size:>9}  {func} {location}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+Measure HTTP throughput and latency under concurrent requests.
+
+Every connection is kept alive and requests the URLs in turn until the
+duration has passed. Run it against the device or against
+tools/mkwww.py --serve on the development machine:
+
+    http_bench.py http://<address> --connections 4 --seconds 10
+"""
+import argparse
+import http.client
+import threading
+import time
+import urllib.parse
+
+DEFAULT_PATHS = ["/", "/app.js", "/style.css", "/api/config", "/api/status"]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))] if values else 0
+
+
+def worker(host, port, paths, deadline, conditional, results, errors):
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    etags = {}
+    i = 0
+    while time.monotonic() < deadline:
+        path = paths[i % len(paths)]
+        i += 1
+        headers = {"Accept-Encoding": "gzip"}
+        if conditional and path in etags:
+            headers["If-None-Match"] = etags[path]
+        try:
+            start = time.monotonic()
+            conn.request("GET", path, headers=headers)
+            res = conn.getresponse()
+            body = res.read()
+            elapsed = time.monotonic() - start
+        except (OSError, http.client.HTTPException):
+            errors.append(path)
+            conn.close()
+            conn = http.client.HTTPConnection(host, port, timeout=10)
+            time.sleep(0.1)
+            continue
+        if res.status not in (200, 304):
+            errors.append(path)
+            continue
+        if res.getheader("ETag"):
+            etags[path] = res.getheader("ETag")
+        results.append((path, elapsed, len(body)))
+    conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("url", help="Base URL, e.g. http://192.168.1.20")
+    parser.add_argument("paths", nargs="*", default=DEFAULT_PATHS)
+    parser.add_argument("--connections", type=int, default=4)
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("--conditional", action="store_true", help="Revalidate with If-None-Match")
+    args = parser.parse_args()
+
+    url = urllib.parse.urlparse(args.url)
+    deadline = time.monotonic() + args.seconds
+    results, errors = [], []
+    threads = [threading.Thread(target=worker, args=(url.hostname, url.port or 80, args.paths, deadline,
+                                                     args.conditional, results, errors))
+               for _ in range(args.connections)]
+    start = time.monotonic()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.monotonic() - start
+
+    total = sum(size for _, _, size in results)
+    print(f"{len(results)} requests in {elapsed:.1f} s over {args.connections} connections, {len(errors)} errors")
+    print(f"{len(results) / elapsed:.1f} req/s, {total / elapsed / 1024:.1f} kB/s\n")
+    print(f"{'Path':20} {'Requests':>8} {'Bytes':>8} {'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8}")
+    for path in args.paths:
+        times = [t * 1000 for p, t, _ in results if p == path]
+        sizes = [s for p, _, s in results if p == path]
+        if not times:
+            continue
+        print(f"{path:20} {len(times):8} {max(sizes):8} {percentile(times, 50):8.1f} "
+              f"{percentile(times, 90):8.1f} {percentile(times, 99):8.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,347 @@
+#!/usr/bin/env python3
+"""
+View the framebuffer mirror of a display ball.
+
+Connects to the mirror service on port 5555 and shows the screen, printing the
+received bandwidth every second. Without --headless a Tk window is opened,
+which needs Pillow.
+
+--selftest runs the stream encoder and decoder over a loopback connection
+with synthetic clock and demo screens, checks that every frame decodes
+exactly and reports the bandwidth each screen needs. --check decodes a
+recorded stream, as written by the host test of the device encoder in
+test/, and compares each frame with the expected framebuffers.
+"""
+import argparse
+import math
+import socket
+import struct
+import sys
+import threading
+import time
+
+PORT = 5555
+MAGIC = b"DBM1"
+END_OF_FRAME = 0xFFFF
+OP_END_OF_ROW = 0x00
+OP_MAX_SKIP = 0x7F
+OP_RUN = 0x80
+OP_LITERAL = 0xC0
+OP_MAX_COUNT = 0x40
+RUN_MIN_LENGTH = 3
+SKIP_MIN_LENGTH = 2
+
+
+class Reader:
+    def __init__(self, sock):
+        self.sock = sock
+        self.buf = bytearray()
+        self.total = 0
+
+    def read(self, n):
+        while len(self.buf) < n:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise EOFError("Connection closed")
+            self.total += len(chunk)
+            self.buf += chunk
+        data = bytes(self.buf[:n])
+        del self.buf[:n]
+        return data
+
+    def u8(self):
+        return self.read(1)[0]
+
+    def u16(self):
+        return struct.unpack("<H", self.read(2))[0]
+
+
+class FileSource:
+    """Stands in for the socket of a Reader when decoding a recorded stream"""
+
+    def __init__(self, f):
+        self.f = f
+
+    def recv(self, n):
+        return self.f.read(n)
+
+
+class Decoder:
+    """Applies frames to a framebuffer of raw 16 bit pixels"""
+
+    def __init__(self, reader):
+        self.reader = reader
+        if reader.read(4) != MAGIC:
+            raise ValueError("Not a mirror stream")
+        self.width = reader.u16()
+        self.height = reader.u16()
+        self.swapped = bool(reader.u8() & 0x01)
+        self.fb = [bytearray(self.width * 2) for _ in range(self.height)]
+
+    def frame(self):
+        """Decode one frame, returns the rows it changed"""
+        rows = []
+        while True:
+            y = self.reader.u16()
+            if y == END_OF_FRAME:
+                return rows
+            row = self.fb[y]
+            x = 0
+            while True:
+                op = self.reader.u8()
+                if op == OP_END_OF_ROW:
+                    break
+                if op < OP_RUN:
+                    x += op
+                elif op < OP_LITERAL:
+                    n = (op & 0x3F) + 1
+                    row[x * 2:(x + n) * 2] = self.reader.read(2) * n
+                    x += n
+                else:
+                    n = (op & 0x3F) + 1
+                    row[x * 2:(x + n) * 2] = self.reader.read(n * 2)
+                    x += n
+            rows.append(y)
+
+    def rgb(self):
+        """Framebuffer as RGB888 bytes"""
+        out = bytearray()
+        order = ">H" if self.swapped else "<H"
+        for row in self.fb:
+            for (p,) in struct.iter_unpack(order, row):
+                out += bytes(((p >> 8) & 0xF8, (p >> 3) & 0xFC, (p << 3) & 0xF8))
+        return bytes(out)
+
+
+class Encoder:
+    """Port of the device encoder, used by the self test"""
+
+    def __init__(self, width, height):
+        self.width = width
+        self.height = height
+        self.shadow = [[0] * width for _ in range(height)]
+        self.out = bytearray()
+
+    def hello(self):
+        return MAGIC + struct.pack("<HHB", self.width, self.height, 1)
+
+    def _changed(self, cur, x, end):
+        while x < end:
+            run = 1
+            while x + run < end and run < OP_MAX_COUNT and cur[x + run] == cur[x]:
+                run += 1
+            if run >= RUN_MIN_LENGTH:
+                self.out.append(OP_RUN | (run - 1))
+                self.out += struct.pack(">H", cur[x])
+                x += run
+                continue
+            n = 0
+            while x + n < end and n < OP_MAX_COUNT:
+                if x + n + RUN_MIN_LENGTH <= end and cur[x + n] == cur[x + n + 1] == cur[x + n + 2]:
+                    break
+                n += 1
+            self.out.append(OP_LITERAL | (n - 1))
+            self.out += struct.pack(f">{n}H", *cur[x:x + n])
+            x += n
+
+    def _row(self, y, cur):
+        prev = self.shadow[y]
+        if cur == prev:
+            return False
+        self.out += struct.pack("<H", y)
+        x = 0
+        while x < self.width:
+            skip = 0
+            while x + skip < self.width and cur[x + skip] == prev[x + skip]:
+                skip += 1
+            if x + skip == self.width:
+                break
+            x += skip
+            while skip > 0:
+                n = min(skip, OP_MAX_SKIP)
+                self.out.append(n)
+                skip -= n
+            end, same = x, 0
+            while end + same < self.width and same < SKIP_MIN_LENGTH:
+                if cur[end + same] == prev[end + same]:
+                    same += 1
+                else:
+                    end += same + 1
+                    same = 0
+            self._changed(cur, x, end)
+            x = end
+        self.out.append(OP_END_OF_ROW)
+        self.shadow[y] = list(cur)
+        return True
+
+    def frame(self, fb):
+        self.out = bytearray()
+        changed = [self._row(y, fb[y]) for y in range(self.height)]
+        if not any(changed):
+            return b""
+        self.out += struct.pack("<H", END_OF_FRAME)
+        return bytes(self.out)
+
+
+def view(host, port, headless):
+    sock = socket.create_connection((host, port))
+    reader = Reader(sock)
+    decoder = Decoder(reader)
+    print(f"{decoder.width}x{decoder.height} from {host}:{port}")
+
+    stats = {"frames": 0}
+    image = None
+    if not headless:
+        import tkinter
+        from PIL import Image, ImageTk
+        root = tkinter.Tk()
+        root.title(f"{host} mirror")
+        label = tkinter.Label(root)
+        label.pack()
+
+    def receive():
+        try:
+            while True:
+                decoder.frame()
+                stats["frames"] += 1
+        except (EOFError, OSError) as e:
+            print(e)
+            stats["closed"] = True
+
+    threading.Thread(target=receive, daemon=True).start()
+
+    last_total, last_frames, last_time = 0, 0, time.monotonic()
+    while "closed" not in stats:
+        if headless:
+            time.sleep(1)
+        else:
+            photo = ImageTk.PhotoImage(Image.frombytes("RGB", (decoder.width, decoder.height), decoder.rgb()))
+            label.configure(image=photo)
+            root.update()
+            image = photo
+            time.sleep(0.1)
+        now = time.monotonic()
+        if now - last_time >= 1:
+            rate = (reader.total - last_total) / (now - last_time) / 1024
+            fps = (stats["frames"] - last_frames) / (now - last_time)
+            print(f"{rate:8.1f} kB/s {fps:5.1f} fps, {reader.total} bytes total")
+            last_total, last_frames, last_time = reader.total, stats["frames"], now
+    return image
+
+
+def synthetic_clock(t, width, height):
+    """Static dial, the seconds digits change once per second"""
+    fb = [[0x0000] * width for _ in range(height)]
+    cx, cy = width // 2, height // 2
+    for y in range(height):
+        for x in range(width):
+            if abs(math.hypot(x - cx, y - cy) - 110) < 2:
+                fb[y][x] = 0x001F
+    second = int(t) % 60
+    for y in range(100, 140):
+        for x in range(80, 160):
+            if ((x - 80) // 8 + (y - 100) // 8 + second) % 3 == 0:
+                fb[y][x] = 0xFFFF
+    return fb
+
+
+def synthetic_demo(t, width, height):
+    """Gradient background with a moving arc and a scrolling chart"""
+    fb = [[(y * 31 // height) << 11 for _ in range(width)] for y in range(height)]
+    angle = t * 2
+    cx, cy = width // 2, height // 2
+    for a in range(90):
+        r = math.radians(a * 2) + angle
+        for d in range(60, 70):
+            fb[int(cy + d * math.sin(r))][int(cx + d * math.cos(r))] = 0xF800
+    for x in range(width):
+        y = int(cy + 30 * math.sin((x + t * 60) / 15))
+        fb[y][x] = 0x07E0
+    return fb
+
+
+def selftest(seconds, fps):
+    width = height = 240
+    server = socket.socket()
+    server.bind(("127.0.0.1", 0))
+    server.listen(1)
+    port = server.getsockname()[1]
+    results = {}
+
+    for name, render in (("clock", synthetic_clock), ("demo", synthetic_demo)):
+        frames = [render(i / fps, width, height) for i in range(seconds * fps)]
+
+        def send():
+            conn, _ = server.accept()
+            encoder = Encoder(width, height)
+            conn.sendall(encoder.hello())
+            for fb in frames:
+                data = encoder.frame(fb)
+                # Empty frames are not sent, mark them so the reader stays in step
+                conn.sendall(data or struct.pack("<H", END_OF_FRAME))
+            conn.close()
+
+        sender = threading.Thread(target=send)
+        sender.start()
+        reader = Reader(socket.create_connection(("127.0.0.1", port)))
+        decoder = Decoder(reader)
+        for i, fb in enumerate(frames):
+            decoder.frame()
+            expected = [struct.pack(f">{width}H", *row) for row in fb]
+            if [bytes(row) for row in decoder.fb] != expected:
+                print(f"{name}: frame {i} decoded wrong")
+                return 1
+        sender.join()
+        results[name] = reader.total
+
+    raw = width * height * 2 * fps
+    print(f"{len(frames)} frames at {fps} fps, raw {raw // 1024} kB/s")
+    for name, total in results.items():
+        print(f"{name:6} {total / seconds / 1024:8.1f} kB/s  {total * 100 / (raw * seconds):5.1f}% of raw")
+    return 0
+
+
+def check(stream, expected):
+    with open(stream, "rb") as f, open(expected, "rb") as e:
+        decoder = Decoder(Reader(FileSource(f)))
+        size = decoder.width * decoder.height * 2
+        frames = 0
+        while True:
+            fb = e.read(size)
+            if not fb:
+                break
+            try:
+                decoder.frame()
+            except EOFError:
+                print(f"Stream ends before frame {frames}")
+                return 1
+            if b"".join(decoder.fb) != fb:
+                print(f"Frame {frames} decoded wrong")
+                return 1
+            frames += 1
+    print(f"{frames} frames decoded")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", nargs="?", help="Device address")
+    parser.add_argument("--port", type=int, default=PORT)
+    parser.add_argument("--headless", action="store_true", help="Only print bandwidth")
+    parser.add_argument("--selftest", action="store_true", help="Loopback test with synthetic screens")
+    parser.add_argument("--check", nargs=2, metavar=("STREAM", "EXPECTED"), help="Decode a recorded stream")
+    parser.add_argument("--seconds", type=int, default=5, help="Self test duration")
+    parser.add_argument("--fps", type=int, default=10, help="Self test frame rate")
+    args = parser.parse_args()
+
+    if args.selftest:
+        sys.exit(selftest(args.seconds, args.fps))
+    if args.check:
+        sys.exit(check(*args.check))
+    if not args.host:
+        parser.error("host is required")
+    view(args.host, args.port, args.headless)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""
+Compile, preview and install watch faces.
+
+A face is described in JSON and compiled to the binary format read by
+src/face.cpp. Example, see tools/faces/ for more:
+
+    {
+      "background": "#000000",
+      "elements": [
+        {"kind": "arc", "x": 0, "y": 0, "w": 240, "h": 240, "width": 6,
+         "color": "#ff4000", "track": "#202020", "bind": "second", "cadence": "second"},
+        {"kind": "text", "x": 0, "y": 94, "w": 240, "h": 52, "font": 48,
+         "color": "#ffffff", "format": "%H:%M", "cadence": "minute"}
+      ]
+    }
+
+Element kinds and their fields:
+
+    rect    color, border, border_width, radius
+    arc     color, track, width, bind (second, minute, hour, hour12)
+    text    color, font (14 or 48), format (strftime)
+
+Every element with a binding or a format with % codes declares its cadence:
+static, second, minute, hour or day. Elements draw in file order.
+
+    mkface.py compile face.json face.bin
+    mkface.py preview face.json face.png --time 10:08:30
+    mkface.py upload <address> face.json --name digital
+
+Upload stores the face on the storage partition and shows it, the console
+command `face <name>` shows it again later.
+"""
+import argparse
+import json
+import os
+import struct
+import sys
+import time
+import urllib.request
+
+MAGIC = b"WFC1"
+WIDTH = 240
+HEIGHT = 240
+MAX_ELEMENTS = 32
+MAX_TEXT = 32
+MAX_FILE_SIZE = 4096
+MAX_NAME = 24
+
+KINDS = {"rect": 1, "arc": 2, "text": 3}
+CADENCES = {"static": 0, "second": 1, "minute": 2, "hour": 3, "day": 4}
+BINDINGS = {"none": 0, "second": 1, "minute": 2, "hour": 3, "hour12": 4}
+BINDING_CADENCE = {"none": "static", "second": "second", "minute": "minute", "hour": "hour", "hour12": "hour"}
+BINDING_RANGE = {"none": 60, "second": 60, "minute": 60, "hour": 24, "hour12": 12}
+FONTS = {14: 0, 48: 1}
+
+
+class FaceError(Exception):
+    pass
+
+
+def parse_color(value):
+    value = value.lstrip("#")
+    if len(value) != 6:
+        raise FaceError(f"Invalid color '{value}'")
+    return tuple(int(value[i:i+2], 16) for i in (0, 2, 4))
+
+
+def rgb565(color):
+    r, g, b = parse_color(color)
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3)
+
+
+def check(face):
+    """Apply the rules of the loader, returns the elements with defaults filled in"""
+    elements = face.get("elements", [])
+    if len(elements) > MAX_ELEMENTS:
+        raise FaceError(f"More than {MAX_ELEMENTS} elements")
+    result = []
+    for i, e in enumerate(elements):
+        e = dict(e)
+        kind = e.get("kind")
+        if kind not in KINDS:
+            raise FaceError(f"Element {i}: unknown kind '{kind}'")
+        if e.get("w", 0) <= 0 or e.get("h", 0) <= 0:
+            raise FaceError(f"Element {i}: no size")
+        bind = e.setdefault("bind", "none")
+        if bind not in BINDINGS:
+            raise FaceError(f"Element {i}: unknown binding '{bind}'")
+        dynamic = bind != "none" or (kind == "text" and "%" in e.get("format", ""))
+        if dynamic and "cadence" not in e:
+            raise FaceError(f"Element {i}: declare the cadence of a changing element")
+        cadence = e.setdefault("cadence", "static")
+        if cadence not in CADENCES:
+            raise FaceError(f"Element {i}: unknown cadence '{cadence}'")
+        if kind == "rect" and (cadence != "static" or bind != "none"):
+            raise FaceError(f"Element {i}: rects are static")
+        if kind == "arc":
+            if (cadence == "static") != (bind == "none"):
+                raise FaceError(f"Element {i}: an arc is static exactly when it has no binding")
+            if CADENCES[cadence] > CADENCES[BINDING_CADENCE[bind]]:
+                raise FaceError(f"Element {i}: cadence {cadence} is slower than {bind}")
+        if kind == "text":
+            if bind != "none":
+                raise FaceError(f"Element {i}: text is bound with its format")
+            if e.setdefault("font", 14) not in FONTS:
+                raise FaceError(f"Element {i}: fonts are {', '.join(map(str, FONTS))}")
+            if len(e.get("format", "").encode()) >= MAX_TEXT:
+                raise FaceError(f"Element {i}: format longer than {MAX_TEXT-1} bytes")
+        result.append(e)
+    return result
+
+
+def compile_face(face):
+    elements = check(face)
+    strings = bytearray()
+    offsets = {}
+    body = bytearray()
+    for e in elements:
+        kind = e["kind"]
+        color = rgb565(e.get("color", "#ffffff"))
+        color2, arg, arg2, font = 0, 0, 0, 0
+        if kind == "rect":
+            color2 = rgb565(e.get("border", "#000000"))
+            arg = e.get("border_width", 0)
+            arg2 = e.get("radius", 0)
+        elif kind == "arc":
+            color2 = rgb565(e.get("track", "#000000"))
+            arg = e.get("width", 4)
+        else:
+            font = FONTS[e["font"]]
+            fmt = e.get("format", "").encode()
+            if fmt not in offsets:
+                offsets[fmt] = len(strings)
+                strings += fmt + b"\0"
+            arg = offsets[fmt]
+        body += struct.pack("<BBBBhhhhHHHH",
+                            KINDS[kind], CADENCES[e["cadence"]], BINDINGS[e["bind"]], font,
+                            e.get("x", 0), e.get("y", 0), e["w"], e["h"],
+                            color, color2, arg, arg2)
+    data = MAGIC + struct.pack("<HBBHH", rgb565(face.get("background", "#000000")), len(elements), 0, len(strings), 0)
+    data += body + strings
+    if len(data) > MAX_FILE_SIZE:
+        raise FaceError(f"Face is {len(data)} bytes, the limit is {MAX_FILE_SIZE}")
+    return bytes(data)
+
+
+def binding_value(bind, t):
+    hour, minute, second = t
+    return {"none": 0, "second": second, "minute": minute, "hour": hour, "hour12": hour % 12}[bind]
+
+
+def preview(face, t, font_path=None):
+    """Approximate rendering, for layout. Text uses font_path or the PIL default font"""
+    # Only previews need PIL
+    from PIL import Image, ImageDraw, ImageFont
+
+    def load_font(size):
+        if font_path:
+            return ImageFont.truetype(font_path, size)
+        try:
+            return ImageFont.load_default(size)
+        except TypeError:
+            return ImageFont.load_default()
+
+    image = Image.new("RGB", (WIDTH, HEIGHT), parse_color(face.get("background", "#000000")))
+    draw = ImageDraw.Draw(image)
+    tm = time.struct_time((2024, 1, 1, t[0], t[1], t[2], 0, 1, -1))
+    for e in check(face):
+        box = (e.get("x", 0), e.get("y", 0), e.get("x", 0) + e["w"] - 1, e.get("y", 0) + e["h"] - 1)
+        if e["kind"] == "rect":
+            draw.rounded_rectangle(box, radius=e.get("radius", 0), fill=parse_color(e.get("color", "#ffffff")),
+                                   outline=parse_color(e.get("border", "#000000")), width=e.get("border_width", 0))
+        elif e["kind"] == "arc":
+            width = e.get("width", 4)
+            draw.arc(box, 0, 360, fill=parse_color(e.get("track", "#000000")), width=width)
+            value = binding_value(e["bind"], t)
+            if value:
+                sweep = 360 * value / BINDING_RANGE[e["bind"]]
+                draw.arc(box, 270, 270 + sweep, fill=parse_color(e.get("color", "#ffffff")), width=width)
+        else:
+            text = time.strftime(e.get("format", ""), tm)
+            font = load_font(e["font"])
+            left, _, right, _ = draw.textbbox((0, 0), text, font=font)
+            draw.text((box[0] + (e["w"] - (right - left)) // 2, box[1]), text, font=font,
+                      fill=parse_color(e.get("color", "#ffffff")))
+
+    # The panel is round
+    mask = Image.new("L", (WIDTH, HEIGHT), 0)
+    ImageDraw.Draw(mask).ellipse((0, 0, WIDTH - 1, HEIGHT - 1), fill=255)
+    return Image.composite(image, Image.new("RGB", (WIDTH, HEIGHT), (64, 64, 64)), mask)
+
+
+def upload(host, name, data):
+    req = urllib.request.Request(f"http://{host}/api/face?name={name}", data=data, method="PUT",
+                                 headers={"Content-Type": "application/octet-stream"})
+    with urllib.request.urlopen(req, timeout=10) as res:
+        return json.load(res)
+
+
+def summary(face, data):
+    elements = check(face)
+    counts = {c: sum(1 for e in elements if e["cadence"] == c) for c in CADENCES}
+    lists = ", ".join(f"{c} {n}" for c, n in counts.items() if n)
+    return f"{len(data)} bytes, {len(elements)} elements: {lists}"
+
+
+def parse_time(value):
+    parts = [int(p) for p in value.split(":")]
+    while len(parts) < 3:
+        parts.append(0)
+    hour, minute, second = parts[:3]
+    if not (0 <= hour < 24 and 0 <= minute < 60 and 0 <= second < 60):
+        raise argparse.ArgumentTypeError(f"Invalid time '{value}'")
+    return hour, minute, second
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("compile", help="Compile a face to its binary format")
+    p.add_argument("input", help="Face description")
+    p.add_argument("output", help="Binary face")
+
+    p = sub.add_parser("preview", help="Render an approximate preview")
+    p.add_argument("input", help="Face description")
+    p.add_argument("output", help="PNG image")
+    p.add_argument("--time", type=parse_time, default=(10, 8, 30), help="HH:MM[:SS] to show")
+    p.add_argument("--font", help="TTF for the text, Montserrat matches the device")
+
+    p = sub.add_parser("upload", help="Install and show a face on a device")
+    p.add_argument("address", help="Device address")
+    p.add_argument("input", help="Face description")
+    p.add_argument("--name", help=f"Name on the device, at most {MAX_NAME-1} characters, the file name by default")
+
+    args = parser.parse_args()
+
+    try:
+        with open(args.input) as f:
+            face = json.load(f)
+        data = compile_face(face)
+    except (OSError, ValueError, FaceError) as e:
+        sys.exit(f"{args.input}: {e}")
+
+    if args.command == "compile":
+        with open(args.output, "wb") as f:
+            f.write(data)
+        print(summary(face, data))
+    elif args.command == "preview":
+        preview(face, args.time, args.font).save(args.output)
+    else:
+        name = args.name or os.path.splitext(os.path.basename(args.input))[0]
+        print(summary(face, data))
+        print(upload(args.address, name, data))
+
+
+if __name__ == "__main__":
+    main()
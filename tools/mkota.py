@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""
+Compress a firmware image for OTA updates.
+
+The device inflates the zlib stream while downloading, so the compressed image
+is all that crosses the network. With --serve the image is served over HTTP
+from this machine, install it from the device console with:
+    ota http://<host>:<port>/firmware.bin.z
+"""
+import argparse
+import functools
+import http.server
+import os
+import socket
+import zlib
+
+ESP_IMAGE_MAGIC = 0xE9
+
+
+def serve(path, port):
+    directory, name = os.path.split(os.path.abspath(path))
+    handler = functools.partial(http.server.SimpleHTTPRequestHandler, directory=directory)
+    with http.server.ThreadingHTTPServer(("", port), handler) as server:
+        host = socket.gethostbyname(socket.gethostname())
+        print(f"Serving on http://{host}:{port}/{name}, Ctrl-C to stop")
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="Firmware image, e.g. .pio/build/seeed_xiao_esp32s3/firmware.bin")
+    parser.add_argument("output", nargs="?", help="Compressed image, defaults to <input>.z")
+    parser.add_argument("--serve", type=int, metavar="PORT", help="Serve the compressed image over HTTP")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+    if not image or image[0] != ESP_IMAGE_MAGIC:
+        parser.error(f"{args.input} is not an app image")
+
+    output = args.output or args.input + ".z"
+    data = zlib.compress(image, 9)
+    with open(output, "wb") as f:
+        f.write(data)
+    print(f"{len(image)} -> {len(data)} bytes ({len(data) * 100 // len(image)}%)")
+
+    if args.serve:
+        serve(output, args.serve)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""
+Encode an image for the splash partition.
+
+The panel driver streams the partition straight to the display before LVGL is
+started, so pixels are stored as RGB565 in panel (big endian) byte order after
+a small header.
+
+Flash the result with:
+    parttool.py write_partition --partition-name=splash --input=splash.bin
+"""
+import argparse
+import struct
+
+from PIL import Image
+
+SPLASH_MAGIC = 0x31505053  # "SPP1"
+WIDTH = 240
+HEIGHT = 240
+
+
+def encode(image):
+    image = image.convert("RGB").resize((WIDTH, HEIGHT))
+    data = bytearray(struct.pack("<IHH", SPLASH_MAGIC, WIDTH, HEIGHT))
+    for r, g, b in image.getdata():
+        data += struct.pack(">H", ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3))
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="Source image")
+    parser.add_argument("output", help="Splash partition image")
+    args = parser.parse_args()
+
+    with open(args.output, "wb") as f:
+        f.write(encode(Image.open(args.input)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""
+Pack the web UI for the www partition.
+
+Every file is gzip compressed, the device serves the stored bytes as they are
+with Content-Encoding: gzip. The image is a header, a table of entries and
+the file data.
+
+Flash the result with:
+    parttool.py write_partition --partition-name=www --input=www.bin
+
+With --serve the image is served from this machine the way the device serves
+it, with a stand-in for the JSON API, for working on the UI and for
+benchmarking with tools/http_bench.py.
+"""
+import argparse
+import gzip
+import http.server
+import json
+import mimetypes
+import os
+import struct
+import time
+import zlib
+
+WWW_MAGIC = 0x31575744  # "DWW1"
+WWW_FLAG_GZIP = 0x01
+PARTITION_SIZE = 128 * 1024
+HEADER = struct.Struct("<II")
+ENTRY = struct.Struct("<48s32sIIII")
+
+
+def pack(directory):
+    files = []
+    for root, _, names in os.walk(directory):
+        for name in sorted(names):
+            path = os.path.join(root, name)
+            uri = "/" + os.path.relpath(path, directory).replace(os.sep, "/")
+            kind = mimetypes.guess_type(name)[0] or "application/octet-stream"
+            if kind.startswith("text/") or kind == "application/javascript":
+                kind += "; charset=utf-8"
+            with open(path, "rb") as f:
+                data = gzip.compress(f.read(), 9, mtime=0)
+            if len(uri) >= 48 or len(kind) >= 32:
+                raise ValueError(f"{uri}: path or type too long")
+            files.append((uri, kind, data))
+
+    offset = HEADER.size + len(files) * ENTRY.size
+    table = bytearray(HEADER.pack(WWW_MAGIC, len(files)))
+    blob = bytearray()
+    for uri, kind, data in files:
+        table += ENTRY.pack(uri.encode(), kind.encode(), offset + len(blob), len(data), zlib.crc32(data), WWW_FLAG_GZIP)
+        blob += data
+    return bytes(table + blob)
+
+
+def unpack(image):
+    magic, count = HEADER.unpack_from(image)
+    if magic != WWW_MAGIC:
+        raise ValueError("Not a www image")
+    entries = {}
+    for i in range(count):
+        path, kind, offset, size, etag, flags = ENTRY.unpack_from(image, HEADER.size + i * ENTRY.size)
+        entries[path.rstrip(b"\0").decode()] = (kind.rstrip(b"\0").decode(), image[offset:offset + size], etag, flags)
+    return entries
+
+
+def serve(image, port):
+    entries = unpack(image)
+    config = {"timezone": "", "ntp_server": "0.pool.ntp.org", "wifi_power": "balanced", "backlight": True}
+    start = time.monotonic()
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def send_body(self, status, kind, body, headers=()):
+            self.send_response(status)
+            self.send_header("Content-Type", kind)
+            self.send_header("Content-Length", str(len(body)))
+            for name, value in headers:
+                self.send_header(name, value)
+            self.end_headers()
+            self.wfile.write(body)
+
+        def send_json(self, value):
+            self.send_body(200, "application/json", json.dumps(value).encode(), [("Cache-Control", "no-store")])
+
+        def do_GET(self):
+            path = self.path.split("?")[0]
+            if path == "/api/config":
+                return self.send_json(config)
+            if path == "/api/status":
+                return self.send_json({"uptime_s": int(time.monotonic() - start)})
+            entry = entries.get("/index.html" if path == "/" else path)
+            if not entry:
+                return self.send_body(404, "text/plain", b"Not found")
+            kind, data, etag, flags = entry
+            tag = f'"{etag:08x}"'
+            headers = [("ETag", tag), ("Cache-Control", "no-cache")]
+            if self.headers.get("If-None-Match") == tag:
+                return self.send_body(304, kind, b"", headers)
+            if flags & WWW_FLAG_GZIP:
+                headers.append(("Content-Encoding", "gzip"))
+            self.send_body(200, kind, data, headers)
+
+        def do_POST(self):
+            body = json.loads(self.rfile.read(int(self.headers.get("Content-Length", 0))) or b"{}")
+            if self.path == "/api/config":
+                config.update({k: v for k, v in body.items() if k in config})
+                return self.send_json(config)
+            if self.path == "/api/wifi":
+                return self.send_json({"joining": body.get("ssid", "")})
+            self.send_body(404, "text/plain", b"Not found")
+
+        def log_message(self, *args):
+            pass
+
+    with http.server.ThreadingHTTPServer(("", port), Handler) as server:
+        print(f"Serving on http://localhost:{port}/, Ctrl-C to stop")
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", default="www", help="Web UI directory")
+    parser.add_argument("output", nargs="?", default="www.bin", help="Partition image")
+    parser.add_argument("--serve", type=int, metavar="PORT", help="Serve the image over HTTP")
+    args = parser.parse_args()
+
+    image = pack(args.input)
+    if len(image) > PARTITION_SIZE:
+        parser.error(f"Image is {len(image)} bytes, the partition holds {PARTITION_SIZE}")
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"{len(unpack(image))} files, {len(image)} bytes")
+
+    if args.serve:
+        serve(image, args.serve)
+
+
+if __name__ == "__main__":
+    main()
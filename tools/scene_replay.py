@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+"""
+Drive the display ball with scene updates, for scripting and load testing.
+
+A recording is a sequence of records, each a u32 little endian delay in
+milliseconds followed by one scene message. Examples:
+
+    scene_replay.py gen session.bin --seconds 60 --rate 200
+    scene_replay.py play <address> session.bin --speed 10
+    scene_replay.py burst <address> --count 1000
+
+Every run ends with a sync, which the device answers once all updates are on
+screen, so the reported time covers the whole path. The reply also tells how
+many batches the device needed for the messages.
+"""
+import argparse
+import random
+import socket
+import struct
+import sys
+import time
+
+PORT = 5556
+
+SET_TEXT = 0x01
+SET_VALUE = 0x02
+CHART_APPEND = 0x03
+SHOW_SCREEN = 0x04
+SYNC = 0x05
+
+SCREENS = {"clock": 1, "demo": 2, "demo1": 3, "demo2": 4}
+ANIM_NONE = 0
+ANIM_MOVE_LEFT = 5
+ANIM_MOVE_RIGHT = 6
+CLOCK_LABEL = 16
+CLOCK_SECONDS = 17
+DEMO1_COLORWHEEL = 18
+DEMO2_LABEL = 19
+DEMO2_CHART = 20
+
+
+def message(kind, widget, payload=b""):
+    return struct.pack("<BBH", kind, widget, len(payload)) + payload
+
+
+def set_text(widget, text):
+    return message(SET_TEXT, widget, text.encode())
+
+
+def set_value(widget, value):
+    return message(SET_VALUE, widget, struct.pack("<i", value))
+
+
+def chart_append(widget, points):
+    return message(CHART_APPEND, widget, struct.pack(f"<{len(points)}h", *points))
+
+
+def show_screen(name, anim=ANIM_NONE, time_ms=0):
+    payload = struct.pack("<BH", anim, time_ms) if anim != ANIM_NONE else b""
+    return message(SHOW_SCREEN, SCREENS[name], payload)
+
+
+def read_recording(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    pos = 0
+    while pos < len(data):
+        (delay,) = struct.unpack_from("<I", data, pos)
+        (length,) = struct.unpack_from("<H", data, pos + 6)
+        yield delay, data[pos + 4:pos + 8 + length]
+        pos += 8 + length
+
+
+class Connection:
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sent = 0
+        self.token = 0
+
+    def send(self, data):
+        self.sock.sendall(data)
+        self.sent += 1
+
+    def sync(self):
+        """Returns messages received and batches applied by the device"""
+        self.token += 1
+        self.sock.sendall(message(SYNC, 0, struct.pack("<I", self.token)))
+        reply = b""
+        while len(reply) < 13:
+            chunk = self.sock.recv(13 - len(reply))
+            if not chunk:
+                raise EOFError("Connection closed")
+            reply += chunk
+        kind, token, messages, batches = struct.unpack("<BIII", reply)
+        if kind != SYNC or token != self.token:
+            raise ValueError("Unexpected sync reply")
+        return messages, batches
+
+
+def report(conn, start, before):
+    messages, batches = conn.sync()
+    elapsed = time.monotonic() - start
+    # Not counting the sync itself
+    messages -= before[0] + 1
+    batches -= before[1]
+    print(f"{conn.sent} updates in {elapsed * 1000:.0f} ms ({conn.sent / elapsed:.0f}/s), "
+          f"device applied {messages} messages in {batches} batches")
+
+
+def cmd_gen(args):
+    """Synthetic session on the demo2 screen: label text every second, chart points at the given rate"""
+    rng = random.Random(args.seed)
+    interval = 1000 / args.rate
+    with open(args.output, "wb") as f:
+        def record(delay, data):
+            f.write(struct.pack("<I", int(delay)) + data)
+
+        record(0, show_screen("demo2"))
+        t = 0.0
+        last = 0
+        while t < args.seconds * 1000:
+            now = int(t)
+            if now // 1000 != last // 1000:
+                record(now - last, set_text(DEMO2_LABEL, time.strftime("%H:%M:%S", time.gmtime(now // 1000))))
+                last = now
+            record(now - last, chart_append(DEMO2_CHART, [rng.randint(0, 100)]))
+            last = now
+            t += interval
+    print(f"Wrote {args.output}")
+
+
+def cmd_play(args):
+    conn = Connection(args.host, args.port)
+    before = conn.sync()
+    records = list(read_recording(args.recording))
+    start = time.monotonic()
+    for _ in range(args.loop):
+        due = time.monotonic()
+        for delay, data in records:
+            due += delay / 1000 / args.speed
+            pause = due - time.monotonic()
+            if pause > 0:
+                time.sleep(pause)
+            conn.send(data)
+    report(conn, start, before)
+
+
+def cmd_burst(args):
+    conn = Connection(args.host, args.port)
+    before = conn.sync()
+    updates = [set_value(CLOCK_SECONDS, i % 60) for i in range(args.count)]
+    start = time.monotonic()
+    conn.sock.sendall(b"".join(updates))
+    conn.sent = len(updates)
+    report(conn, start, before)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    gen = sub.add_parser("gen", help="Write a synthetic recording")
+    gen.add_argument("output")
+    gen.add_argument("--seconds", type=int, default=60)
+    gen.add_argument("--rate", type=float, default=50, help="Chart points per second")
+    gen.add_argument("--seed", type=int, default=1)
+    gen.set_defaults(func=cmd_gen)
+
+    play = sub.add_parser("play", help="Replay a recording")
+    play.add_argument("host")
+    play.add_argument("recording")
+    play.add_argument("--speed", type=float, default=1, help="Time scale, 0 sends as fast as possible")
+    play.add_argument("--loop", type=int, default=1)
+    play.set_defaults(func=cmd_play)
+
+    burst = sub.add_parser("burst", help="Send updates back to back")
+    burst.add_argument("host")
+    burst.add_argument("--count", type=int, default=1000)
+    burst.set_defaults(func=cmd_burst)
+
+    for p in (play, burst):
+        p.add_argument("--port", type=int, default=PORT)
+
+    args = parser.parse_args()
+    if getattr(args, "speed", 1) == 0:
+        args.speed = float("inf")
+    args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
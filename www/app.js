@@ -0,0 +1,77 @@
+"use strict";
+
+const STATUS_INTERVAL_MS = 2000;
+
+async function request(method, url, body) {
+    const res = await fetch(url, {
+        method,
+        headers: body ? { "Content-Type": "application/json" } : {},
+        body: body ? JSON.stringify(body) : undefined,
+    });
+    if (!res.ok) {
+        throw new Error(await res.text() || res.statusText);
+    }
+    return res.json();
+}
+
+function showResult(form, text, error) {
+    const result = form.querySelector(".result");
+    result.textContent = text;
+    result.classList.toggle("error", !!error);
+}
+
+function fillConfig(config) {
+    const form = document.getElementById("config");
+    form.timezone.value = config.timezone;
+    form.ntp_server.value = config.ntp_server;
+    form.wifi_power.value = config.wifi_power;
+    form.backlight.checked = config.backlight;
+}
+
+async function updateStatus() {
+    try {
+        const status = await request("GET", "/api/status");
+        const list = document.getElementById("status");
+        list.replaceChildren();
+        for (const [key, value] of Object.entries(status)) {
+            const dt = document.createElement("dt");
+            const dd = document.createElement("dd");
+            dt.textContent = key.replaceAll("_", " ");
+            dd.textContent = value;
+            list.append(dt, dd);
+        }
+    } catch (e) {
+        // Keep the last status while the device is unreachable
+    }
+}
+
+document.getElementById("config").addEventListener("submit", async (event) => {
+    event.preventDefault();
+    const form = event.target;
+    try {
+        fillConfig(await request("POST", "/api/config", {
+            timezone: form.timezone.value,
+            ntp_server: form.ntp_server.value,
+            wifi_power: form.wifi_power.value,
+            backlight: form.backlight.checked,
+        }));
+        showResult(form, "Saved");
+    } catch (e) {
+        showResult(form, e.message, true);
+    }
+});
+
+document.getElementById("wifi").addEventListener("submit", async (event) => {
+    event.preventDefault();
+    const form = event.target;
+    try {
+        const res = await request("POST", "/api/wifi", { ssid: form.ssid.value, password: form.password.value });
+        showResult(form, `Joining ${res.joining}, reconnect on that network`);
+    } catch (e) {
+        showResult(form, e.message, true);
+    }
+});
+
+request("GET", "/api/config").then(fillConfig).catch(() => {});
+updateStatus();
+setInterval(updateStatus, STATUS_INTERVAL_MS);